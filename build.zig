@@ -19,16 +19,21 @@ pub fn build(b: *std.Build) void {
     const optimize = b.standardOptimizeOption(.{});
 
     // Options
-    const log_level = b.option(LogLevel, "log_level", "Minimum log level") orelse .info;
+    // Levels below this are compiled out; above it, levels are set at runtime
+    // (default info) via the `loglevel` shell command or kernel command line.
+    const log_level = b.option(LogLevel, "log_level", "Lowest log level compiled in") orelse .debug;
+    const trace = b.option(bool, "trace", "Compile in kernel tracepoints") orelse true;
 
     // We create separate option sets for default (PKS on) and no-pks
     const options = b.addOptions();
     options.addOption(LogLevel, "log_level", log_level);
     options.addOption(bool, "expect_pks", true);
+    options.addOption(bool, "trace", trace);
 
     const options_no_pks = b.addOptions();
     options_no_pks.addOption(LogLevel, "log_level", log_level);
     options_no_pks.addOption(bool, "expect_pks", false);
+    options_no_pks.addOption(bool, "trace", trace);
 
     // ======================================
     // Main Kernel Build
@@ -119,6 +124,34 @@ pub fn build(b: *std.Build) void {
     const run_step = b.step("run", "Run the kernel in QEMU");
     run_step.dependOn(&qemu_cmd.step);
 
+    // ======================================
+    // Trace Decoder (Host Tool)
+    // ======================================
+    // Usage: zig build trace-decode < serial.log
+    const host_target = b.graph.host;
+    const trace_format_mod = b.createModule(.{
+        .root_source_file = b.path("src/kernel/trace_format.zig"),
+        .target = host_target,
+        .optimize = optimize,
+    });
+    const trace_decode_mod = b.createModule(.{
+        .root_source_file = b.path("tools/trace_decode.zig"),
+        .target = host_target,
+        .optimize = optimize,
+    });
+    trace_decode_mod.addImport("trace_format", trace_format_mod);
+
+    const trace_decode = b.addExecutable(.{
+        .name = "trace_decode",
+        .root_module = trace_decode_mod,
+    });
+    const run_trace_decode = b.addRunArtifact(trace_decode);
+    run_trace_decode.stdio = .inherit;
+    if (b.args) |args| run_trace_decode.addArgs(args);
+
+    const trace_decode_step = b.step("trace-decode", "Decode a '#T' trace dump from stdin (or a file argument)");
+    trace_decode_step.dependOn(&run_trace_decode.step);
+
     // ======================================
     // Test Kernel Build (PKS Enabled - Default)
     // ======================================
@@ -0,0 +1,381 @@
+/// ACPI Table Discovery
+///
+/// Finds the RSDP through Limine's RSDP request, walks the XSDT (or RSDT on
+/// ACPI 1.0 firmware) and parses the MADT ("APIC" table) into an `ApicTopology`:
+/// - Local APIC IDs (xAPIC and x2APIC entries) and the LAPIC base address
+/// - Every IOAPIC with the first GSI it serves
+/// - Interrupt Source Overrides that remap legacy ISA IRQs to other GSIs or
+///   change their polarity/trigger mode
+///
+/// Only the tables the kernel needs are parsed; everything else is skipped by length.
+const std = @import("std");
+const limine = @import("../../limine_import.zig").C;
+const serial = @import("../../kernel/serial.zig");
+const log = serial.scoped(.acpi);
+const vmm = @import("../../kernel/memory/vmm.zig");
+
+// RSDP Request (Defined in limine.c)
+extern var rsdp_request: limine.struct_limine_rsdp_request;
+
+/// Upper bounds for the parsed topology (fixed arrays, no heap needed this early).
+pub const MAX_LAPICS: usize = 256;
+pub const MAX_IOAPICS: usize = 8;
+pub const LEGACY_IRQS: usize = 16;
+
+/// Architectural defaults used when the firmware provides no MADT.
+pub const DEFAULT_LAPIC_BASE: u64 = 0xFEE00000;
+pub const DEFAULT_IOAPIC_BASE: u64 = 0xFEC00000;
+
+/// Root System Description Pointer (ACPI 2.0+ layout; revision 0 stops at `rsdt_address`).
+const Rsdp = extern struct {
+    signature: [8]u8,
+    checksum: u8,
+    oem_id: [6]u8,
+    revision: u8,
+    rsdt_address: u32,
+    length: u32,
+    xsdt_address: u64,
+    extended_checksum: u8,
+    reserved: [3]u8,
+};
+
+/// Common header of every System Description Table.
+pub const SdtHeader = extern struct {
+    signature: [4]u8,
+    length: u32,
+    revision: u8,
+    checksum: u8,
+    oem_id: [6]u8,
+    oem_table_id: [8]u8,
+    oem_revision: u32,
+    creator_id: u32,
+    creator_revision: u32,
+};
+
+// MADT layout
+const MADT_LAPIC_ADDRESS_OFFSET = @sizeOf(SdtHeader);
+const MADT_ENTRIES_OFFSET = @sizeOf(SdtHeader) + 8; // LAPIC address (u32) + flags (u32)
+
+const MADT_TYPE_LAPIC: u8 = 0;
+const MADT_TYPE_IOAPIC: u8 = 1;
+const MADT_TYPE_ISO: u8 = 2;
+const MADT_TYPE_LAPIC_ADDRESS_OVERRIDE: u8 = 5;
+const MADT_TYPE_X2APIC: u8 = 9;
+
+const LAPIC_FLAG_ENABLED: u32 = 1 << 0;
+const LAPIC_FLAG_ONLINE_CAPABLE: u32 = 1 << 1;
+
+/// Interrupt pin polarity.
+pub const Polarity = enum { active_high, active_low };
+
+/// Interrupt trigger mode.
+pub const Trigger = enum { edge, level };
+
+/// One IOAPIC and the first GSI it serves.
+pub const IoApic = struct {
+    id: u8,
+    phys: u64,
+    gsi_base: u32,
+};
+
+/// Where a legacy ISA IRQ is actually wired.
+pub const IrqRoute = struct {
+    gsi: u32,
+    polarity: Polarity,
+    trigger: Trigger,
+};
+
+/// Interrupt topology described by the MADT.
+pub const ApicTopology = struct {
+    lapic_base: u64 = DEFAULT_LAPIC_BASE,
+    lapic_ids: [MAX_LAPICS]u32 = undefined,
+    lapic_count: usize = 0,
+    ioapics: [MAX_IOAPICS]IoApic = undefined,
+    ioapic_count: usize = 0,
+    /// Legacy IRQ N -> GSI. Identity mapped, ISA defaults (edge, active high) unless overridden.
+    legacy: [LEGACY_IRQS]IrqRoute = defaultLegacyRoutes(),
+
+    /// Returns the route for legacy IRQ `irq`, applying any Interrupt Source Override.
+    pub fn legacyRoute(self: *const ApicTopology, irq: u8) IrqRoute {
+        if (irq < LEGACY_IRQS) return self.legacy[irq];
+        return .{ .gsi = irq, .polarity = .active_high, .trigger = .edge };
+    }
+
+    /// Returns the IOAPIC serving `gsi`: the one with the highest base not above it.
+    pub fn ioapicForGsi(self: *const ApicTopology, gsi: u32) ?*const IoApic {
+        const index = self.ioapicIndexForGsi(gsi) orelse return null;
+        return &self.ioapics[index];
+    }
+
+    /// Like ioapicForGsi, but returns the IOAPIC's position in MADT order.
+    pub fn ioapicIndexForGsi(self: *const ApicTopology, gsi: u32) ?usize {
+        var best: ?usize = null;
+        for (self.ioapics[0..self.ioapic_count], 0..) |io, i| {
+            if (io.gsi_base <= gsi and (best == null or io.gsi_base > self.ioapics[best.?].gsi_base)) {
+                best = i;
+            }
+        }
+        return best;
+    }
+};
+
+fn defaultLegacyRoutes() [LEGACY_IRQS]IrqRoute {
+    var routes: [LEGACY_IRQS]IrqRoute = undefined;
+    for (&routes, 0..) |*r, i| {
+        r.* = .{ .gsi = @intCast(i), .polarity = .active_high, .trigger = .edge };
+    }
+    return routes;
+}
+
+var topology: ApicTopology = .{};
+var madt_found: bool = false;
+
+/// Locates the MADT and parses it. Must run after vmm.init() (tables are
+/// mapped on demand). Without ACPI the defaults describe one IOAPIC at
+/// 0xFEC00000 serving GSI 0 and identity-mapped legacy IRQs.
+pub fn init() void {
+    if (findTable("APIC".*)) |madt| {
+        const bytes = @as([*]const u8, @ptrCast(madt))[0..madt.length];
+        parseMadt(bytes, &topology);
+        madt_found = true;
+        log.info("ACPI: MADT parsed.");
+    } else {
+        log.warn("ACPI: MADT not found. Using default APIC layout.");
+    }
+
+    if (topology.ioapic_count == 0) {
+        topology.ioapics[0] = .{ .id = 0, .phys = DEFAULT_IOAPIC_BASE, .gsi_base = 0 };
+        topology.ioapic_count = 1;
+    }
+
+    log.debug("ACPI: Local APICs:");
+    log.printHex(.debug, topology.lapic_count);
+    log.debug("ACPI: IOAPICs:");
+    log.printHex(.debug, topology.ioapic_count);
+}
+
+/// Returns the parsed interrupt topology.
+pub fn apicTopology() *const ApicTopology {
+    return &topology;
+}
+
+/// True if the firmware provided a MADT.
+pub fn hasMadt() bool {
+    return madt_found;
+}
+
+/// Maps `len` bytes of a firmware table read-only and returns a pointer to it.
+fn mapTable(phys: u64, len: u64) ?[*]const u8 {
+    const virt = vmm.mapPhysical(phys, len, vmm.PTE_NX) catch {
+        log.err("ACPI: Failed to map table!");
+        return null;
+    };
+    return @ptrFromInt(virt);
+}
+
+fn checksumOk(bytes: []const u8) bool {
+    var sum: u8 = 0;
+    for (bytes) |b| sum +%= b;
+    return sum == 0;
+}
+
+/// Maps an SDT (header first, then its full length) and validates its checksum.
+fn mapSdt(phys: u64) ?*const SdtHeader {
+    const head = mapTable(phys, @sizeOf(SdtHeader)) orelse return null;
+    const header: *const SdtHeader = @ptrCast(@alignCast(head));
+    const full = mapTable(phys, header.length) orelse return null;
+    if (!checksumOk(full[0..header.length])) return null;
+    return header;
+}
+
+/// Returns the RSDP, or null if Limine found none.
+fn getRsdp() ?*const Rsdp {
+    const resp = @as(*volatile ?*limine.struct_limine_rsdp_response, &rsdp_request.response).*;
+    const r = resp orelse return null;
+    // Base revision 3: the RSDP address is physical.
+    const phys = @intFromPtr(r.address orelse return null);
+    const bytes = mapTable(phys, @sizeOf(Rsdp)) orelse return null;
+    const rsdp: *const Rsdp = @ptrCast(@alignCast(bytes));
+    if (!std.mem.eql(u8, &rsdp.signature, "RSD PTR ")) return null;
+    if (!checksumOk(bytes[0..20])) return null;
+    return rsdp;
+}
+
+/// Finds the table with `signature` through the XSDT (preferred) or RSDT.
+pub fn findTable(signature: [4]u8) ?*const SdtHeader {
+    const rsdp = getRsdp() orelse {
+        log.warn("ACPI: RSDP not available.");
+        return null;
+    };
+
+    const use_xsdt = rsdp.revision >= 2 and rsdp.xsdt_address != 0;
+    const root_phys: u64 = if (use_xsdt) rsdp.xsdt_address else rsdp.rsdt_address;
+    const root = mapSdt(root_phys) orelse {
+        log.err("ACPI: Root table checksum mismatch.");
+        return null;
+    };
+
+    const entry_size: usize = if (use_xsdt) 8 else 4;
+    const entries = @as([*]const u8, @ptrCast(root))[@sizeOf(SdtHeader)..root.length];
+    var off: usize = 0;
+    while (off + entry_size <= entries.len) : (off += entry_size) {
+        // XSDT entries are only 4-byte aligned.
+        const phys: u64 = if (use_xsdt)
+            std.mem.readInt(u64, entries[off..][0..8], .little)
+        else
+            std.mem.readInt(u32, entries[off..][0..4], .little);
+
+        const head = mapTable(phys, @sizeOf(SdtHeader)) orelse continue;
+        if (!std.mem.eql(u8, head[0..4], &signature)) continue;
+        return mapSdt(phys);
+    }
+    return null;
+}
+
+/// Parses a complete MADT (`bytes` includes the SDT header) into `out`.
+pub fn parseMadt(bytes: []const u8, out: *ApicTopology) void {
+    if (bytes.len < MADT_ENTRIES_OFFSET) return;
+    out.lapic_base = std.mem.readInt(u32, bytes[MADT_LAPIC_ADDRESS_OFFSET..][0..4], .little);
+
+    var off: usize = MADT_ENTRIES_OFFSET;
+    while (off + 2 <= bytes.len) {
+        const kind = bytes[off];
+        const len = bytes[off + 1];
+        if (len < 2 or off + len > bytes.len) break;
+        const e = bytes[off .. off + len];
+        off += len;
+
+        switch (kind) {
+            MADT_TYPE_LAPIC => {
+                if (len < 8) continue;
+                const flags = std.mem.readInt(u32, e[4..8], .little);
+                addLapic(out, e[3], flags);
+            },
+            MADT_TYPE_X2APIC => {
+                if (len < 16) continue;
+                const id = std.mem.readInt(u32, e[4..8], .little);
+                const flags = std.mem.readInt(u32, e[8..12], .little);
+                addLapic(out, id, flags);
+            },
+            MADT_TYPE_IOAPIC => {
+                if (len < 12) continue;
+                if (out.ioapic_count == MAX_IOAPICS) {
+                    log.warn("ACPI: Too many IOAPICs. Extra ones are ignored.");
+                    continue;
+                }
+                out.ioapics[out.ioapic_count] = .{
+                    .id = e[2],
+                    .phys = std.mem.readInt(u32, e[4..8], .little),
+                    .gsi_base = std.mem.readInt(u32, e[8..12], .little),
+                };
+                out.ioapic_count += 1;
+            },
+            MADT_TYPE_ISO => {
+                if (len < 10) continue;
+                const source = e[3];
+                if (e[2] != 0 or source >= LEGACY_IRQS) continue; // Only ISA (bus 0)
+                const flags = std.mem.readInt(u16, e[8..10], .little);
+                out.legacy[source] = .{
+                    .gsi = std.mem.readInt(u32, e[4..8], .little),
+                    // MPS INTI flags: 0b11 = low / level, anything else keeps the ISA default.
+                    .polarity = if ((flags & 0x3) == 0x3) .active_low else .active_high,
+                    .trigger = if (((flags >> 2) & 0x3) == 0x3) .level else .edge,
+                };
+            },
+            MADT_TYPE_LAPIC_ADDRESS_OVERRIDE => {
+                if (len < 12) continue;
+                out.lapic_base = std.mem.readInt(u64, e[4..12], .little);
+            },
+            else => {},
+        }
+    }
+}
+
+fn addLapic(out: *ApicTopology, id: u32, flags: u32) void {
+    if ((flags & (LAPIC_FLAG_ENABLED | LAPIC_FLAG_ONLINE_CAPABLE)) == 0) return;
+    // Firmware may list a CPU in both an xAPIC and an x2APIC entry.
+    for (out.lapic_ids[0..out.lapic_count]) |existing| {
+        if (existing == id) return;
+    }
+    if (out.lapic_count == MAX_LAPICS) return;
+    out.lapic_ids[out.lapic_count] = id;
+    out.lapic_count += 1;
+}
+
+// --- Unit Tests ---
+
+test "ACPI Table Layouts" {
+    try std.testing.expect(@sizeOf(SdtHeader) == 36);
+    try std.testing.expect(@offsetOf(Rsdp, "rsdt_address") == 16);
+    try std.testing.expect(@offsetOf(Rsdp, "xsdt_address") == 24);
+}
+
+test "ACPI MADT Parsing" {
+    // Header (36) + LAPIC address + flags, followed by entries.
+    var madt = [_]u8{0} ** (MADT_ENTRIES_OFFSET + 8 + 8 + 8 + 12 + 12 + 10 + 10 + 16);
+    std.mem.writeInt(u32, madt[MADT_LAPIC_ADDRESS_OFFSET..][0..4], 0xFEE00000, .little);
+
+    var off: usize = MADT_ENTRIES_OFFSET;
+    // Two enabled LAPICs and one disabled one.
+    for ([_][2]u8{ .{ 0, 1 }, .{ 1, 1 }, .{ 7, 0 } }) |cpu_entry| {
+        madt[off] = MADT_TYPE_LAPIC;
+        madt[off + 1] = 8;
+        madt[off + 3] = cpu_entry[0];
+        madt[off + 4] = cpu_entry[1];
+        off += 8;
+    }
+    // Two IOAPICs: GSIs 0-23 and 24+.
+    for ([_][2]u32{ .{ 0xFEC00000, 0 }, .{ 0xFEC01000, 24 } }, 0..) |io_entry, idx| {
+        madt[off] = MADT_TYPE_IOAPIC;
+        madt[off + 1] = 12;
+        madt[off + 2] = @intCast(idx);
+        std.mem.writeInt(u32, madt[off + 4 ..][0..4], io_entry[0], .little);
+        std.mem.writeInt(u32, madt[off + 8 ..][0..4], io_entry[1], .little);
+        off += 12;
+    }
+    // ISO: IRQ 0 -> GSI 2 (bus defaults), IRQ 9 -> GSI 9 level/low (SCI).
+    for ([_][3]u32{ .{ 0, 2, 0 }, .{ 9, 9, 0xF } }) |iso_entry| {
+        madt[off] = MADT_TYPE_ISO;
+        madt[off + 1] = 10;
+        madt[off + 3] = @intCast(iso_entry[0]);
+        std.mem.writeInt(u32, madt[off + 4 ..][0..4], iso_entry[1], .little);
+        std.mem.writeInt(u16, madt[off + 8 ..][0..2], @intCast(iso_entry[2]), .little);
+        off += 10;
+    }
+    // x2APIC entry for a CPU beyond the 8-bit ID range.
+    madt[off] = MADT_TYPE_X2APIC;
+    madt[off + 1] = 16;
+    std.mem.writeInt(u32, madt[off + 4 ..][0..4], 300, .little);
+    std.mem.writeInt(u32, madt[off + 8 ..][0..4], LAPIC_FLAG_ENABLED, .little);
+    off += 16;
+    try std.testing.expect(off == madt.len);
+
+    var topo = ApicTopology{};
+    parseMadt(&madt, &topo);
+
+    try std.testing.expect(topo.lapic_base == 0xFEE00000);
+    try std.testing.expect(topo.lapic_count == 3);
+    try std.testing.expect(topo.lapic_ids[0] == 0);
+    try std.testing.expect(topo.lapic_ids[1] == 1);
+    try std.testing.expect(topo.lapic_ids[2] == 300);
+
+    try std.testing.expect(topo.ioapic_count == 2);
+    try std.testing.expect(topo.ioapicForGsi(5).?.phys == 0xFEC00000);
+    try std.testing.expect(topo.ioapicForGsi(30).?.phys == 0xFEC01000);
+    try std.testing.expect(topo.ioapicIndexForGsi(30).? == 1);
+
+    const timer = topo.legacyRoute(0);
+    try std.testing.expect(timer.gsi == 2 and timer.trigger == .edge and timer.polarity == .active_high);
+    const sci = topo.legacyRoute(9);
+    try std.testing.expect(sci.gsi == 9 and sci.trigger == .level and sci.polarity == .active_low);
+    try std.testing.expect(topo.legacyRoute(1).gsi == 1);
+}
+
+test "ACPI Live Topology" {
+    // QEMU always provides a MADT with at least the BSP and one IOAPIC.
+    const topo = apicTopology();
+    try std.testing.expect(topo.ioapic_count >= 1);
+    if (hasMadt()) {
+        try std.testing.expect(topo.lapic_count >= 1);
+    }
+}
@@ -1,29 +1,11 @@
 const std = @import("std");
 const io = @import("io.zig");
 const serial = @import("../../kernel/serial.zig");
-const limine = @import("../../limine_import.zig").C;
-
-// TODO: Parse ACPI (MADT table) to get the actual Local APIC and IOAPIC physical addresses.
-// For now, we use the standard defaults which QEMU (and most hardware) respects.
-const LAPIC_PHYS_BASE = 0xFEE00000;
-const IOAPIC_PHYS_BASE = 0xFEC00000;
-
-// Access to HHDM Request (Defined in limine.c)
-extern var hhdm_request: limine.struct_limine_hhdm_request;
-
-fn getHhdmOffset() u64 {
-    const resp = hhdm_request.response;
-    if (resp == null) {
-        // Fallback or Panic? For now, assume it exists or return 0 (which will likely crash but explicitly)
-        // We can't easily log here if serial depends on something, but serial is usually safe.
-        return 0;
-    }
-    return resp.*.offset;
-}
-
-fn getVirtualAddress(phys: u64) u64 {
-    return phys + getHhdmOffset();
-}
+const log = serial.scoped(.apic);
+const cpu = @import("cpu.zig");
+const acpi = @import("acpi.zig");
+const smp = @import("smp.zig");
+const vmm = @import("../../kernel/memory/vmm.zig");
 
 // Local APIC Registers (Offsets)
 const LAPIC_ID = 0x0020;
@@ -32,6 +14,8 @@ const LAPIC_SVR = 0x00F0; // Spurious Interrupt Vector Register
 const LAPIC_ICR_LOW = 0x0300; // Interrupt Command Register Low
 const LAPIC_ICR_HIGH = 0x0310; // Interrupt Command Register High
 const LAPIC_LVT_TIMER = 0x0320;
+const LAPIC_TIMER_INITIAL_COUNT = 0x0380;
+const LAPIC_TIMER_DIVIDE = 0x03E0;
 
 // IOAPIC Registers (Offsets)
 const IOAPIC_ID = 0x00;
@@ -39,132 +23,363 @@ const IOAPIC_VER = 0x01;
 const IOAPIC_ARB = 0x02;
 const IOAPIC_RED_TBL = 0x10; // Redirection Table entries start here (low/high pairs)
 
+// x2APIC
+// In x2APIC mode every LAPIC register at MMIO offset X is the MSR 0x800 + (X >> 4).
+// The ICR becomes a single 64-bit MSR and the ID register holds the full 32-bit ID.
+const MSR_IA32_APIC_BASE: u32 = 0x1B;
+const APIC_BASE_EXTD: u64 = 1 << 10; // x2APIC mode
+const APIC_BASE_EN: u64 = 1 << 11; // xAPIC global enable
+const X2APIC_MSR_BASE: u32 = 0x800;
+const CPUID_X2APIC_BIT: u32 = 1 << 21; // CPUID.01H:ECX[21]
+
+/// True once the LAPIC has been switched to x2APIC (MSR) mode.
+var x2apic_enabled: bool = false;
+
+// LAPIC MMIO pointer, resolved once in init() instead of on every access.
+// Only used in xAPIC mode.
+var lapic_mmio: [*]volatile u32 = undefined;
+
+/// A mapped IOAPIC and the GSIs it serves ([gsi_base, gsi_base + gsi_count)).
+const IoApic = struct {
+    mmio: [*]volatile u32,
+    gsi_base: u32,
+    gsi_count: u32,
+};
+
+var ioapics: [acpi.MAX_IOAPICS]IoApic = undefined;
+var ioapic_count: usize = 0;
+
+/// An IRQ routed through an IOAPIC, remembered so its target CPU can be changed.
+const IrqBinding = struct {
+    irq: u8,
+    gsi: u32,
+    vector: u8,
+    polarity: acpi.Polarity,
+    trigger: acpi.Trigger,
+    cpu_index: usize,
+};
+
+const MAX_BINDINGS: usize = 32;
+var bindings: [MAX_BINDINGS]IrqBinding = undefined;
+var binding_count: usize = 0;
+// Round-robin cursor for spreading IRQs over online CPUs.
+var next_target: usize = 0;
+
+// MMIO must not be cached (strong UC: no write-combining either).
+const MMIO_FLAGS = vmm.PTE_RW | vmm.cacheFlags(.uncached) | vmm.PTE_NX;
+
+/// Returns the x2APIC MSR for an xAPIC MMIO register offset.
+fn x2apicMsr(offset: u64) u32 {
+    return X2APIC_MSR_BASE + @as(u32, @intCast(offset >> 4));
+}
+
 /// Read from Local APIC Register
 fn lapicRead(offset: u64) u32 {
-    const addr = getVirtualAddress(LAPIC_PHYS_BASE) + offset;
-    const ptr = @as(*volatile u32, @ptrFromInt(addr));
-    return ptr.*;
+    if (x2apic_enabled) {
+        return @truncate(cpu.readMsr(x2apicMsr(offset)));
+    }
+    return lapic_mmio[offset / 4];
 }
 
 /// Write to Local APIC Register
 fn lapicWrite(offset: u64, value: u32) void {
-    const addr = getVirtualAddress(LAPIC_PHYS_BASE) + offset;
-    const ptr = @as(*volatile u32, @ptrFromInt(addr));
-    ptr.* = value;
+    if (x2apic_enabled) {
+        cpu.writeMsr(x2apicMsr(offset), value);
+        return;
+    }
+    lapic_mmio[offset / 4] = value;
 }
 
 /// Read from IOAPIC Register (Indirect Access)
 /// Index Register: Base + 0x00
 /// Data Register:  Base + 0x10
-fn ioapicRead(reg: u32) u32 {
-    const base = getVirtualAddress(IOAPIC_PHYS_BASE);
-    const idx_ptr = @as(*volatile u32, @ptrFromInt(base + 0x00));
-    const dat_ptr = @as(*volatile u32, @ptrFromInt(base + 0x10));
-
-    idx_ptr.* = reg;
-    return dat_ptr.*;
+fn ioapicRead(ioapic: *const IoApic, reg: u32) u32 {
+    ioapic.mmio[0x00 / 4] = reg;
+    return ioapic.mmio[0x10 / 4];
 }
 
 /// Write to IOAPIC Register (Indirect Access)
-fn ioapicWrite(reg: u32, value: u32) void {
-    const base = getVirtualAddress(IOAPIC_PHYS_BASE);
-    const idx_ptr = @as(*volatile u32, @ptrFromInt(base + 0x00));
-    const dat_ptr = @as(*volatile u32, @ptrFromInt(base + 0x10));
+fn ioapicWrite(ioapic: *const IoApic, reg: u32, value: u32) void {
+    ioapic.mmio[0x00 / 4] = reg;
+    ioapic.mmio[0x10 / 4] = value;
+}
 
-    idx_ptr.* = reg;
-    dat_ptr.* = value;
+/// Returns the mapped IOAPIC serving `gsi`. ioapics[] is filled in MADT
+/// order, so the topology's index selects it directly.
+fn ioapicForGsi(gsi: u32) ?*const IoApic {
+    const index = acpi.apicTopology().ioapicIndexForGsi(gsi) orelse return null;
+    if (index >= ioapic_count) return null;
+    const ioapic = &ioapics[index];
+    if (gsi - ioapic.gsi_base >= ioapic.gsi_count) return null;
+    return ioapic;
 }
 
-const vmm = @import("../../kernel/memory/vmm.zig");
+/// Returns true if the CPU supports x2APIC mode.
+fn x2apicSupported() bool {
+    return (cpu.cpuid(1, 0).ecx & CPUID_X2APIC_BIT) != 0;
+}
+
+/// Switches the LAPIC to x2APIC mode (no-op if the bootloader already did).
+fn enableX2apic() void {
+    const base = cpu.readMsr(MSR_IA32_APIC_BASE);
+    if ((base & APIC_BASE_EXTD) == 0) {
+        // xAPIC -> x2APIC requires EN to already be set; set both in one write.
+        cpu.writeMsr(MSR_IA32_APIC_BASE, base | APIC_BASE_EN | APIC_BASE_EXTD);
+    }
+    x2apic_enabled = true;
+}
+
+/// Returns true if the LAPIC is in x2APIC mode.
+pub fn isX2apic() bool {
+    return x2apic_enabled;
+}
 
-// ...
 
 pub fn init() void {
-    // 0. Map MMIO Regions via VMM
-    // We map them to HHDM + PhysBase
-    const lapic_virt = getVirtualAddress(LAPIC_PHYS_BASE);
-    const ioapic_virt = getVirtualAddress(IOAPIC_PHYS_BASE);
-
-    // Flags: Present | ReadWrite | CacheDisable (MMIO should not be cached)
-    // Note: vmm.mapPage takes constants. Access them via vmm or hardcode?
-    // Let's rely on VMM constants being private, we pass raw flags or add public flags to vmm?
-    // vmm flags are private. Let's pass raw values or make them public?
-    // vmm flags are private. I will update vmm to make flags public or magic number (PTE_PRESENT=1, RW=2, PCD=16).
-    // Let's use magic numbers for now or update vmm.
-    const PTE_PRESENT = 1;
-    const PTE_RW = 2;
-    const PTE_PCD = 16; // Cache Disable
-
-    vmm.mapPage(lapic_virt, LAPIC_PHYS_BASE, PTE_PRESENT | PTE_RW | PTE_PCD, 0) catch {
-        serial.err("APIC: Failed to map LAPIC Page!");
-        while (true) {}
-    };
-    vmm.mapPage(ioapic_virt, IOAPIC_PHYS_BASE, PTE_PRESENT | PTE_RW | PTE_PCD, 0) catch {
-        serial.err("APIC: Failed to map IOAPIC Page!");
+    const topo = acpi.apicTopology();
+
+    // 0. Map MMIO Regions (addresses come from the MADT, see acpi.zig)
+    const lapic_virt = vmm.mapPhysical(topo.lapic_base, 4096, MMIO_FLAGS) catch {
+        log.err("APIC: Failed to map LAPIC Page!");
         while (true) {}
     };
+    lapic_mmio = @ptrFromInt(lapic_virt);
 
     // 1. Disable legacy PIC (mask all)
     // Even though we are switching to APIC, legacy PICs can still cause trouble if not silenced.
     io.outb(0xA1, 0xFF);
     io.outb(0x21, 0xFF);
 
-    serial.debug("Disabling Legacy PIC...");
+    log.debug("Disabling Legacy PIC...");
 
     // 2. Enable Local APIC
+    // Prefer x2APIC: MSR access avoids MMIO round trips and is required above 255 CPUs.
+    if (x2apicSupported()) {
+        enableX2apic();
+        log.info("Local APIC: x2APIC mode enabled.");
+    } else {
+        log.info("Local APIC: x2APIC not supported, using xAPIC MMIO.");
+    }
+
     // Set SVR (Spurious Interrupt Vector Register)
     // Bit 8 = Enable APIC
     // Bits 0-7 = Vector number for spurious interrupts (e.g., 0xFF)
     lapicWrite(LAPIC_SVR, 0x1FF); // Enable + Vector 255
 
-    serial.info("Local APIC Initialized (SVR=0x1FF)");
+    log.info("Local APIC Initialized (SVR=0x1FF)");
+
+    // 3. Initialize every IOAPIC and mask all of its entries
+    ioapic_count = 0;
+    for (topo.ioapics[0..topo.ioapic_count]) |info| {
+        const virt = vmm.mapPhysical(info.phys, 4096, MMIO_FLAGS) catch {
+            log.err("APIC: Failed to map IOAPIC Page!");
+            while (true) {}
+        };
+        var ioapic = IoApic{ .mmio = @ptrFromInt(virt), .gsi_base = info.gsi_base, .gsi_count = 0 };
 
-    // 3. Initialize IOAPIC (Log ID/Version)
-    const ver = ioapicRead(IOAPIC_VER);
-    const count = (ver >> 16) & 0xFF; // Max Redirection Entry (Number of IRQs - 1)
+        const ver = ioapicRead(&ioapic, IOAPIC_VER);
+        ioapic.gsi_count = ((ver >> 16) & 0xFF) + 1; // Max Redirection Entry + 1
 
-    serial.info("IOAPIC Initialized");
-    serial.debug("IOAPIC Version: ");
-    serial.printHex(.debug, ver & 0xFF);
-    serial.debug("IOAPIC Max Redirection Entries: ");
-    serial.printHex(.debug, count);
+        var pin: u32 = 0;
+        while (pin < ioapic.gsi_count) : (pin += 1) {
+            ioapicWrite(&ioapic, IOAPIC_RED_TBL + pin * 2, REDIR_MASKED);
+        }
 
-    // Mask all IOAPIC Entries by default?
-    // They usually come up masked, but good practice to clear them.
-    // (omitted for brevity, we will just enable the ones we need)
+        ioapics[ioapic_count] = ioapic;
+        ioapic_count += 1;
+
+        log.debug("IOAPIC Version / GSI Base / Entries: ");
+        log.printHex(.debug, ver & 0xFF);
+        log.printHex(.debug, ioapic.gsi_base);
+        log.printHex(.debug, ioapic.gsi_count);
+    }
+
+    log.info("IOAPICs Initialized");
 }
 
 /// Send End of Interrupt to Local APIC
 pub fn sendEoi() void {
-    lapicWrite(LAPIC_EOI, 0);
+    if (x2apic_enabled) {
+        cpu.writeMsr(x2apicMsr(LAPIC_EOI), 0);
+        return;
+    }
+    lapic_mmio[LAPIC_EOI / 4] = 0;
 }
 
-/// Enable a legacy IRQ (0-15) by mapping it to a CPU Vector via IOAPIC
+// Interrupt Command Register (Low) bits
+//   [0-7]   Vector
+//   [8-10]  Delivery Mode (000 = Fixed)
+//   [12]    Delivery Status (RO, 1 = Send Pending)
+//   [14]    Level (1 = Assert)
+//   [18-19] Destination Shorthand (00 = None, 01 = Self, 11 = All Excluding Self)
+const ICR_DELIVERY_PENDING: u32 = 1 << 12;
+const ICR_LEVEL_ASSERT: u32 = 1 << 14;
+const ICR_SHORTHAND_SELF: u32 = 1 << 18;
+const ICR_SHORTHAND_ALL_BUT_SELF: u32 = 3 << 18;
+
+/// Returns the APIC ID of the executing CPU.
+pub fn currentApicId() u32 {
+    // x2APIC IDs are the full 32-bit register; xAPIC IDs live in bits 24-31.
+    if (x2apic_enabled) return lapicRead(LAPIC_ID);
+    return lapicRead(LAPIC_ID) >> 24;
+}
+
+/// Writes the ICR and waits until the LAPIC has accepted the IPI.
+fn writeIcr(dest_apic_id: u32, low: u32) void {
+    if (x2apic_enabled) {
+        // Single 64-bit write: destination in bits 32-63. No delivery status to poll.
+        // WRMSR to the x2APIC ICR is not serializing: fence so the stores the
+        // target will look at (e.g. a TLB shootdown request) are visible first.
+        asm volatile ("mfence; lfence" ::: .{ .memory = true });
+        cpu.writeMsr(x2apicMsr(LAPIC_ICR_LOW), (@as(u64, dest_apic_id) << 32) | low);
+        return;
+    }
+
+    lapicWrite(LAPIC_ICR_HIGH, dest_apic_id << 24);
+    lapicWrite(LAPIC_ICR_LOW, low);
+
+    while ((lapicRead(LAPIC_ICR_LOW) & ICR_DELIVERY_PENDING) != 0) {
+        asm volatile ("pause");
+    }
+}
+
+/// Sends a fixed-delivery IPI with `vector` to the CPU with APIC ID `dest_apic_id`.
+pub fn sendIpi(dest_apic_id: u32, vector: u8) void {
+    writeIcr(dest_apic_id, ICR_LEVEL_ASSERT | vector);
+}
+
+/// Sends an IPI with `vector` to every CPU except the current one.
+/// Prefer targeted sendIpi() calls when only some CPUs need to be interrupted.
+pub fn sendIpiAllButSelf(vector: u8) void {
+    writeIcr(0, ICR_SHORTHAND_ALL_BUT_SELF | ICR_LEVEL_ASSERT | vector);
+}
+
+/// Sends an IPI with `vector` to the current CPU (ICR destination shorthand "Self").
+/// Used for software-triggered work and for measuring interrupt latency.
+pub fn sendSelfIpi(vector: u8) void {
+    writeIcr(0, ICR_SHORTHAND_SELF | ICR_LEVEL_ASSERT | vector);
+}
+
+// Redirection Table Entry (64-bit)
+// Low 32 bits:
+//   [0-7]   Vector
+//   [8-10]  Delivery Mode (000 = Fixed)
+//   [11]    Dest Mode (0 = Physical)
+//   [12]    Delivery Status (RO)
+//   [13]    Pin Polarity (0 = High Active, 1 = Low Active)
+//   [14]    Remote IRR (RO)
+//   [15]    Trigger Mode (0 = Edge, 1 = Level)
+//   [16]    Mask (0 = Unmasked, 1 = Masked)
+// High 32 bits:
+//   [56-63] Destination (APIC ID)
+const REDIR_ACTIVE_LOW: u32 = 1 << 13;
+const REDIR_LEVEL: u32 = 1 << 15;
+const REDIR_MASKED: u32 = 1 << 16;
+
+/// Builds the low word of a redirection entry (fixed delivery, physical destination).
+fn redirectionLow(vector: u8, polarity: acpi.Polarity, trigger: acpi.Trigger) u32 {
+    var low: u32 = vector;
+    if (polarity == .active_low) low |= REDIR_ACTIVE_LOW;
+    if (trigger == .level) low |= REDIR_LEVEL;
+    return low;
+}
+
+/// Returns the IOAPIC destination for CPU `cpu_index`.
+/// IOAPIC destinations are 8 bits; larger x2APIC IDs need interrupt remapping,
+/// which we do not have, so those IRQs stay on the BSP.
+fn irqDestination(cpu_index: usize) u32 {
+    const id = smp.lapicId(cpu_index);
+    if (id > 0xFF) return smp.lapicId(smp.bspIndex());
+    return id;
+}
+
+/// Picks the next online CPU for a new IRQ so device interrupts are spread out.
+fn nextIrqTarget() usize {
+    const mask = smp.onlineMask();
+    var tries: usize = 0;
+    while (tries < smp.MAX_CPUS) : (tries += 1) {
+        const candidate = next_target % smp.MAX_CPUS;
+        next_target = candidate + 1;
+        if ((mask & smp.cpuBit(candidate)) != 0) return candidate;
+    }
+    return smp.bspIndex();
+}
+
+/// Writes the redirection entry for `binding`.
+fn programBinding(binding: *const IrqBinding) void {
+    const ioapic = ioapicForGsi(binding.gsi) orelse {
+        log.err("APIC: No IOAPIC serves GSI:");
+        log.printHex(.err, binding.gsi);
+        return;
+    };
+    const pin = binding.gsi - ioapic.gsi_base;
+    const low_index = IOAPIC_RED_TBL + pin * 2;
+    const high_index = low_index + 1;
+
+    // Mask while rewriting so the entry is never half-updated and live.
+    ioapicWrite(ioapic, low_index, REDIR_MASKED);
+    ioapicWrite(ioapic, high_index, irqDestination(binding.cpu_index) << 24);
+    ioapicWrite(ioapic, low_index, redirectionLow(binding.vector, binding.polarity, binding.trigger));
+}
+
+fn findBinding(irq: u8) ?*IrqBinding {
+    for (bindings[0..binding_count]) |*binding| {
+        if (binding.irq == irq) return binding;
+    }
+    return null;
+}
+
+/// Enable a legacy IRQ (0-15) by mapping it to a CPU Vector via the IOAPIC that
+/// serves it. Interrupt Source Overrides from the MADT decide the GSI, polarity
+/// and trigger mode. Each newly enabled IRQ goes to the next online CPU.
 pub fn enableIrq(irq: u8, vector: u8) void {
-    // Redirection Table Entry (64-bit)
-    // Low 32 bits:
-    //   [0-7]   Vector
-    //   [8-10]  Delivery Mode (000 = Fixed)
-    //   [11]    Dest Mode (0 = Physical)
-    //   [12]    Delivery Status (RO)
-    //   [13]    Pin Polarity (0 = High Active)
-    //   [14]    Remote IRR (RO)
-    //   [15]    Trigger Mode (0 = Edge)
-    //   [16]    Mask (0 = Unmasked, 1 = Masked)
-    // High 32 bits:
-    //   [56-63] Destination (APIC ID)
+    const route = acpi.apicTopology().legacyRoute(irq);
+
+    const binding = findBinding(irq) orelse blk: {
+        if (binding_count == MAX_BINDINGS) {
+            log.err("APIC: Too many IRQ bindings!");
+            return;
+        }
+        bindings[binding_count] = .{
+            .irq = irq,
+            .gsi = route.gsi,
+            .vector = vector,
+            .polarity = route.polarity,
+            .trigger = route.trigger,
+            .cpu_index = nextIrqTarget(),
+        };
+        binding_count += 1;
+        break :blk &bindings[binding_count - 1];
+    };
+    binding.vector = vector;
 
-    const low_index = IOAPIC_RED_TBL + (irq * 2);
-    const high_index = IOAPIC_RED_TBL + (irq * 2) + 1;
+    programBinding(binding);
+}
 
-    // Target CPU APIC ID 0 (BSP)
-    const high_val: u32 = 0 << 24;
+/// Routes `irq` to CPU `cpu_index` (an smp index, which must be online).
+pub fn setIrqAffinity(irq: u8, cpu_index: usize) error{ NotEnabled, CpuOffline }!void {
+    const binding = findBinding(irq) orelse return error.NotEnabled;
+    if (cpu_index >= smp.MAX_CPUS or (smp.onlineMask() & smp.cpuBit(cpu_index)) == 0) {
+        return error.CpuOffline;
+    }
+    binding.cpu_index = cpu_index;
+    programBinding(binding);
+}
 
-    // Fixed mode, Physical, High Active, Edge, Unmasked, Vector
-    const low_val: u32 = vector; // Rest are 0
+/// Returns the smp index of the CPU that receives `irq`.
+pub fn irqAffinity(irq: u8) ?usize {
+    const binding = findBinding(irq) orelse return null;
+    return binding.cpu_index;
+}
 
-    ioapicWrite(high_index, high_val);
-    ioapicWrite(low_index, low_val);
+/// Redistributes every enabled IRQ round-robin over the online CPUs.
+/// Call after bringing CPUs online.
+pub fn rebalanceIrqs() void {
+    next_target = 0;
+    for (bindings[0..binding_count]) |*binding| {
+        binding.cpu_index = nextIrqTarget();
+        programBinding(binding);
+    }
 }
 
 // --- Unit Tests ---
@@ -173,3 +388,44 @@ test "APIC Constants" {
     try std.testing.expect(LAPIC_SVR == 0x00F0);
     try std.testing.expect(LAPIC_EOI == 0x00B0);
 }
+
+test "x2APIC MSR Mapping" {
+    try std.testing.expect(x2apicMsr(LAPIC_ID) == 0x802);
+    try std.testing.expect(x2apicMsr(LAPIC_EOI) == 0x80B);
+    try std.testing.expect(x2apicMsr(LAPIC_SVR) == 0x80F);
+    try std.testing.expect(x2apicMsr(LAPIC_ICR_LOW) == 0x830);
+    try std.testing.expect(x2apicMsr(LAPIC_LVT_TIMER) == 0x832);
+    try std.testing.expect(x2apicMsr(LAPIC_TIMER_INITIAL_COUNT) == 0x838);
+    try std.testing.expect(x2apicMsr(LAPIC_TIMER_DIVIDE) == 0x83E);
+}
+
+test "IOAPIC Redirection Encoding" {
+    try std.testing.expect(redirectionLow(0x21, .active_high, .edge) == 0x21);
+    try std.testing.expect(redirectionLow(0x29, .active_low, .level) == (0x29 | REDIR_ACTIVE_LOW | REDIR_LEVEL));
+}
+
+test "IOAPIC Covers Legacy IRQs" {
+    try std.testing.expect(ioapic_count >= 1);
+    try std.testing.expect(ioapicForGsi(acpi.apicTopology().legacyRoute(1).gsi) != null);
+}
+
+test "IRQ Affinity" {
+    // The keyboard IRQ is a safe candidate: rerouting it to an online CPU is harmless.
+    const irq: u8 = 1;
+    const vector: u8 = 33;
+    enableIrq(irq, vector);
+    try std.testing.expect(irqAffinity(irq) != null);
+    try std.testing.expect((smp.onlineMask() & smp.cpuBit(irqAffinity(irq).?)) != 0);
+
+    try setIrqAffinity(irq, smp.bspIndex());
+    try std.testing.expect(irqAffinity(irq).? == smp.bspIndex());
+    try std.testing.expectError(error.NotEnabled, setIrqAffinity(15, smp.bspIndex()));
+
+    rebalanceIrqs();
+    try std.testing.expect((smp.onlineMask() & smp.cpuBit(irqAffinity(irq).?)) != 0);
+}
+
+test "APIC Mode Matches CPUID" {
+    // init() must pick x2APIC whenever the CPU offers it.
+    try std.testing.expect(isX2apic() == x2apicSupported());
+}
@@ -0,0 +1,95 @@
+/// Small wrappers around x86_64 instructions that do not belong to a specific device.
+
+/// Reads the Time Stamp Counter.
+pub fn rdtsc() u64 {
+    var low: u32 = undefined;
+    var high: u32 = undefined;
+    asm volatile ("rdtsc"
+        : [low] "={eax}" (low),
+          [high] "={edx}" (high),
+    );
+    return (@as(u64, high) << 32) | low;
+}
+
+/// Spin-loop hint. Use inside busy-wait loops.
+pub fn pause() void {
+    asm volatile ("pause" ::: .{ .memory = true });
+}
+
+/// Returns true if maskable interrupts are enabled (RFLAGS.IF).
+pub fn interruptsEnabled() bool {
+    const rflags = asm volatile (
+        \\ pushfq
+        \\ popq %[ret]
+        : [ret] "=r" (-> u64),
+    );
+    return (rflags & (1 << 9)) != 0;
+}
+
+/// Enables maskable interrupts.
+pub fn enableInterrupts() void {
+    asm volatile ("sti" ::: .{ .memory = true });
+}
+
+/// Disables maskable interrupts.
+pub fn disableInterrupts() void {
+    asm volatile ("cli" ::: .{ .memory = true });
+}
+
+/// Enables interrupts and halts until the next one arrives.
+/// `sti` delays interrupt delivery by one instruction, so an interrupt that
+/// becomes pending after the caller's last check (made with IF=0) still wakes
+/// the `hlt` instead of being lost. Returns with interrupts enabled.
+pub fn waitForInterrupt() void {
+    asm volatile (
+        \\ sti
+        \\ hlt
+        ::: .{ .memory = true });
+}
+
+/// Reads a Model Specific Register.
+pub fn readMsr(msr: u32) u64 {
+    var low: u32 = undefined;
+    var high: u32 = undefined;
+    asm volatile ("rdmsr"
+        : [low] "={eax}" (low),
+          [high] "={edx}" (high),
+        : [msr] "{ecx}" (msr),
+    );
+    return (@as(u64, high) << 32) | low;
+}
+
+/// Writes a Model Specific Register.
+pub fn writeMsr(msr: u32, value: u64) void {
+    asm volatile ("wrmsr"
+        :
+        : [low] "{eax}" (@as(u32, @truncate(value))),
+          [high] "{edx}" (@as(u32, @truncate(value >> 32))),
+          [msr] "{ecx}" (msr),
+        : .{ .memory = true });
+}
+
+/// Result of a CPUID query.
+pub const CpuidResult = struct {
+    eax: u32,
+    ebx: u32,
+    ecx: u32,
+    edx: u32,
+};
+
+/// Executes CPUID for `leaf`/`subleaf`.
+pub fn cpuid(leaf: u32, subleaf: u32) CpuidResult {
+    var eax: u32 = undefined;
+    var ebx: u32 = undefined;
+    var ecx: u32 = undefined;
+    var edx: u32 = undefined;
+    asm volatile ("cpuid"
+        : [eax] "={eax}" (eax),
+          [ebx] "={ebx}" (ebx),
+          [ecx] "={ecx}" (ecx),
+          [edx] "={edx}" (edx),
+        : [leaf] "{eax}" (leaf),
+          [subleaf] "{ecx}" (subleaf),
+    );
+    return .{ .eax = eax, .ebx = ebx, .ecx = ecx, .edx = edx };
+}
@@ -1,7 +1,8 @@
 const std = @import("std");
 const serial = @import("../../kernel/serial.zig");
 const apic = @import("apic.zig");
-const keyboard = @import("../../drivers/keyboard.zig");
+const trace = @import("../../kernel/trace.zig");
+const pks = @import("pks.zig");
 
 // Interrupt Descriptor Table Pointer (IDTR)
 const IdtDescriptor = packed struct {
@@ -68,122 +69,126 @@ pub const InterruptFrame = extern struct {
 // The IDT itself
 var idt_entries: [256]IdtEntry = undefined;
 
-// Externs for Assembly Stubs
-extern fn isr_stub_0() void;
-extern fn isr_stub_1() void;
-extern fn isr_stub_2() void;
-extern fn isr_stub_3() void;
-extern fn isr_stub_4() void;
-extern fn isr_stub_5() void;
-extern fn isr_stub_6() void;
-extern fn isr_stub_7() void;
-extern fn isr_stub_8() void;
-extern fn isr_stub_9() void;
-extern fn isr_stub_10() void;
-extern fn isr_stub_11() void;
-extern fn isr_stub_12() void;
-extern fn isr_stub_13() void;
-extern fn isr_stub_14() void;
-extern fn isr_stub_15() void;
-extern fn isr_stub_16() void;
-extern fn isr_stub_17() void;
-extern fn isr_stub_18() void;
-extern fn isr_stub_19() void;
-extern fn isr_stub_20() void;
-extern fn isr_stub_21() void;
-extern fn isr_stub_22() void;
-extern fn isr_stub_23() void;
-extern fn isr_stub_24() void;
-extern fn isr_stub_25() void;
-extern fn isr_stub_26() void;
-extern fn isr_stub_27() void;
-extern fn isr_stub_28() void;
-extern fn isr_stub_29() void;
-extern fn isr_stub_30() void;
-extern fn isr_stub_31() void;
-extern fn isr_stub_32() void;
-extern fn isr_stub_33() void;
-extern fn isr_stub_34() void;
-extern fn isr_stub_35() void;
-extern fn isr_stub_36() void;
-extern fn isr_stub_37() void;
-extern fn isr_stub_38() void;
-extern fn isr_stub_39() void;
-extern fn isr_stub_40() void;
-extern fn isr_stub_41() void;
-extern fn isr_stub_42() void;
-extern fn isr_stub_43() void;
-extern fn isr_stub_44() void;
-extern fn isr_stub_45() void;
-extern fn isr_stub_46() void;
-extern fn isr_stub_47() void;
-
-// Helper to get function address
-fn getAddr(func: *const fn () callconv(.c) void) u64 {
-    return @intFromPtr(func);
+// First vector that is not a CPU exception (IRQs, MSIs, IPIs).
+pub const FIRST_IRQ_VECTOR: u8 = 32;
+// Spurious vector programmed into the LAPIC SVR. Must NOT be acknowledged with an EOI.
+pub const SPURIOUS_VECTOR: u8 = 0xFF;
+
+// Size of each generated stub in interrupts.S (`.balign 16`).
+const ISR_STUB_SIZE: u64 = 16;
+
+// Start of the 256 fixed-size stubs generated in interrupts.S
+extern const isr_stub_table: u8;
+// Start of the fast-path stubs for vectors 32-255 (see irq_fast_common)
+extern const isr_fast_stub_table: u8;
+
+/// Signature of a registered interrupt handler.
+/// `ctx` is the opaque pointer given to registerHandler (driver state, or null).
+pub const Handler = *const fn (frame: *InterruptFrame, ctx: ?*anyopaque) void;
+
+/// Signature of a fast-path handler (see registerFastHandler).
+/// Called directly from irq_fast_common with the vector number in RDI.
+pub const FastHandler = *const fn (vector: u64) callconv(.c) void;
+
+pub const RegisterError = error{
+    /// Another handler already owns this vector.
+    VectorInUse,
+    /// Fast handlers are only allowed on IRQ vectors (>= FIRST_IRQ_VECTOR).
+    InvalidVector,
+};
+
+const HandlerEntry = struct {
+    handler: ?Handler = null,
+    ctx: ?*anyopaque = null,
+};
+
+// Dispatch table, indexed directly by vector number.
+var handlers: [256]HandlerEntry = [_]HandlerEntry{.{}} ** 256;
+
+// Fast-path dispatch table, read by irq_fast_common in interrupts.S.
+export var isr_fast_handlers: [256]?FastHandler = [_]?FastHandler{null} ** 256;
+
+// Per-vector hit counters (incremented on every entry, handled or not).
+// Exported because irq_fast_common bumps them from assembly.
+export var isr_hit_counts: [256]u64 = [_]u64{0} ** 256;
+
+/// Registers `handler` for `vector`. The handler is called with `ctx` on every hit.
+/// For vectors >= FIRST_IRQ_VECTOR the dispatcher sends the LAPIC EOI after the
+/// handler returns, so drivers must not do it themselves.
+pub fn registerHandler(vector: u8, handler: Handler, ctx: ?*anyopaque) RegisterError!void {
+    if (handlers[vector].handler != null or isr_fast_handlers[vector] != null) return RegisterError.VectorInUse;
+    handlers[vector] = .{ .handler = handler, .ctx = ctx };
+}
+
+/// Removes the handler for `vector`. Unregistered IRQ vectors are acknowledged and dropped.
+pub fn unregisterHandler(vector: u8) void {
+    handlers[vector] = .{};
+}
+
+/// Registers a fast-path handler for a high-rate IRQ vector (timer, IPIs, MSI-X).
+///
+/// The gate is switched to a lightweight stub that saves only the caller-saved
+/// registers and calls `handler` directly, skipping the InterruptFrame and the
+/// generic dispatcher. In exchange the handler:
+///   - receives no frame, only the vector number
+///   - must send its own EOI (apic.sendEoi())
+///   - must not context switch or inspect the interrupted state
+///
+/// Register before unmasking the interrupt source, since the gate is rewritten in place.
+pub fn registerFastHandler(vector: u8, handler: FastHandler) RegisterError!void {
+    if (vector < FIRST_IRQ_VECTOR or vector == SPURIOUS_VECTOR) return RegisterError.InvalidVector;
+    if (handlers[vector].handler != null or isr_fast_handlers[vector] != null) return RegisterError.VectorInUse;
+
+    isr_fast_handlers[vector] = handler;
+    setGate(vector, fastStubAddress(vector));
+}
+
+/// Removes a fast-path handler and restores the full-frame stub for `vector`.
+pub fn unregisterFastHandler(vector: u8) void {
+    if (vector < FIRST_IRQ_VECTOR) return;
+    setGate(vector, stubAddress(vector));
+    isr_fast_handlers[vector] = null;
+}
+
+/// Returns how many times `vector` has fired since boot.
+pub fn hitCount(vector: u8) u64 {
+    return @as(*volatile u64, &isr_hit_counts[vector]).*;
+}
+
+/// Returns the address of the generated entry stub for `vector`.
+fn stubAddress(vector: usize) u64 {
+    return @intFromPtr(&isr_stub_table) + vector * ISR_STUB_SIZE;
+}
+
+/// Returns the address of the fast-path stub for an IRQ `vector` (>= 32).
+fn fastStubAddress(vector: usize) u64 {
+    return @intFromPtr(&isr_fast_stub_table) + (vector - FIRST_IRQ_VECTOR) * ISR_STUB_SIZE;
+}
+
+/// Points the gate for `vector` at `handler_addr`.
+fn setGate(vector: u8, handler_addr: u64) void {
+    const kernel_code_selector = 0x08;
+    const idt_attr = 0x8E;
+    idt_entries[vector] = IdtEntry.init(handler_addr, kernel_code_selector, idt_attr);
 }
 
 /// Initializes the Interrupt Descriptor Table (IDT).
-/// Populates the first 32 entries (exceptions) with ISR stubs and loads the IDT.
+/// Points all 256 vectors at their generated ISR stubs and loads the IDT.
 pub fn init() void {
     // 0x8E = Present(1) | Ring0(00) | Gate(0) | InterruptGate(1110)
     const kernel_code_selector = 0x08; // Offset of Kernel Code in GDT
     const idt_attr = 0x8E;
 
-    // Zero out database
-    // @memset(&idt_entries, std.mem.zeroes(IdtEntry)); // Usually necessary, but undefined is fine if we set all used ones. Better to be safe?
-    // Let's just set the ones we use.
-
-    idt_entries[0] = IdtEntry.init(getAddr(isr_stub_0), kernel_code_selector, idt_attr);
-    idt_entries[1] = IdtEntry.init(getAddr(isr_stub_1), kernel_code_selector, idt_attr);
-    idt_entries[2] = IdtEntry.init(getAddr(isr_stub_2), kernel_code_selector, idt_attr);
-    idt_entries[3] = IdtEntry.init(getAddr(isr_stub_3), kernel_code_selector, idt_attr);
-    idt_entries[4] = IdtEntry.init(getAddr(isr_stub_4), kernel_code_selector, idt_attr);
-    idt_entries[5] = IdtEntry.init(getAddr(isr_stub_5), kernel_code_selector, idt_attr);
-    idt_entries[6] = IdtEntry.init(getAddr(isr_stub_6), kernel_code_selector, idt_attr);
-    idt_entries[7] = IdtEntry.init(getAddr(isr_stub_7), kernel_code_selector, idt_attr);
-    idt_entries[8] = IdtEntry.init(getAddr(isr_stub_8), kernel_code_selector, idt_attr);
-    idt_entries[9] = IdtEntry.init(getAddr(isr_stub_9), kernel_code_selector, idt_attr);
-    idt_entries[10] = IdtEntry.init(getAddr(isr_stub_10), kernel_code_selector, idt_attr);
-    idt_entries[11] = IdtEntry.init(getAddr(isr_stub_11), kernel_code_selector, idt_attr);
-    idt_entries[12] = IdtEntry.init(getAddr(isr_stub_12), kernel_code_selector, idt_attr);
-    idt_entries[13] = IdtEntry.init(getAddr(isr_stub_13), kernel_code_selector, idt_attr);
-    idt_entries[14] = IdtEntry.init(getAddr(isr_stub_14), kernel_code_selector, idt_attr);
-    idt_entries[15] = IdtEntry.init(getAddr(isr_stub_15), kernel_code_selector, idt_attr);
-    idt_entries[16] = IdtEntry.init(getAddr(isr_stub_16), kernel_code_selector, idt_attr);
-    idt_entries[17] = IdtEntry.init(getAddr(isr_stub_17), kernel_code_selector, idt_attr);
-    idt_entries[18] = IdtEntry.init(getAddr(isr_stub_18), kernel_code_selector, idt_attr);
-    idt_entries[19] = IdtEntry.init(getAddr(isr_stub_19), kernel_code_selector, idt_attr);
-    idt_entries[20] = IdtEntry.init(getAddr(isr_stub_20), kernel_code_selector, idt_attr);
-    idt_entries[21] = IdtEntry.init(getAddr(isr_stub_21), kernel_code_selector, idt_attr);
-    idt_entries[22] = IdtEntry.init(getAddr(isr_stub_22), kernel_code_selector, idt_attr);
-    idt_entries[23] = IdtEntry.init(getAddr(isr_stub_23), kernel_code_selector, idt_attr);
-    idt_entries[24] = IdtEntry.init(getAddr(isr_stub_24), kernel_code_selector, idt_attr);
-    idt_entries[25] = IdtEntry.init(getAddr(isr_stub_25), kernel_code_selector, idt_attr);
-    idt_entries[26] = IdtEntry.init(getAddr(isr_stub_26), kernel_code_selector, idt_attr);
-    idt_entries[27] = IdtEntry.init(getAddr(isr_stub_27), kernel_code_selector, idt_attr);
-    idt_entries[28] = IdtEntry.init(getAddr(isr_stub_28), kernel_code_selector, idt_attr);
-    idt_entries[29] = IdtEntry.init(getAddr(isr_stub_29), kernel_code_selector, idt_attr);
-    idt_entries[30] = IdtEntry.init(getAddr(isr_stub_30), kernel_code_selector, idt_attr);
-    idt_entries[31] = IdtEntry.init(getAddr(isr_stub_31), kernel_code_selector, idt_attr);
-
-    // IRQs (32-47)
-    idt_entries[32] = IdtEntry.init(getAddr(isr_stub_32), kernel_code_selector, idt_attr);
-    idt_entries[33] = IdtEntry.init(getAddr(isr_stub_33), kernel_code_selector, idt_attr);
-    idt_entries[34] = IdtEntry.init(getAddr(isr_stub_34), kernel_code_selector, idt_attr);
-    idt_entries[35] = IdtEntry.init(getAddr(isr_stub_35), kernel_code_selector, idt_attr);
-    idt_entries[36] = IdtEntry.init(getAddr(isr_stub_36), kernel_code_selector, idt_attr);
-    idt_entries[37] = IdtEntry.init(getAddr(isr_stub_37), kernel_code_selector, idt_attr);
-    idt_entries[38] = IdtEntry.init(getAddr(isr_stub_38), kernel_code_selector, idt_attr);
-    idt_entries[39] = IdtEntry.init(getAddr(isr_stub_39), kernel_code_selector, idt_attr);
-    idt_entries[40] = IdtEntry.init(getAddr(isr_stub_40), kernel_code_selector, idt_attr);
-    idt_entries[41] = IdtEntry.init(getAddr(isr_stub_41), kernel_code_selector, idt_attr);
-    idt_entries[42] = IdtEntry.init(getAddr(isr_stub_42), kernel_code_selector, idt_attr);
-    idt_entries[43] = IdtEntry.init(getAddr(isr_stub_43), kernel_code_selector, idt_attr);
-    idt_entries[44] = IdtEntry.init(getAddr(isr_stub_44), kernel_code_selector, idt_attr);
-    idt_entries[45] = IdtEntry.init(getAddr(isr_stub_45), kernel_code_selector, idt_attr);
-    idt_entries[46] = IdtEntry.init(getAddr(isr_stub_46), kernel_code_selector, idt_attr);
-    idt_entries[47] = IdtEntry.init(getAddr(isr_stub_47), kernel_code_selector, idt_attr);
+    for (&idt_entries, 0..) |*entry, vector| {
+        entry.* = IdtEntry.init(stubAddress(vector), kernel_code_selector, idt_attr);
+    }
+
+    // Fast handlers registered before init() keep their gates.
+    for (isr_fast_handlers, 0..) |handler, vector| {
+        if (handler != null) {
+            idt_entries[vector] = IdtEntry.init(fastStubAddress(vector), kernel_code_selector, idt_attr);
+        }
+    }
 
     load();
 }
@@ -201,21 +206,33 @@ fn load() void {
     );
 }
 
-/// Global Exception Handler called from ASM stubs.
-/// Dumps register state and halts the system upon exception.
+/// Global Interrupt Handler called from ASM stubs.
+/// Dispatches to the registered handler for the vector in O(1).
+/// Unhandled exceptions dump register state and halt the system.
 export fn handleInterrupt(frame: *InterruptFrame) callconv(.c) void {
-    // IRQ Handling
-    if (frame.int_num >= 32 and frame.int_num <= 47) {
-        // serial.debug("IRQ Caught: ");
-        // serial.printHex(.debug, frame.int_num);
-
-        // Handle specific IRQs
-        if (frame.int_num == 33) {
-            keyboard.handleIrq();
+    // The interrupted code may be a program: handlers run in the kernel domain
+    const caller = pks.enterKernel();
+    defer pks.leave(caller);
+
+    const vector: u8 = @truncate(frame.int_num);
+    isr_hit_counts[vector] +%= 1;
+
+    const entry = handlers[vector];
+    if (entry.handler) |handler| {
+        trace.point(.irq_entry, .{ vector, frame.rip });
+        handler(frame, entry.ctx);
+        if (vector >= FIRST_IRQ_VECTOR and vector != SPURIOUS_VECTOR) {
+            apic.sendEoi();
         }
+        trace.point(.irq_exit, .{vector});
+        return;
+    }
 
-        // Send EOI to Local APIC
-        apic.sendEoi();
+    // Unclaimed IRQ: acknowledge it so the LAPIC does not stall lower priorities.
+    if (vector >= FIRST_IRQ_VECTOR) {
+        if (vector != SPURIOUS_VECTOR) {
+            apic.sendEoi();
+        }
         return;
     }
 
@@ -255,3 +272,131 @@ export fn handleInterrupt(frame: *InterruptFrame) callconv(.c) void {
         asm volatile ("hlt");
     }
 }
+
+// --- Unit Tests ---
+
+test "IDT Handler Registration" {
+    const TestState = struct {
+        var calls: usize = 0;
+        var last_ctx: ?*anyopaque = null;
+        var marker: u32 = 0;
+
+        fn handler(frame: *InterruptFrame, ctx: ?*anyopaque) void {
+            _ = frame;
+            calls += 1;
+            last_ctx = ctx;
+        }
+    };
+
+    const vector: u8 = 0xF0;
+
+    try registerHandler(vector, TestState.handler, &TestState.marker);
+    defer unregisterHandler(vector);
+
+    // Double registration must be rejected.
+    if (registerHandler(vector, TestState.handler, null)) |_| {
+        return error.TestFailure;
+    } else |e| {
+        try std.testing.expect(e == RegisterError.VectorInUse);
+    }
+
+    // Fire the vector through the real stub (software interrupt).
+    const before = hitCount(vector);
+    asm volatile ("int $0xF0");
+
+    try std.testing.expect(TestState.calls == 1);
+    try std.testing.expect(TestState.last_ctx == @as(?*anyopaque, &TestState.marker));
+    try std.testing.expect(hitCount(vector) == before + 1);
+}
+
+test "IDT Stub Table Layout" {
+    // Stubs are generated at a fixed stride; every gate must point inside the table.
+    try std.testing.expect(stubAddress(1) - stubAddress(0) == ISR_STUB_SIZE);
+    try std.testing.expect(stubAddress(255) == @intFromPtr(&isr_stub_table) + 255 * ISR_STUB_SIZE);
+}
+
+test "IDT Fast Handler Registration" {
+    const TestState = struct {
+        var calls: usize = 0;
+        var last_vector: u64 = 0;
+
+        fn handler(vector: u64) callconv(.c) void {
+            calls += 1;
+            last_vector = vector;
+            apic.sendEoi();
+        }
+    };
+
+    const test_vector: u8 = 0xF1;
+
+    // Exceptions cannot use the fast path.
+    if (registerFastHandler(14, TestState.handler)) |_| {
+        return error.TestFailure;
+    } else |e| {
+        try std.testing.expect(e == RegisterError.InvalidVector);
+    }
+
+    try registerFastHandler(test_vector, TestState.handler);
+    defer unregisterFastHandler(test_vector);
+
+    const before = hitCount(test_vector);
+    asm volatile ("int $0xF1");
+
+    try std.testing.expect(TestState.calls == 1);
+    try std.testing.expect(TestState.last_vector == test_vector);
+    try std.testing.expect(hitCount(test_vector) == before + 1);
+}
+
+test "Benchmark: IPI Round Trip (Full Frame vs Fast Path)" {
+    const bench = @import("../../kernel/bench.zig");
+    const cpu = @import("cpu.zig");
+
+    const TestState = struct {
+        var done: bool = false;
+
+        fn fullHandler(frame: *InterruptFrame, ctx: ?*anyopaque) void {
+            _ = frame;
+            _ = ctx;
+            @as(*volatile bool, &done).* = true;
+        }
+
+        fn fastHandler(vector: u64) callconv(.c) void {
+            _ = vector;
+            @as(*volatile bool, &done).* = true;
+            apic.sendEoi();
+        }
+
+        /// Sends `iterations` self-IPIs on `vector` and returns the total cycles.
+        fn run(vector: u8, iterations: usize) u64 {
+            var total: u64 = 0;
+            var i: usize = 0;
+            while (i < iterations) : (i += 1) {
+                @as(*volatile bool, &done).* = false;
+                const start = bench.now();
+                apic.sendSelfIpi(vector);
+                while (!@as(*volatile bool, &done).*) {
+                    cpu.pause();
+                }
+                total += bench.now() - start;
+            }
+            return total;
+        }
+    };
+
+    const full_vector: u8 = 0xF2;
+    const fast_vector: u8 = 0xF3;
+    const iteration_count = 1000;
+
+    try registerHandler(full_vector, TestState.fullHandler, null);
+    defer unregisterHandler(full_vector);
+    try registerFastHandler(fast_vector, TestState.fastHandler);
+    defer unregisterFastHandler(fast_vector);
+
+    // Self-IPIs stay pending while IF=0, and the test runner does not enable interrupts.
+    const was_enabled = cpu.interruptsEnabled();
+    cpu.enableInterrupts();
+    defer if (!was_enabled) cpu.disableInterrupts();
+
+    bench.report("IPI round trip (full frame)", TestState.run(full_vector, iteration_count), iteration_count);
+    bench.report("IPI round trip (fast path)", TestState.run(fast_vector, iteration_count), iteration_count);
+}
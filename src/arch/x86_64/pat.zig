@@ -0,0 +1,101 @@
+/// Page Attribute Table (PAT)
+///
+/// A page's memory type is chosen by three PTE bits (PWT, PCD and PAT) that
+/// together index one of the eight entries of the IA32_PAT MSR. The reset
+/// value only offers WB, WT, UC- and UC, so write-combining (needed to make
+/// framebuffer writes fast) requires reprogramming the MSR.
+///
+/// We use the same layout Limine documents for its handoff. Entries 0-3 keep
+/// their reset meaning, so existing PWT/PCD mappings are unaffected:
+///   0 WB, 1 WT, 2 UC-, 3 UC, 4 WP, 5 WC, 6 UC-, 7 UC
+///
+/// Every CPU must run init() with the same layout before using PAT-typed
+/// mappings; mismatched tables across CPUs are undefined behaviour.
+const std = @import("std");
+const cpu = @import("cpu.zig");
+const serial = @import("../../kernel/serial.zig");
+
+const MSR_IA32_PAT: u32 = 0x277;
+const CPUID_PAT_BIT: u32 = 1 << 16;
+
+/// Memory types, using their architectural encodings.
+pub const CacheType = enum(u8) {
+    uncached = 0,
+    write_combining = 1,
+    write_through = 4,
+    write_protect = 5,
+    write_back = 6,
+    /// UC, but can be overridden to WC by an MTRR.
+    uncached_minus = 7,
+};
+
+/// The table written to IA32_PAT, entry 0 first.
+pub const layout = [8]CacheType{
+    .write_back,
+    .write_through,
+    .uncached_minus,
+    .uncached,
+    .write_protect,
+    .write_combining,
+    .uncached_minus,
+    .uncached,
+};
+
+var supported: bool = false;
+
+/// Returns the PAT entry that selects `cache` (the lowest, if several do).
+pub fn index(cache: CacheType) u3 {
+    for (layout, 0..) |entry, i| {
+        if (entry == cache) return @intCast(i);
+    }
+    unreachable;
+}
+
+/// The IA32_PAT value for `layout`.
+pub fn msrValue() u64 {
+    var value: u64 = 0;
+    for (layout, 0..) |entry, i| {
+        value |= @as(u64, @intFromEnum(entry)) << @intCast(i * 8);
+    }
+    return value;
+}
+
+/// True once the PAT has been programmed. Without it every type other than
+/// WB, WT, UC- and UC silently falls back to its reset entry.
+pub fn isSupported() bool {
+    return supported;
+}
+
+/// Programs IA32_PAT with `layout` on the calling CPU.
+/// Caches are written back around the change, as the SDM requires when
+/// memory types may change. The caller reloads CR3 (vmm.init() does) so no
+/// stale TLB entries keep the old types.
+pub fn init() void {
+    if ((cpu.cpuid(1, 0).edx & CPUID_PAT_BIT) == 0) {
+        serial.warn("PAT: Not supported, write-combining unavailable");
+        return;
+    }
+
+    const was_enabled = cpu.interruptsEnabled();
+    cpu.disableInterrupts();
+    asm volatile ("wbinvd" ::: .{ .memory = true });
+    cpu.writeMsr(MSR_IA32_PAT, msrValue());
+    asm volatile ("wbinvd" ::: .{ .memory = true });
+    if (was_enabled) cpu.enableInterrupts();
+
+    supported = true;
+    serial.info("PAT: Programmed (entry 5 = WC)");
+}
+
+// --- Unit Tests ---
+
+test "PAT Layout Keeps Reset Entries And Adds WC" {
+    // Reset value 0x0007040600070406: WB, WT, UC-, UC, repeated.
+    try std.testing.expect((msrValue() & 0xFFFF_FFFF) == 0x0007_0406);
+    try std.testing.expect(index(.write_back) == 0);
+    try std.testing.expect(index(.uncached) == 3);
+    try std.testing.expect(index(.write_combining) == 5);
+    if (supported) {
+        try std.testing.expect(cpu.readMsr(MSR_IA32_PAT) == msrValue());
+    }
+}
@@ -1,14 +1,89 @@
+/// Protection Keys for Supervisor (PKS)
+///
+/// Every page carries a 4-bit protection key in its PTE; the PKRS MSR holds
+/// two bits per key (AD: access disable, WD: write disable) for the code
+/// running on this CPU. Kernel and programs share one address space and run
+/// in ring 0, so PKRS is what separates them:
+///   - the kernel runs with KERNEL_PKRS (every key accessible);
+///   - a program runs with domainPkrs(key), which denies the kernel's
+///     domains (heap, page tables, driver state) and every program key but
+///     its own (domain.zig hands out the keys);
+///   - kernel-table calls and interrupts switch to KERNEL_PKRS on entry and
+///     back to the interrupted domain on exit (see gate.zig and idt.zig).
+///
+/// Without PKS hardware (test runs only) the keys are still written to the
+/// PTEs but nothing is enforced and PKRS is never touched.
 const std = @import("std");
 const serial = @import("../../kernel/serial.zig");
 
 // Constants
 const CR4_PKS_BIT: u64 = 1 << 24;
-const MSR_IA32_PKRS: u32 = 0x691;
+/// The PKRS MSR. Exported for code that switches domains outside Zig
+/// (service.zig stubs).
+pub const MSR_IA32_PKRS: u32 = 0x691;
 const CPUID_PKS_BIT: u32 = 1 << 31;
 
+/// Domain keys. Key 0 covers everything not assigned to a domain: the
+/// kernel image (which holds the kernel table and the stack programs run
+/// on) and memory the kernel loads or allocates outside a program domain.
+pub const KEY_DEFAULT: u4 = 0;
+/// User pixel surfaces created outside a program domain (compositor.zig);
+/// writable by programs.
+pub const KEY_SURFACE: u4 = 1;
+/// Kernel heap pages (heap.zig).
+pub const KEY_HEAP: u4 = 2;
+/// Page-table pages (vmm.zig).
+pub const KEY_PAGE_TABLES: u4 = 3;
+/// Driver state: back buffer, console cells, the writable alias of the
+/// kernel data page.
+pub const KEY_DRIVERS: u4 = 4;
+/// Pages of program domains that currently hold no key (domain.zig).
+/// Denied to every program.
+pub const KEY_PARKED: u4 = 5;
+/// Keys handed out to program domains, FIRST_PROGRAM_KEY..LAST_PROGRAM_KEY.
+pub const FIRST_PROGRAM_KEY: u4 = 6;
+pub const LAST_PROGRAM_KEY: u4 = 15;
+
+/// PKRS bits that deny all access to `key`.
+pub fn denyAccess(key: u4) u32 {
+    return @as(u32, 1) << (@as(u5, key) * 2);
+}
+
+/// PKRS bits that make `key` read-only.
+pub fn denyWrite(key: u4) u32 {
+    return @as(u32, 2) << (@as(u5, key) * 2);
+}
+
+/// True if code running with `pkrs` may read (or, with `write`, write)
+/// pages tagged `key`.
+pub fn allows(pkrs: u32, key: u4, write: bool) bool {
+    const bits = (pkrs >> (@as(u5, key) * 2)) & 3;
+    return if (write) bits == 0 else (bits & 1) == 0;
+}
+
+/// Rights of kernel code: everything.
+pub const KERNEL_PKRS: u32 = 0;
+/// Rights of a program without a domain key: no access to the kernel's
+/// domains, parked pages or any program domain.
+pub const PROGRAM_PKRS: u32 = blk: {
+    var pkrs = denyAccess(KEY_HEAP) | denyAccess(KEY_PAGE_TABLES) | denyAccess(KEY_DRIVERS) | denyAccess(KEY_PARKED);
+    for (FIRST_PROGRAM_KEY..@as(usize, LAST_PROGRAM_KEY) + 1) |key| pkrs |= denyAccess(@intCast(key));
+    break :blk pkrs;
+};
+
+/// Rights of a program running in the domain holding `key`: PROGRAM_PKRS
+/// plus full access to its own key.
+pub fn domainPkrs(key: u4) u32 {
+    return PROGRAM_PKRS & ~(@as(u32, 3) << (@as(u5, key) * 2));
+}
+
+/// Non-zero once PKRS may be written. Exported for irq_fast_common, which
+/// switches domains around fast IRQ handlers.
+export var pks_enabled: u8 = 0;
+
 /// Protection Key Rights for Supervisor (PKRS) MSR wrapper
 pub const Pkrs = struct {
-    pub fn read() u32 {
+    pub inline fn read() u32 {
         var low: u32 = 0;
         var high: u32 = 0;
         asm volatile ("rdmsr"
@@ -19,7 +94,7 @@ pub const Pkrs = struct {
         return low;
     }
 
-    pub fn write(val: u32) void {
+    pub inline fn write(val: u32) void {
         const high: u32 = 0; // PKRS is 32-bit, high bits reserved 0
         asm volatile ("wrmsr"
             :
@@ -87,9 +162,36 @@ pub fn init() void {
 
     serial.info("PKS: Enabled in CR4.");
 
-    // Initialize PKRS to 0 (allow all access) for now
-    Pkrs.write(0);
-    serial.info("PKS: PKRS initialized to 0.");
+    // The kernel itself runs with every key accessible
+    Pkrs.write(KERNEL_PKRS);
+    pks_enabled = 1;
+    serial.info("PKS: PKRS initialized to the kernel domain.");
+}
+
+/// True once PKS is enabled and PKRS is live.
+pub fn isEnabled() bool {
+    return pks_enabled != 0;
+}
+
+/// Switches the calling CPU to the kernel domain and returns the rights of
+/// the code that was running (pass them to leave()). Costs an rdmsr, plus a
+/// wrmsr when coming from a program.
+pub inline fn enterKernel() u32 {
+    if (pks_enabled == 0) return KERNEL_PKRS;
+    const caller = Pkrs.read();
+    if (caller != KERNEL_PKRS) Pkrs.write(KERNEL_PKRS);
+    return caller;
+}
+
+/// Returns to the domain enterKernel() came from.
+pub inline fn leave(caller: u32) void {
+    if (caller != KERNEL_PKRS) Pkrs.write(caller);
+}
+
+/// Sets the calling CPU's rights, e.g. PROGRAM_PKRS before jumping to a
+/// program and KERNEL_PKRS once it returns.
+pub fn switchTo(pkrs: u32) void {
+    if (pks_enabled != 0) Pkrs.write(pkrs);
 }
 
 const build_options = @import("build_options");
@@ -108,3 +210,28 @@ test "PKS Support Check" {
         return error.PksStateMismatch;
     }
 }
+
+test "PKS Domain Rights" {
+    try std.testing.expect(allows(KERNEL_PKRS, KEY_HEAP, true));
+    try std.testing.expect(!allows(PROGRAM_PKRS, KEY_HEAP, false));
+    try std.testing.expect(!allows(PROGRAM_PKRS, KEY_PAGE_TABLES, false));
+    try std.testing.expect(!allows(PROGRAM_PKRS, KEY_DRIVERS, false));
+    try std.testing.expect(allows(PROGRAM_PKRS, KEY_DEFAULT, true));
+    try std.testing.expect(allows(PROGRAM_PKRS, KEY_SURFACE, true));
+    try std.testing.expect(allows(denyWrite(5), 5, false) and !allows(denyWrite(5), 5, true));
+    try std.testing.expect(denyAccess(15) == 0x4000_0000);
+
+    const mine = domainPkrs(FIRST_PROGRAM_KEY);
+    try std.testing.expect(allows(mine, FIRST_PROGRAM_KEY, true));
+    try std.testing.expect(!allows(mine, FIRST_PROGRAM_KEY + 1, false));
+    try std.testing.expect(!allows(mine, KEY_PARKED, false));
+    try std.testing.expect(!allows(mine, KEY_HEAP, false));
+    try std.testing.expect(allows(mine, KEY_DEFAULT, true));
+
+    if (isEnabled()) {
+        try std.testing.expect(Pkrs.read() == KERNEL_PKRS);
+        const caller = enterKernel();
+        try std.testing.expect(caller == KERNEL_PKRS);
+        leave(caller);
+    }
+}
@@ -0,0 +1,124 @@
+/// SMP Bookkeeping
+///
+/// Tracks the CPUs reported by Limine's MP response and which of them are online.
+/// CPUs are referred to by a dense index (0..count()) rather than by APIC ID, so
+/// per-CPU arrays and CPU masks stay small even when APIC IDs are sparse.
+///
+/// Limine parks every AP until its goto_address is written. Until AP bring-up
+/// exists only the BSP is marked online; other subsystems (TLB shootdown, IRQ
+/// affinity) consult the online mask so they keep working as APs come up.
+const std = @import("std");
+const limine = @import("../../limine_import.zig").C;
+const apic = @import("apic.zig");
+const acpi = @import("acpi.zig");
+const serial = @import("../../kernel/serial.zig");
+const log = serial.scoped(.smp);
+
+// MP Request (Defined in limine.c)
+extern var mp_request: limine.struct_limine_mp_request;
+
+/// Upper bound on tracked CPUs. CPU masks are a single u64.
+pub const MAX_CPUS: usize = 64;
+
+var cpu_count: usize = 1;
+var bsp_index: usize = 0;
+var lapic_ids: [MAX_CPUS]u32 = [_]u32{0} ** MAX_CPUS;
+var online_mask = std.atomic.Value(u64).init(1);
+
+/// Reads the CPU list from Limine and marks the BSP online.
+/// Must run after apic.init() (the fallback path reads the LAPIC ID).
+pub fn init() void {
+    const resp = @as(*volatile ?*limine.struct_limine_mp_response, &mp_request.response).*;
+    if (resp) |r| {
+        const total: usize = @intCast(r.cpu_count);
+        if (total > MAX_CPUS) {
+            log.warn("SMP: More CPUs than MAX_CPUS. Extra CPUs are ignored.");
+        }
+        cpu_count = @min(total, MAX_CPUS);
+
+        var i: usize = 0;
+        while (i < cpu_count) : (i += 1) {
+            const info = r.cpus[i];
+            lapic_ids[i] = info.*.lapic_id;
+            if (info.*.lapic_id == r.bsp_lapic_id) {
+                bsp_index = i;
+            }
+        }
+    } else if (acpi.apicTopology().lapic_count > 0) {
+        // Fall back to the MADT's list of enabled LAPICs.
+        log.warn("SMP: MP response missing. Using the MADT CPU list.");
+        const topo = acpi.apicTopology();
+        cpu_count = @min(topo.lapic_count, MAX_CPUS);
+        const self_id = apic.currentApicId();
+        bsp_index = 0;
+        var i: usize = 0;
+        while (i < cpu_count) : (i += 1) {
+            lapic_ids[i] = topo.lapic_ids[i];
+            if (lapic_ids[i] == self_id) bsp_index = i;
+        }
+    } else {
+        log.warn("SMP: MP response missing. Assuming a single CPU.");
+        cpu_count = 1;
+        bsp_index = 0;
+        lapic_ids[0] = apic.currentApicId();
+    }
+
+    online_mask.store(cpuBit(bsp_index), .release);
+
+    log.info("SMP: CPUs reported by bootloader:");
+    log.printHex(.info, cpu_count);
+}
+
+/// Returns the mask bit for CPU `index`.
+pub fn cpuBit(index: usize) u64 {
+    return @as(u64, 1) << @intCast(index);
+}
+
+/// Number of CPUs present (online or parked).
+pub fn count() usize {
+    return cpu_count;
+}
+
+/// Number of CPUs currently online.
+pub fn onlineCount() usize {
+    return @popCount(online_mask.load(.acquire));
+}
+
+/// Mask of online CPUs (bit N = CPU index N).
+pub fn onlineMask() u64 {
+    return online_mask.load(.acquire);
+}
+
+/// Marks CPU `index` online. Called by the AP itself once it is ready for IPIs.
+pub fn markOnline(index: usize) void {
+    _ = online_mask.fetchOr(cpuBit(index), .acq_rel);
+}
+
+/// Returns the APIC ID of CPU `index`.
+pub fn lapicId(index: usize) u32 {
+    return lapic_ids[index];
+}
+
+/// Returns the index of the BSP.
+pub fn bspIndex() usize {
+    return bsp_index;
+}
+
+/// Returns the index of the CPU executing this code.
+pub fn currentIndex() usize {
+    const id = apic.currentApicId();
+    var i: usize = 0;
+    while (i < cpu_count) : (i += 1) {
+        if (lapic_ids[i] == id) return i;
+    }
+    return bsp_index;
+}
+
+// --- Unit Tests ---
+
+test "SMP BSP Online" {
+    try std.testing.expect(count() >= 1);
+    try std.testing.expect(onlineCount() >= 1);
+    try std.testing.expect((onlineMask() & cpuBit(bspIndex())) != 0);
+    try std.testing.expect(currentIndex() == bspIndex());
+}
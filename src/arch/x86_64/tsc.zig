@@ -0,0 +1,136 @@
+/// Time Stamp Counter Calibration
+///
+/// Converts TSC cycles to nanoseconds. The frequency comes from CPUID leaf
+/// 0x15 (crystal clock times the TSC/crystal ratio) when the CPU enumerates
+/// it, and otherwise from timing a 10 ms one-shot of PIT channel 2.
+///
+/// Conversion uses a 32.32 fixed-point multiplier so it needs no division:
+///   ns = (cycles * mult) >> 32
+/// The same multiplier is published in the kernel data page (vdso.zig) so
+/// programs can read the clock without calling the kernel.
+const std = @import("std");
+const cpu = @import("cpu.zig");
+const io = @import("io.zig");
+const serial = @import("../../kernel/serial.zig");
+
+/// PIT input clock in Hz.
+const PIT_HZ: u64 = 1_193_182;
+/// Calibration window: 10 ms.
+const PIT_TICKS: u16 = @intCast(PIT_HZ / 100);
+const PIT_CHANNEL2_DATA: u16 = 0x42;
+const PIT_COMMAND: u16 = 0x43;
+/// Port B: bit 0 gates channel 2, bit 1 drives the speaker, bit 5 is OUT2.
+const PORT_B: u16 = 0x61;
+/// Give up waiting for OUT2 after this many polls (no PIT present).
+const PIT_POLL_LIMIT: usize = 50_000_000;
+
+const CPUID_INVARIANT_TSC_BIT: u32 = 1 << 8;
+
+var hz: u64 = 0;
+var mult: u64 = 0;
+var base: u64 = 0;
+var invariant: bool = false;
+
+/// Calibrates the TSC. Call once on the BSP; the result is shared by all CPUs.
+pub fn init() void {
+    if (cpu.cpuid(0x8000_0000, 0).eax >= 0x8000_0007) {
+        invariant = (cpu.cpuid(0x8000_0007, 0).edx & CPUID_INVARIANT_TSC_BIT) != 0;
+    }
+
+    const measured = fromCpuid() orelse fromPit() orelse {
+        serial.warn("TSC: Calibration failed, clock unavailable");
+        return;
+    };
+    hz = measured;
+    mult = multiplierFor(measured);
+    base = cpu.rdtsc();
+
+    serial.info("TSC: Calibrated (kHz)");
+    serial.printHex(.info, hz / 1000);
+    if (!invariant) serial.warn("TSC: Not invariant, may drift with frequency changes");
+}
+
+/// Frequency from CPUID leaf 0x15, if the crystal clock is enumerated.
+fn fromCpuid() ?u64 {
+    if (cpu.cpuid(0, 0).eax < 0x15) return null;
+    const leaf = cpu.cpuid(0x15, 0);
+    if (leaf.eax == 0 or leaf.ebx == 0 or leaf.ecx == 0) return null;
+    return @as(u64, leaf.ecx) * leaf.ebx / leaf.eax;
+}
+
+/// Frequency measured against a PIT channel 2 one-shot.
+fn fromPit() ?u64 {
+    const was_enabled = cpu.interruptsEnabled();
+    cpu.disableInterrupts();
+    defer if (was_enabled) cpu.enableInterrupts();
+
+    // Gate on, speaker off; mode 0 (interrupt on terminal count), lo/hi byte.
+    io.outb(PORT_B, (io.inb(PORT_B) & ~@as(u8, 0x02)) | 0x01);
+    io.outb(PIT_COMMAND, 0xB0);
+    io.outb(PIT_CHANNEL2_DATA, @truncate(PIT_TICKS));
+    io.outb(PIT_CHANNEL2_DATA, @truncate(PIT_TICKS >> 8));
+
+    const start = cpu.rdtsc();
+    var polls: usize = 0;
+    while ((io.inb(PORT_B) & 0x20) == 0) : (polls += 1) {
+        if (polls == PIT_POLL_LIMIT) return null;
+    }
+    const cycles = cpu.rdtsc() - start;
+    if (cycles == 0) return null;
+    return cycles * PIT_HZ / PIT_TICKS;
+}
+
+/// 32.32 fixed-point nanoseconds per cycle.
+fn multiplierFor(frequency: u64) u64 {
+    return @intCast((@as(u128, std.time.ns_per_s) << 32) / frequency);
+}
+
+/// True once the TSC has been calibrated.
+pub fn isCalibrated() bool {
+    return hz != 0;
+}
+
+/// True if the TSC ticks at a constant rate in every P-, C- and T-state.
+pub fn isInvariant() bool {
+    return invariant;
+}
+
+/// TSC frequency in Hz (0 if uncalibrated).
+pub fn frequency() u64 {
+    return hz;
+}
+
+/// The 32.32 multiplier from cycles to nanoseconds (0 if uncalibrated).
+pub fn multiplier() u64 {
+    return mult;
+}
+
+/// TSC value at calibration; the kernel clock counts from here.
+pub fn baseCycles() u64 {
+    return base;
+}
+
+/// Converts a cycle count to nanoseconds (0 if uncalibrated).
+pub fn toNs(cycles: u64) u64 {
+    return @intCast((@as(u128, cycles) * mult) >> 32);
+}
+
+/// Nanoseconds since calibration.
+pub fn nowNs() u64 {
+    return toNs(cpu.rdtsc() -% base);
+}
+
+// --- Unit Tests ---
+
+test "TSC Multiplier Converts A Second Of Cycles" {
+    const m = multiplierFor(3_000_000_000);
+    const one_second: u64 = @intCast((@as(u128, 3_000_000_000) * m) >> 32);
+    try std.testing.expect(one_second <= std.time.ns_per_s and one_second > std.time.ns_per_s - 2);
+
+    if (!isCalibrated()) return;
+    // Any real or emulated CPU: 100 MHz .. 10 GHz.
+    try std.testing.expect(hz > 100_000_000 and hz < 10_000_000_000);
+    const a = nowNs();
+    const b = nowNs();
+    try std.testing.expect(b >= a);
+}
@@ -1,137 +1,195 @@
 const std = @import("std");
 const limine = @import("../limine_import.zig").C;
-const framebuffer = @import("../drivers/graphics/framebuffer.zig");
-const font = @import("../drivers/graphics/font.zig");
+const display = @import("../drivers/graphics/display.zig");
+const console = @import("../drivers/graphics/console.zig");
 const keyboard = @import("../drivers/keyboard.zig");
 const serial = @import("../kernel/serial.zig");
 const elf = @import("../loaders/elf.zig");
 const table = @import("../kernel/table.zig");
+const io_ring = @import("../kernel/io_ring.zig");
+const trace = @import("../kernel/trace.zig");
+const pks = @import("../arch/x86_64/pks.zig");
+const domain = @import("../kernel/domain.zig");
+const service = @import("../kernel/service.zig");
+const compositor = @import("../drivers/graphics/compositor.zig");
 
-/// Runs the interactive shell.
+/// Runs the interactive shell on the text console.
 /// This function enters an infinite loop.
-pub fn runShell(fb: *limine.struct_limine_framebuffer, modules: ?*limine.struct_limine_module_response) noreturn {
+pub fn runShell(modules: ?*limine.struct_limine_module_response) noreturn {
     // Clear screen first
-    framebuffer.fill(fb, 0xFF000000); // Black background
-
-    var cursor_x: u64 = 10;
-    var cursor_y: u64 = 10;
+    console.clear();
 
     // Command Buffer
     var buffer: [256]u8 = undefined;
     var buffer_idx: usize = 0;
 
     const prompt = "> ";
-    printStr(fb, &cursor_x, &cursor_y, prompt);
+    console.write(prompt);
 
+    var keys: [32]u8 = undefined;
     while (true) {
-        asm volatile ("hlt");
+        // Show what the last batch of input (or a program) drew
+        console.flush();
+        _ = display.present();
+
+        // Sleep until input arrives, doing idle work on every wakeup; take
+        // every pending key at once
+        const n = keyboard.waitKeysIdle(&keys, idleWork);
 
         // Process Input
-        while (keyboard.pop()) |char| {
-            handleCharacter(fb, char, &buffer, &buffer_idx, &cursor_x, &cursor_y, prompt, modules);
+        for (keys[0..n]) |char| {
+            handleCharacter(char, &buffer, &buffer_idx, prompt, modules);
         }
     }
 }
 
+/// Work the shell's CPU does while it waits for input.
+fn idleWork() void {
+    // Drive async I/O rings that programs published without calling io_enter
+    io_ring.poll();
+    // Drain buffered log lines in case a THRE interrupt was missed
+    serial.drain();
+}
+
 /// Handles a single character input from the keyboard
 fn handleCharacter(
-    fb: *limine.struct_limine_framebuffer,
     char: u8,
     buffer: *[256]u8,
     buffer_idx: *usize,
-    cursor_x: *u64,
-    cursor_y: *u64,
     prompt: []const u8,
     modules: ?*limine.struct_limine_module_response,
 ) void {
     if (char == '\n' or char == 10) {
-        handleNewline(fb, buffer, buffer_idx, cursor_x, cursor_y, prompt, modules);
+        handleNewline(buffer, buffer_idx, prompt, modules);
     } else if (char == 8) {
-        handleBackspace(fb, buffer_idx, cursor_x, cursor_y);
+        handleBackspace(buffer_idx);
     } else {
-        handlePrintableChar(fb, buffer, buffer_idx, cursor_x, cursor_y, char);
-    }
-
-    // Wrap logic (basic)
-    if (cursor_x.* >= fb.width - 10) {
-        cursor_x.* = 10;
-        cursor_y.* += 10;
+        handlePrintableChar(buffer, buffer_idx, char);
     }
 }
 
 /// Handles newline/enter key: processes the command and resets the prompt
 fn handleNewline(
-    fb: *limine.struct_limine_framebuffer,
     buffer: *[256]u8,
     buffer_idx: *usize,
-    cursor_x: *u64,
-    cursor_y: *u64,
     prompt: []const u8,
     modules: ?*limine.struct_limine_module_response,
 ) void {
+    // Move to next line for output
+    console.write("\n");
+
     if (buffer_idx.* > 0) {
         const cmd = buffer[0..buffer_idx.*];
-
-        // Move to next line for output
-        cursor_x.* = 10;
-        cursor_y.* += 10;
-
-        processCommand(fb, cmd, cursor_x, cursor_y, modules);
+        processCommand(cmd, modules);
 
         // Reset buffer
         buffer_idx.* = 0;
-    } else {
-        cursor_x.* = 10;
-        cursor_y.* += 10;
     }
 
     // New Prompt
-    printStr(fb, cursor_x, cursor_y, prompt);
+    console.write(prompt);
 }
 
 /// Processes a command and executes the appropriate action
 fn processCommand(
-    fb: *limine.struct_limine_framebuffer,
     cmd: []const u8,
-    cursor_x: *u64,
-    cursor_y: *u64,
     modules: ?*limine.struct_limine_module_response,
 ) void {
     if (std.mem.eql(u8, cmd, "load test.elf")) {
-        loadTestElf(fb, cursor_x, cursor_y, modules);
+        loadTestElf(modules);
+    } else if (std.mem.eql(u8, cmd, "trace")) {
+        trace.dump();
+        console.write("Trace dumped to serial.\n");
+    } else if (std.mem.eql(u8, cmd, "clear")) {
+        console.clear();
+    } else if (std.mem.eql(u8, cmd, "unload")) {
+        unloadResident();
+    } else if (std.mem.startsWith(u8, cmd, "loglevel")) {
+        setLogLevel(cmd["loglevel".len..]);
     } else {
-        printStr(fb, cursor_x, cursor_y, "Unknown command: ");
-        printStr(fb, cursor_x, cursor_y, cmd);
-        cursor_x.* = 10;
-        cursor_y.* += 10;
+        console.write("Unknown command: ");
+        console.write(cmd);
+        console.write("\n");
+    }
+}
+
+/// Handles `loglevel [subsystem] <level>` by translating it to the kernel
+/// command line syntax (`loglevel=<level>` / `log.<subsystem>=<level>`).
+/// Without arguments, lists the current level of every subsystem.
+fn setLogLevel(args: []const u8) void {
+    var words = std.mem.tokenizeScalar(u8, args, ' ');
+    const first = words.next() orelse {
+        inline for (@typeInfo(serial.Subsystem).@"enum".fields) |field| {
+            console.write(field.name ++ ": ");
+            console.write(serial.levelName(serial.getLevel(@enumFromInt(field.value))));
+            console.write("\n");
+        }
+        return;
+    };
+
+    var buf: [64]u8 = undefined;
+    const setting = if (words.next()) |level|
+        std.fmt.bufPrint(&buf, "log.{s}={s}", .{ first, level }) catch ""
+    else
+        std.fmt.bufPrint(&buf, "loglevel={s}", .{first}) catch "";
+
+    const applied = serial.configure(setting) catch 0;
+    console.write(if (applied > 0) "Log level updated.\n" else "Usage: loglevel [subsystem] debug|info|warn|error\n");
+}
+
+/// Domains of programs kept loaded to serve what they published. The
+/// service table caps publishers at MAX_PUBLISHERS, so this never fills.
+var resident = [_]?*domain.Domain{null} ** service.MAX_PUBLISHERS;
+
+fn keepResident(dom: *domain.Domain) void {
+    for (&resident) |*slot| {
+        if (slot.* == null) {
+            slot.* = dom;
+            return;
+        }
+    }
+    serial.warn("Shell: no slot to track a resident program");
+}
+
+/// Handles `unload`: withdraws every service resident programs published
+/// and unloads them like any finished program.
+fn unloadResident() void {
+    var programs: usize = 0;
+    var services: usize = 0;
+    for (&resident) |*slot| {
+        const dom = slot.* orelse continue;
+        services += service.withdrawAll(dom);
+        unloadProgram(dom);
+        slot.* = null;
+        programs += 1;
     }
+
+    var buf: [64]u8 = undefined;
+    console.write(std.fmt.bufPrint(&buf, "Unloaded {d} program(s), {d} service(s).\n", .{ programs, services }) catch "Unloaded.\n");
+}
+
+/// Frees everything a finished program owned (surfaces, alloc_pages
+/// blocks, its image) and then its domain.
+fn unloadProgram(dom: *domain.Domain) void {
+    _ = compositor.destroyOwned(dom);
+    _ = dom.releasePages();
+    elf.unload(dom);
+    domain.destroy(dom);
 }
 
 /// Loads and executes the test.elf module
-fn loadTestElf(
-    fb: *limine.struct_limine_framebuffer,
-    cursor_x: *u64,
-    cursor_y: *u64,
-    modules: ?*limine.struct_limine_module_response,
-) void {
-    printStr(fb, cursor_x, cursor_y, "Loading test.elf...");
-    cursor_x.* = 10;
-    cursor_y.* += 10;
+fn loadTestElf(modules: ?*limine.struct_limine_module_response) void {
+    console.write("Loading test.elf...\n");
 
-    const found = findAndLoadElf(fb, cursor_x, cursor_y, modules);
+    const found = findAndLoadElf(modules);
 
     if (!found) {
-        printStr(fb, cursor_x, cursor_y, "Module 'test.elf' not found.");
+        console.write("Module 'test.elf' not found.\n");
     }
 }
 
 /// Searches for test.elf in modules and loads it if found
-fn findAndLoadElf(
-    fb: *limine.struct_limine_framebuffer,
-    cursor_x: *u64,
-    cursor_y: *u64,
-    modules: ?*limine.struct_limine_module_response,
-) bool {
+fn findAndLoadElf(modules: ?*limine.struct_limine_module_response) bool {
     const mods = modules orelse return false;
 
     var i: usize = 0;
@@ -145,7 +203,7 @@ fn findAndLoadElf(
         const path = std.mem.span(file.path);
 
         if (std.mem.indexOf(u8, path, "test.elf") != null) {
-            executeElf(fb, cursor_x, cursor_y, &file, path);
+            executeElf(&file, path);
             return true;
         }
     }
@@ -154,79 +212,70 @@ fn findAndLoadElf(
 }
 
 /// Executes an ELF file
-fn executeElf(
-    fb: *limine.struct_limine_framebuffer,
-    cursor_x: *u64,
-    cursor_y: *u64,
-    file: *const limine.struct_limine_file,
-    path: []const u8,
-) void {
-    printStr(fb, cursor_x, cursor_y, "Found module: ");
-    printStr(fb, cursor_x, cursor_y, path);
-    cursor_x.* = 10;
-    cursor_y.* += 10;
+fn executeElf(file: *const limine.struct_limine_file, path: []const u8) void {
+    console.write("Found module: ");
+    console.write(path);
+    console.write("\n");
+
+    // Each program gets its own protection domain
+    const dom = domain.create() orelse {
+        console.write("No free protection domain!\n");
+        return;
+    };
+    // A program that published a service stays resident to serve it
+    // (until `unload`); anything else is unloaded so its addresses can be
+    // loaded again.
+    defer {
+        if (service.ownedBy(dom)) {
+            keepResident(dom);
+        } else {
+            unloadProgram(dom);
+        }
+    }
 
     // Load it
-    if (elf.loadElf(@ptrCast(file.address), file.size)) |entry| {
-        printStr(fb, cursor_x, cursor_y, "Jumping to entry point...");
+    if (elf.loadElf(@ptrCast(file.address), file.size, dom)) |entry| {
+        const pkrs = domain.enter(dom) catch {
+            console.write("No protection key available!\n");
+            return;
+        };
+        defer domain.leave();
+
+        console.write("Jumping to entry point...\n");
+        // Programs that draw directly need the console's text on screen first
+        console.flush();
 
         // Pass the kernel table to userspace via C calling convention (RDI)
         const entry_fn = @as(*const fn (ktable: *const table.KernelTable) callconv(.c) void, @ptrFromInt(entry));
+        // The program can reach only its own domain and key 0; the table's
+        // gates switch to the kernel's rights for each call.
+        pks.switchTo(pkrs);
         entry_fn(&table.table);
+        pks.switchTo(pks.KERNEL_PKRS);
 
         // If it returns (unlikely for our test), we are back?
         // It might mess up stack/regs but let's hope for best.
     } else |_| {
-        printStr(fb, cursor_x, cursor_y, "Load Failed!");
+        console.write("Load Failed!\n");
         serial.err("ELF Load Failed");
     }
 }
 
 /// Handles backspace key: removes last character from buffer and screen
-fn handleBackspace(
-    fb: *limine.struct_limine_framebuffer,
-    buffer_idx: *usize,
-    cursor_x: *u64,
-    cursor_y: *u64,
-) void {
+fn handleBackspace(buffer_idx: *usize) void {
     if (buffer_idx.* > 0) {
         buffer_idx.* -= 1;
-
-        // Visual backspace
-        if (cursor_x.* > 10) {
-            cursor_x.* -= 9;
-            // Overwrite with black (background color)
-            // Width 9 (8 char + 1 padding), Height 8
-            framebuffer.drawRect(fb, cursor_x.*, cursor_y.*, 9, 8, 0xFF000000);
-        }
+        // Visual backspace: the console blanks the previous cell
+        console.write("\x08");
     }
 }
 
 /// Handles a printable character: adds to buffer and displays on screen
-fn handlePrintableChar(
-    fb: *limine.struct_limine_framebuffer,
-    buffer: *[256]u8,
-    buffer_idx: *usize,
-    cursor_x: *u64,
-    cursor_y: *u64,
-    char: u8,
-) void {
+fn handlePrintableChar(buffer: *[256]u8, buffer_idx: *usize, char: u8) void {
     if (buffer_idx.* < buffer.len) {
         buffer[buffer_idx.*] = char;
         buffer_idx.* += 1;
 
-        font.drawChar(fb, cursor_x.*, cursor_y.*, char, 0xFFFFFFFF); // White text
-        cursor_x.* += 9;
-    }
-}
-
-fn printStr(fb: *limine.struct_limine_framebuffer, x: *u64, y: *u64, str: []const u8) void {
-    for (str) |c| {
-        font.drawChar(fb, x.*, y.*, c, 0xFFFFFFFF);
-        x.* += 9;
-        if (x.* >= fb.width - 10) {
-            x.* = 10;
-            y.* += 10;
-        }
+        console.write(&[_]u8{char});
     }
 }
@@ -0,0 +1,498 @@
+/// Compositor
+///
+/// A program can ask for its own pixel surface and render into it with plain
+/// memory stores: no table call per primitive. Surface pages come from the
+/// PMM and are mapped in their own window of the surface region (see
+/// layout.zig), tagged with SURFACE_PKEY, so write access is granted through
+/// the protection key rather than by sharing the HHDM.
+///
+/// Surfaces are layers above the back buffer (the console and everything
+/// drawn through framebuffer.zig), stacked by `z` and then by placement
+/// order. Nothing is composited into the back buffer itself. display.present()
+/// hands each damaged screen rectangle to composeRect(), which builds each
+/// row of the final image in a cache-resident scratch row and streams it to
+/// VRAM:
+///   - only layers that intersect the rectangle are visited;
+///   - the walk starts at the topmost opaque layer covering the rectangle,
+///     so hidden layers (and the back buffer) below it are never read;
+///   - opaque spans are vector copies, alpha spans go through the SIMD
+///     source-over kernel (surface.blendRow).
+///
+/// Damage is per surface, in surface coordinates (damage_surface). A surface
+/// that never reported damage is treated as fully damaged on every present.
+/// Damage hidden under an opaque layer is dropped when it is collected.
+///
+/// Programs get a SurfaceInfo in a page mapped read-only at
+/// layout.SURFACE_INFO_BASE; the kernel writes it through its HHDM alias,
+/// which is in the driver domain. Composition only uses the kernel's own
+/// copy in the slot, so nothing a program writes can redirect it.
+const std = @import("std");
+const surface = @import("surface.zig");
+const framebuffer = @import("framebuffer.zig");
+const display = @import("display.zig");
+const pmm = @import("../../kernel/memory/pmm.zig");
+const vmm = @import("../../kernel/memory/vmm.zig");
+const layout = @import("../../kernel/memory/layout.zig");
+const pks = @import("../../arch/x86_64/pks.zig");
+const domain = @import("../../kernel/domain.zig");
+
+const Surface = surface.Surface;
+const Rect = surface.Rect;
+
+/// Surfaces that may exist at once.
+pub const MAX_SURFACES: usize = 16;
+/// Protection key of surfaces created outside a program domain; every
+/// program's PKRS grants it. A program's own surfaces carry its domain's key.
+pub const SURFACE_PKEY: u4 = pks.KEY_SURFACE;
+
+/// place() flag: blend the surface with its per-pixel alpha instead of
+/// copying it as opaque.
+pub const FLAG_ALPHA: u32 = 1 << 0;
+
+/// Pixels composed per scratch pass; wider rectangles are done in strips.
+const SCRATCH_PIXELS: usize = 2048;
+
+/// What a program sees of its surface: a read-only copy of the kernel's
+/// state; only the pixels it points to are writable.
+pub const SurfaceInfo = extern struct {
+    /// First pixel (0xAARRGGBB). Row y starts at pixels + y * stride.
+    pixels: [*]u32,
+    width: u32,
+    height: u32,
+    /// Distance between rows, in pixels.
+    stride: u32,
+    id: u32,
+    /// Screen position of the top-left pixel.
+    x: u32,
+    y: u32,
+    /// Stacking order: higher is in front.
+    z: u32,
+    flags: u32,
+};
+
+const Slot = struct {
+    live: bool = false,
+    /// The kernel's copy; programs see it through published().
+    info: SurfaceInfo = undefined,
+    phys: u64 = 0,
+    pages: usize = 0,
+    /// Domain whose key the pages carry (null: SURFACE_PKEY).
+    owner: ?*domain.Domain = null,
+    /// Placement sequence number; breaks ties between equal z.
+    seq: u64 = 0,
+    /// Until the program reports damage, the whole surface is redrawn.
+    tracks_damage: bool = false,
+    damage: surface.DamageList = .{},
+
+    fn screenRect(self: *const Slot) Rect {
+        return .{ .x = self.info.x, .y = self.info.y, .w = self.info.width, .h = self.info.height };
+    }
+
+    fn isOpaque(self: *const Slot) bool {
+        return (self.info.flags & FLAG_ALPHA) == 0;
+    }
+};
+
+var slots: [MAX_SURFACES]Slot = [_]Slot{.{}} ** MAX_SURFACES;
+/// Live slot indices, bottom to top.
+var order: [MAX_SURFACES]u8 = undefined;
+var order_len: usize = 0;
+var next_seq: u64 = 0;
+
+var scratch: [SCRATCH_PIXELS]u32 align(64) = undefined;
+
+/// Writable alias of the read-only SurfaceInfo page, once it exists.
+var shared: ?*[MAX_SURFACES]SurfaceInfo = null;
+
+comptime {
+    std.debug.assert(@sizeOf([MAX_SURFACES]SurfaceInfo) <= pmm.PAGE_SIZE);
+}
+
+/// Allocates the SurfaceInfo page and maps it read-only at
+/// SURFACE_INFO_BASE on first use.
+fn sharedInfos() ?*[MAX_SURFACES]SurfaceInfo {
+    if (shared) |infos| return infos;
+    const phys = pmm.allocatePage() orelse return null;
+    const page: [*]u8 = @ptrFromInt(phys + vmm.getHhdmOffset());
+    @memset(page[0..pmm.PAGE_SIZE], 0);
+    vmm.mapPage(layout.SURFACE_INFO_BASE, phys, vmm.PTE_NX, 0) catch {
+        pmm.freePage(phys);
+        return null;
+    };
+    vmm.setKey(@intFromPtr(page), pmm.PAGE_SIZE, pks.KEY_DRIVERS);
+    shared = @ptrCast(@alignCast(page));
+    return shared;
+}
+
+/// The program-visible copy of slot `index`.
+fn published(index: usize) *const SurfaceInfo {
+    const infos: *const [MAX_SURFACES]SurfaceInfo = @ptrFromInt(layout.SURFACE_INFO_BASE);
+    return &infos[index];
+}
+
+/// Refreshes the program-visible copy of `slot`.
+fn publish(slot: *const Slot) void {
+    const infos = shared orelse return;
+    infos[slot.info.id] = slot.info;
+}
+
+fn slotBase(index: usize) u64 {
+    return layout.SURFACE_REGION_BASE + index * layout.SURFACE_SLOT_SIZE;
+}
+
+fn below(a: *const Slot, b: *const Slot) bool {
+    if (a.info.z != b.info.z) return a.info.z < b.info.z;
+    return a.seq < b.seq;
+}
+
+/// Rebuilds the bottom-to-top order (insertion sort; at most 16 entries).
+fn restack() void {
+    order_len = 0;
+    for (&slots, 0..) |*slot, i| {
+        if (!slot.live) continue;
+        var j = order_len;
+        while (j > 0 and below(slot, &slots[order[j - 1]])) : (j -= 1) order[j] = order[j - 1];
+        order[j] = @intCast(i);
+        order_len += 1;
+    }
+}
+
+/// True if a `width` x `height` surface at (x, y) ends inside the u32
+/// coordinate space, so screen rectangles built from it cannot overflow.
+/// A surface may still hang off the screen; composition clips it.
+fn fitsAt(x: u32, y: u32, width: u32, height: u32) bool {
+    const max = std.math.maxInt(u32);
+    return @as(u64, x) + width <= max and @as(u64, y) + height <= max;
+}
+
+/// Creates a zeroed, opaque `width` x `height` surface shown at (x, y) in
+/// front of every existing surface. Returns null if the size or position is
+/// invalid or no memory or slot is free.
+pub fn create(x: u32, y: u32, width: u32, height: u32) ?*const SurfaceInfo {
+    if (width == 0 or height == 0) return null;
+    if (!fitsAt(x, y, width, height)) return null;
+    const bytes = @as(u64, width) * height * 4;
+    if (bytes > layout.SURFACE_SLOT_SIZE) return null;
+    _ = sharedInfos() orelse return null;
+
+    const index = for (slots, 0..) |slot, i| {
+        if (!slot.live) break i;
+    } else return null;
+
+    const pages: usize = @intCast((bytes + pmm.PAGE_SIZE - 1) / pmm.PAGE_SIZE);
+    const phys = pmm.allocatePages(pages) orelse return null;
+    const base = slotBase(index);
+    const owner = domain.current();
+    const key = if (owner) |d| d.tag() else SURFACE_PKEY;
+    var i: usize = 0;
+    while (i < pages) : (i += 1) {
+        vmm.mapPage(base + i * pmm.PAGE_SIZE, phys + i * pmm.PAGE_SIZE, vmm.PTE_RW | vmm.PTE_NX, key) catch {
+            vmm.unmapPages(base, i);
+            pmm.freePages(phys, pages);
+            return null;
+        };
+    }
+    if (owner) |d| {
+        d.addRegion(base, pages, .surface) catch {
+            vmm.unmapPages(base, pages);
+            pmm.freePages(phys, pages);
+            return null;
+        };
+    }
+
+    const pixels: [*]u32 = @ptrFromInt(base);
+    @memset(pixels[0 .. @as(usize, width) * height], 0);
+
+    const top_z = if (order_len > 0) slots[order[order_len - 1]].info.z else 0;
+    slots[index] = .{
+        .live = true,
+        .info = .{
+            .pixels = pixels,
+            .width = width,
+            .height = height,
+            .stride = width,
+            .id = @intCast(index),
+            .x = x,
+            .y = y,
+            .z = top_z,
+            .flags = 0,
+        },
+        .phys = phys,
+        .pages = pages,
+        .owner = owner,
+        .seq = next_seq,
+    };
+    next_seq += 1;
+    restack();
+    publish(&slots[index]);
+    display.markDirty(slots[index].screenRect());
+    return published(index);
+}
+
+/// Finds the slot owning `info`, which must be a pointer returned by create().
+/// Every program can read the SurfaceInfo page, so a program only finds its
+/// own surfaces; the kernel finds any.
+fn slotOf(info: *const SurfaceInfo) ?*Slot {
+    const caller = domain.current();
+    for (&slots, 0..) |*slot, i| {
+        if (!slot.live or published(i) != info) continue;
+        if (caller != null and caller != slot.owner) return null;
+        return slot;
+    }
+    return null;
+}
+
+/// Unmaps and frees a surface; what was under it is recomposed on the next
+/// present. Returns false for an unknown pointer or another domain's surface.
+pub fn destroy(info: *const SurfaceInfo) bool {
+    const slot = slotOf(info) orelse return false;
+    release(slot);
+    return true;
+}
+
+/// Destroys every surface `d` created, before its domain goes away.
+/// Returns how many there were.
+pub fn destroyOwned(d: *const domain.Domain) usize {
+    var count: usize = 0;
+    for (&slots) |*slot| {
+        if (!slot.live or slot.owner != d) continue;
+        release(slot);
+        count += 1;
+    }
+    return count;
+}
+
+fn release(slot: *Slot) void {
+    display.markDirty(slot.screenRect());
+    if (slot.owner) |d| _ = d.removeRegion(@intFromPtr(slot.info.pixels));
+    vmm.unmapPages(@intFromPtr(slot.info.pixels), slot.pages);
+    pmm.freePages(slot.phys, slot.pages);
+    slot.live = false;
+    if (shared) |infos| @memset(std.mem.asBytes(&infos[slot.info.id]), 0);
+    restack();
+}
+
+/// Moves a surface to (x, y), sets its stacking order and flags. Among
+/// surfaces with equal z the most recently placed is in front. Returns
+/// false for an unknown or foreign pointer or a position the surface cannot
+/// end at.
+pub fn place(info: *const SurfaceInfo, x: u32, y: u32, z: u32, flags: u32) bool {
+    const slot = slotOf(info) orelse return false;
+    if (!fitsAt(x, y, slot.info.width, slot.info.height)) return false;
+    display.markDirty(slot.screenRect());
+    slot.info.x = x;
+    slot.info.y = y;
+    slot.info.z = z;
+    slot.info.flags = flags & FLAG_ALPHA;
+    slot.seq = next_seq;
+    next_seq += 1;
+    restack();
+    publish(slot);
+    display.markDirty(slot.screenRect());
+    return true;
+}
+
+/// Records that `rect` (surface coordinates) of a surface changed. From the
+/// first call on, only reported damage is recomposed.
+pub fn damage(info: *const SurfaceInfo, rect: Rect) bool {
+    const slot = slotOf(info) orelse return false;
+    slot.tracks_damage = true;
+    slot.damage.add(rect.intersect(.{ .w = slot.info.width, .h = slot.info.height }));
+    return true;
+}
+
+/// True if an opaque surface above order position `pos` covers `rect`.
+fn hiddenAbove(pos: usize, rect: Rect) bool {
+    for (order[pos + 1 .. order_len]) |idx| {
+        const s = &slots[idx];
+        if (!s.isOpaque()) continue;
+        const r = s.screenRect();
+        if (r.x <= rect.x and r.y <= rect.y and r.right() >= rect.right() and r.bottom() >= rect.bottom()) return true;
+    }
+    return false;
+}
+
+/// Moves every surface's damage, in screen coordinates, into `out`.
+/// Damage that an opaque surface above hides is dropped.
+pub fn collectDamage(out: *surface.DamageList) void {
+    for (order[0..order_len], 0..) |idx, pos| {
+        const slot = &slots[idx];
+        const origin = slot.screenRect();
+        if (!slot.tracks_damage) {
+            if (!hiddenAbove(pos, origin)) out.add(origin);
+            continue;
+        }
+        // damage() clipped d to the surface and fitsAt() bounds the origin,
+        // so these sums cannot overflow.
+        for (slot.damage.items()) |d| {
+            const r = Rect{ .x = origin.x + d.x, .y = origin.y + d.y, .w = d.w, .h = d.h };
+            if (!hiddenAbove(pos, r)) out.add(r);
+        }
+        slot.damage.clear();
+    }
+}
+
+fn layerRow(slot: *const Slot, screen_y: u32) [*]const u32 {
+    return slot.info.pixels + @as(usize, screen_y - slot.info.y) * slot.info.stride;
+}
+
+/// Composes screen rectangle `r` from `base` and the surfaces and streams
+/// it to `front`. Returns the pixels written.
+pub fn composeRect(front: *Surface, base: *const Surface, rect: Rect) u64 {
+    const r = rect.intersect(front.bounds()).intersect(base.bounds());
+    if (r.isEmpty()) return 0;
+
+    // Layers touching r, bottom to top, starting at the topmost opaque one
+    // that covers all of r.
+    var layers: [MAX_SURFACES]*const Slot = undefined;
+    var count: usize = 0;
+    var from_base = true;
+    for (order[0..order_len]) |idx| {
+        const slot = &slots[idx];
+        const sr = slot.screenRect();
+        if (sr.intersect(r).isEmpty()) continue;
+        if (slot.isOpaque() and sr.x <= r.x and sr.y <= r.y and sr.right() >= r.right() and sr.bottom() >= r.bottom()) {
+            count = 0;
+            from_base = false;
+        }
+        layers[count] = slot;
+        count += 1;
+    }
+
+    if (count == 0) {
+        var y = r.y;
+        while (y < r.bottom()) : (y += 1) display.streamRow(front.row(y) + r.x, base.row(y) + r.x, r.w);
+        return r.area();
+    }
+
+    var strip_x = r.x;
+    while (strip_x < r.right()) : (strip_x += SCRATCH_PIXELS) {
+        const strip_w: u32 = @intCast(@min(SCRATCH_PIXELS, r.right() - strip_x));
+        var y = r.y;
+        while (y < r.bottom()) : (y += 1) {
+            if (from_base) surface.copyRow(&scratch, base.row(y) + strip_x, strip_w);
+            for (layers[0..count]) |slot| {
+                const sr = slot.screenRect();
+                if (y < sr.y or y >= sr.bottom()) continue;
+                const x0 = @max(strip_x, sr.x);
+                const x1 = @min(@as(u64, strip_x) + strip_w, sr.right());
+                if (x0 >= x1) continue;
+                const n: usize = @intCast(x1 - x0);
+                const dst = @as([*]u32, &scratch) + (x0 - strip_x);
+                const src = layerRow(slot, y) + (x0 - sr.x);
+                if (slot.isOpaque()) surface.copyRow(dst, src, n) else surface.blendRow(dst, src, n);
+            }
+            display.streamRow(front.row(y) + strip_x, &scratch, strip_w);
+        }
+    }
+    return r.area();
+}
+
+// --- Unit Tests ---
+
+test "Surface Is Keyed And Destroy Frees Its Slot" {
+    const info = create(4, 6, 20, 10) orelse return error.OutOfMemory;
+    const base = @intFromPtr(info.pixels);
+    try std.testing.expect(vmm.pageKey(base) == SURFACE_PKEY);
+    try std.testing.expect(info.pixels[0] == 0);
+
+    // The program's view is a read-only copy; composition uses the slot's.
+    const slot = slotOf(info) orelse return error.TestUnexpectedResult;
+    try std.testing.expect(@intFromPtr(info) >= layout.SURFACE_INFO_BASE);
+    try std.testing.expect(vmm.mappingKey(@intFromPtr(shared.?)) == pks.KEY_DRIVERS);
+    try std.testing.expect(slot.info.pixels == info.pixels and info.width == 20);
+
+    // Another program cannot destroy, move or damage it.
+    const other = domain.create() orelse return error.OutOfMemory;
+    defer domain.destroy(other);
+    _ = try domain.enter(other);
+    try std.testing.expect(!destroy(info));
+    try std.testing.expect(!place(info, 0, 0, 0, 0));
+    try std.testing.expect(!damage(info, .{ .w = 1, .h = 1 }));
+    domain.leave();
+
+    try std.testing.expect(destroy(info));
+    try std.testing.expect(!vmm.isMapped(base));
+    try std.testing.expect(!destroy(info));
+    try std.testing.expect(create(0, 0, 0, 8) == null);
+}
+
+test "Compositor Stacks, Blends And Skips Hidden Layers" {
+    var base_px = [_]u32{0xFF000010} ** (32 * 32);
+    var front_px = [_]u32{0} ** (32 * 32);
+    const base = Surface{ .pixels = &base_px, .width = 32, .height = 32, .stride = 32 };
+    var front = Surface{ .pixels = &front_px, .width = 32, .height = 32, .stride = 32 };
+
+    const low = create(0, 0, 16, 16) orelse return error.OutOfMemory;
+    defer _ = destroy(low);
+    const high = create(8, 8, 16, 16) orelse return error.OutOfMemory;
+    defer _ = destroy(high);
+    @memset(low.pixels[0 .. 16 * 16], 0xFF0000FF);
+    @memset(high.pixels[0 .. 16 * 16], 0xFF00FF00);
+
+    _ = composeRect(&front, &base, .{ .w = 32, .h = 32 });
+    try std.testing.expect(front.getPixel(2, 2) == 0xFF0000FF);
+    try std.testing.expect(front.getPixel(10, 10) == 0xFF00FF00);
+    try std.testing.expect(front.getPixel(30, 2) == 0xFF000010);
+
+    // Raise `low` above `high` and make it translucent (alpha 0: invisible).
+    @memset(low.pixels[0 .. 16 * 16], 0x000000FF);
+    try std.testing.expect(place(low, 0, 0, high.z + 1, FLAG_ALPHA));
+    _ = composeRect(&front, &base, .{ .w = 32, .h = 32 });
+    try std.testing.expect(front.getPixel(2, 2) == 0xFF000010);
+    try std.testing.expect(front.getPixel(10, 10) == 0xFF00FF00);
+
+    // Damage on `high` under an opaque `low` is dropped when collected.
+    try std.testing.expect(place(low, 0, 0, high.z + 1, 0));
+    try std.testing.expect(damage(high, .{ .w = 4, .h = 4 }));
+    try std.testing.expect(damage(low, .{ .w = 1, .h = 1 }));
+    var list = surface.DamageList{};
+    collectDamage(&list);
+    try std.testing.expect(list.items().len == 1);
+    try std.testing.expect(list.items()[0].w == 1);
+
+    // A surface cannot be moved where its far edge would overflow.
+    try std.testing.expect(!place(high, 0xFFFF_FFF0, 0, 0, 0));
+    try std.testing.expect(create(0, 0xFFFF_FFF8, 16, 16) == null);
+}
+
+test "Benchmark: Composited Frames With 4 And 16 Surfaces" {
+    const bench = @import("../../kernel/bench.zig");
+    const fb = framebuffer.getFramebuffer() orelse return;
+    if (!display.isBuffered() or fb.width < 640 or fb.height < 480) return;
+
+    inline for (.{ 4, 16 }) |n| {
+        var infos: [n]*const SurfaceInfo = undefined;
+        var made: usize = 0;
+        defer {
+            for (infos[0..made]) |info| _ = destroy(info);
+        }
+        while (made < n) : (made += 1) {
+            const x: u32 = @intCast(20 + made * 28);
+            const y: u32 = @intCast(20 + (made % 4) * 60);
+            infos[made] = create(x, y, 160, 120) orelse return error.OutOfMemory;
+            @memset(infos[made].pixels[0 .. 160 * 120], 0x80000000 | @as(u32, @intCast(made * 0x0F0F0F)));
+            _ = place(infos[made], x, y, 0, if (made % 2 == 0) FLAG_ALPHA else 0);
+        }
+        _ = display.present();
+
+        const frames: u64 = 32;
+        // A typical frame: each surface redraws a 32x32 sprite.
+        var start = bench.now();
+        var f: u64 = 0;
+        while (f < frames) : (f += 1) {
+            for (infos) |info| _ = damage(info, .{ .x = @intCast(f % 64), .y = 16, .w = 32, .h = 32 });
+            _ = display.present();
+        }
+        bench.reportRate(std.fmt.comptimePrint("compositor frames, {d} surfaces, 32x32 damage each", .{n}), bench.now() - start, frames);
+
+        // Worst case: every surface fully damaged.
+        start = bench.now();
+        f = 0;
+        while (f < frames) : (f += 1) {
+            for (infos) |info| _ = damage(info, .{ .w = info.width, .h = info.height });
+            _ = display.present();
+        }
+        bench.reportRate(std.fmt.comptimePrint("compositor frames, {d} surfaces, full damage", .{n}), bench.now() - start, frames);
+    }
+}
@@ -0,0 +1,426 @@
+/// Text Console
+///
+/// A grid of character cells over the framebuffer, backed by a ring of lines
+/// that also serves as scrollback. Writing only updates cells and records,
+/// per screen row, the span of columns that changed. render() then repaints
+/// just those spans as opaque text runs (font.drawTextOn).
+///
+/// Scrolling never redraws text. New lines advance the ring; at the next
+/// render the surviving rows are moved up with one copyRect of the back
+/// buffer, and only the rows that scrolled in are painted. Viewing older
+/// lines (scrollView) is a ring-offset redraw of the visible rows.
+///
+/// The primary console (init/write/flush) draws on the boot framebuffer and
+/// is shared by the shell and the kernel table's write_console. Like the
+/// rest of the drawing code it is not locked; callers serialize.
+const std = @import("std");
+const limine = @import("../../limine_import.zig").C;
+const framebuffer = @import("framebuffer.zig");
+const display = @import("display.zig");
+const font = @import("font.zig");
+const surface = @import("surface.zig");
+const pmm = @import("../../kernel/memory/pmm.zig");
+const pks = @import("../../arch/x86_64/pks.zig");
+const vmm = @import("../../kernel/memory/vmm.zig");
+const serial = @import("../../kernel/serial.zig");
+
+const Surface = surface.Surface;
+const Rect = surface.Rect;
+
+/// Pixels between lines: the 8-pixel glyph plus 2 pixels of spacing.
+pub const LINE_HEIGHT: u32 = 10;
+/// Blank border around the text area, in pixels.
+pub const MARGIN: u32 = 10;
+pub const MAX_COLS: u32 = 256;
+pub const MAX_ROWS: u32 = 256;
+/// Lines kept above the screen for scrollView.
+pub const SCROLLBACK_LINES: u32 = 512;
+
+pub const DEFAULT_FG: u32 = 0xFFFFFFFF;
+pub const DEFAULT_BG: u32 = 0xFF000000;
+
+pub const Cell = struct {
+    ch: u8 = ' ',
+    fg: u32 = DEFAULT_FG,
+};
+
+pub const Console = struct {
+    /// `ring_lines` lines of `cols` cells each.
+    cells: []Cell,
+    ring_lines: u32,
+    cols: u32,
+    rows: u32,
+    origin_x: u32,
+    origin_y: u32,
+    fg: u32 = DEFAULT_FG,
+    bg: u32 = DEFAULT_BG,
+
+    /// Absolute line number shown on screen row 0 when following output.
+    top: u64 = 0,
+    /// How many lines the view is scrolled back from `top`.
+    view_back: u64 = 0,
+    cursor_row: u32 = 0,
+    cursor_col: u32 = 0,
+    /// Lines scrolled since the last render (the rows to move up).
+    pending_scroll: u32 = 0,
+    /// Per screen row, the changed columns [lo, hi). Empty when lo >= hi.
+    dirty_lo: [MAX_ROWS]u16 = [_]u16{0} ** MAX_ROWS,
+    dirty_hi: [MAX_ROWS]u16 = [_]u16{0} ** MAX_ROWS,
+
+    /// Lays out as many cells as fit in `area_w` x `area_h` pixels at
+    /// (origin_x, origin_y), using `cells` as the line ring. The ring must
+    /// hold at least one screen of lines.
+    pub fn init(cells: []Cell, origin_x: u32, origin_y: u32, area_w: u32, area_h: u32) Console {
+        const cols = @min(area_w / font.CELL_WIDTH, MAX_COLS);
+        const rows = @min(area_h / LINE_HEIGHT, MAX_ROWS, @as(u32, @intCast(cells.len / @max(cols, 1))));
+        var self = Console{
+            .cells = cells,
+            .ring_lines = @intCast(cells.len / @max(cols, 1)),
+            .cols = cols,
+            .rows = rows,
+            .origin_x = origin_x,
+            .origin_y = origin_y,
+        };
+        self.reset();
+        return self;
+    }
+
+    /// Blanks every line and moves the cursor home.
+    pub fn reset(self: *Console) void {
+        @memset(self.cells, .{ .fg = self.fg });
+        self.top = 0;
+        self.view_back = 0;
+        self.cursor_row = 0;
+        self.cursor_col = 0;
+        self.pending_scroll = 0;
+        self.markAll();
+    }
+
+    /// The text area in pixels.
+    pub fn area(self: *const Console) Rect {
+        return .{
+            .x = self.origin_x,
+            .y = self.origin_y,
+            .w = self.cols * font.CELL_WIDTH,
+            .h = self.rows * LINE_HEIGHT,
+        };
+    }
+
+    fn line(self: *const Console, number: u64) []Cell {
+        const start: usize = @intCast((number % self.ring_lines) * self.cols);
+        return self.cells[start..][0..self.cols];
+    }
+
+    /// The cell at screen (row, col) of the current view.
+    pub fn cellAt(self: *const Console, row: u32, col: u32) Cell {
+        return self.line(self.top - self.view_back + row)[col];
+    }
+
+    fn markCells(self: *Console, row: u32, lo: u32, hi: u32) void {
+        if (self.dirty_lo[row] >= self.dirty_hi[row]) {
+            self.dirty_lo[row] = @intCast(lo);
+            self.dirty_hi[row] = @intCast(hi);
+        } else {
+            self.dirty_lo[row] = @min(self.dirty_lo[row], @as(u16, @intCast(lo)));
+            self.dirty_hi[row] = @max(self.dirty_hi[row], @as(u16, @intCast(hi)));
+        }
+    }
+
+    fn markAll(self: *Console) void {
+        var row: u32 = 0;
+        while (row < self.rows) : (row += 1) self.markCells(row, 0, self.cols);
+        // Every row is repainted, so moving pixels first would be wasted.
+        self.pending_scroll = 0;
+    }
+
+    /// Returns to the live view if the user was looking at scrollback.
+    fn follow(self: *Console) void {
+        if (self.view_back == 0) return;
+        self.view_back = 0;
+        self.markAll();
+    }
+
+    fn setCell(self: *Console, row: u32, col: u32, ch: u8) void {
+        self.line(self.top + row)[col] = .{ .ch = ch, .fg = self.fg };
+        self.markCells(row, col, col + 1);
+    }
+
+    fn newLine(self: *Console) void {
+        self.cursor_col = 0;
+        if (self.cursor_row + 1 < self.rows) {
+            self.cursor_row += 1;
+            return;
+        }
+
+        // Scroll: the ring advances and the dirty spans move up with the rows.
+        self.top += 1;
+        @memset(self.line(self.top + self.rows - 1), .{ .fg = self.fg });
+        const last = self.rows - 1;
+        std.mem.copyForwards(u16, self.dirty_lo[0..last], self.dirty_lo[1..self.rows]);
+        std.mem.copyForwards(u16, self.dirty_hi[0..last], self.dirty_hi[1..self.rows]);
+        self.dirty_lo[last] = 0;
+        self.dirty_hi[last] = 0;
+        self.markCells(last, 0, self.cols);
+        if (self.pending_scroll < self.rows) self.pending_scroll += 1;
+    }
+
+    /// Writes `bytes` at the cursor. Handles '\n', '\r', '\t' and backspace
+    /// (8, which erases the previous cell); other control bytes are ignored.
+    /// Long lines wrap.
+    pub fn write(self: *Console, bytes: []const u8) void {
+        if (self.rows == 0 or self.cols == 0) return;
+        self.follow();
+        for (bytes) |c| {
+            switch (c) {
+                '\n' => self.newLine(),
+                '\r' => self.cursor_col = 0,
+                '\t' => {
+                    const stop = @min((self.cursor_col / 8 + 1) * 8, self.cols);
+                    while (self.cursor_col < stop) : (self.cursor_col += 1) {
+                        self.setCell(self.cursor_row, self.cursor_col, ' ');
+                    }
+                },
+                8 => {
+                    if (self.cursor_col > 0) {
+                        self.cursor_col -= 1;
+                    } else if (self.cursor_row > 0) {
+                        self.cursor_row -= 1;
+                        self.cursor_col = self.cols - 1;
+                    } else continue;
+                    self.setCell(self.cursor_row, self.cursor_col, ' ');
+                },
+                32...127 => {
+                    if (self.cursor_col >= self.cols) self.newLine();
+                    self.setCell(self.cursor_row, self.cursor_col, c);
+                    self.cursor_col += 1;
+                },
+                else => {},
+            }
+        }
+    }
+
+    /// Shows older (`delta` > 0) or newer lines, clamped to the scrollback
+    /// that is still in the ring. Any write returns to the live view.
+    pub fn scrollView(self: *Console, delta: i64) void {
+        const history = @min(self.top, self.ring_lines - self.rows);
+        const wanted = @as(i64, @intCast(self.view_back)) + delta;
+        const back: u64 = @intCast(std.math.clamp(wanted, 0, @as(i64, @intCast(history))));
+        if (back == self.view_back) return;
+        self.view_back = back;
+        self.markAll();
+    }
+
+    /// Repaints everything that changed since the last render onto `s`.
+    /// Returns the bounding box of the pixels touched (empty if none).
+    pub fn render(self: *Console, s: *Surface) Rect {
+        const text_area = self.area();
+        var touched = Rect{};
+
+        if (self.pending_scroll > 0) {
+            const shift = self.pending_scroll * LINE_HEIGHT;
+            s.copyRect(text_area.x, text_area.y, .{
+                .x = text_area.x,
+                .y = text_area.y + shift,
+                .w = text_area.w,
+                .h = text_area.h - shift,
+            });
+            touched = text_area;
+            self.pending_scroll = 0;
+        }
+
+        var chars: [MAX_COLS]u8 = undefined;
+        var row: u32 = 0;
+        while (row < self.rows) : (row += 1) {
+            const lo: u32 = self.dirty_lo[row];
+            const hi: u32 = self.dirty_hi[row];
+            if (lo >= hi) continue;
+            self.dirty_lo[row] = 0;
+            self.dirty_hi[row] = 0;
+
+            const cells = self.line(self.top - self.view_back + row);
+            const y = text_area.y + row * LINE_HEIGHT;
+            // One text run per stretch of cells sharing a colour.
+            var start = lo;
+            while (start < hi) {
+                const fg = cells[start].fg;
+                var end = start;
+                while (end < hi and cells[end].fg == fg) : (end += 1) chars[end] = cells[end].ch;
+                var drawn = font.drawTextOn(s, text_area.x + start * font.CELL_WIDTH, y, chars[start..end], fg, self.bg);
+                if (!drawn.isEmpty()) {
+                    // Opaque down to the next line, so stray pixels in the gap go too.
+                    s.fillRect(.{ .x = drawn.x, .y = y + font.CELL_HEIGHT, .w = drawn.w, .h = LINE_HEIGHT - font.CELL_HEIGHT }, self.bg);
+                    drawn.h = LINE_HEIGHT;
+                    touched = if (touched.isEmpty()) drawn else touched.unionWith(drawn);
+                }
+                start = end;
+            }
+        }
+        return touched;
+    }
+};
+
+// --- Primary Console ---
+
+var primary: ?Console = null;
+var primary_fb: ?*limine.struct_limine_framebuffer = null;
+
+/// Sets up the console on the boot framebuffer, with SCROLLBACK_LINES of
+/// history. Without a framebuffer (or memory) the console stays disabled
+/// and writes are dropped. Must run after display.init().
+pub fn init() void {
+    const fb = framebuffer.getFramebuffer() orelse return;
+    if (fb.width <= 2 * MARGIN or fb.height <= 2 * MARGIN) return;
+
+    const area_w: u32 = @intCast(fb.width - 2 * MARGIN);
+    const area_h: u32 = @intCast(fb.height - 2 * MARGIN);
+    const cols = @min(area_w / font.CELL_WIDTH, MAX_COLS);
+    const rows = @min(area_h / LINE_HEIGHT, MAX_ROWS);
+    const bytes = @as(usize, cols) * (rows + SCROLLBACK_LINES) * @sizeOf(Cell);
+    const pages = (bytes + pmm.PAGE_SIZE - 1) / pmm.PAGE_SIZE;
+    const phys = pmm.allocatePages(pages) orelse {
+        serial.warn("Console: Out of memory for the line ring, console disabled");
+        return;
+    };
+    const ring: [*]Cell = @ptrFromInt(phys + vmm.getHhdmOffset());
+    vmm.setKey(@intFromPtr(ring), pages * pmm.PAGE_SIZE, pks.KEY_DRIVERS);
+
+    primary = Console.init(ring[0 .. @as(usize, cols) * (rows + SCROLLBACK_LINES)], MARGIN, MARGIN, area_w, area_h);
+    primary_fb = fb;
+    serial.info("Console: Initialized");
+}
+
+/// Writes to the primary console. Call flush() (or present through the
+/// shell loop) to make it visible.
+pub fn write(bytes: []const u8) void {
+    if (primary) |*c| c.write(bytes);
+}
+
+/// Sets the foreground colour for subsequent writes.
+pub fn setColor(fg: u32) void {
+    if (primary) |*c| c.fg = fg;
+}
+
+/// Clears the whole screen to the console background and blanks the grid.
+pub fn clear() void {
+    if (primary) |*c| {
+        c.reset();
+        framebuffer.fill(primary_fb.?, c.bg);
+    }
+}
+
+/// Scrolls the primary console's view; see Console.scrollView.
+pub fn scrollView(delta: i64) void {
+    if (primary) |*c| c.scrollView(delta);
+}
+
+/// Renders pending changes into the back buffer and marks them for present().
+pub fn flush() void {
+    if (primary) |*c| {
+        var s = display.surfaceFor(primary_fb.?);
+        const touched = c.render(&s);
+        if (!touched.isEmpty()) display.markDirty(touched);
+    }
+}
+
+// --- Unit Tests ---
+
+fn testConsole(cells: []Cell, pixels: []u32, s: *Surface) Console {
+    s.* = .{ .pixels = pixels.ptr, .width = 100, .height = 40, .stride = 100 };
+    @memset(pixels, 0x1234);
+    // 11 columns x 4 rows, 6 lines of ring
+    return Console.init(cells, 0, 0, 100, 40);
+}
+
+test "Console Wraps, Scrolls And Keeps Scrollback" {
+    var cells: [11 * 6]Cell = undefined;
+    var pixels: [100 * 40]u32 = undefined;
+    var s: Surface = undefined;
+    var c = testConsole(&cells, &pixels, &s);
+    try std.testing.expect(c.cols == 11 and c.rows == 4 and c.ring_lines == 6);
+
+    c.write("hello world!\nab\x08c");
+    try std.testing.expect(c.cellAt(0, 10).ch == 'd');
+    try std.testing.expect(c.cellAt(1, 0).ch == '!');
+    try std.testing.expect(c.cellAt(2, 0).ch == 'a' and c.cellAt(2, 1).ch == 'c');
+
+    c.write("\n\n\nlast");
+    try std.testing.expect(c.top == 2);
+    try std.testing.expect(c.cellAt(0, 0).ch == 'a');
+    try std.testing.expect(c.cellAt(3, 0).ch == 'l');
+
+    // Two lines of history are still in the ring.
+    c.scrollView(5);
+    try std.testing.expect(c.view_back == 2);
+    try std.testing.expect(c.cellAt(0, 0).ch == 'h');
+    c.write("");
+    try std.testing.expect(c.view_back == 0);
+}
+
+test "Console Repaints Only Changed Cells And Scrolls By Copy" {
+    var cells: [11 * 6]Cell = undefined;
+    var pixels: [100 * 40]u32 = undefined;
+    var s: Surface = undefined;
+    var c = testConsole(&cells, &pixels, &s);
+
+    // The first render paints the whole grid.
+    try std.testing.expect(c.render(&s).w == c.area().w);
+    try std.testing.expect(c.render(&s).isEmpty());
+
+    c.write("x");
+    const one = c.render(&s);
+    try std.testing.expect(one.w == font.CELL_WIDTH and one.h == LINE_HEIGHT);
+
+    // Four newlines from row 0 scroll the grid by one line, taking "x" off
+    // the top of the screen (but not out of the ring).
+    var row0: [font.CELL_WIDTH]u32 = undefined;
+    @memcpy(&row0, s.row(0)[0..font.CELL_WIDTH]);
+    c.write("\n\n\n\n");
+    try std.testing.expect(c.pending_scroll == 1);
+    _ = c.render(&s);
+    // Row 0 now holds what row 1 had (blank); "x" scrolled off the top.
+    try std.testing.expect(s.getPixel(0, 0) == c.bg);
+    try std.testing.expect(c.pending_scroll == 0);
+
+    // Scrolling back is a redraw from the ring: "x" is back on row 0.
+    c.scrollView(1);
+    _ = c.render(&s);
+    try std.testing.expect(std.mem.eql(u32, s.row(0)[0..font.CELL_WIDTH], &row0));
+}
+
+test "Benchmark: Console Scroll vs Full Redraw" {
+    const bench = @import("../../kernel/bench.zig");
+    const p = primary orelse return;
+    var s = display.surfaceFor(primary_fb.?);
+
+    // A scratch console over the same area, so the primary's text survives;
+    // it is repainted afterwards.
+    const pages = (p.cells.len * @sizeOf(Cell) + pmm.PAGE_SIZE - 1) / pmm.PAGE_SIZE;
+    const phys = pmm.allocatePages(pages) orelse return error.OutOfMemory;
+    const ring: [*]Cell = @ptrFromInt(phys + vmm.getHhdmOffset());
+    var c = Console.init(ring[0..p.cells.len], p.origin_x, p.origin_y, p.area().w, p.area().h);
+    defer {
+        pmm.freePages(phys, pages);
+        primary.?.markAll();
+        flush();
+    }
+
+    const iterations: u64 = 32;
+    c.write("The quick brown fox jumps over the lazy dog.");
+    _ = c.render(&s);
+
+    var start = bench.now();
+    var i: u64 = 0;
+    while (i < iterations) : (i += 1) {
+        c.write("\nThe quick brown fox jumps over the lazy dog.");
+        _ = c.render(&s);
+    }
+    bench.report("console scroll one line (copyRect + 1 row)", bench.now() - start, iterations);
+
+    start = bench.now();
+    i = 0;
+    while (i < iterations) : (i += 1) {
+        c.markAll();
+        _ = c.render(&s);
+    }
+    bench.report("console full redraw", bench.now() - start, iterations);
+}
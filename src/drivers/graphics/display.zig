@@ -0,0 +1,229 @@
+/// Double-Buffered Display
+///
+/// The Limine framebuffer is VRAM: uncached or write-combining, where reads
+/// and small scattered writes are slow. After init(), all framebuffer drawing
+/// (framebuffer.zig, font.zig, the kernel table's draw_rect) goes to a back
+/// buffer in ordinary RAM and records the rectangles it touched. present()
+/// then copies only those rectangles to VRAM, with non-temporal (streaming)
+/// stores that bypass the cache, and fences once at the end.
+///
+/// init() also remaps VRAM write-combining through the PAT, so those stores
+/// are merged into full bus bursts instead of going out one by one.
+///
+/// The back buffer is the bottom layer of the screen: user surfaces
+/// (compositor.zig) are stacked on top of it while each damaged rectangle is
+/// streamed out, never drawn into it.
+///
+/// Before init() (or without a framebuffer) drawing goes straight to VRAM
+/// and present() does nothing.
+const std = @import("std");
+const limine = @import("../../limine_import.zig").C;
+const framebuffer = @import("framebuffer.zig");
+const surface = @import("surface.zig");
+const pmm = @import("../../kernel/memory/pmm.zig");
+const vmm = @import("../../kernel/memory/vmm.zig");
+const serial = @import("../../kernel/serial.zig");
+const pat = @import("../../arch/x86_64/pat.zig");
+const pks = @import("../../arch/x86_64/pks.zig");
+const compositor = @import("compositor.zig");
+
+const Surface = surface.Surface;
+const Rect = surface.Rect;
+
+var fb_ptr: ?*limine.struct_limine_framebuffer = null;
+var front: Surface = undefined;
+var back: Surface = undefined;
+var damage = surface.DamageList{};
+var ready: bool = false;
+
+/// Allocates the back buffer (one unpadded row per scanline) and seeds it
+/// with the current screen contents.
+pub fn init() void {
+    const fb = framebuffer.getFramebuffer() orelse {
+        serial.warn("Display: No framebuffer, drawing stays unbuffered");
+        return;
+    };
+    if (fb.address == null or fb.bpp != 32) {
+        serial.warn("Display: Unsupported framebuffer, drawing stays unbuffered");
+        return;
+    }
+
+    front = Surface.fromFramebuffer(fb);
+    if (pat.isSupported()) {
+        vmm.setCacheType(@intFromPtr(front.pixels), vramBytes(), .write_combining);
+        serial.info("Display: VRAM mapped write-combining");
+    }
+
+    const bytes = @as(usize, front.width) * front.height * 4;
+    const pages = (bytes + pmm.PAGE_SIZE - 1) / pmm.PAGE_SIZE;
+    const phys = pmm.allocatePages(pages) orelse {
+        serial.warn("Display: Out of memory for back buffer, drawing stays unbuffered");
+        return;
+    };
+    back = .{
+        .pixels = @ptrFromInt(phys + vmm.getHhdmOffset()),
+        .width = front.width,
+        .height = front.height,
+        .stride = front.width,
+    };
+    back.blit(back.bounds(), front.pixels, front.stride);
+    // Programs draw through the kernel table, never into the buffer itself
+    vmm.setKey(@intFromPtr(back.pixels), pages * pmm.PAGE_SIZE, pks.KEY_DRIVERS);
+
+    fb_ptr = fb;
+    ready = true;
+    serial.info("Display: Back buffer allocated");
+}
+
+fn vramBytes() u64 {
+    return @as(u64, front.stride) * front.height * 4;
+}
+
+pub fn isBuffered() bool {
+    return ready;
+}
+
+/// The surface drawing on `fb` should go to: the back buffer for the primary
+/// framebuffer once buffered, otherwise VRAM itself.
+pub fn surfaceFor(fb: *limine.struct_limine_framebuffer) Surface {
+    if (ready and fb == fb_ptr) return back;
+    return Surface.fromFramebuffer(fb);
+}
+
+/// Records that `rect` of the back buffer changed.
+pub fn markDirty(rect: Rect) void {
+    if (!ready) return;
+    damage.add(rect.intersect(back.bounds()));
+}
+
+/// Marks the whole screen dirty.
+pub fn markAllDirty() void {
+    if (!ready) return;
+    damage.add(back.bounds());
+}
+
+/// Composes every damaged rectangle (back buffer plus the surfaces above
+/// it) into VRAM. Returns the pixels written.
+pub fn present() u64 {
+    if (!ready) return 0;
+
+    compositor.collectDamage(&damage);
+    var pixels: u64 = 0;
+    for (damage.items()) |r| {
+        pixels += compositor.composeRect(&front, &back, r);
+    }
+    damage.clear();
+    // Non-temporal stores are weakly ordered: drain them before returning.
+    asm volatile ("sfence" ::: .{ .memory = true });
+    return pixels;
+}
+
+/// Copies a row with movntdq, 64 bytes per iteration. movntdq needs a
+/// 16-byte aligned destination, so the head and tail are copied normally.
+/// The caller issues the sfence.
+pub fn streamRow(dst: [*]u32, src: [*]const u32, len: usize) void {
+    var i: usize = 0;
+    while (i < len and (@intFromPtr(dst + i) & 15) != 0) : (i += 1) dst[i] = src[i];
+    while (i + 16 <= len) : (i += 16) {
+        asm volatile (
+            \\movdqu 0(%[src]), %%xmm0
+            \\movdqu 16(%[src]), %%xmm1
+            \\movdqu 32(%[src]), %%xmm2
+            \\movdqu 48(%[src]), %%xmm3
+            \\movntdq %%xmm0, 0(%[dst])
+            \\movntdq %%xmm1, 16(%[dst])
+            \\movntdq %%xmm2, 32(%[dst])
+            \\movntdq %%xmm3, 48(%[dst])
+            :
+            : [src] "r" (src + i),
+              [dst] "r" (dst + i),
+            : .{ .xmm0 = true, .xmm1 = true, .xmm2 = true, .xmm3 = true, .memory = true });
+    }
+    while (i < len) : (i += 1) dst[i] = src[i];
+}
+
+// --- Unit Tests ---
+
+test "Display Draws To Back Buffer Until Present" {
+    if (!ready) return;
+    const fb = fb_ptr.?;
+
+    _ = present();
+    const r = Rect{ .x = 3, .y = 5, .w = 40, .h = 2 };
+    const before = front.getPixel(3, 5);
+    const color: u32 = before ^ 0x00FFFFFF;
+
+    framebuffer.drawRect(fb, r.x, r.y, r.w, r.h, color);
+    try std.testing.expect(back.getPixel(3, 5) == color);
+    try std.testing.expect(front.getPixel(3, 5) == before);
+    try std.testing.expect(!damage.isEmpty());
+
+    try std.testing.expect(present() >= r.area());
+    try std.testing.expect(front.getPixel(3, 5) == color);
+    try std.testing.expect(front.getPixel(42, 6) == color);
+    try std.testing.expect(damage.isEmpty());
+    try std.testing.expect(present() == 0);
+}
+
+test "Benchmark: Present Dirty Rect vs Full Screen" {
+    if (!ready) return;
+    const bench = @import("../../kernel/bench.zig");
+    const frames: u64 = 4;
+    const full = @as(u64, back.width) * back.height;
+
+    // Full-screen copy with ordinary stores, the cost of an unbuffered redraw.
+    var start = bench.now();
+    var f: u64 = 0;
+    while (f < frames) : (f += 1) {
+        var y: u32 = 0;
+        while (y < back.height) : (y += 1) surface.copyRow(front.row(y), back.row(y), back.width);
+    }
+    bench.reportThroughput("present full screen, plain stores (pixels)", frames * full, bench.now() - start);
+
+    start = bench.now();
+    f = 0;
+    var pixels: u64 = 0;
+    while (f < frames) : (f += 1) {
+        markAllDirty();
+        pixels += present();
+    }
+    bench.reportThroughput("present full screen, streaming (pixels)", pixels, bench.now() - start);
+
+    // A typical frame: a few small dirty rects.
+    start = bench.now();
+    f = 0;
+    var elapsed_px: u64 = 0;
+    while (f < frames * 16) : (f += 1) {
+        markDirty(.{ .x = 8, .y = 8, .w = 64, .h = 16 });
+        markDirty(.{ .x = 200, .y = 100, .w = 9, .h = 8 });
+        elapsed_px += present();
+    }
+    const cycles = bench.now() - start;
+    bench.report("present 2 small dirty rects (per frame)", cycles, frames * 16);
+    bench.reportThroughput("present small dirty rects (pixels)", elapsed_px, cycles);
+}
+
+test "Benchmark: VRAM Fill And Present By Memory Type" {
+    if (!ready or !pat.isSupported()) return;
+    const bench = @import("../../kernel/bench.zig");
+    const full = @as(u64, front.width) * front.height;
+    const types = [_]struct { cache: vmm.CacheType, fill: []const u8, present: []const u8 }{
+        .{ .cache = .uncached, .fill = "VRAM fill, UC (pixels)", .present = "present full screen, UC (pixels)" },
+        .{ .cache = .write_back, .fill = "VRAM fill, WB (pixels)", .present = "present full screen, WB (pixels)" },
+        .{ .cache = .write_combining, .fill = "VRAM fill, WC (pixels)", .present = "present full screen, WC (pixels)" },
+    };
+    defer vmm.setCacheType(@intFromPtr(front.pixels), vramBytes(), .write_combining);
+
+    for (types) |t| {
+        vmm.setCacheType(@intFromPtr(front.pixels), vramBytes(), t.cache);
+
+        var start = bench.now();
+        front.fill(0x00203040);
+        bench.reportThroughput(t.fill, full, bench.now() - start);
+
+        start = bench.now();
+        markAllDirty();
+        const pixels = present();
+        bench.reportThroughput(t.present, pixels, bench.now() - start);
+    }
+}
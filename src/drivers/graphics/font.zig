@@ -1,5 +1,15 @@
 const std = @import("std");
 const framebuffer = @import("framebuffer.zig");
+const display = @import("display.zig");
+const surface = @import("surface.zig");
+
+const Surface = surface.Surface;
+const Rect = surface.Rect;
+
+/// Glyph cell size used by drawText: 8 glyph columns plus one column of
+/// spacing, 8 rows (the same advance drawString and the shell use).
+pub const CELL_WIDTH: u32 = 9;
+pub const CELL_HEIGHT: u32 = 8;
 
 // 8x8 Bitmap Font (IBM VGA 8x8 inspired)
 // Covering ASCII 32 (Space) to 127 (DEL)
@@ -210,7 +220,8 @@ pub fn drawChar(fb: *limine.struct_limine_framebuffer, x: u64, y: u64, char: u8,
     const index = char - 32;
     const bitmap = font_data[index];
 
-    // Draw 8x8 bitmap
+    // Draw 8x8 bitmap into the back buffer, then mark the cell dirty once
+    var s = display.surfaceFor(fb);
     var row: u64 = 0;
     while (row < 8) : (row += 1) {
         // x check (optional if we trust caller, but safe)
@@ -224,10 +235,13 @@ pub fn drawChar(fb: *limine.struct_limine_framebuffer, x: u64, y: u64, char: u8,
             // Check if bit is set (MSB is left)
             // 0x80 = 10000000
             if ((bits & (@as(u8, 0x80) >> @intCast(col))) != 0) {
-                framebuffer.putPixel(fb, x + col, y + row, color);
+                s.putPixel(@intCast(x + col), @intCast(y + row), color);
             }
         }
     }
+    if (x < fb.width and y < fb.height) {
+        display.markDirty(.{ .x = @intCast(x), .y = @intCast(y), .w = 8, .h = 8 });
+    }
 }
 
 /// Draws a string starting at (x, y).
@@ -246,3 +260,184 @@ pub fn drawString(fb: *limine.struct_limine_framebuffer, x: u64, y: u64, text: [
         curr_x += 9; // Advance 8 pixels + 1 padding
     }
 }
+
+// --- Glyph Atlas ---
+//
+// drawChar tests each bitmap bit and writes pixels one at a time. For opaque
+// text the whole cell is known once the colours are: an atlas expands every
+// glyph into ready-made 32-bit rows for one (fg, bg) pair, and drawText then
+// renders a run by copying those rows, one scanline of the run at a time.
+
+const GLYPH_COUNT = font_data.len;
+/// Colour pairs kept expanded at once (round-robin replacement).
+const ATLAS_SLOTS = 4;
+
+const Row8 = @Vector(8, u32);
+
+/// For each bitmap byte, which of the 8 pixels are set (MSB is left).
+const row_masks: [256]@Vector(8, bool) = blk: {
+    @setEvalBranchQuota(10_000);
+    var masks: [256]@Vector(8, bool) = undefined;
+    for (0..256) |bits| {
+        var m: [8]bool = undefined;
+        for (0..8) |col| m[col] = (bits & (@as(usize, 0x80) >> @intCast(col))) != 0;
+        masks[bits] = m;
+    }
+    break :blk masks;
+};
+
+const Atlas = struct {
+    fg: u32 = 0,
+    bg: u32 = 0,
+    valid: bool = false,
+    glyphs: [GLYPH_COUNT][CELL_HEIGHT][CELL_WIDTH]u32 = undefined,
+
+    fn build(self: *Atlas, fg: u32, bg: u32) void {
+        const fg_v: Row8 = @splat(fg);
+        const bg_v: Row8 = @splat(bg);
+        for (&self.glyphs, font_data) |*glyph, bitmap| {
+            for (glyph, bitmap) |*out, bits| {
+                out[0..8].* = @select(u32, row_masks[bits], fg_v, bg_v);
+                out[8] = bg;
+            }
+        }
+        self.fg = fg;
+        self.bg = bg;
+        self.valid = true;
+    }
+};
+
+var atlases: [ATLAS_SLOTS]Atlas = [_]Atlas{.{}} ** ATLAS_SLOTS;
+var next_slot: usize = 0;
+
+/// Returns the atlas for (fg, bg), expanding it on a miss.
+/// Like the rest of the drawing code, callers serialize access.
+fn atlasFor(fg: u32, bg: u32) *const Atlas {
+    for (&atlases) |*a| {
+        if (a.valid and a.fg == fg and a.bg == bg) return a;
+    }
+    const a = &atlases[next_slot];
+    next_slot = (next_slot + 1) % ATLAS_SLOTS;
+    a.build(fg, bg);
+    return a;
+}
+
+/// Draws `text` as one line of opaque cells (CELL_WIDTH x CELL_HEIGHT each)
+/// with its top-left corner at (x, y). Characters outside ASCII 32 - 127 are
+/// drawn as blank cells; the run is clipped to the screen.
+pub fn drawText(fb: *limine.struct_limine_framebuffer, x: u64, y: u64, text: []const u8, fg: u32, bg: u32) void {
+    if (x >= fb.width or y >= fb.height) return;
+    var s = display.surfaceFor(fb);
+    display.markDirty(drawTextOn(&s, @intCast(x), @intCast(y), text, fg, bg));
+}
+
+/// drawText on an arbitrary surface. Returns the rectangle drawn.
+pub fn drawTextOn(s: *Surface, x: u32, y: u32, text: []const u8, fg: u32, bg: u32) Rect {
+    return drawTextClipped(s, x, y, text, fg, bg, s.bounds());
+}
+
+/// drawTextOn, drawing only the part of the run inside `clip`. Lets a
+/// caller render a run in horizontal bands.
+pub fn drawTextClipped(s: *Surface, x: u32, y: u32, text: []const u8, fg: u32, bg: u32, clip: Rect) Rect {
+    const wanted = Rect{
+        .x = x,
+        .y = y,
+        .w = @intCast(@min(text.len * CELL_WIDTH, s.width)),
+        .h = CELL_HEIGHT,
+    };
+    const r = wanted.intersect(s.bounds()).intersect(clip);
+    if (r.isEmpty()) return r;
+
+    const atlas = atlasFor(fg, bg);
+    // Columns of the run to draw, relative to its left edge.
+    const first = r.x - x;
+    const last = first + r.w;
+
+    var py = r.y;
+    while (py < r.bottom()) : (py += 1) {
+        const glyph_row = py - y;
+        var dst = s.row(py) + r.x;
+        var p = first;
+        while (p < last) {
+            const pixels = &atlas.glyphs[glyphIndex(text[p / CELL_WIDTH])][glyph_row];
+            const off = p % CELL_WIDTH;
+            const n = @min(CELL_WIDTH - off, last - p);
+            if (n == CELL_WIDTH) {
+                dst[0..CELL_WIDTH].* = pixels.*;
+            } else {
+                @memcpy(dst[0..n], pixels[off..][0..n]);
+            }
+            dst += n;
+            p += n;
+        }
+    }
+    return r;
+}
+
+fn glyphIndex(c: u8) usize {
+    return if (c < 32 or c > 127) 0 else c - 32;
+}
+
+// --- Unit Tests ---
+
+test "Glyph Atlas Expands Bitmap Rows" {
+    const a = atlasFor(0x00FFFFFF, 0x00000010);
+    const bang = a.glyphs['!' - 32];
+    // Row 0 of '!' is 0x18: columns 3 and 4 set.
+    try std.testing.expect(bang[0][2] == 0x00000010);
+    try std.testing.expect(bang[0][3] == 0x00FFFFFF);
+    try std.testing.expect(bang[0][4] == 0x00FFFFFF);
+    try std.testing.expect(bang[0][8] == 0x00000010);
+    try std.testing.expect(atlasFor(0x00FFFFFF, 0x00000010) == a);
+}
+
+test "Draw Text Renders Opaque Cells And Clips" {
+    const width = 40;
+    var pixels = [_]u32{0xDEAD} ** (width * 10);
+    var s = Surface{ .pixels = &pixels, .width = width, .height = 10, .stride = width };
+
+    // Five cells in a 40-pixel row: four whole cells and 4 columns of the fifth.
+    const drawn = drawTextOn(&s, 0, 1, "!!!!!", 7, 1);
+    try std.testing.expect(drawn.w == width and drawn.h == CELL_HEIGHT);
+    try std.testing.expect(s.getPixel(0, 0) == 0xDEAD);
+    try std.testing.expect(s.getPixel(0, 1) == 1);
+    try std.testing.expect(s.getPixel(3, 1) == 7);
+    try std.testing.expect(s.getPixel(CELL_WIDTH + 4, 1) == 7);
+    try std.testing.expect(s.getPixel(39, 8) == 1);
+    try std.testing.expect(s.getPixel(0, 9) == 0xDEAD);
+
+    // Off-surface runs draw nothing.
+    try std.testing.expect(drawTextOn(&s, 0, 10, "x", 7, 1).isEmpty());
+
+    // A clipped draw touches only the clip, matching the unclipped pixels.
+    @memset(&pixels, 0xDEAD);
+    const part = drawTextClipped(&s, 2, 0, "!!", 7, 1, .{ .x = 5, .y = 3, .w = 3, .h = 2 });
+    try std.testing.expect(part.x == 5 and part.y == 3 and part.w == 3 and part.h == 2);
+    try std.testing.expect(s.getPixel(4, 3) == 0xDEAD and s.getPixel(5, 2) == 0xDEAD);
+    // Column 5 is glyph column 3 of '!', which is set in row 3.
+    try std.testing.expect(s.getPixel(5, 3) == 7);
+}
+
+test "Benchmark: drawChar vs drawText" {
+    const fb = framebuffer.getFramebuffer() orelse return;
+    if (fb.width < 80 * CELL_WIDTH or fb.height < 2 * CELL_HEIGHT) return;
+    const bench = @import("../../kernel/bench.zig");
+    const line = "The quick brown fox jumps over the lazy dog. 0123456789 !#$%&()*+,-./:;<=>?@[]";
+    const lines: u64 = 16;
+
+    var start = bench.now();
+    var i: u64 = 0;
+    while (i < lines) : (i += 1) {
+        framebuffer.drawRect(fb, 0, 0, line.len * CELL_WIDTH, CELL_HEIGHT, 0);
+        drawString(fb, 0, 0, line, 0x00FFFFFF);
+    }
+    bench.report("drawRect + drawString (per 80-char line)", bench.now() - start, lines);
+
+    start = bench.now();
+    i = 0;
+    while (i < lines) : (i += 1) {
+        drawText(fb, 0, 0, line, 0x00FFFFFF, 0);
+    }
+    bench.report("drawText (per 80-char line)", bench.now() - start, lines);
+    _ = display.present();
+}
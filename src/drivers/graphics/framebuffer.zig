@@ -1,5 +1,10 @@
 const std = @import("std");
 const limine = @import("../../limine_import.zig").C;
+const surface = @import("surface.zig");
+const display = @import("display.zig");
+
+pub const Surface = surface.Surface;
+pub const Rect = surface.Rect;
 
 extern var framebuffer_request: limine.struct_limine_framebuffer_request;
 
@@ -20,14 +25,13 @@ pub fn getFramebuffer() ?*limine.struct_limine_framebuffer {
 pub fn putPixel(fb: *limine.struct_limine_framebuffer, x: u64, y: u64, color: u32) void {
     if (x >= fb.width or y >= fb.height) return;
 
-    const fb_ptr: [*]u32 = @ptrCast(@alignCast(fb.address));
-    // pitch is in bytes, so for u32 (4 bytes) we divide by 4.
-    // In a real generic driver we might handle bpp, but Limine 32bpp is standard.
-    const index = (y * (fb.pitch / 4)) + x;
-    fb_ptr[index] = color;
+    var s = display.surfaceFor(fb);
+    s.putPixel(@intCast(x), @intCast(y), color);
+    display.markDirty(.{ .x = @intCast(x), .y = @intCast(y), .w = 1, .h = 1 });
 }
 
 /// Draws a filled rectangle at (x, y) with the specified width, height, and color.
+/// Clipped once against the framebuffer, then filled a row at a time.
 pub fn drawRect(fb: *limine.struct_limine_framebuffer, x: u64, y: u64, width: u64, height: u64, color: u32) void {
     const serial = @import("../../kernel/serial.zig");
     // Sanity check
@@ -35,14 +39,17 @@ pub fn drawRect(fb: *limine.struct_limine_framebuffer, x: u64, y: u64, width: u6
         serial.err("FATAL: Framebuffer address is NULL in drawRect");
         return;
     }
+    if (x >= fb.width or y >= fb.height) return;
 
-    var cy: u64 = 0;
-    while (cy < height) : (cy += 1) {
-        var cx: u64 = 0;
-        while (cx < width) : (cx += 1) {
-            putPixel(fb, x + cx, y + cy, color);
-        }
-    }
+    const rect = Rect{
+        .x = @intCast(x),
+        .y = @intCast(y),
+        .w = @intCast(@min(width, fb.width - x)),
+        .h = @intCast(@min(height, fb.height - y)),
+    };
+    var s = display.surfaceFor(fb);
+    s.fillRect(rect, color);
+    display.markDirty(rect);
 }
 
 /// Fills the entire framebuffer with a single color.
@@ -54,40 +61,44 @@ pub fn fill(fb: *limine.struct_limine_framebuffer, color: u32) void {
         return;
     }
 
-    const fb_ptr: [*]u32 = @ptrCast(@alignCast(fb.address));
-    // Note: This naive filling assumes pitch == width * 4.
-    // A safer way is row by row if pitch includes padding.
-
-    var y: u64 = 0;
-    while (y < fb.height) : (y += 1) {
-        var x: u64 = 0;
-        while (x < fb.width) : (x += 1) {
-            const index = (y * (fb.pitch / 4)) + x;
-            fb_ptr[index] = color;
-        }
-    }
+    // Row by row, so a pitch with padding is handled.
+    var s = display.surfaceFor(fb);
+    s.fill(color);
+    display.markAllDirty();
 }
 
 /// Draws a filled circle centered at (cx, cy) with the specified radius and color.
+/// Each row is one horizontal span.
 pub fn fillCircle(fb: *limine.struct_limine_framebuffer, cx: u64, cy: u64, radius: u64, color: u32) void {
     const r2 = radius * radius;
-    // Bounding box optimization
-    const start_x = if (cx > radius) cx - radius else 0;
-    const end_x = if (cx + radius < fb.width) cx + radius else fb.width - 1;
     const start_y = if (cy > radius) cy - radius else 0;
-    const end_y = if (cy + radius < fb.height) cy + radius else fb.height - 1;
+    const end_y = cy + radius;
 
+    var s = display.surfaceFor(fb);
     var y: u64 = start_y;
-    while (y <= end_y) : (y += 1) {
-        var x: u64 = start_x;
-        while (x <= end_x) : (x += 1) {
-            // distance check: (x-cx)^2 + (y-cy)^2 <= r^2
-            // Use i64 to avoid underflow/overflow logic with u64
-            const dx: i64 = @as(i64, @intCast(x)) - @as(i64, @intCast(cx));
-            const dy: i64 = @as(i64, @intCast(y)) - @as(i64, @intCast(cy));
-            if (dx * dx + dy * dy <= r2) {
-                putPixel(fb, x, y, color);
-            }
+    while (y <= end_y and y < fb.height) : (y += 1) {
+        const dy = if (y > cy) y - cy else cy - y;
+        // Widest dx with dx^2 + dy^2 <= r^2
+        const half: u64 = std.math.sqrt(r2 - dy * dy);
+        const x0 = if (cx > half) cx - half else 0;
+        const x1 = cx + half; // inclusive
+        if (x0 >= fb.width) continue;
+        s.fillRect(.{
+            .x = @intCast(x0),
+            .y = @intCast(y),
+            .w = @intCast(@min(x1 + 1, fb.width) - x0),
+            .h = 1,
+        }, color);
+    }
+    if (start_y < fb.height) {
+        const x0 = if (cx > radius) cx - radius else 0;
+        if (x0 < fb.width) {
+            display.markDirty(.{
+                .x = @intCast(x0),
+                .y = @intCast(start_y),
+                .w = @intCast(@min(cx + radius + 1, fb.width) - x0),
+                .h = @intCast(@min(end_y + 1, fb.height) - start_y),
+            });
         }
     }
 }
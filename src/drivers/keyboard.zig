@@ -1,12 +1,24 @@
+const std = @import("std");
 const io = @import("../arch/x86_64/io.zig");
+const cpu = @import("../arch/x86_64/cpu.zig");
 const serial = @import("../kernel/serial.zig");
+const log = serial.scoped(.keyboard);
 const apic = @import("../arch/x86_64/apic.zig");
+const idt = @import("../arch/x86_64/idt.zig");
+const io_ring = @import("../kernel/io_ring.zig");
+const event = @import("../kernel/event.zig");
+const ring = @import("../kernel/ring.zig");
 
-// Circular Buffer
+// Legacy IRQ1 is routed to this vector through the IOAPIC
+const KEYBOARD_IRQ: u8 = 1;
+const KEYBOARD_VECTOR: u8 = 33;
+
+// Key buffer. MPMC: the IRQ may land on any CPU, and the shell, wait_key
+// callers and parked io_ring reads may consume from different CPUs.
 const BUFFER_SIZE = 256;
-var buffer: [BUFFER_SIZE]u8 = undefined;
-var write_idx: usize = 0;
-var read_idx: usize = 0;
+var key_ring: ring.MpmcRing(u8, BUFFER_SIZE) = .{};
+// Keys dropped because the buffer was full (no logging from IRQ context).
+var dropped_keys = std.atomic.Value(u64).init(0);
 
 // Scancode Table (Set 1)
 // 0 = Unknown/Special
@@ -26,6 +38,9 @@ const scancode_shift_map = [_]u8{
 
 var shift_pressed: bool = false;
 
+/// Signalled once per buffered key. Consumers block on it with waitKeys().
+pub var input_event: event.Event = .{};
+
 /// Flushes any stale data from the keyboard controller's output buffer.
 /// This prevents early key presses (before initialization) from leaving the controller in a faulty state.
 fn flushBuffer() void {
@@ -49,8 +64,8 @@ fn flushBuffer() void {
     }
 
     if (flushed_count > 0) {
-        serial.info("Keyboard: Flushed stale bytes from buffer:");
-        serial.printHex(.info, flushed_count);
+        log.info("Keyboard: Flushed stale bytes from buffer:");
+        log.printHex(.info, flushed_count);
     }
 }
 
@@ -58,10 +73,21 @@ pub fn init() void {
     // Flush any stale data from early key presses before enabling interrupts
     flushBuffer();
 
+    // Claim the vector before unmasking so no interrupt arrives unhandled.
+    // init() may be called more than once; a second registration is harmless.
+    idt.registerHandler(KEYBOARD_VECTOR, irqHandler, null) catch {};
+
     // Unmask IRQ1 (Keyboard) -> Map to Vector 33
     // IOAPIC Redirection
-    apic.enableIrq(1, 33);
-    serial.info("Keyboard Initialized (APIC IRQ1 -> Vec 33)");
+    apic.enableIrq(KEYBOARD_IRQ, KEYBOARD_VECTOR);
+    log.info("Keyboard Initialized (APIC IRQ1 -> Vec 33)");
+}
+
+/// IDT dispatch entry for the keyboard vector.
+fn irqHandler(frame: *idt.InterruptFrame, ctx: ?*anyopaque) void {
+    _ = frame;
+    _ = ctx;
+    handleIrq();
 }
 
 pub fn handleIrq() void {
@@ -93,38 +119,75 @@ pub fn handleIrq() void {
 
         if (char != 0) {
             push(char);
-            serial.debug("Key Pressed: ");
-            serial.printHex(.debug, char);
+            input_event.signal(1);
+            io_ring.onKeyboardInput();
+            // One line per key at most, and a held key cannot flood the UART.
+            if (log.ratelimit(.debug, @src())) {
+                var buf: [32]u8 = undefined;
+                log.debug(std.fmt.bufPrint(&buf, "Key Pressed: 0x{X}", .{char}) catch "Key Pressed");
+            }
         }
     }
 }
 
 fn push(c: u8) void {
-    // If buffer full, drop? Or overwrite? Let's drop.
-    const next_write = (write_idx + 1) % BUFFER_SIZE;
-    if (next_write == read_idx) {
-        serial.warn("Keyboard Buffer Full!");
-        return;
+    if (!key_ring.push(c)) {
+        _ = dropped_keys.fetchAdd(1, .monotonic);
+        if (log.ratelimit(.warn, @src())) log.warn("Keyboard: Input buffer full, dropping keys");
     }
-    buffer[write_idx] = c;
-    write_idx = next_write;
 }
 
 pub fn pop() ?u8 {
-    // Atomic load of write_idx effectively needed, but on single core x64,
-    // aligned size_t access is atomic.
-    if (read_idx == getWriteIdx()) {
-        return null;
+    return key_ring.pop();
+}
+
+/// Moves up to `buf.len` buffered keys into `buf`. Returns the number moved.
+pub fn popBatch(buf: []u8) usize {
+    return key_ring.popBatch(buf);
+}
+
+/// Number of keys dropped because the buffer was full.
+pub fn droppedKeys() u64 {
+    return dropped_keys.load(.monotonic);
+}
+
+/// Blocks until at least one key is buffered, then moves every buffered key
+/// that fits into `buf` (one wakeup delivers a whole batch).
+/// Returns the number of keys copied; 0 only if `buf` is empty.
+pub fn waitKeys(buf: []u8) usize {
+    if (buf.len == 0) return 0;
+    while (true) {
+        const n = key_ring.popBatch(buf);
+        if (n > 0) {
+            // Keys taken here (or by pop() elsewhere) may leave signals behind;
+            // drop them so the next wait does not return empty-handed.
+            if (key_ring.isEmpty()) _ = input_event.tryWait();
+            return n;
+        }
+        _ = input_event.wait();
     }
-    const c = buffer[read_idx];
-    read_idx = (read_idx + 1) % BUFFER_SIZE;
-    return c;
 }
 
-// Helper to ensure we read the latest write_idx (prevent optimization caching)
-fn getWriteIdx() usize {
-    const ptr = @as(*volatile usize, &write_idx);
-    return ptr.*;
+/// Like waitKeys(), for a CPU's idle loop: runs `idle` before every sleep,
+/// and sleeps until any interrupt (not only a key) so that `idle` also gets
+/// to run after a UART, wake-up or shootdown interrupt. Sleeping enables
+/// interrupts.
+pub fn waitKeysIdle(buf: []u8, comptime idle: fn () void) usize {
+    if (buf.len == 0) return 0;
+    var was_enabled = cpu.interruptsEnabled();
+    while (true) {
+        idle();
+        // IF=0 from the check to the hlt so a key cannot slip in between.
+        cpu.disableInterrupts();
+        const n = key_ring.popBatch(buf);
+        if (n > 0) {
+            if (key_ring.isEmpty()) _ = input_event.tryWait();
+            if (was_enabled) cpu.enableInterrupts();
+            return n;
+        }
+        cpu.waitForInterrupt();
+        was_enabled = true;
+    }
 }
 
 test "Keyboard Buffer Logic" {
@@ -132,8 +195,7 @@ test "Keyboard Buffer Logic" {
     // Use manual checks.
 
     // Reset state for test
-    write_idx = 0;
-    read_idx = 0;
+    key_ring = .{};
 
     push('A');
     push('B');
@@ -145,6 +207,59 @@ test "Keyboard Buffer Logic" {
     if (pop() != null) return error.TestFailed;
 }
 
+test "Keyboard Batched Wait" {
+    key_ring = .{};
+    _ = input_event.tryWait();
+
+    // Keys already buffered are returned without blocking, all in one batch.
+    push('x');
+    push('y');
+    push('z');
+    input_event.signal(3);
+
+    var batch: [2]u8 = undefined;
+    try std.testing.expect(waitKeys(&batch) == 2);
+    try std.testing.expect(batch[0] == 'x' and batch[1] == 'y');
+    try std.testing.expect(waitKeys(&batch) == 1);
+    try std.testing.expect(batch[0] == 'z');
+    try std.testing.expect(input_event.tryWait() == 0);
+}
+
+test "Keyboard Idle Wait Runs The Idle Hook" {
+    key_ring = .{};
+    _ = input_event.tryWait();
+    const Idle = struct {
+        var runs: usize = 0;
+        fn run() void {
+            runs += 1;
+        }
+    };
+
+    push('q');
+    input_event.signal(1);
+
+    var batch: [4]u8 = undefined;
+    try std.testing.expect(waitKeysIdle(&batch, Idle.run) == 1);
+    try std.testing.expect(batch[0] == 'q');
+    try std.testing.expect(Idle.runs == 1);
+    try std.testing.expect(input_event.tryWait() == 0);
+}
+
+test "Keyboard Buffer Full Drops Without Logging" {
+    key_ring = .{};
+    const before = droppedKeys();
+
+    var i: usize = 0;
+    while (i < BUFFER_SIZE + 3) : (i += 1) {
+        push('k');
+    }
+    try std.testing.expect(droppedKeys() - before == 3);
+
+    var batch: [BUFFER_SIZE]u8 = undefined;
+    try std.testing.expect(popBatch(&batch) == BUFFER_SIZE);
+    try std.testing.expect(pop() == null);
+}
+
 test "Keyboard Buffer Flush" {
     // Test that flushBuffer doesn't crash and handles empty buffer gracefully
     // Note: In test environment, we can't actually read from port 0x60/0x64,
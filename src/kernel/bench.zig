@@ -0,0 +1,47 @@
+/// Micro-benchmark helpers.
+///
+/// Benchmarks live next to the code they measure as regular `test` blocks and
+/// report through the serial console, so a `zig build test` run doubles as a
+/// benchmark run. Results are in TSC cycles, plus nanoseconds once the TSC is
+/// calibrated; QEMU TCG numbers are only useful for before/after comparisons
+/// on the same host.
+const std = @import("std");
+const serial = @import("serial.zig");
+const cpu = @import("../arch/x86_64/cpu.zig");
+const tsc = @import("../arch/x86_64/tsc.zig");
+
+/// Returns the current timestamp in cycles.
+pub fn now() u64 {
+    return cpu.rdtsc();
+}
+
+/// Prints "[BENCH] <name>: <cycles/op> cycles/op (<iterations> iterations)",
+/// with the time per op added when the TSC is calibrated.
+pub fn report(name: []const u8, total_cycles: u64, iterations: u64) void {
+    const per_op = if (iterations == 0) 0 else total_cycles / iterations;
+    var buf: [160]u8 = undefined;
+    const msg = if (tsc.isCalibrated())
+        std.fmt.bufPrint(&buf, "[BENCH] {s}: {d} cycles/op, {d} ns/op ({d} iterations)", .{ name, per_op, tsc.toNs(per_op), iterations }) catch "[BENCH] Fmt Error"
+    else
+        std.fmt.bufPrint(&buf, "[BENCH] {s}: {d} cycles/op ({d} iterations)", .{ name, per_op, iterations }) catch "[BENCH] Fmt Error";
+    serial.info(msg);
+}
+
+/// Prints "[BENCH] <name>: <units>/Mcycle" for throughput style benchmarks
+/// (pixels, bytes, ops) where a per-op figure would round to zero.
+pub fn reportThroughput(name: []const u8, units: u64, total_cycles: u64) void {
+    const per_mcycle = if (total_cycles == 0) 0 else (units * 1_000_000) / total_cycles;
+    var buf: [128]u8 = undefined;
+    const msg = std.fmt.bufPrint(&buf, "[BENCH] {s}: {d} per Mcycle ({d} units, {d} cycles)", .{ name, per_mcycle, units, total_cycles }) catch "[BENCH] Fmt Error";
+    serial.info(msg);
+}
+
+/// Prints "[BENCH] <name>: <rate>/s" for rate style benchmarks (frames,
+/// requests). Falls back to report() while the TSC is uncalibrated.
+pub fn reportRate(name: []const u8, total_cycles: u64, iterations: u64) void {
+    if (!tsc.isCalibrated() or total_cycles == 0 or iterations == 0) return report(name, total_cycles, iterations);
+    const per_sec: u64 = @intCast(@as(u128, iterations) * tsc.frequency() / total_cycles);
+    var buf: [160]u8 = undefined;
+    const msg = std.fmt.bufPrint(&buf, "[BENCH] {s}: {d}/s, {d} cycles/op ({d} iterations)", .{ name, per_sec, total_cycles / iterations, iterations }) catch "[BENCH] Fmt Error";
+    serial.info(msg);
+}
@@ -0,0 +1,428 @@
+/// Zero-Copy Channels
+///
+/// Programs share one address space, so a message can change hands instead
+/// of being copied. A sender fills a block it got from alloc_pages and
+/// passes its start to send(). The block leaves the sender's protection
+/// domain and its pages are parked (pks.KEY_PARKED): from the moment send()
+/// returns the sender can no longer touch it. recv() adds the block to the
+/// receiver's domain, which retags its pages with the receiver's key, and
+/// returns the pointer. No byte is copied: a transfer costs two key flips
+/// of the block's pages, each one TLB flush.
+///
+/// A channel has one receiver, the domain that created it; anyone may send
+/// to it. The receiver owns a block from then on and may reuse it for a
+/// reply or forward it. Kernel callers (no current domain) may send any
+/// page-aligned buffer; its keys are left alone until a program receives it.
+/// Messages still queued when a channel is destroyed are dropped and their
+/// pages stay parked.
+///
+/// Example (program side, through the kernel table):
+///   const buf = table.alloc_pages(1).?;
+///   @memcpy(buf[0..5], "hello");
+///   _ = table.channel_send(ch, buf, 5);   // buf is gone
+///   ...
+///   var len: usize = 0;
+///   const msg = table.channel_recv(ch, &len) orelse return;  // in the receiver
+const std = @import("std");
+const cpu = @import("../arch/x86_64/cpu.zig");
+const domain = @import("domain.zig");
+const io_ring = @import("io_ring.zig");
+const serial = @import("serial.zig");
+
+/// Channels that may exist at once.
+pub const MAX_CHANNELS: usize = 16;
+/// Messages a channel holds before send() reports E_BUSY (a power of two).
+pub const MAX_MESSAGES: usize = 16;
+
+const PAGE_SIZE: u64 = 4096;
+
+const Message = struct {
+    start: u64,
+    pages: u64,
+    len: u64,
+};
+
+const Channel = struct {
+    live: bool = false,
+    /// The only domain that may receive or destroy (the kernel: any caller
+    /// outside a domain).
+    receiver: domain.Requester = .{},
+    messages: [MAX_MESSAGES]Message = undefined,
+    /// Messages ever queued and ever taken; the slot is `n % MAX_MESSAGES`.
+    head: u64 = 0,
+    tail: u64 = 0,
+
+    fn queued(self: *const Channel) u64 {
+        return self.tail - self.head;
+    }
+};
+
+var channels: [MAX_CHANNELS]Channel = [_]Channel{.{}} ** MAX_CHANNELS;
+
+// Sending retags pages and shoots down TLBs, so as in domain.zig the lock
+// is held with interrupts enabled. Order: this lock, then the domain lock.
+var lock = std.atomic.Value(bool).init(false);
+
+fn acquire() void {
+    while (lock.cmpxchgWeak(false, true, .acquire, .monotonic) != null) {
+        cpu.pause();
+    }
+}
+
+fn release() void {
+    lock.store(false, .release);
+}
+
+fn lookup(id: u32) ?*Channel {
+    if (id >= MAX_CHANNELS) return null;
+    const ch = &channels[id];
+    return if (ch.live) ch else null;
+}
+
+/// True if the caller may receive from (and destroy) `ch`: its receiver,
+/// or the kernel.
+fn mayReceive(ch: *const Channel) bool {
+    const d = domain.current() orelse return true;
+    return ch.receiver.is(d);
+}
+
+/// Creates a channel, receivable only by the caller's domain, and returns
+/// its id, or null if every slot is taken.
+pub fn create() ?u32 {
+    acquire();
+    defer release();
+    for (&channels, 0..) |*ch, i| {
+        if (ch.live) continue;
+        ch.* = .{ .live = true, .receiver = domain.Requester.caller() };
+        return @intCast(i);
+    }
+    return null;
+}
+
+/// Destroys a channel, dropping queued messages. Returns false for an
+/// unknown id or a channel the caller does not receive from.
+pub fn destroy(id: u32) bool {
+    acquire();
+    defer release();
+    const ch = lookup(id) orelse return false;
+    if (!mayReceive(ch)) return false;
+    if (ch.queued() != 0) serial.warn("Channel: Destroyed with undelivered messages");
+    ch.* = .{};
+    return true;
+}
+
+/// Queues the block at `buf` holding a `len`-byte message. A program must
+/// pass the start of a block from alloc_pages (or one it received) and
+/// loses access to it. Returns 0, or io_ring.E_INVAL for an unknown
+/// channel or a block the caller does not own, or io_ring.E_BUSY when the
+/// channel is full.
+pub fn send(id: u32, buf: [*]u8, len: usize) i64 {
+    acquire();
+    defer release();
+    const ch = lookup(id) orelse return io_ring.E_INVAL;
+    if (ch.queued() == MAX_MESSAGES) return io_ring.E_BUSY;
+
+    const start = @intFromPtr(buf);
+    const msg: Message = if (domain.current()) |d| blk: {
+        // Check the length before detaching: a detached block is parked
+        // and retagging it back could fail.
+        if (!d.owns(start, len, .pages)) return io_ring.E_INVAL;
+        const region = d.detach(start) orelse return io_ring.E_INVAL;
+        break :blk .{ .start = start, .pages = region.pages, .len = len };
+    } else blk: {
+        if (len == 0 or start % PAGE_SIZE != 0) return io_ring.E_INVAL;
+        break :blk .{ .start = start, .pages = (len + PAGE_SIZE - 1) / PAGE_SIZE, .len = len };
+    };
+
+    ch.messages[ch.tail % MAX_MESSAGES] = msg;
+    ch.tail += 1;
+    return 0;
+}
+
+/// Takes the oldest message: stores its length in `len` and returns the
+/// block, now owned by the caller's domain. Returns null if the channel is
+/// unknown or empty, the caller is not its receiver, or the caller's domain
+/// has no room for the block.
+pub fn recv(id: u32, len: *usize) ?[*]u8 {
+    acquire();
+    defer release();
+    const ch = lookup(id) orelse return null;
+    if (!mayReceive(ch)) return null;
+    if (ch.queued() == 0) return null;
+
+    const msg = ch.messages[ch.head % MAX_MESSAGES];
+    if (domain.current()) |d| {
+        d.addRegion(msg.start, msg.pages, .pages) catch return null;
+    }
+    ch.head += 1;
+    len.* = @intCast(msg.len);
+    return @ptrFromInt(msg.start);
+}
+
+// --- Unit Tests ---
+
+const pks = @import("../arch/x86_64/pks.zig");
+const pmm = @import("memory/pmm.zig");
+const vmm = @import("memory/vmm.zig");
+
+test "Channel Moves A Block Between Domains" {
+    const phys = pmm.allocatePage() orelse return error.OutOfMemory;
+    const block = phys + vmm.getHhdmOffset();
+    defer {
+        vmm.setKey(block, PAGE_SIZE, pks.KEY_DEFAULT);
+        pmm.freePage(phys);
+    }
+    const buf: [*]u8 = @ptrFromInt(block);
+
+    const a = domain.create() orelse return error.OutOfMemory;
+    defer domain.destroy(a);
+    const b = domain.create() orelse return error.OutOfMemory;
+    defer domain.destroy(b);
+    _ = try domain.enter(b);
+    const id = create() orelse return error.OutOfMemory;
+    domain.leave();
+    defer _ = destroy(id);
+
+    _ = try domain.enter(a);
+    try a.addRegion(block, 1, .pages);
+    @memcpy(buf[0..4], "ping");
+    try std.testing.expect(send(id, buf, PAGE_SIZE + 1) == io_ring.E_INVAL);
+    try std.testing.expect(send(id, buf, 4) == 0);
+    try std.testing.expect(send(id, buf, 4) == io_ring.E_INVAL); // no longer a's
+    var len: usize = 0;
+    try std.testing.expect(recv(id, &len) == null); // only b receives
+    try std.testing.expect(!destroy(id));
+    domain.leave();
+    try std.testing.expect(a.region_count == 0);
+    try std.testing.expect(vmm.mappingKey(block) == pks.KEY_PARKED);
+
+    const pkrs = try domain.enter(b);
+    const got = recv(id, &len) orelse return error.TestUnexpectedResult;
+    domain.leave();
+    try std.testing.expect(got == buf and len == 4);
+    try std.testing.expect(std.mem.eql(u8, got[0..4], "ping"));
+    try std.testing.expect(vmm.mappingKey(block) == b.key.?);
+    try std.testing.expect(pks.allows(pkrs, b.key.?, true));
+    try std.testing.expect(recv(id, &len) == null);
+}
+
+test "Channel Rejects Bad Ids And Fills Up" {
+    try std.testing.expect(send(MAX_CHANNELS, undefined, 1) == io_ring.E_INVAL);
+    var len: usize = 0;
+    try std.testing.expect(recv(MAX_CHANNELS, &len) == null);
+
+    const id = create() orelse return error.OutOfMemory;
+    defer _ = destroy(id);
+    var page: [PAGE_SIZE]u8 align(PAGE_SIZE) = undefined;
+    try std.testing.expect(send(id, @ptrCast(&page[1]), 8) == io_ring.E_INVAL);
+    var i: usize = 0;
+    while (i < MAX_MESSAGES) : (i += 1) try std.testing.expect(send(id, &page, 8) == 0);
+    try std.testing.expect(send(id, &page, 8) == io_ring.E_BUSY);
+    while (recv(id, &len) != null) i -= 1;
+    try std.testing.expect(i == 0);
+}
+
+/// The baseline: a channel that copies each message into a kernel slot on
+/// send and out into the receiver's buffer on receive.
+const CopyChannel = struct {
+    slots: [MAX_MESSAGES][]u8,
+    lens: [MAX_MESSAGES]usize = undefined,
+    head: usize = 0,
+    tail: usize = 0,
+
+    fn send(self: *CopyChannel, msg: []const u8) bool {
+        if (self.tail - self.head == MAX_MESSAGES) return false;
+        const slot = self.slots[self.tail % MAX_MESSAGES];
+        @memcpy(slot[0..msg.len], msg);
+        self.lens[self.tail % MAX_MESSAGES] = msg.len;
+        self.tail += 1;
+        return true;
+    }
+
+    fn recv(self: *CopyChannel, out: []u8) ?usize {
+        if (self.tail == self.head) return null;
+        const len = self.lens[self.head % MAX_MESSAGES];
+        @memcpy(out[0..len], self.slots[self.head % MAX_MESSAGES][0..len]);
+        self.head += 1;
+        return len;
+    }
+};
+
+/// A channel that `d` receives from.
+fn createFor(d: *domain.Domain) !?u32 {
+    _ = try domain.enter(d);
+    defer domain.leave();
+    return create();
+}
+
+/// Two domains with one `pages`-page block each for the benchmarks.
+const BenchSetup = struct {
+    a: *domain.Domain,
+    b: *domain.Domain,
+    phys: [2]u64,
+    pages: usize,
+
+    fn init(pages: usize) ?BenchSetup {
+        const a = domain.create() orelse return null;
+        const b = domain.create() orelse {
+            domain.destroy(a);
+            return null;
+        };
+        const p0 = pmm.allocatePages(pages) orelse {
+            domain.destroy(b);
+            domain.destroy(a);
+            return null;
+        };
+        const p1 = pmm.allocatePages(pages) orelse {
+            pmm.freePages(p0, pages);
+            domain.destroy(b);
+            domain.destroy(a);
+            return null;
+        };
+        return .{ .a = a, .b = b, .phys = .{ p0, p1 }, .pages = pages };
+    }
+
+    fn block(self: *const BenchSetup, i: usize) [*]u8 {
+        return @ptrFromInt(self.phys[i] + vmm.getHhdmOffset());
+    }
+
+    fn deinit(self: *BenchSetup) void {
+        domain.destroy(self.b);
+        domain.destroy(self.a);
+        for (self.phys) |p| {
+            vmm.setKey(p + vmm.getHhdmOffset(), self.pages * PAGE_SIZE, pks.KEY_DEFAULT);
+            pmm.freePages(p, self.pages);
+        }
+    }
+};
+
+test "Benchmark: Channel Ping-Pong, Zero-Copy vs Memcpy" {
+    const bench = @import("bench.zig");
+    const MSG_LEN: usize = 64;
+    const rounds: u64 = 2_000;
+
+    var setup = BenchSetup.init(1) orelse return;
+    defer setup.deinit();
+    const to_b = (try createFor(setup.b)) orelse return;
+    defer _ = destroy(to_b);
+    const to_a = (try createFor(setup.a)) orelse return;
+    defer _ = destroy(to_a);
+
+    // Zero-copy: one block bounces between the domains.
+    _ = try domain.enter(setup.a);
+    try setup.a.addRegion(@intFromPtr(setup.block(0)), 1, .pages);
+    domain.leave();
+
+    var len: usize = 0;
+    var start = bench.now();
+    var i: u64 = 0;
+    while (i < rounds) : (i += 1) {
+        _ = try domain.enter(setup.a);
+        const out = if (i == 0) setup.block(0) else recv(to_a, &len).?;
+        out[0] +%= 1;
+        _ = send(to_b, out, MSG_LEN);
+        domain.leave();
+
+        _ = try domain.enter(setup.b);
+        const in = recv(to_b, &len).?;
+        in[0] +%= 1;
+        _ = send(to_a, in, MSG_LEN);
+        domain.leave();
+    }
+    bench.report("channel ping-pong zero-copy (64 B, round trip)", bench.now() - start, rounds);
+    _ = try domain.enter(setup.a);
+    _ = recv(to_a, &len);
+    domain.leave();
+
+    // Memcpy: each side keeps its own buffer, the kernel keeps copies.
+    var kernel_slots: [2][MAX_MESSAGES][MSG_LEN]u8 = undefined;
+    var ab = CopyChannel{ .slots = undefined };
+    var ba = CopyChannel{ .slots = undefined };
+    for (&ab.slots, &ba.slots, &kernel_slots[0], &kernel_slots[1]) |*x, *y, *sx, *sy| {
+        x.* = sx;
+        y.* = sy;
+    }
+    const a_buf = setup.block(0)[0..MSG_LEN];
+    const b_buf = setup.block(1)[0..MSG_LEN];
+
+    start = bench.now();
+    i = 0;
+    while (i < rounds) : (i += 1) {
+        _ = try domain.enter(setup.a);
+        if (i != 0) _ = ba.recv(a_buf);
+        a_buf[0] +%= 1;
+        _ = ab.send(a_buf);
+        domain.leave();
+
+        _ = try domain.enter(setup.b);
+        _ = ab.recv(b_buf);
+        b_buf[0] +%= 1;
+        _ = ba.send(b_buf);
+        domain.leave();
+    }
+    bench.report("channel ping-pong memcpy (64 B, round trip)", bench.now() - start, rounds);
+}
+
+test "Benchmark: Channel Bulk Throughput, Zero-Copy vs Memcpy" {
+    const bench = @import("bench.zig");
+    const PAGES: usize = 16;
+    const BYTES: usize = PAGES * PAGE_SIZE;
+    const messages: u64 = 256;
+
+    var setup = BenchSetup.init(PAGES) orelse return;
+    defer setup.deinit();
+    const id = (try createFor(setup.b)) orelse return;
+    defer _ = destroy(id);
+
+    // Zero-copy: the sender hands over a 64 KiB block, the receiver reads a
+    // byte of it and gives it back through a second channel.
+    const back = (try createFor(setup.a)) orelse return;
+    defer _ = destroy(back);
+    _ = try domain.enter(setup.a);
+    try setup.a.addRegion(@intFromPtr(setup.block(0)), PAGES, .pages);
+    domain.leave();
+
+    var len: usize = 0;
+    var sink: u64 = 0;
+    var start = bench.now();
+    var i: u64 = 0;
+    while (i < messages) : (i += 1) {
+        _ = try domain.enter(setup.a);
+        const out = if (i == 0) setup.block(0) else recv(back, &len).?;
+        _ = send(id, out, BYTES);
+        domain.leave();
+
+        _ = try domain.enter(setup.b);
+        const in = recv(id, &len).?;
+        sink +%= in[len - 1];
+        _ = send(back, in, BYTES);
+        domain.leave();
+    }
+    bench.reportThroughput("channel bulk zero-copy (bytes)", messages * BYTES, bench.now() - start);
+    _ = try domain.enter(setup.a);
+    _ = recv(back, &len);
+    domain.leave();
+
+    // Memcpy: one kernel slot is enough for a strict send/receive alternation.
+    const slot_phys = pmm.allocatePages(PAGES) orelse return;
+    defer pmm.freePages(slot_phys, PAGES);
+    const slot: [*]u8 = @ptrFromInt(slot_phys + vmm.getHhdmOffset());
+    var copy = CopyChannel{ .slots = [_][]u8{slot[0..BYTES]} ** MAX_MESSAGES };
+    const a_buf = setup.block(0)[0..BYTES];
+    const b_buf = setup.block(1)[0..BYTES];
+
+    start = bench.now();
+    i = 0;
+    while (i < messages) : (i += 1) {
+        _ = try domain.enter(setup.a);
+        _ = copy.send(a_buf);
+        domain.leave();
+
+        _ = try domain.enter(setup.b);
+        len = copy.recv(b_buf).?;
+        sink +%= b_buf[len - 1];
+        domain.leave();
+    }
+    bench.reportThroughput("channel bulk memcpy (bytes)", messages * BYTES, bench.now() - start);
+    std.mem.doNotOptimizeAway(sink);
+}
@@ -0,0 +1,556 @@
+/// Program Protection Domains
+///
+/// Every program the shell loads gets a Domain: the pages of its ELF image,
+/// the memory it gets from alloc_pages and its surfaces. The pages carry the
+/// domain's own protection key and the program runs with
+/// pks.domainPkrs(key), which denies every other program key, so programs
+/// can no longer read or write each other's memory. alloc_pages blocks can
+/// change hands between domains through channels (channel.zig).
+///
+/// PKS has 16 keys and the kernel keeps six, leaving ten for programs. A
+/// domain without a key has its pages tagged pks.KEY_PARKED, which no
+/// program may touch. enter() gives a parked domain a key back, taking it
+/// from the least recently entered domain that is neither running nor
+/// pinned (service.zig) when none is free. Both retags go into one TLB
+/// batch, so a key switch costs one shootdown however many regions move.
+/// stats() reports what retagging has cost so far; each retag also records
+/// a domain_retag tracepoint.
+///
+/// Example:
+///   const d = domain.create() orelse return;
+///   defer domain.destroy(d);
+///   // load the image, then:
+///   pks.switchTo(try domain.enter(d));
+///   entry(&table.table);
+///   pks.switchTo(pks.KERNEL_PKRS);
+///   domain.leave();
+const std = @import("std");
+const cpu = @import("../arch/x86_64/cpu.zig");
+const smp = @import("../arch/x86_64/smp.zig");
+const pks = @import("../arch/x86_64/pks.zig");
+const vmm = @import("memory/vmm.zig");
+const pmm = @import("memory/pmm.zig");
+const tlb = @import("memory/tlb.zig");
+const trace = @import("trace.zig");
+const serial = @import("serial.zig");
+
+/// Domains that may exist at once (more than there are keys).
+pub const MAX_DOMAINS: usize = 32;
+/// Regions one domain may own: image segments, alloc_pages blocks, surfaces.
+pub const MAX_REGIONS: usize = 32;
+/// Keys available to programs.
+pub const KEY_COUNT: usize = @as(usize, pks.LAST_PROGRAM_KEY) - pks.FIRST_PROGRAM_KEY + 1;
+
+const PAGE_SIZE: u64 = 4096;
+
+pub const Error = error{
+    /// The domain has no room for another region.
+    TooManyRegions,
+    /// Every program key belongs to a running or pinned domain.
+    NoFreeKey,
+};
+
+/// A run of pages owned by a domain.
+pub const Region = struct {
+    start: u64,
+    pages: u64,
+    kind: Kind,
+
+    pub const Kind = enum {
+        /// ELF segment pages.
+        image,
+        /// alloc_pages memory; the only kind that can move to another
+        /// domain (channel.zig).
+        pages,
+        /// Compositor surface pixels.
+        surface,
+    };
+};
+
+pub const Domain = struct {
+    live: bool = false,
+    id: u32 = 0,
+    key: ?u4 = null,
+    /// Value of `clock` when the domain last entered; the smallest is
+    /// evicted first.
+    last_run: u64 = 0,
+    /// CPUs running the domain right now; a running domain keeps its key.
+    active: u32 = 0,
+    /// Holders that rely on the key not changing (published services); a
+    /// pinned domain is never evicted.
+    pins: u32 = 0,
+    regions: [MAX_REGIONS]Region = undefined,
+    region_count: usize = 0,
+
+    /// The key the domain's pages carry now. Read without the lock it is a
+    /// hint: addRegion() retags to the current value anyway.
+    pub fn tag(self: *const Domain) u4 {
+        return self.key orelse pks.KEY_PARKED;
+    }
+
+    /// Records `pages` pages at `start` (already mapped) as owned by the
+    /// domain and tags them with its key.
+    pub fn addRegion(self: *Domain, start: u64, pages: u64, kind: Region.Kind) Error!void {
+        acquire();
+        defer release();
+        if (self.region_count == MAX_REGIONS) return Error.TooManyRegions;
+        self.regions[self.region_count] = .{ .start = start, .pages = pages, .kind = kind };
+        self.region_count += 1;
+        vmm.setKey(start, pages * PAGE_SIZE, self.tag());
+    }
+
+    /// Forgets the region starting at `start`, whose pages the caller is
+    /// about to unmap or hand back. Returns false if there is none.
+    pub fn removeRegion(self: *Domain, start: u64) bool {
+        acquire();
+        defer release();
+        for (self.regions[0..self.region_count], 0..) |region, i| {
+            if (region.start != start) continue;
+            self.region_count -= 1;
+            self.regions[i] = self.regions[self.region_count];
+            return true;
+        }
+        return false;
+    }
+
+    /// Takes the .pages region starting at `start` away from the domain and
+    /// parks it, so no program can reach it until a domain adds it again.
+    /// Returns null if the domain has no such region.
+    pub fn detach(self: *Domain, start: u64) ?Region {
+        acquire();
+        defer release();
+        for (self.regions[0..self.region_count], 0..) |region, i| {
+            if (region.start != start or region.kind != .pages) continue;
+            self.region_count -= 1;
+            self.regions[i] = self.regions[self.region_count];
+            if (self.key != null) vmm.setKey(region.start, region.pages * PAGE_SIZE, pks.KEY_PARKED);
+            return region;
+        }
+        return null;
+    }
+
+    /// True if [addr, addr + len) lies inside one of the domain's regions
+    /// of the given kind.
+    pub fn owns(self: *Domain, addr: u64, len: u64, kind: Region.Kind) bool {
+        acquire();
+        defer release();
+        for (self.regions[0..self.region_count]) |region| {
+            if (region.kind != kind) continue;
+            const end = region.start + region.pages * PAGE_SIZE;
+            if (addr >= region.start and addr <= end and len <= end - addr) return true;
+        }
+        return false;
+    }
+
+    /// Hands every alloc_pages block the domain still owns back to the PMM,
+    /// with the default key. Part of unloading a program; blocks sent away
+    /// through a channel belong to their receiver by then. Returns the
+    /// pages freed.
+    pub fn releasePages(self: *Domain) u64 {
+        acquire();
+        defer release();
+        var batch = tlb.Batch{};
+        var freed: [MAX_REGIONS]Region = undefined;
+        var count: usize = 0;
+        var i: usize = 0;
+        while (i < self.region_count) {
+            const region = self.regions[i];
+            if (region.kind != .pages) {
+                i += 1;
+                continue;
+            }
+            _ = vmm.setKeyBatched(region.start, region.pages * PAGE_SIZE, pks.KEY_DEFAULT, &batch);
+            freed[count] = region;
+            count += 1;
+            self.region_count -= 1;
+            self.regions[i] = self.regions[self.region_count];
+        }
+        // No CPU may still reach a block through a stale translation.
+        batch.flush();
+
+        var pages: u64 = 0;
+        for (freed[0..count]) |region| {
+            pmm.freePages(region.start - vmm.getHhdmOffset(), region.pages);
+            pages += region.pages;
+        }
+        return pages;
+    }
+
+    /// Keeps the domain's current key until unpin(). The domain must hold
+    /// a key (it does while it runs).
+    pub fn pin(self: *Domain) void {
+        acquire();
+        defer release();
+        self.pins += 1;
+    }
+
+    pub fn unpin(self: *Domain) void {
+        acquire();
+        defer release();
+        self.pins -= 1;
+    }
+
+    /// Total pages in the domain's regions.
+    pub fn pageCount(self: *const Domain) u64 {
+        var total: u64 = 0;
+        for (self.regions[0..self.region_count]) |region| total += region.pages;
+        return total;
+    }
+};
+
+/// Running totals of the cost of moving keys between domains.
+pub const Stats = struct {
+    /// Keys taken from one domain for another.
+    evictions: u64 = 0,
+    /// Retag operations: key assignments (with the eviction they may
+    /// cause) and key releases by destroy().
+    retags: u64 = 0,
+    /// 4KB pages whose key changed.
+    pages: u64 = 0,
+    /// TSC cycles spent retagging, TLB shootdowns included.
+    cycles: u64 = 0,
+};
+
+var domains: [MAX_DOMAINS]Domain = [_]Domain{.{}} ** MAX_DOMAINS;
+/// Domain holding each program key (index: key - FIRST_PROGRAM_KEY).
+var owners: [KEY_COUNT]?*Domain = [_]?*Domain{null} ** KEY_COUNT;
+/// Domain each CPU is running, if any.
+var running: [smp.MAX_CPUS]?*Domain = [_]?*Domain{null} ** smp.MAX_CPUS;
+var clock: u64 = 0;
+var next_id: u32 = 1;
+var totals: Stats = .{};
+
+// Retags shoot down TLBs, which waits for other CPUs to take an IPI, so the
+// lock is held with interrupts enabled: a CPU spinning here still acks.
+var lock = std.atomic.Value(bool).init(false);
+
+fn acquire() void {
+    while (lock.cmpxchgWeak(false, true, .acquire, .monotonic) != null) {
+        cpu.pause();
+    }
+}
+
+fn release() void {
+    lock.store(false, .release);
+}
+
+/// Creates an empty domain, with a free key if there is one (a new domain
+/// never evicts). Returns null if every domain slot is taken.
+pub fn create() ?*Domain {
+    acquire();
+    defer release();
+    const d = for (&domains) |*slot| {
+        if (!slot.live) break slot;
+    } else return null;
+
+    d.* = .{ .live = true, .id = next_id };
+    next_id += 1;
+    if (freeKey()) |key| {
+        owners[key - pks.FIRST_PROGRAM_KEY] = d;
+        d.key = key;
+    }
+    return d;
+}
+
+/// Releases the domain's key and parks its remaining pages so no later
+/// program can reach them. The domain must not be running.
+pub fn destroy(d: *Domain) void {
+    acquire();
+    defer release();
+    if (d.active != 0) {
+        serial.warn("Domain: Destroying a running domain");
+    }
+    if (d.pins != 0) {
+        serial.warn("Domain: Destroying a pinned domain");
+    }
+    if (d.key) |key| {
+        var batch = tlb.Batch{};
+        const start = cpu.rdtsc();
+        const pages = retag(d, pks.KEY_PARKED, &batch);
+        batch.flush();
+        account(d, pks.KEY_PARKED, pages, cpu.rdtsc() - start);
+        owners[key - pks.FIRST_PROGRAM_KEY] = null;
+    }
+    d.* = .{};
+}
+
+/// Marks `d` as running on this CPU and returns the PKRS to run it with.
+/// A parked domain gets a key first, evicting the least recently entered
+/// idle domain when none is free.
+pub fn enter(d: *Domain) Error!u32 {
+    acquire();
+    defer release();
+    if (d.key == null) try assignKey(d);
+
+    clock += 1;
+    d.last_run = clock;
+    d.active += 1;
+    running[smp.currentIndex()] = d;
+    return pks.domainPkrs(d.key.?);
+}
+
+/// Ends the domain this CPU entered last.
+pub fn leave() void {
+    acquire();
+    defer release();
+    const slot = &running[smp.currentIndex()];
+    const d = slot.* orelse return;
+    d.active -= 1;
+    slot.* = null;
+}
+
+/// The domain this CPU is running, if any. Kernel-table calls made by a
+/// program see the program's domain.
+pub fn current() ?*Domain {
+    return running[smp.currentIndex()];
+}
+
+/// Who the kernel acts for when it uses pointers after the table call that
+/// handed them over returned (io_ring SQEs, parked reads). Remembers the
+/// domain by id, so a destroyed or reused slot is not mistaken for it.
+pub const Requester = struct {
+    /// Null: the kernel itself.
+    domain: ?*const Domain = null,
+    id: u32 = 0,
+
+    /// The caller of the current kernel-table call.
+    pub fn caller() Requester {
+        const d = running[smp.currentIndex()] orelse return .{};
+        return .{ .domain = d, .id = d.id };
+    }
+
+    /// True if `d` is the requester's domain and not a later domain reusing
+    /// its slot.
+    pub fn is(self: Requester, d: *const Domain) bool {
+        return self.domain == d and d.id == self.id;
+    }
+
+    /// The PKRS to check the requester's pointers against now. A domain
+    /// without a key, or one that is gone, reaches no program pages.
+    pub fn rights(self: Requester) u32 {
+        const d = self.domain orelse return pks.KERNEL_PKRS;
+        if (!d.live or d.id != self.id) return pks.PROGRAM_PKRS;
+        return if (d.key) |key| pks.domainPkrs(key) else pks.PROGRAM_PKRS;
+    }
+};
+
+/// Retag costs so far.
+pub fn stats() Stats {
+    acquire();
+    defer release();
+    return totals;
+}
+
+fn freeKey() ?u4 {
+    for (owners, 0..) |owner, i| {
+        if (owner == null) return @intCast(pks.FIRST_PROGRAM_KEY + i);
+    }
+    return null;
+}
+
+/// Gives `d` a key, moving its pages off KEY_PARKED. Called with the lock.
+fn assignKey(d: *Domain) Error!void {
+    var batch = tlb.Batch{};
+    const start = cpu.rdtsc();
+    var pages: u64 = 0;
+
+    const key = freeKey() orelse blk: {
+        const victim = leastRecentlyRun() orelse return Error.NoFreeKey;
+        const key = victim.key.?;
+        pages += retag(victim, pks.KEY_PARKED, &batch);
+        victim.key = null;
+        totals.evictions += 1;
+        break :blk key;
+    };
+    owners[key - pks.FIRST_PROGRAM_KEY] = d;
+    d.key = key;
+    pages += retag(d, key, &batch);
+
+    // The new owner must not hit a stale translation carrying the parked
+    // key, nor the old owner one carrying the recycled key.
+    batch.flush();
+    account(d, key, pages, cpu.rdtsc() - start);
+}
+
+/// The idle, unpinned key holder entered longest ago.
+fn leastRecentlyRun() ?*Domain {
+    var best: ?*Domain = null;
+    for (owners) |owner| {
+        const d = owner orelse continue;
+        if (d.active != 0 or d.pins != 0) continue;
+        if (best == null or d.last_run < best.?.last_run) best = d;
+    }
+    return best;
+}
+
+fn retag(d: *const Domain, key: u4, batch: *tlb.Batch) u64 {
+    var pages: u64 = 0;
+    for (d.regions[0..d.region_count]) |region| {
+        pages += vmm.setKeyBatched(region.start, region.pages * PAGE_SIZE, key, batch);
+    }
+    return pages;
+}
+
+fn account(d: *const Domain, key: u4, pages: u64, cycles: u64) void {
+    totals.retags += 1;
+    totals.pages += pages;
+    totals.cycles += cycles;
+    trace.point(.domain_retag, .{ d.id, key, pages, cycles });
+}
+
+// --- Unit Tests ---
+
+/// One HHDM page per domain, handed back with the default key.
+const TestPages = struct {
+    phys: [KEY_COUNT + 1]u64 = undefined,
+    count: usize = 0,
+
+    fn take(self: *TestPages) !u64 {
+        const phys = pmm.allocatePage() orelse return error.OutOfMemory;
+        self.phys[self.count] = phys;
+        self.count += 1;
+        return phys + vmm.getHhdmOffset();
+    }
+
+    fn free(self: *TestPages) void {
+        for (self.phys[0..self.count]) |phys| {
+            vmm.setKey(phys + vmm.getHhdmOffset(), PAGE_SIZE, pks.KEY_DEFAULT);
+            pmm.freePage(phys);
+        }
+    }
+};
+
+test "Domain Keys Are Recycled Least Recently Run First" {
+    var pages = TestPages{};
+    defer pages.free();
+    var made: [KEY_COUNT + 1]*Domain = undefined;
+    var made_count: usize = 0;
+    defer {
+        for (made[0..made_count]) |d| destroy(d);
+    }
+
+    // Fill every key, entering each domain once in order.
+    while (made_count < KEY_COUNT + 1) : (made_count += 1) {
+        const d = create() orelse return error.OutOfMemory;
+        made[made_count] = d;
+        try d.addRegion(try pages.take(), 1, .pages);
+    }
+    for (made[0..KEY_COUNT]) |d| {
+        try std.testing.expect(d.key != null);
+        try std.testing.expect(vmm.mappingKey(d.regions[0].start) == d.key.?);
+        _ = try enter(d);
+        leave();
+    }
+
+    // The extra domain started parked and takes the first domain's key.
+    const extra = made[KEY_COUNT];
+    try std.testing.expect(extra.key == null);
+    try std.testing.expect(vmm.mappingKey(extra.regions[0].start) == pks.KEY_PARKED);
+    const before = stats();
+    const first_key = made[0].key.?;
+    const pkrs = try enter(extra);
+    leave();
+
+    try std.testing.expect(extra.key == first_key);
+    try std.testing.expect(pkrs == pks.domainPkrs(first_key));
+    try std.testing.expect(made[0].key == null);
+    try std.testing.expect(vmm.mappingKey(made[0].regions[0].start) == pks.KEY_PARKED);
+    try std.testing.expect(vmm.mappingKey(extra.regions[0].start) == first_key);
+
+    const after = stats();
+    try std.testing.expect(after.evictions == before.evictions + 1);
+    try std.testing.expect(after.pages == before.pages + 2);
+
+    // A running domain keeps its key. Pretend made[1], now the least
+    // recently run holder, is running on another CPU: made[2] goes instead.
+    made[1].active += 1;
+    defer made[1].active -= 1;
+    _ = try enter(made[0]);
+    leave();
+    try std.testing.expect(made[1].key != null);
+    try std.testing.expect(made[2].key == null);
+}
+
+test "Domain Region Bookkeeping" {
+    const d = create() orelse return error.OutOfMemory;
+    defer destroy(d);
+    var pages = TestPages{};
+    defer pages.free();
+
+    const a = try pages.take();
+    const b = try pages.take();
+    try d.addRegion(a, 1, .pages);
+    try d.addRegion(b, 1, .image);
+    try std.testing.expect(d.pageCount() == 2);
+    try std.testing.expect(d.removeRegion(a));
+    try std.testing.expect(!d.removeRegion(a));
+    try std.testing.expect(d.region_count == 1 and d.regions[0].start == b);
+
+    // Only alloc_pages memory can be detached; detached pages are parked.
+    try std.testing.expect(d.detach(b) == null);
+    try d.addRegion(a, 1, .pages);
+    const moved = d.detach(a) orelse return error.TestUnexpectedResult;
+    try std.testing.expect(moved.pages == 1 and d.region_count == 1);
+    try std.testing.expect(vmm.mappingKey(a) == pks.KEY_PARKED);
+    try std.testing.expect(current() == null);
+}
+
+test "Domain Releases Its Blocks On Unload" {
+    const d = create() orelse return error.OutOfMemory;
+    defer destroy(d);
+    var pages = TestPages{};
+    defer pages.free();
+
+    const phys = pmm.allocatePages(2) orelse return error.OutOfMemory;
+    const block = phys + vmm.getHhdmOffset();
+    const image = try pages.take();
+    try d.addRegion(block, 2, .pages);
+    try d.addRegion(image, 1, .image);
+
+    try std.testing.expect(d.releasePages() == 2);
+    try std.testing.expect(d.region_count == 1 and d.regions[0].kind == .image);
+    try std.testing.expect(vmm.mappingKey(block) == pks.KEY_DEFAULT);
+    try std.testing.expect(d.releasePages() == 0);
+}
+
+test "Benchmark: Domain Key Eviction" {
+    const bench = @import("bench.zig");
+    const REGION_PAGES: usize = 16;
+
+    // KEY_COUNT + 1 domains of 16 pages each, entered round robin: every
+    // enter evicts the least recently run domain.
+    var phys: [KEY_COUNT + 1]u64 = undefined;
+    var made: [KEY_COUNT + 1]*Domain = undefined;
+    var n: usize = 0;
+    defer {
+        for (made[0..n], phys[0..n]) |d, p| {
+            destroy(d);
+            vmm.setKey(p + vmm.getHhdmOffset(), REGION_PAGES * PAGE_SIZE, pks.KEY_DEFAULT);
+            pmm.freePages(p, REGION_PAGES);
+        }
+    }
+    while (n < made.len) : (n += 1) {
+        phys[n] = pmm.allocatePages(REGION_PAGES) orelse return;
+        made[n] = create() orelse {
+            pmm.freePages(phys[n], REGION_PAGES);
+            return;
+        };
+        try made[n].addRegion(phys[n] + vmm.getHhdmOffset(), REGION_PAGES, .pages);
+    }
+
+    const before = stats();
+    const rounds: usize = 20;
+    const start = bench.now();
+    var i: usize = 0;
+    while (i < rounds * made.len) : (i += 1) {
+        _ = try enter(made[i % made.len]);
+        leave();
+    }
+    const elapsed = bench.now() - start;
+    const after = stats();
+
+    bench.report("domain enter with eviction (16 pages)", elapsed, rounds * made.len);
+    const retags = after.retags - before.retags;
+    bench.report("domain retag (cycles per retag)", after.cycles - before.cycles, retags);
+    bench.report("domain retag (cycles per page)", after.cycles - before.cycles, after.pages - before.pages);
+}
@@ -0,0 +1,97 @@
+/// Waitable Events
+///
+/// An eventfd-like counter: producers (usually IRQ handlers) add to it with
+/// signal(), consumers block in wait() until it is non-zero and take the whole
+/// count at once. One wakeup therefore covers every signal since the last wait,
+/// which lets consumers drain input in batches.
+///
+/// There is no scheduler, so a waiting CPU parks in `hlt`. Waiters advertise
+/// themselves in a CPU mask; signal() sends a wake-up IPI to waiting CPUs other
+/// than the current one (a CPU halted on the signalling IRQ wakes by itself).
+const std = @import("std");
+const cpu = @import("../arch/x86_64/cpu.zig");
+const smp = @import("../arch/x86_64/smp.zig");
+const apic = @import("../arch/x86_64/apic.zig");
+const idt = @import("../arch/x86_64/idt.zig");
+const serial = @import("serial.zig");
+
+/// IPI vector used only to bring a halted CPU out of `hlt`.
+pub const WAKE_VECTOR: u8 = 0xFC;
+
+pub const Event = struct {
+    count: std.atomic.Value(u64) = std.atomic.Value(u64).init(0),
+    /// CPUs currently parked in wait() on this event.
+    waiters: std.atomic.Value(u64) = std.atomic.Value(u64).init(0),
+
+    /// Adds `n` to the counter and wakes waiting CPUs. Safe from IRQ context.
+    pub fn signal(self: *Event, n: u64) void {
+        _ = self.count.fetchAdd(n, .seq_cst);
+        // Pairs with the waiter's register-then-check in wait().
+        const others = self.waiters.load(.seq_cst) & ~smp.cpuBit(smp.currentIndex());
+        if (others == 0) return;
+
+        var pending = others;
+        while (pending != 0) : (pending &= pending - 1) {
+            apic.sendIpi(smp.lapicId(@ctz(pending)), WAKE_VECTOR);
+        }
+    }
+
+    /// Takes the counter without blocking. Returns 0 if nothing was signalled.
+    pub fn tryWait(self: *Event) u64 {
+        return self.count.swap(0, .acquire);
+    }
+
+    /// Blocks until the counter is non-zero, then takes and returns it.
+    /// Must not be called with interrupts disabled by a caller that relies on
+    /// an IRQ to signal the event (it would never arrive).
+    pub fn wait(self: *Event) u64 {
+        const was_enabled = cpu.interruptsEnabled();
+        const me = smp.cpuBit(smp.currentIndex());
+
+        while (true) {
+            // IF=0 from the check to the hlt so a signal cannot slip in between.
+            cpu.disableInterrupts();
+            _ = self.waiters.fetchOr(me, .seq_cst);
+            const n = self.count.swap(0, .seq_cst);
+            if (n != 0) {
+                _ = self.waiters.fetchAnd(~me, .seq_cst);
+                if (was_enabled) cpu.enableInterrupts();
+                return n;
+            }
+            cpu.waitForInterrupt();
+            _ = self.waiters.fetchAnd(~me, .seq_cst);
+        }
+    }
+};
+
+/// Registers the wake-up IPI handler.
+pub fn init() void {
+    idt.registerFastHandler(WAKE_VECTOR, wakeHandler) catch {
+        serial.err("Event: Wake vector already in use!");
+        return;
+    };
+}
+
+/// The IPI's only job is to end `hlt`; the woken CPU rechecks its event.
+fn wakeHandler(vector: u64) callconv(.c) void {
+    _ = vector;
+    apic.sendEoi();
+}
+
+// --- Unit Tests ---
+
+test "Event Signal And Wait" {
+    var ev = Event{};
+    try std.testing.expect(ev.tryWait() == 0);
+
+    // Several signals are delivered as one batch.
+    ev.signal(1);
+    ev.signal(2);
+    try std.testing.expect(ev.wait() == 3);
+    try std.testing.expect(ev.tryWait() == 0);
+    try std.testing.expect(ev.waiters.load(.acquire) == 0);
+}
+
+test "Event Wake Vector Registered" {
+    try std.testing.expectError(error.VectorInUse, idt.registerFastHandler(WAKE_VECTOR, wakeHandler));
+}
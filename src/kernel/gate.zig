@@ -0,0 +1,184 @@
+/// Kernel Table Call Gates
+///
+/// Programs run in ring 0 with PROGRAM_PKRS, which denies the kernel's
+/// protection domains (pks.zig). Every KernelTable entry is therefore a gate
+/// generated by wrap() around the kernel function:
+///   1. read PKRS (the caller's rights) and switch to KERNEL_PKRS;
+///   2. if the caller is not the kernel, check that every pointer argument
+///      is mapped and that the caller could access it itself, so a program
+///      cannot make the kernel read or write memory on its behalf;
+///   3. run the kernel function;
+///   4. restore the caller's PKRS.
+/// Pointers carried inside data (io_ring SQEs, draw commands) are invisible
+/// here; the code that follows them checks them with rangeAccessible()
+/// against the rights of the domain they came from (domain.Requester).
+///
+/// A kernel-internal caller pays one rdmsr; a program pays an rdmsr, two
+/// wrmsr (PKRS writes are not serializing) and a page walk per argument page.
+/// A rejected call logs a warning and returns rejected(R): nothing for void,
+/// null for optionals, 0 for unsigned and io_ring.E_FAULT for signed results.
+const std = @import("std");
+const pks = @import("../arch/x86_64/pks.zig");
+const vmm = @import("memory/vmm.zig");
+const io_ring = @import("io_ring.zig");
+const serial = @import("serial.zig");
+
+const PAGE_SIZE: u64 = 4096;
+/// Largest buffer a single argument may describe.
+pub const MAX_ARG_BYTES: u64 = 64 * 1024 * 1024;
+
+/// Returns a gate with the same C signature as `func`.
+pub fn wrap(comptime func: anytype) *const @TypeOf(func) {
+    const G = Gate(func);
+    return switch (G.params.len) {
+        0 => &G.call0,
+        1 => &G.call1,
+        2 => &G.call2,
+        3 => &G.call3,
+        4 => &G.call4,
+        5 => &G.call5,
+        6 => &G.call6,
+        else => @compileError("gate.wrap: too many parameters"),
+    };
+}
+
+fn Gate(comptime func: anytype) type {
+    return struct {
+        const Fn = @TypeOf(func);
+        const params = @typeInfo(Fn).@"fn".params;
+        const R = @typeInfo(Fn).@"fn".return_type.?;
+
+        fn P(comptime i: usize) type {
+            return params[i].type.?;
+        }
+
+        inline fn run(args: std.meta.ArgsTuple(Fn)) R {
+            const caller = pks.enterKernel();
+            defer pks.leave(caller);
+            if (caller != pks.KERNEL_PKRS and !argsValid(caller, args)) {
+                serial.warn("Gate: Rejected a kernel table call with an inaccessible pointer");
+                return rejected(R);
+            }
+            return @call(.auto, func, args);
+        }
+
+        fn call0() callconv(.c) R {
+            return run(.{});
+        }
+        fn call1(a: P(0)) callconv(.c) R {
+            return run(.{a});
+        }
+        fn call2(a: P(0), b: P(1)) callconv(.c) R {
+            return run(.{ a, b });
+        }
+        fn call3(a: P(0), b: P(1), c: P(2)) callconv(.c) R {
+            return run(.{ a, b, c });
+        }
+        fn call4(a: P(0), b: P(1), c: P(2), d: P(3)) callconv(.c) R {
+            return run(.{ a, b, c, d });
+        }
+        fn call5(a: P(0), b: P(1), c: P(2), d: P(3), e: P(4)) callconv(.c) R {
+            return run(.{ a, b, c, d, e });
+        }
+        fn call6(a: P(0), b: P(1), c: P(2), d: P(3), e: P(4), f: P(5)) callconv(.c) R {
+            return run(.{ a, b, c, d, e, f });
+        }
+    };
+}
+
+/// The value a gate returns for a rejected call.
+fn rejected(comptime R: type) R {
+    return switch (@typeInfo(R)) {
+        .void => {},
+        .optional => null,
+        .int => |int| if (int.signedness == .signed) @as(R, io_ring.E_FAULT) else 0,
+        else => @compileError("gate: no rejection value for " ++ @typeName(R)),
+    };
+}
+
+/// Checks the pointer arguments in `args` against the rights `pkrs`.
+/// A many-pointer followed by a usize is a (pointer, element count) pair;
+/// any other pointer covers one element.
+pub fn argsValid(pkrs: u32, args: anytype) bool {
+    const fields = @typeInfo(@TypeOf(args)).@"struct".fields;
+    inline for (fields, 0..) |field, i| {
+        switch (@typeInfo(field.type)) {
+            .pointer => |ptr| {
+                const counted = ptr.size == .many and i + 1 < fields.len and fields[i + 1].type == usize;
+                const count: u64 = if (counted) args[i + 1] else 1;
+                const bytes = std.math.mul(u64, count, @sizeOf(ptr.child)) catch return false;
+                if (bytes > MAX_ARG_BYTES) return false;
+                if (!rangeAccessible(pkrs, @intFromPtr(args[i]), bytes, !ptr.is_const)) return false;
+            },
+            else => {},
+        }
+    }
+    return true;
+}
+
+/// True if every page of [addr, addr + len) is mapped and its key allows
+/// the access under `pkrs`.
+pub fn rangeAccessible(pkrs: u32, addr: u64, len: u64, write: bool) bool {
+    if (len == 0) return true;
+    const end = std.math.add(u64, addr, len) catch return false;
+    var page = addr & ~(PAGE_SIZE - 1);
+    while (page < end) : (page += PAGE_SIZE) {
+        const key = vmm.mappingKey(page) orelse return false;
+        if (!pks.allows(pkrs, key, write)) return false;
+    }
+    return true;
+}
+
+// --- Unit Tests ---
+
+const heap = @import("memory/heap.zig");
+
+test "Gate Argument Checks Follow The Caller's Rights" {
+    var local: [16]u8 = undefined;
+    const stack_args = .{ @as([*]const u8, &local), @as(usize, local.len) };
+    try std.testing.expect(argsValid(pks.PROGRAM_PKRS, stack_args));
+
+    // Heap memory is the kernel's: fine for kernel callers only.
+    const allocator = heap.getAllocator();
+    const buf = try allocator.alloc(u8, 64);
+    defer allocator.free(buf);
+    const heap_args = .{ @as([*]u8, buf.ptr), @as(usize, buf.len) };
+    try std.testing.expect(argsValid(pks.KERNEL_PKRS, heap_args));
+    try std.testing.expect(!argsValid(pks.PROGRAM_PKRS, heap_args));
+
+    // Unmapped, wrapping and oversized ranges.
+    try std.testing.expect(!rangeAccessible(pks.KERNEL_PKRS, 0xFFFF_9200_0000_0000, 8, false));
+    try std.testing.expect(!rangeAccessible(pks.KERNEL_PKRS, std.math.maxInt(u64) - 4, 8, false));
+    const huge = .{ @as([*]const u8, &local), @as(usize, MAX_ARG_BYTES + 1) };
+    try std.testing.expect(!argsValid(pks.KERNEL_PKRS, huge));
+}
+
+test "Gate Rejects Program Calls With Kernel Pointers" {
+    const Probe = struct {
+        var calls: usize = 0;
+        fn fill(buf: [*]u8, len: usize) callconv(.c) i64 {
+            calls += 1;
+            @memset(buf[0..len], 0xAA);
+            return @intCast(len);
+        }
+    };
+    const gated = wrap(Probe.fill);
+
+    var local: [8]u8 = undefined;
+    try std.testing.expect(gated(&local, local.len) == 8);
+    try std.testing.expect(Probe.calls == 1);
+    if (!pks.isEnabled()) return;
+
+    const allocator = heap.getAllocator();
+    const buf = try allocator.alloc(u8, 32);
+    defer allocator.free(buf);
+
+    pks.switchTo(pks.PROGRAM_PKRS);
+    const ok = gated(&local, local.len);
+    const bad = gated(buf.ptr, buf.len);
+    pks.switchTo(pks.KERNEL_PKRS);
+
+    try std.testing.expect(ok == 8);
+    try std.testing.expect(bad == io_ring.E_FAULT);
+    try std.testing.expect(Probe.calls == 2);
+}
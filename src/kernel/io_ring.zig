@@ -0,0 +1,584 @@
+/// Async I/O Rings
+///
+/// io_uring-style submission/completion queues shared between a program and the
+/// kernel. The program fills Submission Queue Entries (SQEs) and publishes them
+/// by advancing `sq_tail`; nothing crosses into the kernel per operation. One
+/// `io_enter` table call (or the kernel's idle-loop worker, see poll()) consumes
+/// every pending SQE, and results come back as Completion Queue Entries (CQEs)
+/// that the program harvests in bulk by advancing `cq_head`.
+///
+/// Each ring index has exactly one writer (sq_tail/cq_head: program,
+/// sq_head/cq_tail: kernel) and lives on its own cache line, so the queues are
+/// lock-free single-producer/single-consumer rings.
+///
+/// Operations that cannot complete immediately (a key read with no key
+/// buffered) are parked in the kernel and completed from the keyboard IRQ.
+/// Completion order therefore need not match submission order; match CQEs to
+/// requests with `user_data`.
+///
+/// Buffers named in SQEs are used after io_enter has returned (from poll()
+/// or the keyboard IRQ), so the call gate cannot check them. A ring
+/// remembers who set it up, and every buffer is checked against that
+/// domain's rights when its SQE executes and again when a parked read
+/// completes.
+const std = @import("std");
+const serial = @import("serial.zig");
+const pmm = @import("memory/pmm.zig");
+const vmm = @import("memory/vmm.zig");
+const framebuffer = @import("../drivers/graphics/framebuffer.zig");
+const keyboard = @import("../drivers/keyboard.zig");
+const cpu = @import("../arch/x86_64/cpu.zig");
+const domain = @import("domain.zig");
+const gate = @import("gate.zig");
+
+pub const RING_MAGIC: u32 = 0x52494E47; // "RING"
+
+/// Largest SQ a program may request. The CQ is twice the SQ size.
+pub const MAX_ENTRIES: u32 = 256;
+
+/// Rings that may exist at once.
+const MAX_RINGS: usize = 8;
+
+/// Key reads that may wait for input per ring.
+const MAX_PENDING_READS: usize = 8;
+
+/// Longest message accepted by a single `log` operation.
+const MAX_LOG_LEN: u64 = 4096;
+
+const PAGE_SIZE: u64 = 4096;
+
+/// Operation codes.
+pub const Opcode = enum(u8) {
+    /// Completes immediately with result 0. Useful for measuring ring overhead.
+    nop = 0,
+    /// args[0] = message pointer, args[1] = length. Result: bytes written.
+    log = 1,
+    /// args[0] = buffer pointer, args[1] = buffer length.
+    /// Completes once at least one key is available. Result: keys copied.
+    read_key = 2,
+    /// args[0..5] = x, y, w, h, color (0xAARRGGBB). Result: 0.
+    draw_rect = 3,
+    /// args[0] = color. Fills the whole framebuffer. Result: 0.
+    fill = 4,
+    _,
+};
+
+/// Negative CQE results (errno style).
+pub const E_FAULT: i64 = -14;
+pub const E_BUSY: i64 = -16;
+pub const E_NODEV: i64 = -19;
+pub const E_INVAL: i64 = -22;
+pub const E_CANCELED: i64 = -125;
+
+/// Submission Queue Entry (one cache line).
+pub const Sqe = extern struct {
+    opcode: Opcode,
+    flags: u8 = 0,
+    reserved: [6]u8 = [_]u8{0} ** 6,
+    /// Opaque value copied into the matching CQE.
+    user_data: u64,
+    args: [6]u64 = [_]u64{0} ** 6,
+
+    pub fn nop(user_data: u64) Sqe {
+        return .{ .opcode = .nop, .user_data = user_data };
+    }
+
+    pub fn log(msg: []const u8, user_data: u64) Sqe {
+        return .{ .opcode = .log, .user_data = user_data, .args = .{ @intFromPtr(msg.ptr), msg.len, 0, 0, 0, 0 } };
+    }
+
+    pub fn readKey(buf: []u8, user_data: u64) Sqe {
+        return .{ .opcode = .read_key, .user_data = user_data, .args = .{ @intFromPtr(buf.ptr), buf.len, 0, 0, 0, 0 } };
+    }
+
+    pub fn drawRect(x: u32, y: u32, w: u32, h: u32, color: u32, user_data: u64) Sqe {
+        return .{ .opcode = .draw_rect, .user_data = user_data, .args = .{ x, y, w, h, color, 0 } };
+    }
+
+    pub fn fill(color: u32, user_data: u64) Sqe {
+        return .{ .opcode = .fill, .user_data = user_data, .args = .{ color, 0, 0, 0, 0, 0 } };
+    }
+};
+
+/// Completion Queue Entry.
+pub const Cqe = extern struct {
+    user_data: u64,
+    /// >= 0 on success (opcode specific), negative E_* code on failure.
+    result: i64,
+};
+
+/// Shared ring header at the start of the ring memory. SQE and CQE arrays
+/// follow at `sq_offset` and `cq_offset` bytes from the header.
+pub const RingHeader = extern struct {
+    magic: u32,
+    sq_entries: u32,
+    cq_entries: u32,
+    sq_offset: u32,
+    cq_offset: u32,
+    /// Total size of the ring memory in pages.
+    pages: u32,
+    reserved: [2]u32 = .{ 0, 0 },
+
+    // Free-running indices (wrap at 2^32). Entries are at index & (entries - 1).
+    /// Next SQE the kernel will consume. Written by the kernel.
+    sq_head: u32 align(std.atomic.cache_line) = 0,
+    /// One past the last published SQE. Written by the program.
+    sq_tail: u32 align(std.atomic.cache_line) = 0,
+    /// Next CQE the program will harvest. Written by the program.
+    cq_head: u32 align(std.atomic.cache_line) = 0,
+    /// One past the last posted CQE. Written by the kernel.
+    cq_tail: u32 align(std.atomic.cache_line) = 0,
+};
+
+/// Typed view of a ring's memory, for the program that owns it. The kernel
+/// never trusts the header's geometry (the program can rewrite it) and
+/// indexes through the copy in its own `Ring` instead.
+pub const RingView = struct {
+    header: *RingHeader,
+
+    pub fn sqes(self: RingView) [*]Sqe {
+        return @ptrFromInt(@intFromPtr(self.header) + self.header.sq_offset);
+    }
+
+    pub fn cqes(self: RingView) [*]Cqe {
+        return @ptrFromInt(@intFromPtr(self.header) + self.header.cq_offset);
+    }
+
+    /// CQEs posted but not yet harvested.
+    pub fn cqReady(self: RingView) u32 {
+        return @atomicLoad(u32, &self.header.cq_tail, .acquire) -% @atomicLoad(u32, &self.header.cq_head, .acquire);
+    }
+
+    /// SQEs published but not yet consumed.
+    pub fn sqPending(self: RingView) u32 {
+        return @atomicLoad(u32, &self.header.sq_tail, .acquire) -% @atomicLoad(u32, &self.header.sq_head, .acquire);
+    }
+};
+
+/// Kernel-side state for one ring. The geometry is fixed at setup() and
+/// only the free-running indices are read from the shared header.
+const Ring = struct {
+    view: RingView,
+    sqes: [*]Sqe,
+    cqes: [*]Cqe,
+    sq_entries: u32,
+    cq_entries: u32,
+    phys: u64,
+    pages: usize,
+    /// Whose buffers the SQEs name.
+    requester: domain.Requester,
+    pending_reads: [MAX_PENDING_READS]Sqe = undefined,
+    pending_count: usize = 0,
+};
+
+var rings: [MAX_RINGS]?Ring = [_]?Ring{null} ** MAX_RINGS;
+
+// Serializes kernel-side ring processing (table calls, IRQ completions, poll()).
+var lock = std.atomic.Value(bool).init(false);
+
+/// Disables interrupts and takes the ring lock. Returns the previous IF state.
+fn acquire() bool {
+    const was_enabled = cpu.interruptsEnabled();
+    cpu.disableInterrupts();
+    while (lock.cmpxchgWeak(false, true, .acquire, .monotonic) != null) {
+        cpu.pause();
+    }
+    return was_enabled;
+}
+
+fn release(was_enabled: bool) void {
+    lock.store(false, .release);
+    if (was_enabled) cpu.enableInterrupts();
+}
+
+fn pagesFor(bytes: u64) usize {
+    return @intCast((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+}
+
+/// Creates a ring with `entries` SQEs (rounded up to a power of two) and
+/// returns its header, or null on bad size / out of memory / too many rings.
+pub fn setup(entries: u32) ?*RingHeader {
+    if (entries == 0 or entries > MAX_ENTRIES) return null;
+    const sq_entries = std.math.ceilPowerOfTwo(u32, entries) catch return null;
+    const cq_entries = sq_entries * 2;
+
+    const sq_offset: u64 = PAGE_SIZE;
+    const cq_offset: u64 = sq_offset + pagesFor(@as(u64, sq_entries) * @sizeOf(Sqe)) * PAGE_SIZE;
+    const pages = pagesFor(cq_offset + @as(u64, cq_entries) * @sizeOf(Cqe));
+
+    const was_enabled = acquire();
+    defer release(was_enabled);
+
+    const slot = for (&rings) |*r| {
+        if (r.* == null) break r;
+    } else {
+        serial.warn("IO Ring: Too many rings.");
+        return null;
+    };
+
+    const phys = pmm.allocatePages(pages) orelse return null;
+    const base: [*]u8 = @ptrFromInt(phys + vmm.getHhdmOffset());
+    @memset(base[0 .. pages * PAGE_SIZE], 0);
+
+    const header: *RingHeader = @ptrCast(@alignCast(base));
+    header.* = .{
+        .magic = RING_MAGIC,
+        .sq_entries = sq_entries,
+        .cq_entries = cq_entries,
+        .sq_offset = @intCast(sq_offset),
+        .cq_offset = @intCast(cq_offset),
+        .pages = @intCast(pages),
+    };
+
+    slot.* = Ring{
+        .view = .{ .header = header },
+        .sqes = @ptrCast(@alignCast(base + sq_offset)),
+        .cqes = @ptrCast(@alignCast(base + cq_offset)),
+        .sq_entries = sq_entries,
+        .cq_entries = cq_entries,
+        .phys = phys,
+        .pages = pages,
+        .requester = domain.Requester.caller(),
+    };
+    return header;
+}
+
+/// Destroys a ring. Parked operations are dropped without completions.
+pub fn destroy(header: *RingHeader) void {
+    const was_enabled = acquire();
+    defer release(was_enabled);
+
+    for (&rings) |*slot| {
+        if (slot.*) |*r| {
+            if (r.view.header != header) continue;
+            header.magic = 0;
+            pmm.freePages(r.phys, r.pages);
+            slot.* = null;
+            return;
+        }
+    }
+}
+
+fn findRing(header: *RingHeader) ?*Ring {
+    for (&rings) |*slot| {
+        if (slot.*) |*r| {
+            if (r.view.header == header) return r;
+        }
+    }
+    return null;
+}
+
+/// Posts a CQE. Returns false if the CQ is full.
+fn complete(r: *Ring, user_data: u64, result: i64) bool {
+    const hdr = r.view.header;
+    const tail = hdr.cq_tail;
+    const head = @atomicLoad(u32, &hdr.cq_head, .acquire);
+    if (tail -% head >= r.cq_entries) return false;
+
+    r.cqes[tail & (r.cq_entries - 1)] = .{ .user_data = user_data, .result = result };
+    @atomicStore(u32, &hdr.cq_tail, tail +% 1, .release);
+    return true;
+}
+
+/// Free CQ slots, minus the ones reserved for parked reads.
+fn cqSpace(r: *const Ring) u32 {
+    const hdr = r.view.header;
+    const used = hdr.cq_tail -% @atomicLoad(u32, &hdr.cq_head, .acquire);
+    const reserved: u32 = @intCast(r.pending_count);
+    if (used >= r.cq_entries or used + reserved >= r.cq_entries) return 0;
+    return r.cq_entries - used - reserved;
+}
+
+/// True if the ring's owner may access `len` bytes at `addr` itself.
+fn accessible(r: *const Ring, addr: u64, len: u64, write: bool) bool {
+    if (addr == 0) return false;
+    return gate.rangeAccessible(r.requester.rights(), addr, len, write);
+}
+
+/// Copies buffered keys into the read's buffer. Returns the count, 0 if none.
+fn drainKeys(sqe: *const Sqe) u64 {
+    const buf: [*]u8 = @ptrFromInt(sqe.args[0]);
+    return keyboard.popBatch(buf[0..sqe.args[1]]);
+}
+
+/// Executes one SQE. Parks key reads that have no input yet.
+fn execute(r: *Ring, sqe: *const Sqe) void {
+    const result: i64 = switch (sqe.opcode) {
+        .nop => 0,
+        .log => blk: {
+            if (sqe.args[1] > MAX_LOG_LEN) break :blk E_INVAL;
+            if (!accessible(r, sqe.args[0], sqe.args[1], false)) break :blk E_FAULT;
+            const msg: [*]const u8 = @ptrFromInt(sqe.args[0]);
+            serial.logRaw(msg[0..sqe.args[1]]);
+            break :blk @intCast(sqe.args[1]);
+        },
+        .read_key => blk: {
+            if (sqe.args[1] == 0 or sqe.args[1] > gate.MAX_ARG_BYTES) break :blk E_INVAL;
+            if (!accessible(r, sqe.args[0], sqe.args[1], true)) break :blk E_FAULT;
+            const n = drainKeys(sqe);
+            if (n > 0) break :blk @intCast(n);
+            if (r.pending_count == MAX_PENDING_READS) break :blk E_BUSY;
+            r.pending_reads[r.pending_count] = sqe.*;
+            r.pending_count += 1;
+            return;
+        },
+        .draw_rect => blk: {
+            const fb = framebuffer.getFramebuffer() orelse break :blk E_NODEV;
+            framebuffer.drawRect(fb, sqe.args[0], sqe.args[1], sqe.args[2], sqe.args[3], @truncate(sqe.args[4]));
+            break :blk 0;
+        },
+        .fill => blk: {
+            const fb = framebuffer.getFramebuffer() orelse break :blk E_NODEV;
+            framebuffer.fill(fb, @truncate(sqe.args[0]));
+            break :blk 0;
+        },
+        _ => E_INVAL,
+    };
+    // cqSpace() was checked before the SQE was consumed.
+    _ = complete(r, sqe.user_data, result);
+}
+
+/// Consumes every published SQE that has CQ room. Returns the number consumed.
+/// SQEs left behind (CQ full) are picked up once the program harvests.
+fn consume(r: *Ring) u32 {
+    const hdr = r.view.header;
+    const mask = r.sq_entries - 1;
+    var head = hdr.sq_head;
+    const tail = @atomicLoad(u32, &hdr.sq_tail, .acquire);
+
+    var consumed: u32 = 0;
+    while (head != tail and cqSpace(r) > 0) {
+        // Copy first: the program may rewrite the slot once sq_head moves.
+        const sqe = r.sqes[head & mask];
+        head +%= 1;
+        execute(r, &sqe);
+        consumed += 1;
+    }
+    @atomicStore(u32, &hdr.sq_head, head, .release);
+    return consumed;
+}
+
+/// Completes parked key reads while keys are buffered. A read whose buffer
+/// its owner can no longer reach (freed, or the domain lost its key)
+/// completes with E_FAULT.
+fn completePendingReads(r: *Ring) void {
+    var i: usize = 0;
+    while (i < r.pending_count) {
+        const read = &r.pending_reads[i];
+        const result: i64 = if (!accessible(r, read.args[0], read.args[1], true)) E_FAULT else blk: {
+            const n = drainKeys(read);
+            if (n == 0) return; // Keyboard empty
+            break :blk @intCast(n);
+        };
+        _ = complete(r, read.user_data, result);
+        r.pending_count -= 1;
+        // Keep FIFO order among parked reads.
+        std.mem.copyForwards(Sqe, r.pending_reads[i..r.pending_count], r.pending_reads[i + 1 .. r.pending_count + 1]);
+    }
+}
+
+/// Submits the ring's pending SQEs (the `io_enter` table call).
+/// Returns the number of SQEs consumed.
+pub fn enter(header: *RingHeader) u32 {
+    const was_enabled = acquire();
+    defer release(was_enabled);
+
+    const r = findRing(header) orelse return 0;
+    return consume(r);
+}
+
+/// Blocks until at least `min_complete` CQEs are ready (the `io_wait` table
+/// call). Returns the number ready, or 0 for an unknown ring.
+///
+/// There is no scheduler to switch to, so the waiting CPU is parked in `hlt`
+/// rather than spinning; the IRQ that completes the operation (e.g. the
+/// keyboard for parked key reads) wakes it. Published but unconsumed SQEs are
+/// submitted first, so a program may publish and wait without io_enter.
+/// Must not be called with interrupts disabled if anything is still parked.
+pub fn wait(header: *RingHeader, min_complete: u32) u32 {
+    const was_enabled = cpu.interruptsEnabled();
+    defer if (!was_enabled) cpu.disableInterrupts();
+
+    while (true) {
+        _ = acquire();
+        const r = findRing(header) orelse {
+            release(false);
+            return 0;
+        };
+        completePendingReads(r);
+        _ = consume(r);
+        const ready = r.view.cqReady();
+        // Nothing parked and no SQE left: waiting longer could never help.
+        const idle = r.pending_count == 0 and r.view.sqPending() == 0;
+        // Keep IF=0 between the check and the hlt (see cpu.waitForInterrupt).
+        release(false);
+
+        if (ready >= min_complete or idle) {
+            if (was_enabled) cpu.enableInterrupts();
+            return ready;
+        }
+        cpu.waitForInterrupt();
+    }
+}
+
+/// Kernel worker: drives every ring without a table call. Called from the
+/// kernel idle loop, so programs may also just publish SQEs and wait.
+pub fn poll() void {
+    const was_enabled = acquire();
+    defer release(was_enabled);
+
+    for (&rings) |*slot| {
+        if (slot.*) |*r| {
+            completePendingReads(r);
+            _ = consume(r);
+        }
+    }
+}
+
+/// Keyboard IRQ hook: completes parked key reads with the new input.
+pub fn onKeyboardInput() void {
+    const was_enabled = acquire();
+    defer release(was_enabled);
+
+    for (&rings) |*slot| {
+        if (slot.*) |*r| {
+            if (r.pending_count > 0) completePendingReads(r);
+        }
+    }
+}
+
+// --- Unit Tests ---
+
+test "IO Ring Layout" {
+    try std.testing.expect(@sizeOf(Sqe) == 64);
+    try std.testing.expect(@sizeOf(Cqe) == 16);
+    try std.testing.expect(@offsetOf(RingHeader, "sq_tail") - @offsetOf(RingHeader, "sq_head") >= std.atomic.cache_line);
+    try std.testing.expect(@offsetOf(RingHeader, "cq_tail") - @offsetOf(RingHeader, "cq_head") >= std.atomic.cache_line);
+}
+
+test "IO Ring Submit And Harvest" {
+    try std.testing.expect(setup(0) == null);
+    try std.testing.expect(setup(MAX_ENTRIES + 1) == null);
+
+    const header = setup(5) orelse return error.OutOfMemory;
+    defer destroy(header);
+    try std.testing.expect(header.sq_entries == 8);
+    try std.testing.expect(header.cq_entries == 16);
+
+    const view = RingView{ .header = header };
+    const msg = "[io_ring test]\n";
+    view.sqes()[0] = Sqe.nop(1);
+    view.sqes()[1] = Sqe.log(msg, 2);
+    view.sqes()[2] = .{ .opcode = @enumFromInt(0xEE), .user_data = 3 };
+    @atomicStore(u32, &header.sq_tail, 3, .release);
+
+    try std.testing.expect(enter(header) == 3);
+    try std.testing.expect(view.cqReady() == 3);
+    const cqes = view.cqes();
+    try std.testing.expect(cqes[0].user_data == 1 and cqes[0].result == 0);
+    try std.testing.expect(cqes[1].user_data == 2 and cqes[1].result == msg.len);
+    try std.testing.expect(cqes[2].user_data == 3 and cqes[2].result == E_INVAL);
+}
+
+test "IO Ring Checks Buffers Against The Ring Owner's Rights" {
+    const heap = @import("memory/heap.zig");
+    const header = setup(4) orelse return error.OutOfMemory;
+    defer destroy(header);
+    const d = domain.create() orelse return;
+    defer domain.destroy(d);
+    findRing(header).?.requester = .{ .domain = d, .id = d.id };
+
+    const allocator = heap.getAllocator();
+    const secret = try allocator.alloc(u8, 32);
+    defer allocator.free(secret);
+
+    const view = RingView{ .header = header };
+    const local = "ok\n";
+    view.sqes()[0] = Sqe.log(secret, 1);
+    view.sqes()[1] = Sqe.readKey(secret, 2);
+    view.sqes()[2] = Sqe.log(local, 3);
+    @atomicStore(u32, &header.sq_tail, 3, .release);
+
+    try std.testing.expect(enter(header) == 3);
+    const cqes = view.cqes();
+    try std.testing.expect(cqes[0].result == E_FAULT);
+    try std.testing.expect(cqes[1].result == E_FAULT);
+    try std.testing.expect(cqes[2].result == local.len);
+}
+
+test "IO Ring Ignores Geometry Rewritten By The Program" {
+    const header = setup(4) orelse return error.OutOfMemory;
+    defer destroy(header);
+    const view = RingView{ .header = header };
+    const sqes = view.sqes();
+    const cqes = view.cqes();
+
+    sqes[0] = Sqe.nop(1);
+    header.sq_entries = 0x8000_0000;
+    header.cq_entries = 0;
+    header.sq_offset = 0xFFFF_0000;
+    header.cq_offset = 0xFFFF_0000;
+    @atomicStore(u32, &header.sq_tail, 1, .release);
+
+    try std.testing.expect(enter(header) == 1);
+    try std.testing.expect(cqes[0].user_data == 1 and cqes[0].result == 0);
+}
+
+test "IO Ring Backpressure When CQ Is Full" {
+    const header = setup(8) orelse return error.OutOfMemory;
+    defer destroy(header);
+    const view = RingView{ .header = header };
+
+    // Fill the CQ completely in two rounds of 8 SQEs.
+    var round: u32 = 0;
+    while (round < 2) : (round += 1) {
+        var i: u32 = 0;
+        while (i < 8) : (i += 1) {
+            view.sqes()[(round * 8 + i) & 7] = Sqe.nop(round * 8 + i);
+        }
+        @atomicStore(u32, &header.sq_tail, (round + 1) * 8, .release);
+        try std.testing.expect(enter(header) == 8);
+    }
+    try std.testing.expect(view.cqReady() == header.cq_entries);
+
+    // Next SQE stays queued until the program harvests.
+    view.sqes()[0] = Sqe.nop(99);
+    @atomicStore(u32, &header.sq_tail, 17, .release);
+    try std.testing.expect(enter(header) == 0);
+    try std.testing.expect(view.sqPending() == 1);
+
+    @atomicStore(u32, &header.cq_head, 1, .release);
+    try std.testing.expect(enter(header) == 1);
+    try std.testing.expect(view.cqes()[16 & 15].user_data == 99);
+}
+
+test "IO Ring Wait Returns Completed Work" {
+    const header = setup(4) orelse return error.OutOfMemory;
+    defer destroy(header);
+    const view = RingView{ .header = header };
+
+    // Published but not entered: wait() submits on its own.
+    view.sqes()[0] = Sqe.nop(1);
+    view.sqes()[1] = Sqe.nop(2);
+    @atomicStore(u32, &header.sq_tail, 2, .release);
+    try std.testing.expect(wait(header, 2) == 2);
+
+    // Asking for more than can ever complete returns instead of parking forever.
+    try std.testing.expect(wait(header, 3) == 2);
+}
+
+test "IO Ring Parks Key Reads" {
+    const header = setup(4) orelse return error.OutOfMemory;
+    defer destroy(header);
+    const view = RingView{ .header = header };
+
+    // Drain anything typed before the test so the read has to wait.
+    while (keyboard.pop()) |_| {}
+
+    var buf: [4]u8 = undefined;
+    view.sqes()[0] = Sqe.readKey(&buf, 7);
+    @atomicStore(u32, &header.sq_tail, 1, .release);
+    try std.testing.expect(enter(header) == 1);
+    try std.testing.expect(view.cqReady() == 0);
+    try std.testing.expect(findRing(header).?.pending_count == 1);
+}
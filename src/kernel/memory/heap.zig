@@ -1,7 +1,10 @@
 const std = @import("std");
 const pmm = @import("pmm.zig");
 const vmm = @import("vmm.zig");
+const pks = @import("../../arch/x86_64/pks.zig");
 const serial = @import("../serial.zig");
+const log = serial.scoped(.heap);
+const trace = @import("../trace.zig");
 
 // Constants
 const PAGE_SIZE = pmm.PAGE_SIZE;
@@ -55,7 +58,7 @@ pub const KernelAllocator = struct {
     /// Initializes the allocator state (clears lists).
     pub fn init(self: *KernelAllocator) void {
         @memset(&self.free_lists, null);
-        serial.info("Heap: KernelAllocator initialized.");
+        log.info("Heap: KernelAllocator initialized.");
     }
 
     /// The main allocation function implementing std.mem.Allocator interface.
@@ -75,6 +78,12 @@ pub const KernelAllocator = struct {
     fn alloc(ctx: *anyopaque, len: usize, ptr_align: std.mem.Alignment, ret_addr: usize) ?[*]u8 {
         _ = ret_addr;
         const self: *KernelAllocator = @ptrCast(@alignCast(ctx));
+        const ptr = self.allocBlock(len, ptr_align);
+        trace.point(.heap_alloc, .{ ptr, len, ptr_align.toByteUnits() });
+        return ptr;
+    }
+
+    fn allocBlock(self: *KernelAllocator, len: usize, ptr_align: std.mem.Alignment) ?[*]u8 {
 
         // 1. Calculate actual size needed (including alignment overhead/padding if complex)
         // For simple power-of-two slab, strict alignment > block size is tricky.
@@ -129,6 +138,7 @@ pub const KernelAllocator = struct {
         _ = buf_align;
         _ = ret_addr;
         const self: *KernelAllocator = @ptrCast(@alignCast(ctx));
+        trace.point(.heap_free, .{ buf.ptr, buf.len });
 
         const len = buf.len;
         const size = @max(len, MIN_BLOCK_SIZE);
@@ -172,6 +182,7 @@ pub const KernelAllocator = struct {
         // Because PMM guarantees physical contiguity, and HHDM is linear,
         // the Virtual Addresses are also contiguous.
         const virt = phys + vmm.getHhdmOffset();
+        vmm.setKey(virt, pages_needed * PAGE_SIZE, pks.KEY_HEAP);
         return @ptrFromInt(virt);
     }
 
@@ -182,6 +193,8 @@ pub const KernelAllocator = struct {
         const phys_addr = virt_addr - vmm.getHhdmOffset();
         const pages = (buf.len + PAGE_SIZE - 1) / PAGE_SIZE;
 
+        // The pages may be handed to a program next
+        vmm.setKey(virt_addr, pages * PAGE_SIZE, pks.KEY_DEFAULT);
         pmm.freePages(phys_addr, pages);
     }
 
@@ -191,6 +204,7 @@ pub const KernelAllocator = struct {
         const phys = pmm.allocatePage() orelse return null;
         // 2. Convert to Virtual (HHDM)
         const virt = phys + vmm.getHhdmOffset();
+        vmm.setKey(virt, PAGE_SIZE, pks.KEY_HEAP);
         const page_ptr = @as([*]u8, @ptrFromInt(virt));
 
         // 3. Chop it up
@@ -341,3 +355,16 @@ test "ArrayList usage" {
     try std.testing.expect(list.items[1] == 20);
     try std.testing.expect(list.items[2] == 30);
 }
+
+test "Heap Pages Carry The Heap Key" {
+    const allocator = getAllocator();
+    const small = try allocator.create(u64);
+    defer allocator.destroy(small);
+    try std.testing.expect(vmm.mappingKey(@intFromPtr(small)) == pks.KEY_HEAP);
+
+    const large = try allocator.alloc(u8, 3 * PAGE_SIZE);
+    const addr = @intFromPtr(large.ptr);
+    try std.testing.expect(vmm.mappingKey(addr + 2 * PAGE_SIZE) == pks.KEY_HEAP);
+    allocator.free(large);
+    try std.testing.expect(vmm.mappingKey(addr) == pks.KEY_DEFAULT);
+}
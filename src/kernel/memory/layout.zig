@@ -1 +1,16 @@
 pub const HIGHER_HALF_BASE: u64 = 0xffffffff80000000;
+
+/// Kernel-managed mappings of user pixel surfaces (see compositor.zig), one
+/// fixed-size window per surface slot. Far from the HHDM and kernel image.
+pub const SURFACE_REGION_BASE: u64 = 0xFFFF_C000_0000_0000;
+/// Address space reserved per surface slot: 4096 x 4096 pixels at 32bpp.
+pub const SURFACE_SLOT_SIZE: u64 = 64 * 1024 * 1024;
+
+/// The read-only kernel data page (see vdso.zig).
+pub const VDSO_BASE: u64 = 0xFFFF_D000_0000_0000;
+/// The read-only page of surface descriptors (see compositor.zig).
+pub const SURFACE_INFO_BASE: u64 = VDSO_BASE + 0x1000;
+
+/// Read-only, executable pages of published services (see service.zig),
+/// one page per service slot and generation (4 GiB in all).
+pub const SERVICE_REGION_BASE: u64 = 0xFFFF_D800_0000_0000;
@@ -1,6 +1,8 @@
 const std = @import("std");
 const limine = @import("../../limine_import.zig").C;
 const serial = @import("../serial.zig");
+const log = serial.scoped(.pmm);
+const trace = @import("../trace.zig");
 // const layout = @import("layout.zig");
 
 // Externs from limine.c
@@ -21,7 +23,7 @@ pub fn init() void {
     const hhdm_resp = hhdm_request.response;
 
     if (memmap_resp == null or hhdm_resp == null) {
-        serial.err("PMM: Bootloader responses missing (Memmap or HHDM). Halting.");
+        log.err("PMM: Bootloader responses missing (Memmap or HHDM). Halting.");
         while (true) {}
     }
 
@@ -29,7 +31,7 @@ pub fn init() void {
     const entries = memmap_resp.*.entries;
     const hhdm_offset = hhdm_resp.*.offset;
 
-    serial.info("PMM: Initializing...");
+    log.info("PMM: Initializing...");
 
     // 1. Calculate max memory to determine bitmap size
     var max_address: u64 = 0;
@@ -37,12 +39,13 @@ pub fn init() void {
     var i: usize = 0;
     while (i < entry_count) : (i += 1) {
         const entry = entries[i];
-        const type_name = getMemmapType(entry.*.type);
 
-        // Logging memory map for debug
-        var buf: [128]u8 = undefined;
-        const msg = std.fmt.bufPrint(&buf, "Region: Base=0x{x} Len=0x{x} Type={s}", .{ entry.*.base, entry.*.length, type_name }) catch "Fmt Error";
-        serial.debug(msg);
+        // Logging memory map for debug (skip the formatting unless enabled)
+        if (log.enabled(.debug)) {
+            var buf: [128]u8 = undefined;
+            const msg = std.fmt.bufPrint(&buf, "Region: Base=0x{x} Len=0x{x} Type={s}", .{ entry.*.base, entry.*.length, getMemmapType(entry.*.type) }) catch "Fmt Error";
+            log.debug(msg);
+        }
 
         if (entry.*.type == limine.LIMINE_MEMMAP_USABLE or
             entry.*.type == limine.LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE or
@@ -79,12 +82,12 @@ pub fn init() void {
     }
 
     if (!bitmap_found) {
-        serial.err("PMM: Could not find memory for bitmap! Halting.");
+        log.err("PMM: Could not find memory for bitmap! Halting.");
         while (true) {}
     }
 
-    serial.info("PMM: Bitmap placed at phys 0x");
-    serial.printHex(.info, bitmap_phys_base);
+    log.info("PMM: Bitmap placed at phys 0x");
+    log.printHex(.info, bitmap_phys_base);
 
     // 3. Populate Bitmap based on Memory Map
     // Now iterate again and mark USABLE regions as free (0)
@@ -103,7 +106,7 @@ pub fn init() void {
     // 5. Reserve the first 1MB (legacy VGA etc) just to be safe
     reserveRegion(0, 0x100000);
 
-    serial.info("PMM: Initialization Complete.");
+    log.info("PMM: Initialization Complete.");
 }
 
 /// Returns a string representation of the Limine memory map type.
@@ -177,19 +180,15 @@ pub fn allocatePages(count: usize) ?u64 {
     if (count == 0) return null;
 
     // Search wrapper to handle wrap-around
-    if (findFreeRange(last_used_index, total_pages, count)) |idx| {
-        markUsed(idx, count);
-        last_used_index = idx + count;
-        return @as(u64, idx) * PAGE_SIZE;
-    }
-
-    if (findFreeRange(0, last_used_index, count)) |idx| {
-        markUsed(idx, count);
-        last_used_index = idx + count;
-        return @as(u64, idx) * PAGE_SIZE;
-    }
-
-    return null; // OOM
+    const idx = findFreeRange(last_used_index, total_pages, count) orelse
+        findFreeRange(0, last_used_index, count) orelse
+        return null; // OOM
+
+    markUsed(idx, count);
+    last_used_index = idx + count;
+    const phys = @as(u64, idx) * PAGE_SIZE;
+    trace.point(.pmm_alloc, .{ phys, count });
+    return phys;
 }
 
 /// Helper to find a range of free bits.
@@ -227,6 +226,7 @@ pub fn freePage(phys_addr: u64) void {
 
 /// Frees `count` contiguous pages starting at `phys_addr`.
 pub fn freePages(phys_addr: u64, count: usize) void {
+    trace.point(.pmm_free, .{ phys_addr, count });
     const start_idx = phys_addr / PAGE_SIZE;
     var i: usize = 0;
     while (i < count) : (i += 1) {
@@ -246,18 +246,18 @@ test "PMM Allocation and Free" {
     // 1. Verify Basic Page Allocation
     const page1 = allocatePage();
     try std.testing.expect(page1 != null);
-    serial.info("Test: Allocated Page 1");
+    log.info("Test: Allocated Page 1");
 
     const page2 = allocatePage();
     try std.testing.expect(page2 != null);
-    serial.info("Test: Allocated Page 2");
+    log.info("Test: Allocated Page 2");
 
     // Addresses should be distinct
     try std.testing.expect(page1.? != page2.?);
 
     freePage(page2.?);
-    serial.info("Test: Freed Page 2");
+    log.info("Test: Freed Page 2");
 
     freePage(page1.?);
-    serial.info("Test: Freed Page 1");
+    log.info("Test: Freed Page 1");
 }
@@ -0,0 +1,335 @@
+/// TLB Shootdown
+///
+/// Every CPU in the single address space walks the same page tables, so an unmap
+/// or protection change made on one CPU can leave stale translations in the TLBs
+/// of the others. This module makes those flushes correct and cheap:
+///
+/// - **Batching**: callers collect invalidations in a `Batch`. Overlapping and
+///   adjacent ranges are coalesced, and large batches degrade to one CR3 reload.
+/// - **Targeting**: only CPUs in `active_mask` are interrupted. CPUs parked in
+///   lazy mode (idle, see enterLazy/exitLazy) are skipped and flush on wake-up.
+/// - **Acknowledgement**: each target publishes the last request generation it
+///   has applied in its own cache line. The initiator spins on those counters
+///   instead of a shared counter that every target would bounce around.
+///
+/// Pages that were never present need no shootdown: x86 does not cache
+/// not-present translations.
+const std = @import("std");
+const smp = @import("../../arch/x86_64/smp.zig");
+const apic = @import("../../arch/x86_64/apic.zig");
+const idt = @import("../../arch/x86_64/idt.zig");
+const cpu = @import("../../arch/x86_64/cpu.zig");
+const serial = @import("../serial.zig");
+const log = serial.scoped(.tlb);
+
+/// IPI vector used to deliver shootdown requests (fast-path handler).
+pub const SHOOTDOWN_VECTOR: u8 = 0xFD;
+
+/// Maximum distinct ranges in one batch before it degrades to a full flush.
+pub const MAX_RANGES: usize = 8;
+
+/// Past this many pages a CR3 reload is cheaper than one invlpg per page.
+const FULL_FLUSH_THRESHOLD_PAGES: u64 = 64;
+
+const PAGE_SIZE: u64 = 4096;
+
+/// A page-aligned virtual range.
+pub const Range = struct {
+    start: u64,
+    pages: u64,
+
+    fn limit(self: Range) u64 {
+        return self.start + self.pages * PAGE_SIZE;
+    }
+};
+
+/// A set of pending invalidations.
+pub const Batch = struct {
+    ranges: [MAX_RANGES]Range = undefined,
+    count: usize = 0,
+    full_flush: bool = false,
+
+    /// Adds `pages` pages starting at `virt` to the batch, merging with any
+    /// range it overlaps or touches.
+    pub fn add(self: *Batch, virt: u64, pages: u64) void {
+        if (pages == 0 or self.full_flush) return;
+
+        var lo = virt & ~(PAGE_SIZE - 1);
+        var hi = lo + pages * PAGE_SIZE;
+
+        // A merge can make the grown range touch another one, so rescan after each merge.
+        var i: usize = 0;
+        while (i < self.count) {
+            const r = self.ranges[i];
+            if (lo <= r.limit() and r.start <= hi) {
+                lo = @min(lo, r.start);
+                hi = @max(hi, r.limit());
+                self.count -= 1;
+                self.ranges[i] = self.ranges[self.count];
+                i = 0;
+                continue;
+            }
+            i += 1;
+        }
+
+        if (self.count == MAX_RANGES) {
+            self.markFull();
+            return;
+        }
+
+        self.ranges[self.count] = .{ .start = lo, .pages = (hi - lo) / PAGE_SIZE };
+        self.count += 1;
+
+        if (self.totalPages() > FULL_FLUSH_THRESHOLD_PAGES) {
+            self.markFull();
+        }
+    }
+
+    /// Degrades the batch to a full TLB flush.
+    pub fn markFull(self: *Batch) void {
+        self.full_flush = true;
+        self.count = 0;
+    }
+
+    /// Total pages covered by the batch's ranges.
+    pub fn totalPages(self: *const Batch) u64 {
+        var total: u64 = 0;
+        for (self.ranges[0..self.count]) |r| {
+            total += r.pages;
+        }
+        return total;
+    }
+
+    pub fn isEmpty(self: *const Batch) bool {
+        return self.count == 0 and !self.full_flush;
+    }
+
+    /// Applies the batch on this CPU and on every CPU that may cache the
+    /// affected translations, then resets it.
+    pub fn flush(self: *Batch) void {
+        if (self.isEmpty()) return;
+        shootdown(self);
+        self.* = .{};
+    }
+};
+
+/// Per-CPU acknowledgement counter, padded so targets never share a cache line.
+const AckCounter = struct {
+    gen: std.atomic.Value(u64) align(std.atomic.cache_line) = std.atomic.Value(u64).init(0),
+};
+
+// The request currently being broadcast. Guarded by `lock`.
+var request: Batch = .{};
+var request_gen = std.atomic.Value(u64).init(0);
+var request_targets = std.atomic.Value(u64).init(0);
+var acks: [smp.MAX_CPUS]AckCounter = [_]AckCounter{.{}} ** smp.MAX_CPUS;
+
+// Serializes initiators so one mailbox is enough.
+var lock = std.atomic.Value(bool).init(false);
+
+// CPUs that may hold live translations (online and not in lazy mode).
+var active_mask = std.atomic.Value(u64).init(0);
+// Bumped by every remote shootdown; lazy CPUs compare it on wake-up.
+var flush_epoch = std.atomic.Value(u64).init(0);
+var lazy_epoch: [smp.MAX_CPUS]u64 = [_]u64{0} ** smp.MAX_CPUS;
+
+// Statistics
+var stat_shootdowns: u64 = 0;
+var stat_ipis: u64 = 0;
+
+/// Registers the shootdown IPI handler and marks the online CPUs active.
+/// Must run after smp.init().
+pub fn init() void {
+    idt.registerFastHandler(SHOOTDOWN_VECTOR, shootdownHandler) catch {
+        log.err("TLB: Shootdown vector already in use!");
+        return;
+    };
+    active_mask.store(smp.onlineMask(), .release);
+    log.info("TLB: Shootdown IPI handler registered.");
+}
+
+/// Invalidates one page on this CPU only.
+pub fn invalidateLocal(virt: u64) void {
+    asm volatile ("invlpg (%[addr])"
+        :
+        : [addr] "r" (virt),
+        : .{ .memory = true });
+}
+
+/// Flushes every non-global translation on this CPU by reloading CR3.
+pub fn flushAllLocal() void {
+    asm volatile (
+        \\ mov %%cr3, %%rax
+        \\ mov %%rax, %%cr3
+        ::: .{ .rax = true, .memory = true });
+}
+
+/// Applies `batch` to this CPU's TLB.
+fn applyLocal(batch: *const Batch) void {
+    if (batch.full_flush) {
+        flushAllLocal();
+        return;
+    }
+    for (batch.ranges[0..batch.count]) |r| {
+        var addr = r.start;
+        while (addr < r.limit()) : (addr += PAGE_SIZE) {
+            invalidateLocal(addr);
+        }
+    }
+}
+
+/// Flushes a single range everywhere it may be cached.
+pub fn flushRange(virt: u64, pages: u64) void {
+    var batch = Batch{};
+    batch.add(virt, pages);
+    batch.flush();
+}
+
+/// Applies the pending request on the current CPU if it is a target that has
+/// not acknowledged it yet.
+fn serviceRequest() void {
+    const me = smp.currentIndex();
+    const gen = request_gen.load(.acquire);
+    if (acks[me].gen.load(.monotonic) >= gen) return;
+    if ((request_targets.load(.acquire) & smp.cpuBit(me)) == 0) return;
+
+    applyLocal(&request);
+    acks[me].gen.store(gen, .release);
+}
+
+/// Fast-path IPI handler (see idt.registerFastHandler).
+fn shootdownHandler(vector: u64) callconv(.c) void {
+    _ = vector;
+    serviceRequest();
+    apic.sendEoi();
+}
+
+fn acquireLock() void {
+    while (lock.cmpxchgWeak(false, true, .acquire, .monotonic) != null) {
+        // Another CPU may be waiting on us while we spin with IF=0.
+        serviceRequest();
+        cpu.pause();
+    }
+}
+
+fn releaseLock() void {
+    lock.store(false, .release);
+}
+
+/// Flushes `batch` locally and on every other active CPU, waiting for all acks.
+fn shootdown(batch: *const Batch) void {
+    applyLocal(batch);
+
+    // Single CPU: nothing else can hold the translations.
+    if (smp.onlineCount() <= 1) return;
+
+    const me = smp.currentIndex();
+    acquireLock();
+    defer releaseLock();
+
+    // Bump the epoch before sampling active_mask (see exitLazy).
+    _ = flush_epoch.fetchAdd(1, .seq_cst);
+    const targets = active_mask.load(.seq_cst) & smp.onlineMask() & ~smp.cpuBit(me);
+    if (targets == 0) return;
+
+    request = batch.*;
+    const gen = request_gen.load(.monotonic) + 1;
+    request_targets.store(targets, .release);
+    request_gen.store(gen, .release);
+
+    var pending = targets;
+    while (pending != 0) : (pending &= pending - 1) {
+        const idx = @ctz(pending);
+        apic.sendIpi(smp.lapicId(idx), SHOOTDOWN_VECTOR);
+        stat_ipis += 1;
+    }
+
+    pending = targets;
+    while (pending != 0) : (pending &= pending - 1) {
+        const idx = @ctz(pending);
+        while (acks[idx].gen.load(.acquire) < gen) {
+            cpu.pause();
+        }
+    }
+
+    stat_shootdowns += 1;
+}
+
+/// Marks the current CPU as not holding live translations (e.g. before idling).
+/// Shootdowns skip lazy CPUs. Code running in lazy mode must not touch memory
+/// that can be unmapped (only interrupt handlers on kernel-static data).
+pub fn enterLazy() void {
+    const me = smp.currentIndex();
+    lazy_epoch[me] = flush_epoch.load(.seq_cst);
+    _ = active_mask.fetchAnd(~smp.cpuBit(me), .seq_cst);
+}
+
+/// Leaves lazy mode. If any shootdown happened meanwhile, flush everything.
+pub fn exitLazy() void {
+    const me = smp.currentIndex();
+    _ = active_mask.fetchOr(smp.cpuBit(me), .seq_cst);
+    // Either the initiator saw our bit (and will IPI us) or we see its epoch.
+    if (flush_epoch.load(.seq_cst) != lazy_epoch[me]) {
+        flushAllLocal();
+    }
+}
+
+/// Marks CPU `index` active. Called when an AP comes online.
+pub fn activateCpu(index: usize) void {
+    _ = active_mask.fetchOr(smp.cpuBit(index), .seq_cst);
+}
+
+/// Number of remote shootdowns performed and IPIs sent since boot.
+pub fn stats() struct { shootdowns: u64, ipis: u64 } {
+    return .{ .shootdowns = stat_shootdowns, .ipis = stat_ipis };
+}
+
+// --- Unit Tests ---
+
+test "TLB Batch Coalescing" {
+    var batch = Batch{};
+    try std.testing.expect(batch.isEmpty());
+
+    // Adjacent ranges merge into one.
+    batch.add(0x1000, 1);
+    batch.add(0x2000, 2);
+    try std.testing.expect(batch.count == 1);
+    try std.testing.expect(batch.ranges[0].start == 0x1000);
+    try std.testing.expect(batch.ranges[0].pages == 3);
+
+    // A disjoint range stays separate.
+    batch.add(0x10000, 1);
+    try std.testing.expect(batch.count == 2);
+
+    // A range bridging both folds everything into one.
+    batch.add(0x4000, 12);
+    try std.testing.expect(batch.count == 1);
+    try std.testing.expect(batch.ranges[0].start == 0x1000);
+    try std.testing.expect(batch.ranges[0].pages == 16);
+}
+
+test "TLB Batch Degrades To Full Flush" {
+    var batch = Batch{};
+    batch.add(0x100000, FULL_FLUSH_THRESHOLD_PAGES + 1);
+    try std.testing.expect(batch.full_flush);
+
+    var sparse = Batch{};
+    var i: u64 = 0;
+    while (i <= MAX_RANGES) : (i += 1) {
+        sparse.add(i * 0x100000, 1);
+    }
+    try std.testing.expect(sparse.full_flush);
+}
+
+test "TLB Local Flush Path" {
+    // With only the BSP online this must not send IPIs or block.
+    const before = stats().ipis;
+    flushRange(0xFFFF_8000_1000_0000, 1);
+    var batch = Batch{};
+    batch.markFull();
+    batch.flush();
+    try std.testing.expect(batch.isEmpty());
+    if (smp.onlineCount() == 1) {
+        try std.testing.expect(stats().ipis == before);
+    }
+}
@@ -19,9 +19,16 @@
 /// 2. **Special Mappings** (`vmm.mapPage()`, `vmm.mapHugePage()`):
 ///    - MMIO regions (e.g., APIC at 0xFEE00000) - hardware registers not backed by RAM
 ///    - ELF program segments with specific flags (executable, read-only, etc.)
-///    - Future: PKS-protected memory regions with specific protection keys
+///    - PKS-protected memory regions with specific protection keys
 ///
-/// 3. **Address Translation Helpers**:
+/// 3. **Protection Domains** (`vmm.setKey()`, `vmm.protectPageTables()`):
+///    - The HHDM starts out as key 0. Kernel domains retag their pages in place
+///      (heap, driver buffers), splitting 2MB pages where a range covers only
+///      part of one; page tables come from a pool tagged pks.KEY_PAGE_TABLES.
+///    - Program domains (domain.zig) retag their pages in batches with
+///      `vmm.setKeyBatched()` when keys are recycled.
+///
+/// 4. **Address Translation Helpers**:
 ///    - `getHhdmOffset()` - Used by heap and allocators for phys↔virt conversions
 ///    - `physToVirt()` / `virtToPhys()` - HHDM address conversions
 ///
@@ -38,14 +45,20 @@ const std = @import("std");
 const limine = @import("../../limine_import.zig").C;
 const pmm = @import("pmm.zig");
 const serial = @import("../serial.zig");
+const log = serial.scoped(.vmm);
 const layout = @import("layout.zig");
+const tlb = @import("tlb.zig");
+const trace = @import("../trace.zig");
+const pat = @import("../../arch/x86_64/pat.zig");
+const pks = @import("../../arch/x86_64/pks.zig");
+
+pub const CacheType = pat.CacheType;
 
 // Requests defined in limine.c
 pub extern var hhdm_request: limine.struct_limine_hhdm_request;
 pub extern var executable_address_request: limine.struct_limine_executable_address_request;
 pub extern var memmap_request: limine.struct_limine_memmap_request;
 
-// Page Table Flags
 // Page Table Flags
 pub const PTE_PRESENT: u64 = 1 << 0;
 pub const PTE_RW: u64 = 1 << 1;
@@ -56,6 +69,10 @@ pub const PTE_ACCESSED: u64 = 1 << 5;
 pub const PTE_DIRTY: u64 = 1 << 6;
 pub const PTE_HUGE: u64 = 1 << 7; // 2MB or 1GB page
 pub const PTE_GLOBAL: u64 = 1 << 8;
+/// PAT index bit 2 in a 4KB PTE. It shares bit 7 with PTE_HUGE, so in 2MB
+/// and 1GB entries it moves to bit 12 (PTE_PAT_HUGE).
+pub const PTE_PAT: u64 = 1 << 7;
+pub const PTE_PAT_HUGE: u64 = 1 << 12;
 pub const PTE_NX: u64 = 1 << 63;
 
 // Address Translation Constants
@@ -75,18 +92,32 @@ const PT_SHIFT: u6 = 12;
 const PTE_PKS_SHIFT: u64 = 59;
 const PTE_PKS_MASK: u64 = 0xF << PTE_PKS_SHIFT;
 const PTE_ADDR_MASK: u64 = 0x000FFFFFFFFFF000;
+// A 2MB entry's address; bit 12 is PTE_PAT_HUGE there.
+const PTE_ADDR_MASK_HUGE: u64 = 0x000FFFFFFFE00000;
+
+const PTE_CACHE_MASK: u64 = PTE_WRITE_THROUGH | PTE_NO_CACHE | PTE_PAT;
+const PTE_CACHE_MASK_HUGE: u64 = PTE_WRITE_THROUGH | PTE_NO_CACHE | PTE_PAT_HUGE;
 
 const PAGE_SIZE: u64 = 4096;
 const HUGE_PAGE_SIZE: u64 = 2 * 1024 * 1024; // 2MB
 
 // The kernel's PML4 (Level 4 Page Table)
 var kernel_pml4: *[512]u64 = undefined;
+var kernel_pml4_phys: u64 = 0;
+
+/// Page tables allocated after protectPageTables() come from this pool,
+/// whose HHDM alias is tagged pks.KEY_PAGE_TABLES. Each 2MB split takes one
+/// table, so 512 pages allow 1GB of finely tagged memory; beyond that,
+/// tables come untagged from the PMM.
+const PT_POOL_PAGES: usize = 512;
+var pt_pool: u64 = 0;
+var pt_pool_used: usize = 0;
 
 /// Gets the HHDM offset from the Limine response
 pub fn getHhdmOffset() u64 {
     const resp = hhdm_request.response;
     if (resp == null) {
-        serial.err("VMM: HHDM Response missing!");
+        log.err("VMM: HHDM Response missing!");
         while (true) {}
     }
     return resp.*.offset;
@@ -102,9 +133,29 @@ fn virtToPhys(virt: u64) u64 {
     return virt - getHhdmOffset();
 }
 
+/// Returns the PWT/PCD/PAT bits that select `cache` for a 4KB mapping.
+/// OR them into the flags of mapPage() or mapPhysical().
+pub fn cacheFlags(cache: CacheType) u64 {
+    return cacheBits(cache, false);
+}
+
+/// As cacheFlags(), for a 2MB mapping made with mapHugePage().
+pub fn cacheFlagsHuge(cache: CacheType) u64 {
+    return cacheBits(cache, true);
+}
+
+fn cacheBits(cache: CacheType, huge: bool) u64 {
+    const idx = pat.index(cache);
+    var bits: u64 = 0;
+    if ((idx & 1) != 0) bits |= PTE_WRITE_THROUGH;
+    if ((idx & 2) != 0) bits |= PTE_NO_CACHE;
+    if ((idx & 4) != 0) bits |= if (huge) PTE_PAT_HUGE else PTE_PAT;
+    return bits;
+}
+
 /// Allocates a zeroed page table and returns its PHYSICAL address
 fn allocPageTable() ?u64 {
-    const phys = pmm.allocatePage();
+    const phys = takePoolPage() orelse pmm.allocatePage();
     if (phys) |p| {
         // Zero it out
         const virt = physToVirt(p);
@@ -115,8 +166,21 @@ fn allocPageTable() ?u64 {
     return null;
 }
 
+fn takePoolPage() ?u64 {
+    if (pt_pool == 0) return null;
+    if (pt_pool_used == PT_POOL_PAGES) {
+        log.warn("VMM: Page table pool exhausted, new tables are untagged");
+        pt_pool = 0;
+        return null;
+    }
+    const p = pt_pool + pt_pool_used * PAGE_SIZE;
+    pt_pool_used += 1;
+    return p;
+}
+
 /// Maps a virtual page to a physical page in the kernel PML4 (4KB)
 pub fn mapPage(virt_addr: u64, phys_addr: u64, flags: u64, pks_key: u4) !void {
+    trace.point(.vmm_map, .{ virt_addr, phys_addr, flags, pks_key });
     const pml4_idx = (virt_addr >> PML4_SHIFT) & PT_INDEX_MASK;
     const pdpt_idx = (virt_addr >> PDPT_SHIFT) & PT_INDEX_MASK;
     const pd_idx = (virt_addr >> PD_SHIFT) & PT_INDEX_MASK;
@@ -148,13 +212,307 @@ pub fn mapPage(virt_addr: u64, phys_addr: u64, flags: u64, pks_key: u4) !void {
 
     // 4. Set PTE
     const pks_bits = @as(u64, pks_key) << PTE_PKS_SHIFT;
+    const old = pt[pt_idx];
     pt[pt_idx] = phys_addr | flags | pks_bits | PTE_PRESENT;
 
-    // Invalidate TLB for this address (invlpg)
-    asm volatile ("invlpg (%[addr])"
-        :
-        : [addr] "r" (virt_addr),
-        : .{ .memory = true });
+    // Replacing a live mapping may leave stale entries on other CPUs.
+    // A not-present entry is never cached, so a local invlpg is enough.
+    if ((old & PTE_PRESENT) != 0) {
+        tlb.flushRange(virt_addr, 1);
+    } else {
+        tlb.invalidateLocal(virt_addr);
+    }
+}
+
+/// Returns a pointer to the 4KB PTE that maps `virt_addr`.
+/// Returns null if any level is missing or the address is covered by a huge page.
+fn lookupPte(virt_addr: u64) ?*u64 {
+    const pml4_idx = (virt_addr >> PML4_SHIFT) & PT_INDEX_MASK;
+    const pdpt_idx = (virt_addr >> PDPT_SHIFT) & PT_INDEX_MASK;
+    const pd_idx = (virt_addr >> PD_SHIFT) & PT_INDEX_MASK;
+    const pt_idx = (virt_addr >> PT_SHIFT) & PT_INDEX_MASK;
+
+    const pml4e = kernel_pml4[pml4_idx];
+    if ((pml4e & PTE_PRESENT) == 0) return null;
+    const pdpt = @as(*[512]u64, @ptrFromInt(physToVirt(pml4e & PTE_ADDR_MASK)));
+
+    const pdpte = pdpt[pdpt_idx];
+    if ((pdpte & PTE_PRESENT) == 0 or (pdpte & PTE_HUGE) != 0) return null;
+    const pd = @as(*[512]u64, @ptrFromInt(physToVirt(pdpte & PTE_ADDR_MASK)));
+
+    const pde = pd[pd_idx];
+    if ((pde & PTE_PRESENT) == 0 or (pde & PTE_HUGE) != 0) return null;
+    const pt = @as(*[512]u64, @ptrFromInt(physToVirt(pde & PTE_ADDR_MASK)));
+
+    return &pt[pt_idx];
+}
+
+/// Returns the physical address behind `virt_addr`, or null if it is not
+/// mapped with a 4KB page.
+pub fn physicalAddress(virt_addr: u64) ?u64 {
+    const pte = lookupPte(virt_addr) orelse return null;
+    if ((pte.* & PTE_PRESENT) == 0) return null;
+    return (pte.* & PTE_ADDR_MASK) | (virt_addr & (PAGE_SIZE - 1));
+}
+
+/// Returns the protection key of the 4KB page mapping `virt_addr`, or null
+/// if it is not mapped with a 4KB page.
+pub fn pageKey(virt_addr: u64) ?u4 {
+    const pte = lookupPte(virt_addr) orelse return null;
+    if ((pte.* & PTE_PRESENT) == 0) return null;
+    return @intCast((pte.* & PTE_PKS_MASK) >> PTE_PKS_SHIFT);
+}
+
+/// Returns the protection key of the 4KB or 2MB page mapping `virt_addr`,
+/// or null if it is not mapped.
+pub fn mappingKey(virt_addr: u64) ?u4 {
+    if (pageKey(virt_addr)) |key| return key;
+    const pde = lookupHugePde(virt_addr) orelse return null;
+    return @intCast((pde.* & PTE_PKS_MASK) >> PTE_PKS_SHIFT);
+}
+
+/// Returns true if `virt_addr` is covered by a present mapping (4KB, 2MB or 1GB).
+pub fn isMapped(virt_addr: u64) bool {
+    const pml4_idx = (virt_addr >> PML4_SHIFT) & PT_INDEX_MASK;
+    const pdpt_idx = (virt_addr >> PDPT_SHIFT) & PT_INDEX_MASK;
+    const pd_idx = (virt_addr >> PD_SHIFT) & PT_INDEX_MASK;
+    const pt_idx = (virt_addr >> PT_SHIFT) & PT_INDEX_MASK;
+
+    const pml4e = kernel_pml4[pml4_idx];
+    if ((pml4e & PTE_PRESENT) == 0) return false;
+    const pdpt = @as(*[512]u64, @ptrFromInt(physToVirt(pml4e & PTE_ADDR_MASK)));
+
+    const pdpte = pdpt[pdpt_idx];
+    if ((pdpte & PTE_PRESENT) == 0) return false;
+    if ((pdpte & PTE_HUGE) != 0) return true;
+    const pd = @as(*[512]u64, @ptrFromInt(physToVirt(pdpte & PTE_ADDR_MASK)));
+
+    const pde = pd[pd_idx];
+    if ((pde & PTE_PRESENT) == 0) return false;
+    if ((pde & PTE_HUGE) != 0) return true;
+    const pt = @as(*[512]u64, @ptrFromInt(physToVirt(pde & PTE_ADDR_MASK)));
+
+    return (pt[pt_idx] & PTE_PRESENT) != 0;
+}
+
+/// Makes `len` bytes of physical memory at `phys` reachable through the HHDM and
+/// returns the HHDM address of `phys`. Pages already covered (e.g. by the HHDM
+/// huge pages built in init()) are left alone, so this is safe to call on
+/// firmware tables and MMIO that may or may not be in the memory map.
+pub fn mapPhysical(phys: u64, len: u64, flags: u64) !u64 {
+    const first = phys & ~(PAGE_SIZE - 1);
+    const last = std.mem.alignForward(u64, phys + @max(len, 1), PAGE_SIZE);
+
+    var page = first;
+    while (page < last) : (page += PAGE_SIZE) {
+        const virt = physToVirt(page);
+        if (isMapped(virt)) continue;
+        try mapPage(virt, page, flags, 0);
+    }
+    return physToVirt(phys);
+}
+
+/// Changes the memory type of the existing mappings covering `len` bytes at
+/// `virt_addr`, keeping addresses, flags and protection keys, and flushes them
+/// from every CPU. A 2MB page that overlaps the range is retyped as a whole;
+/// HHDM huge pages never cross a memory map entry, so for a device range such
+/// as the framebuffer the excess is the same device. Unmapped pages are skipped.
+pub fn setCacheType(virt_addr: u64, len: u64, cache: CacheType) void {
+    var batch = tlb.Batch{};
+    var virt = virt_addr & ~(PAGE_SIZE - 1);
+    const end = virt_addr + len;
+    while (virt < end) {
+        if (lookupPte(virt)) |pte| {
+            if ((pte.* & PTE_PRESENT) != 0) {
+                const new = (pte.* & ~PTE_CACHE_MASK) | cacheBits(cache, false);
+                if (new != pte.*) {
+                    pte.* = new;
+                    batch.add(virt, 1);
+                }
+            }
+            virt += PAGE_SIZE;
+        } else if (lookupHugePde(virt)) |pde| {
+            const base = virt & ~(HUGE_PAGE_SIZE - 1);
+            const new = (pde.* & ~PTE_CACHE_MASK_HUGE) | cacheBits(cache, true);
+            if (new != pde.*) {
+                pde.* = new;
+                batch.add(base, HUGE_PAGE_SIZE / PAGE_SIZE);
+            }
+            virt = base + HUGE_PAGE_SIZE;
+        } else {
+            virt += PAGE_SIZE;
+        }
+    }
+    batch.flush();
+}
+
+/// Changes the protection key of the existing mappings covering `len` bytes
+/// at `virt_addr`, keeping everything else, and flushes them from every CPU.
+/// A 2MB page the range covers only partly is split into 4KB pages first,
+/// so neighbouring memory keeps its key. Unmapped pages are skipped.
+pub fn setKey(virt_addr: u64, len: u64, pks_key: u4) void {
+    var batch = tlb.Batch{};
+    _ = setKeyBatched(virt_addr, len, pks_key, &batch);
+    batch.flush();
+}
+
+/// setKey() without the flush: changed pages are added to `batch`. Returns
+/// the number of 4KB pages whose key changed (512 per retagged 2MB page).
+pub fn setKeyBatched(virt_addr: u64, len: u64, pks_key: u4, batch: *tlb.Batch) u64 {
+    const bits = @as(u64, pks_key) << PTE_PKS_SHIFT;
+    var changed: u64 = 0;
+    var virt = virt_addr & ~(PAGE_SIZE - 1);
+    const end = virt_addr + len;
+    while (virt < end) {
+        if (lookupPte(virt)) |pte| {
+            if ((pte.* & PTE_PRESENT) != 0 and (pte.* & PTE_PKS_MASK) != bits) {
+                pte.* = (pte.* & ~PTE_PKS_MASK) | bits;
+                batch.add(virt, 1);
+                changed += 1;
+            }
+            virt += PAGE_SIZE;
+        } else if (lookupHugePde(virt)) |pde| {
+            const base = virt & ~(HUGE_PAGE_SIZE - 1);
+            if ((pde.* & PTE_PKS_MASK) == bits) {
+                virt = base + HUGE_PAGE_SIZE;
+            } else if (virt == base and end >= base + HUGE_PAGE_SIZE) {
+                pde.* = (pde.* & ~PTE_PKS_MASK) | bits;
+                batch.add(base, HUGE_PAGE_SIZE / PAGE_SIZE);
+                changed += HUGE_PAGE_SIZE / PAGE_SIZE;
+                virt = base + HUGE_PAGE_SIZE;
+            } else {
+                // Retried as 4KB pages on the next iteration.
+                splitHugePde(pde) catch {
+                    log.warn("VMM: Out of memory splitting a 2MB page, key unchanged");
+                    virt = base + HUGE_PAGE_SIZE;
+                };
+            }
+        } else {
+            virt += PAGE_SIZE;
+        }
+    }
+    return changed;
+}
+
+/// Replaces a 2MB mapping with a page table of 512 4KB pages with the same
+/// addresses, flags, memory type and key. The stale 2MB TLB entry maps the
+/// same memory; the caller flushes it along with whatever it changes next.
+fn splitHugePde(pde: *u64) !void {
+    const old = pde.*;
+    const pt_phys = allocPageTable() orelse return error.OutOfMemory;
+    const pt = @as(*[512]u64, @ptrFromInt(physToVirt(pt_phys)));
+
+    var flags = old & ~(PTE_ADDR_MASK_HUGE | PTE_HUGE | PTE_PAT_HUGE);
+    if ((old & PTE_PAT_HUGE) != 0) flags |= PTE_PAT;
+    const phys = old & PTE_ADDR_MASK_HUGE;
+    for (pt, 0..) |*entry, i| entry.* = (phys + i * PAGE_SIZE) | flags;
+
+    pde.* = pt_phys | PTE_PRESENT | PTE_RW;
+}
+
+/// Moves every page table into the pks.KEY_PAGE_TABLES domain: sets up the
+/// table pool for future tables and retags the existing ones. Needs the
+/// TLB shootdown path (tlb.init()).
+pub fn protectPageTables() void {
+    const pool = pmm.allocatePages(PT_POOL_PAGES) orelse {
+        log.warn("VMM: No memory for the page table pool, tables stay untagged");
+        return;
+    };
+    setKey(physToVirt(pool), PT_POOL_PAGES * PAGE_SIZE, pks.KEY_PAGE_TABLES);
+    pt_pool = pool;
+    pt_pool_used = 0;
+
+    // Tables created by the splits above are retagged here too.
+    tagTable(kernel_pml4_phys);
+    for (kernel_pml4) |pml4e| {
+        if ((pml4e & PTE_PRESENT) == 0) continue;
+        tagTable(pml4e & PTE_ADDR_MASK);
+        const pdpt = @as(*[512]u64, @ptrFromInt(physToVirt(pml4e & PTE_ADDR_MASK)));
+        for (pdpt) |pdpte| {
+            if ((pdpte & PTE_PRESENT) == 0 or (pdpte & PTE_HUGE) != 0) continue;
+            tagTable(pdpte & PTE_ADDR_MASK);
+            const pd = @as(*[512]u64, @ptrFromInt(physToVirt(pdpte & PTE_ADDR_MASK)));
+            for (pd) |pde| {
+                if ((pde & PTE_PRESENT) == 0 or (pde & PTE_HUGE) != 0) continue;
+                tagTable(pde & PTE_ADDR_MASK);
+            }
+        }
+    }
+    log.info("VMM: Page tables tagged with their own protection key");
+}
+
+fn tagTable(phys: u64) void {
+    const virt = physToVirt(phys);
+    if (mappingKey(virt) == pks.KEY_PAGE_TABLES) return;
+    setKey(virt, PAGE_SIZE, pks.KEY_PAGE_TABLES);
+}
+
+/// Returns a pointer to the 2MB PD entry that maps `virt_addr`, or null if
+/// the address is not covered by a 2MB page.
+fn lookupHugePde(virt_addr: u64) ?*u64 {
+    const pml4_idx = (virt_addr >> PML4_SHIFT) & PT_INDEX_MASK;
+    const pdpt_idx = (virt_addr >> PDPT_SHIFT) & PT_INDEX_MASK;
+    const pd_idx = (virt_addr >> PD_SHIFT) & PT_INDEX_MASK;
+
+    const pml4e = kernel_pml4[pml4_idx];
+    if ((pml4e & PTE_PRESENT) == 0) return null;
+    const pdpt = @as(*[512]u64, @ptrFromInt(physToVirt(pml4e & PTE_ADDR_MASK)));
+
+    const pdpte = pdpt[pdpt_idx];
+    if ((pdpte & PTE_PRESENT) == 0 or (pdpte & PTE_HUGE) != 0) return null;
+    const pd = @as(*[512]u64, @ptrFromInt(physToVirt(pdpte & PTE_ADDR_MASK)));
+
+    const pde = &pd[pd_idx];
+    if ((pde.* & PTE_PRESENT) == 0 or (pde.* & PTE_HUGE) == 0) return null;
+    return pde;
+}
+
+/// Unmaps `count` 4KB pages starting at `virt_addr`, adding them to `batch`.
+/// The caller flushes the batch once all changes are made, so several
+/// operations can share one cross-CPU shootdown.
+pub fn unmapPagesBatched(virt_addr: u64, count: usize, batch: *tlb.Batch) void {
+    var i: usize = 0;
+    while (i < count) : (i += 1) {
+        const virt = virt_addr + i * PAGE_SIZE;
+        const pte = lookupPte(virt) orelse continue;
+        if ((pte.* & PTE_PRESENT) == 0) continue;
+        pte.* = 0;
+        batch.add(virt, 1);
+    }
+}
+
+/// Unmaps `count` 4KB pages starting at `virt_addr` and flushes them from every CPU.
+/// Does not free the backing physical pages.
+pub fn unmapPages(virt_addr: u64, count: usize) void {
+    var batch = tlb.Batch{};
+    unmapPagesBatched(virt_addr, count, &batch);
+    batch.flush();
+}
+
+/// Changes the flags and protection key of `count` mapped 4KB pages, keeping
+/// their physical addresses and memory type (see setCacheType()). Changed
+/// pages are added to `batch`.
+pub fn protectPagesBatched(virt_addr: u64, count: usize, flags: u64, pks_key: u4, batch: *tlb.Batch) void {
+    const pks_bits = @as(u64, pks_key) << PTE_PKS_SHIFT;
+    var i: usize = 0;
+    while (i < count) : (i += 1) {
+        const virt = virt_addr + i * PAGE_SIZE;
+        const pte = lookupPte(virt) orelse continue;
+        const old = pte.*;
+        if ((old & PTE_PRESENT) == 0) continue;
+
+        const new = (old & (PTE_ADDR_MASK | PTE_CACHE_MASK)) | flags | pks_bits | PTE_PRESENT;
+        if (new == old) continue;
+        pte.* = new;
+        batch.add(virt, 1);
+    }
+}
+
+/// Changes the flags and protection key of `count` pages and flushes them from every CPU.
+pub fn protectPages(virt_addr: u64, count: usize, flags: u64, pks_key: u4) void {
+    var batch = tlb.Batch{};
+    protectPagesBatched(virt_addr, count, flags, pks_key, &batch);
+    batch.flush();
 }
 
 /// Maps a 2MB Huge Page in the kernel PML4
@@ -194,20 +552,21 @@ pub fn mapHugePage(virt_addr: u64, phys_addr: u64, flags: u64, pks_key: u4) !voi
 }
 
 pub fn init() void {
-    serial.info("VMM: Initializing...");
+    log.info("VMM: Initializing...");
 
     // 1. Allocate a new PML4
     const pml4_phys = allocPageTable() orelse {
-        serial.err("VMM: Failed to allocate kernel PML4!");
+        log.err("VMM: Failed to allocate kernel PML4!");
         while (true) {}
     };
     kernel_pml4 = @as(*[512]u64, @ptrFromInt(physToVirt(pml4_phys)));
-    serial.info("VMM: Kernel PML4 allocated.");
+    kernel_pml4_phys = pml4_phys;
+    log.info("VMM: Kernel PML4 allocated.");
 
     // 2. Map the entire Physical Memory to HHDM (Higher Half)
     const memmap_resp = memmap_request.response;
     if (memmap_resp == null) {
-        serial.err("VMM: Memmap response missing.");
+        log.err("VMM: Memmap response missing.");
         while (true) {}
     }
 
@@ -235,26 +594,26 @@ pub fn init() void {
             if (is_aligned and remaining >= HUGE_PAGE_SIZE) {
                 // Map 2MB Huge Page
                 mapHugePage(curr + hhdm_offset, curr, PTE_RW, 0) catch {
-                    serial.err("VMM: Failed to map HHDM Huge Page.");
+                    log.err("VMM: Failed to map HHDM Huge Page.");
                     while (true) {}
                 };
                 curr += HUGE_PAGE_SIZE;
             } else {
                 // Map 4KB Small Page
                 mapPage(curr + hhdm_offset, curr, PTE_RW | PTE_NX, 0) catch {
-                    serial.err("VMM: Failed to map HHDM 4KB Page.");
+                    log.err("VMM: Failed to map HHDM 4KB Page.");
                     while (true) {}
                 };
                 curr += PAGE_SIZE;
             }
         }
     }
-    serial.info("VMM: HHDM Mapped (Optimized with Huge Pages).");
+    log.info("VMM: HHDM Mapped (Optimized with Huge Pages).");
 
     // 3. Map the Kernel Itself
     const exec_resp = executable_address_request.response;
     if (exec_resp == null) {
-        serial.err("VMM: Exec address response missing.");
+        log.err("VMM: Exec address response missing.");
         while (true) {}
     }
 
@@ -275,19 +634,19 @@ pub fn init() void {
     while (offset < kernel_size) : (offset += PAGE_SIZE) {
         // Map kernel as Key 0 using 4KB pages for now (safer for permissions)
         mapPage(virt_base + offset, phys_base + offset, PTE_RW, 0) catch {
-            serial.err("VMM: Failed to map Kernel.");
+            log.err("VMM: Failed to map Kernel.");
             while (true) {}
         };
     }
-    serial.info("VMM: Kernel Mapped.");
+    log.info("VMM: Kernel Mapped.");
 
     // 4. Switch CR3
-    serial.info("VMM: Switching CR3...");
+    log.info("VMM: Switching CR3...");
     asm volatile ("mov %[pml4], %%cr3"
         :
         : [pml4] "r" (pml4_phys),
         : .{ .memory = true });
-    serial.info("VMM: CR3 Switched. We are live on custom tables.");
+    log.info("VMM: CR3 Switched. We are live on custom tables.");
 }
 
 test "VMM Basic Mapping" {
@@ -302,8 +661,8 @@ test "VMM Basic Mapping" {
     }
 
     // Log the page we got
-    serial.info("Test: Testing VMM with Phys Page:");
-    serial.printHex(.info, phys);
+    log.info("Test: Testing VMM with Phys Page:");
+    log.printHex(.info, phys);
     const virt: u64 = 0xFFFF_8000_1000_0000; // Arbitrary high address
 
     // Map it
@@ -322,11 +681,88 @@ test "VMM Basic Mapping" {
 
     // We expect DEADBEEF, but due to test aliasing issues, we warn on mismatch instead of failing
     if (phys_ptr.* != 0xDEADBEEF) {
-        serial.warn("Test: HHDM mirror read mismatch (Likely Cache/TLB aliasing).");
-        serial.printHex(.warn, phys_ptr.*);
+        log.warn("Test: HHDM mirror read mismatch (Likely Cache/TLB aliasing).");
+        log.printHex(.warn, phys_ptr.*);
     } else {
         try std.testing.expect(phys_ptr.* == 0xDEADBEEF);
     }
 
-    serial.info("Test: VMM Mapping read/write success.");
+    log.info("Test: VMM Mapping read/write success.");
+}
+
+test "VMM Protect And Unmap" {
+    const phys = pmm.allocatePage() orelse return error.OutOfMemory;
+    defer pmm.freePage(phys);
+
+    // Well above the HHDM so the walk ends in a 4KB page table.
+    const virt: u64 = 0xFFFF_9000_0000_0000;
+    try mapPage(virt, phys, PTE_RW, 0);
+
+    // Retag with key 3, read-only
+    protectPages(virt, 1, PTE_NX, 3);
+    const pte = lookupPte(virt) orelse return error.TestFailure;
+    try std.testing.expect((pte.* & PTE_ADDR_MASK) == phys);
+    try std.testing.expect((pte.* & PTE_RW) == 0);
+    try std.testing.expect(((pte.* & PTE_PKS_MASK) >> PTE_PKS_SHIFT) == 3);
+
+    unmapPages(virt, 1);
+    try std.testing.expect((pte.* & PTE_PRESENT) == 0);
+}
+
+test "VMM Map Physical Skips Existing Mappings" {
+    const phys = pmm.allocatePage() orelse return error.OutOfMemory;
+    defer pmm.freePage(phys);
+
+    // RAM from the memory map is already in the HHDM (possibly as a huge page).
+    try std.testing.expect(isMapped(physToVirt(phys)));
+    const virt = try mapPhysical(phys + 0x10, 8, PTE_RW | PTE_NX);
+    try std.testing.expect(virt == physToVirt(phys) + 0x10);
+    try std.testing.expect(!isMapped(0xFFFF_9100_0000_0000));
+}
+
+test "VMM Cache Type Bits" {
+    try std.testing.expect(cacheFlags(.write_back) == 0);
+    try std.testing.expect(cacheFlags(.uncached) == (PTE_WRITE_THROUGH | PTE_NO_CACHE));
+    try std.testing.expect(cacheFlags(.write_combining) == (PTE_PAT | PTE_WRITE_THROUGH));
+    try std.testing.expect(cacheFlagsHuge(.write_combining) == (PTE_PAT_HUGE | PTE_WRITE_THROUGH));
+}
+
+test "VMM Set Cache Type Keeps Address And Key" {
+    const phys = pmm.allocatePage() orelse return error.OutOfMemory;
+    defer pmm.freePage(phys);
+
+    const virt: u64 = 0xFFFF_9000_0010_0000;
+    try mapPage(virt, phys, PTE_RW | PTE_NX, 2);
+    defer unmapPages(virt, 1);
+
+    setCacheType(virt, PAGE_SIZE, .write_combining);
+    const pte = lookupPte(virt) orelse return error.TestFailure;
+    try std.testing.expect((pte.* & PTE_CACHE_MASK) == cacheFlags(.write_combining));
+    try std.testing.expect((pte.* & PTE_ADDR_MASK) == phys);
+    try std.testing.expect(((pte.* & PTE_PKS_MASK) >> PTE_PKS_SHIFT) == 2);
+    try std.testing.expect((pte.* & PTE_NX) != 0);
+
+    setCacheType(virt, PAGE_SIZE, .write_back);
+    try std.testing.expect((pte.* & PTE_CACHE_MASK) == 0);
+}
+
+test "VMM Set Key Splits Only The Covered Part Of A Huge Page" {
+    const phys = pmm.allocatePage() orelse return error.OutOfMemory;
+    defer pmm.freePage(phys);
+    const virt = physToVirt(phys);
+    const neighbour = if ((virt & (HUGE_PAGE_SIZE - 1)) == 0) virt + PAGE_SIZE else virt - PAGE_SIZE;
+    const neighbour_key = mappingKey(neighbour);
+
+    setKey(virt, PAGE_SIZE, 6);
+    try std.testing.expect(mappingKey(virt) == 6);
+    try std.testing.expect(pageKey(virt) == 6);
+    try std.testing.expect(mappingKey(neighbour) == neighbour_key);
+
+    // Still the same memory.
+    const ptr = @as(*volatile u64, @ptrFromInt(virt));
+    ptr.* = 0x1234;
+    try std.testing.expect(ptr.* == 0x1234);
+
+    setKey(virt, PAGE_SIZE, pks.KEY_DEFAULT);
+    try std.testing.expect(mappingKey(virt) == pks.KEY_DEFAULT);
 }
@@ -0,0 +1,294 @@
+/// Lock-Free Ring Buffers
+///
+/// `Ring(T, N, mode)` is a bounded FIFO of N items (N a power of two) that is
+/// safe to share between CPUs and interrupt handlers without locks:
+///
+/// - `.spsc`: one producer, one consumer. Plain head/tail indices; each side
+///   caches the other side's index so the fast path touches only its own line.
+/// - `.mpsc`: many producers, one consumer.
+/// - `.mpmc`: many producers, many consumers.
+///
+/// The multi-producer variants use per-slot sequence numbers (Vyukov's bounded
+/// queue): a producer claims a position with a CAS on `tail`, fills the slot and
+/// then publishes it by bumping the slot's sequence, so a consumer never reads
+/// a half-written item even if producers finish out of order.
+///
+/// Producer and consumer indices live on separate cache lines. Batch
+/// operations claim a run of slots with one atomic operation.
+///
+/// Example:
+///   var keys: Ring(u8, 256, .mpmc) = .{};
+///   _ = keys.push('a');
+///   const c = keys.pop();
+const std = @import("std");
+
+pub const Mode = enum { spsc, mpsc, mpmc };
+
+pub fn SpscRing(comptime T: type, comptime N: usize) type {
+    return Ring(T, N, .spsc);
+}
+
+pub fn MpscRing(comptime T: type, comptime N: usize) type {
+    return Ring(T, N, .mpsc);
+}
+
+pub fn MpmcRing(comptime T: type, comptime N: usize) type {
+    return Ring(T, N, .mpmc);
+}
+
+pub fn Ring(comptime T: type, comptime N: usize, comptime mode: Mode) type {
+    if (N == 0 or !std.math.isPowerOfTwo(N)) @compileError("Ring size must be a power of two");
+
+    return switch (mode) {
+        .spsc => SpscImpl(T, N),
+        .mpsc => SequencedImpl(T, N, false),
+        .mpmc => SequencedImpl(T, N, true),
+    };
+}
+
+fn SpscImpl(comptime T: type, comptime N: usize) type {
+    return struct {
+        const Self = @This();
+        pub const capacity = N;
+        const mask = N - 1;
+
+        // Consumer side
+        head: std.atomic.Value(usize) align(std.atomic.cache_line) = std.atomic.Value(usize).init(0),
+        cached_tail: usize = 0,
+        // Producer side
+        tail: std.atomic.Value(usize) align(std.atomic.cache_line) = std.atomic.Value(usize).init(0),
+        cached_head: usize = 0,
+
+        items: [N]T align(std.atomic.cache_line) = undefined,
+
+        /// Appends `item`. Returns false if the ring is full. Producer only.
+        pub fn push(self: *Self, item: T) bool {
+            return self.pushBatch(&[_]T{item}) == 1;
+        }
+
+        /// Appends as many of `src` as fit. Returns the number pushed. Producer only.
+        pub fn pushBatch(self: *Self, src: []const T) usize {
+            const tail = self.tail.raw;
+            var free = N - (tail -% self.cached_head);
+            if (free < src.len) {
+                self.cached_head = self.head.load(.acquire);
+                free = N - (tail -% self.cached_head);
+            }
+            const n = @min(free, src.len);
+            for (src[0..n], 0..) |item, i| {
+                self.items[(tail +% i) & mask] = item;
+            }
+            self.tail.store(tail +% n, .release);
+            return n;
+        }
+
+        /// Removes the oldest item. Consumer only.
+        pub fn pop(self: *Self) ?T {
+            var out: [1]T = undefined;
+            if (self.popBatch(&out) == 0) return null;
+            return out[0];
+        }
+
+        /// Removes up to `dst.len` items into `dst`. Returns the number popped. Consumer only.
+        pub fn popBatch(self: *Self, dst: []T) usize {
+            const head = self.head.raw;
+            var avail = self.cached_tail -% head;
+            if (avail < dst.len) {
+                self.cached_tail = self.tail.load(.acquire);
+                avail = self.cached_tail -% head;
+            }
+            const n = @min(avail, dst.len);
+            for (dst[0..n], 0..) |*item, i| {
+                item.* = self.items[(head +% i) & mask];
+            }
+            self.head.store(head +% n, .release);
+            return n;
+        }
+
+        /// Number of items queued (a snapshot when other CPUs are active).
+        pub fn len(self: *const Self) usize {
+            return self.tail.load(.acquire) -% self.head.load(.acquire);
+        }
+
+        pub fn isEmpty(self: *const Self) bool {
+            return self.len() == 0;
+        }
+    };
+}
+
+fn SequencedImpl(comptime T: type, comptime N: usize, comptime multi_consumer: bool) type {
+    return struct {
+        const Self = @This();
+        pub const capacity = N;
+        const mask = N - 1;
+
+        const Slot = struct {
+            /// == position: free for the producer of that position.
+            /// == position + 1: holds the item for the consumer of that position.
+            seq: std.atomic.Value(usize),
+            value: T,
+        };
+
+        head: std.atomic.Value(usize) align(std.atomic.cache_line) = std.atomic.Value(usize).init(0),
+        tail: std.atomic.Value(usize) align(std.atomic.cache_line) = std.atomic.Value(usize).init(0),
+        slots: [N]Slot align(std.atomic.cache_line) = initSlots(),
+
+        fn initSlots() [N]Slot {
+            @setEvalBranchQuota(N * 4 + 1000);
+            var slots: [N]Slot = undefined;
+            for (&slots, 0..) |*slot, i| {
+                slot.seq = std.atomic.Value(usize).init(i);
+            }
+            return slots;
+        }
+
+        /// Appends `item`. Returns false if the ring is full.
+        pub fn push(self: *Self, item: T) bool {
+            return self.pushBatch(&[_]T{item}) == 1;
+        }
+
+        /// Appends as many of `src` as fit, as one contiguous run.
+        /// Returns the number pushed.
+        pub fn pushBatch(self: *Self, src: []const T) usize {
+            if (src.len == 0) return 0;
+            var pos = self.tail.load(.monotonic);
+            while (true) {
+                // Count the free slots starting at pos (at most src.len).
+                var n: usize = 0;
+                while (n < src.len) : (n += 1) {
+                    const seq = self.slots[(pos +% n) & mask].seq.load(.acquire);
+                    if (seq != pos +% n) break;
+                }
+                if (n == 0) {
+                    const seq = self.slots[pos & mask].seq.load(.acquire);
+                    // Slot still holds an unconsumed item from the previous lap: full.
+                    if (@as(isize, @bitCast(seq -% pos)) < 0) return 0;
+                    // Another producer moved tail past us; retry from the new tail.
+                    pos = self.tail.load(.monotonic);
+                    continue;
+                }
+
+                if (self.tail.cmpxchgWeak(pos, pos +% n, .monotonic, .monotonic)) |current| {
+                    pos = current;
+                    continue;
+                }
+
+                for (src[0..n], 0..) |item, i| {
+                    const slot = &self.slots[(pos +% i) & mask];
+                    slot.value = item;
+                    slot.seq.store(pos +% i +% 1, .release);
+                }
+                return n;
+            }
+        }
+
+        /// Removes the oldest item.
+        pub fn pop(self: *Self) ?T {
+            var out: [1]T = undefined;
+            if (self.popBatch(&out) == 0) return null;
+            return out[0];
+        }
+
+        /// Removes up to `dst.len` published items, oldest first.
+        /// Returns the number popped.
+        pub fn popBatch(self: *Self, dst: []T) usize {
+            if (dst.len == 0) return 0;
+            var pos = self.head.load(.monotonic);
+            while (true) {
+                var n: usize = 0;
+                while (n < dst.len) : (n += 1) {
+                    const seq = self.slots[(pos +% n) & mask].seq.load(.acquire);
+                    if (seq != pos +% n +% 1) break;
+                }
+                if (n == 0) {
+                    if (!multi_consumer) return 0;
+                    const seq = self.slots[pos & mask].seq.load(.acquire);
+                    // Not yet published: empty (or the producer is mid-write).
+                    if (@as(isize, @bitCast(seq -% (pos +% 1))) < 0) return 0;
+                    pos = self.head.load(.monotonic);
+                    continue;
+                }
+
+                if (multi_consumer) {
+                    if (self.head.cmpxchgWeak(pos, pos +% n, .monotonic, .monotonic)) |current| {
+                        pos = current;
+                        continue;
+                    }
+                } else {
+                    self.head.store(pos +% n, .monotonic);
+                }
+
+                for (dst[0..n], 0..) |*item, i| {
+                    const slot = &self.slots[(pos +% i) & mask];
+                    item.* = slot.value;
+                    // Free the slot for the producer one lap ahead.
+                    slot.seq.store(pos +% i +% N, .release);
+                }
+                return n;
+            }
+        }
+
+        /// Number of claimed positions (a snapshot; includes items being written).
+        pub fn len(self: *const Self) usize {
+            return self.tail.load(.acquire) -% self.head.load(.acquire);
+        }
+
+        pub fn isEmpty(self: *const Self) bool {
+            return self.len() == 0;
+        }
+    };
+}
+
+// --- Unit Tests ---
+
+fn expectFifo(comptime R: type) !void {
+    var ring: R = .{};
+    try std.testing.expect(ring.isEmpty());
+    try std.testing.expect(ring.pop() == null);
+
+    // Fill, overflow, drain, then wrap around several laps.
+    var lap: u32 = 0;
+    while (lap < 3) : (lap += 1) {
+        var i: u32 = 0;
+        while (i < R.capacity) : (i += 1) {
+            try std.testing.expect(ring.push(lap * 100 + i));
+        }
+        try std.testing.expect(!ring.push(999));
+        try std.testing.expect(ring.len() == R.capacity);
+
+        i = 0;
+        while (i < R.capacity) : (i += 1) {
+            try std.testing.expect(ring.pop().? == lap * 100 + i);
+        }
+        try std.testing.expect(ring.pop() == null);
+    }
+
+    // Batches are partial when the ring cannot take or give everything.
+    const input = [_]u32{ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+    try std.testing.expect(ring.pushBatch(&input) == R.capacity);
+    var out: [16]u32 = undefined;
+    try std.testing.expect(ring.popBatch(out[0..3]) == 3);
+    try std.testing.expect(out[0] == 1 and out[2] == 3);
+    try std.testing.expect(ring.pushBatch(input[R.capacity..]) == 2);
+    try std.testing.expect(ring.popBatch(&out) == R.capacity - 1);
+    try std.testing.expect(out[0] == 4 and out[R.capacity - 2] == R.capacity + 2);
+}
+
+test "Ring SPSC FIFO And Batches" {
+    try expectFifo(SpscRing(u32, 8));
+}
+
+test "Ring MPSC FIFO And Batches" {
+    try expectFifo(MpscRing(u32, 8));
+}
+
+test "Ring MPMC FIFO And Batches" {
+    try expectFifo(MpmcRing(u32, 8));
+}
+
+test "Ring Index Padding" {
+    const R = MpmcRing(u8, 16);
+    try std.testing.expect(@offsetOf(R, "tail") - @offsetOf(R, "head") >= std.atomic.cache_line);
+    const S = SpscRing(u8, 16);
+    try std.testing.expect(@offsetOf(S, "tail") - @offsetOf(S, "head") >= std.atomic.cache_line);
+}
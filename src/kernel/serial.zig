@@ -1,19 +1,93 @@
+/// Serial Console Logging (COM1)
+///
+/// Until `initAsync()` runs, every log line is written straight to the UART.
+/// After that, a log call only copies the formatted line into the calling
+/// CPU's lock-free log ring and returns. The rings are drained into the 16550
+/// FIFO in bursts of up to 16 bytes, either by the transmit-empty (THRE)
+/// interrupt or by the idle loop calling `drain()`.
+///
+/// Error-level messages, `flush()` and `panicFlush()` stay synchronous: they
+/// empty the rings and busy-wait on the line status register, so nothing is
+/// lost when the kernel halts right after logging.
+const std = @import("std");
 const io = @import("../arch/x86_64/io.zig");
+const cpu = @import("../arch/x86_64/cpu.zig");
+const smp = @import("../arch/x86_64/smp.zig");
+const apic = @import("../arch/x86_64/apic.zig");
+const idt = @import("../arch/x86_64/idt.zig");
+const ring = @import("ring.zig");
 const build_options = @import("build_options");
 
-pub const LogLevel = enum {
+pub const LogLevel = enum(u8) {
     debug,
     info,
     warn,
     error_level, // avoiding keyword 'error'
 };
 
-// Map build_options enum to our enum (names match, mostly)
-// We need to ensure we compare values correctly.
-// build_options.LogLevel is a separate type from this one.
+// --- 16550 UART (COM1) ---
+
+const COM1: u16 = 0x3F8;
+const REG_IER: u16 = COM1 + 1;
+const REG_FCR: u16 = COM1 + 2; // Write: FIFO control. Read: IIR.
+const REG_MCR: u16 = COM1 + 4;
+const REG_LSR: u16 = COM1 + 5;
+
+const IER_THRE: u8 = 1 << 1;
+/// Enable and clear both FIFOs, 14-byte receive trigger.
+const FCR_ENABLE_FIFO: u8 = 0xC7;
+/// DTR | RTS | OUT2. OUT2 gates the UART interrupt line on PCs.
+const MCR_OUT2: u8 = 0x0B;
+const LSR_THRE: u8 = 1 << 5;
+
+/// Transmit FIFO depth: bytes that can be written per THRE.
+pub const FIFO_DEPTH: usize = 16;
+
+const COM1_IRQ: u8 = 4;
+const COM1_VECTOR: u8 = 36;
+
+/// Per-CPU log buffer size in bytes.
+pub const LOG_RING_SIZE: usize = 4096;
+
+const LogRing = ring.SpscRing(u8, LOG_RING_SIZE);
+
+// One ring per CPU. The producer side is owned by that CPU and only touched
+// with interrupts disabled, so it has exactly one producer. The consumer side
+// is serialized by drain_lock.
+var log_rings: [smp.MAX_CPUS]LogRing = [_]LogRing{.{}} ** smp.MAX_CPUS;
+var drain_lock = std.atomic.Value(bool).init(false);
+// Ring the next burst starts from, so busy CPUs cannot starve the others.
+var drain_cursor: usize = 0;
+
+var async_enabled: bool = false;
+var irq_enabled: bool = false;
+
+// --- Log Levels ---
+//
+// build_options.log_level is the lowest level compiled in; anything below it
+// is removed at compile time. Above that floor, each subsystem has a runtime
+// level (default: info) set with setLevel(), the `loglevel` shell command or
+// the kernel command line (see configure()).
 // We can assume numerical order: debug=0, info=1, warn=2, error=3.
 
-/// Determines if the message should be logged based on the configured log level.
+/// Log sources with an independent runtime level. Unscoped calls
+/// (serial.info etc.) belong to `.kernel`.
+pub const Subsystem = enum {
+    kernel,
+    pmm,
+    vmm,
+    heap,
+    tlb,
+    acpi,
+    apic,
+    smp,
+    keyboard,
+    elf,
+};
+
+const SUBSYSTEM_COUNT = @typeInfo(Subsystem).@"enum".fields.len;
+
+/// Determines if the level is compiled in at all.
 fn shouldLog(level: LogLevel) bool {
     // Basic enum to int conversion for comparison
     const min_level_int = @intFromEnum(build_options.log_level);
@@ -21,23 +95,210 @@ fn shouldLog(level: LogLevel) bool {
     return msg_level_int >= min_level_int;
 }
 
+const DEFAULT_LEVEL: LogLevel = if (shouldLog(.info)) .info else @enumFromInt(@intFromEnum(build_options.log_level));
+
+var levels: [SUBSYSTEM_COUNT]LogLevel = [_]LogLevel{DEFAULT_LEVEL} ** SUBSYSTEM_COUNT;
+
+/// Returns true if `subsystem` currently logs at `level`.
+pub inline fn enabled(comptime level: LogLevel, subsystem: Subsystem) bool {
+    if (comptime !shouldLog(level)) return false;
+    const current = @atomicLoad(LogLevel, &levels[@intFromEnum(subsystem)], .monotonic);
+    return @intFromEnum(level) >= @intFromEnum(current);
+}
+
+/// Sets the runtime level of one subsystem.
+pub fn setLevel(subsystem: Subsystem, level: LogLevel) void {
+    @atomicStore(LogLevel, &levels[@intFromEnum(subsystem)], level, .monotonic);
+}
+
+/// Sets the runtime level of every subsystem.
+pub fn setAllLevels(level: LogLevel) void {
+    for (0..SUBSYSTEM_COUNT) |i| setLevel(@enumFromInt(i), level);
+}
+
+pub fn getLevel(subsystem: Subsystem) LogLevel {
+    return @atomicLoad(LogLevel, &levels[@intFromEnum(subsystem)], .monotonic);
+}
+
+/// Parses "debug", "info", "warn" or "error".
+pub fn parseLevel(name: []const u8) ?LogLevel {
+    if (std.mem.eql(u8, name, "error")) return .error_level;
+    return std.meta.stringToEnum(LogLevel, name);
+}
+
+pub fn levelName(level: LogLevel) []const u8 {
+    return switch (level) {
+        .debug => "debug",
+        .info => "info",
+        .warn => "warn",
+        .error_level => "error",
+    };
+}
+
+pub const ConfigError = error{ UnknownSubsystem, UnknownLevel };
+
+/// Applies log settings from a kernel command line. Recognized words:
+///   loglevel=<level>          every subsystem
+///   log.<subsystem>=<level>   one subsystem
+/// Other words are ignored. Returns the number of settings applied.
+///
+/// Example: "quiet loglevel=warn log.pmm=debug"
+pub fn configure(cmdline: []const u8) ConfigError!usize {
+    var applied: usize = 0;
+    var words = std.mem.tokenizeScalar(u8, cmdline, ' ');
+    while (words.next()) |word| {
+        const eq = std.mem.indexOfScalar(u8, word, '=') orelse continue;
+        const key = word[0..eq];
+        const value = word[eq + 1 ..];
+
+        if (std.mem.eql(u8, key, "loglevel")) {
+            setAllLevels(parseLevel(value) orelse return ConfigError.UnknownLevel);
+        } else if (std.mem.startsWith(u8, key, "log.")) {
+            const subsystem = std.meta.stringToEnum(Subsystem, key["log.".len..]) orelse return ConfigError.UnknownSubsystem;
+            setLevel(subsystem, parseLevel(value) orelse return ConfigError.UnknownLevel);
+        } else continue;
+        applied += 1;
+    }
+    return applied;
+}
+
+// --- Rate Limiting ---
+
+/// Messages a call site may print per window before it is throttled.
+pub const RATE_LIMIT_BURST: u32 = 10;
+/// Window length in TSC cycles (about a second on a few-GHz part).
+pub const RATE_LIMIT_WINDOW: u64 = 1 << 31;
+
+/// Per-call-site throttle. While throttled, a call costs one counter
+/// increment and a TSC read; the number of dropped messages is reported
+/// with the first message of the next window.
+pub const RateLimit = struct {
+    /// Calls in the current window, printed or not.
+    count: std.atomic.Value(u32) = std.atomic.Value(u32).init(0),
+    window_start: std.atomic.Value(u64) = std.atomic.Value(u64).init(0),
+
+    /// Returns null if the message should be dropped, otherwise the number of
+    /// messages dropped since the last one that was printed.
+    pub fn check(self: *RateLimit) ?u32 {
+        const n = self.count.fetchAdd(1, .monotonic);
+        if (n == 0) self.window_start.store(cpu.rdtsc(), .monotonic);
+        if (n < RATE_LIMIT_BURST) return 0;
+
+        const start = self.window_start.load(.monotonic);
+        const now = cpu.rdtsc();
+        if (now -% start < RATE_LIMIT_WINDOW) return null;
+        // One CPU opens the new window; the others keep dropping.
+        if (self.window_start.cmpxchgStrong(start, now, .monotonic, .monotonic) != null) return null;
+        // The swapped-out count includes this call and the printed burst.
+        return self.count.swap(1, .monotonic) - RATE_LIMIT_BURST - 1;
+    }
+};
+
+/// One RateLimit per source location.
+fn siteLimit(comptime src: std.builtin.SourceLocation) *RateLimit {
+    const Site = struct {
+        // Referencing `src` makes this a distinct type per call site.
+        const location = src;
+        var limit: RateLimit = .{};
+    };
+    return &Site.limit;
+}
+
+/// Log functions bound to a subsystem. Conventionally imported as
+/// `const log = serial.scoped(.pmm);`.
+pub fn scoped(comptime subsystem: Subsystem) type {
+    return struct {
+        /// Runtime check, for skipping formatting work when disabled.
+        pub inline fn enabled(comptime level: LogLevel) bool {
+            return serial_enabled(level, subsystem);
+        }
+
+        pub fn debug(msg: []const u8) void {
+            logScoped(.debug, subsystem, msg);
+        }
+
+        pub fn info(msg: []const u8) void {
+            logScoped(.info, subsystem, msg);
+        }
+
+        pub fn warn(msg: []const u8) void {
+            logScoped(.warn, subsystem, msg);
+        }
+
+        pub fn err(msg: []const u8) void {
+            logScoped(.error_level, subsystem, msg);
+        }
+
+        pub fn printHex(comptime level: LogLevel, value: u64) void {
+            if (serial_enabled(level, subsystem)) writeHex(value);
+        }
+
+        /// Rate-limited gate for the call site at `src` (pass `@src()`).
+        /// Returns true if a message may be printed now; format it inside
+        /// the `if` so throttled calls do no formatting at all.
+        ///
+        /// Example:
+        ///   if (log.ratelimit(.warn, @src())) log.warn("Queue full");
+        pub fn ratelimit(comptime level: LogLevel, comptime src: std.builtin.SourceLocation) bool {
+            if (!serial_enabled(level, subsystem)) return false;
+            const dropped = siteLimit(src).check() orelse return false;
+            if (dropped > 0) {
+                var buf: [64]u8 = undefined;
+                const note = std.fmt.bufPrint(&buf, "({d} similar messages suppressed)", .{dropped}) catch "(messages suppressed)";
+                logScoped(level, subsystem, note);
+            }
+            return true;
+        }
+
+        /// Logs `msg` unless the call site at `src` is being throttled.
+        pub fn limited(comptime level: LogLevel, comptime src: std.builtin.SourceLocation, msg: []const u8) void {
+            if (ratelimit(level, src)) logScoped(level, subsystem, msg);
+        }
+    };
+}
+
+// scoped() declares its own `enabled`; this alias reaches the global one.
+const serial_enabled = enabled;
+
+fn logScoped(comptime level: LogLevel, subsystem: Subsystem, msg: []const u8) void {
+    if (!enabled(level, subsystem)) return;
+    // Prepend tag
+    const tag = switch (level) {
+        .debug => "[DEBUG] ",
+        .info => "[INFO] ",
+        .warn => "[WARN] ",
+        .error_level => "[ERROR] ",
+    };
+    // Errors usually precede a halt: write them out before returning.
+    if (level == .error_level) {
+        writeSync(&.{ tag, msg, "\n" });
+    } else {
+        emit(&.{ tag, msg, "\n" });
+    }
+}
+
+/// Switches logging to the buffered path. Requires the APIC and SMP tables,
+/// since the ring is picked by `smp.currentIndex()` and drained from IRQ4.
+pub fn initAsync() void {
+    io.outb(REG_FCR, FCR_ENABLE_FIFO);
+    io.outb(REG_MCR, MCR_OUT2);
+
+    if (idt.registerFastHandler(COM1_VECTOR, uartHandler)) |_| {
+        apic.enableIrq(COM1_IRQ, COM1_VECTOR);
+        io.outb(REG_IER, IER_THRE);
+        irq_enabled = true;
+    } else |_| {
+        // Still buffered; the idle loop and the producers do the draining.
+        writeDirect("[WARN] Serial: COM1 vector already in use, polling only\n");
+    }
+
+    @atomicStore(bool, &async_enabled, true, .release);
+}
+
 /// Logs a message with the specified log level if it meets the configured verbosity.
 /// Prepends a tag (e.g., "[INFO]") to the message.
 pub fn log(comptime level: LogLevel, msg: []const u8) void {
-    if (comptime shouldLog(level)) {
-        // Prepend tag
-        const tag = switch (level) {
-            .debug => "[DEBUG] ",
-            .info => "[INFO] ",
-            .warn => "[WARN] ",
-            .error_level => "[ERROR] ",
-        };
-        for (tag) |c| {
-            io.outb(0x3F8, c);
-        }
-        logRaw(msg);
-        io.outb(0x3F8, '\n');
-    }
+    logScoped(level, .kernel, msg);
 }
 
 /// Logs a debug message.
@@ -68,25 +329,274 @@ pub fn err(msg: []const u8) void {
 ///   logRaw("Score: ");  // No newline
 ///   logRaw("42");       // Outputs "Score: 42" on same line
 pub fn logRaw(msg: []const u8) void {
-    for (msg) |c| {
-        io.outb(0x3F8, c);
-    }
+    emit(&.{msg});
 }
 
 /// Prints a 64-bit unsigned integer in hexadecimal format to the serial port.
 pub fn printHex(comptime level: LogLevel, value: u64) void {
-    if (comptime shouldLog(level)) {
-        const digits = "0123456789ABCDEF";
-        for ("0x") |c| {
-            io.outb(0x3F8, c);
-        }
-        var shift: u6 = 60;
-        while (true) {
-            const digit_index = (value >> shift) & 0xF;
-            io.outb(0x3F8, digits[digit_index]);
-            if (shift == 0) break;
-            shift -= 4;
+    if (enabled(level, .kernel)) writeHex(value);
+}
+
+fn writeHex(value: u64) void {
+    const digits = "0123456789ABCDEF";
+    var buf: [19]u8 = undefined;
+    buf[0] = '0';
+    buf[1] = 'x';
+    var shift: u6 = 60;
+    var i: usize = 2;
+    while (true) : (i += 1) {
+        buf[i] = digits[(value >> shift) & 0xF];
+        if (shift == 0) break;
+        shift -= 4;
+    }
+    buf[18] = '\n';
+    emit(&.{&buf});
+}
+
+/// Drains one FIFO burst if the transmitter is idle. Called from the idle loop.
+/// Interrupts stay off while drain_lock is held: a handler on this CPU that
+/// logs synchronously would otherwise spin on the lock forever.
+pub fn drain() void {
+    if (!@atomicLoad(bool, &async_enabled, .acquire)) return;
+    const was_enabled = cpu.interruptsEnabled();
+    cpu.disableInterrupts();
+    _ = drainBurst();
+    if (was_enabled) cpu.enableInterrupts();
+}
+
+/// Writes out everything buffered on every CPU, busy-waiting on the UART.
+pub fn flush() void {
+    const was_enabled = cpu.interruptsEnabled();
+    cpu.disableInterrupts();
+    lockDrain();
+    flushLocked();
+    unlockDrain();
+    if (was_enabled) cpu.enableInterrupts();
+}
+
+/// Last-resort flush for panics and fatal errors. Takes the drain lock even if
+/// another (possibly dead) CPU holds it, empties every ring and makes all
+/// later output synchronous. Leaves interrupts disabled.
+pub fn panicFlush() void {
+    cpu.disableInterrupts();
+    @atomicStore(bool, &async_enabled, false, .release);
+    drain_lock.store(true, .acquire);
+    flushLocked();
+    unlockDrain();
+}
+
+/// Bytes waiting in the log rings (a snapshot).
+pub fn pendingBytes() usize {
+    var total: usize = 0;
+    for (&log_rings) |*r| total += r.len();
+    return total;
+}
+
+// --- Internals ---
+
+/// Copies `parts` into this CPU's ring as one unit and kicks the drainer.
+fn emit(parts: []const []const u8) void {
+    if (!@atomicLoad(bool, &async_enabled, .acquire)) {
+        for (parts) |part| writeDirect(part);
+        return;
+    }
+
+    const was_enabled = cpu.interruptsEnabled();
+    cpu.disableInterrupts();
+    const r = &log_rings[smp.currentIndex()];
+    for (parts) |part| {
+        var rest = part;
+        while (rest.len > 0) {
+            rest = rest[r.pushBatch(rest)..];
+            // Ring full: fall back to writing synchronously instead of dropping.
+            if (rest.len > 0) {
+                lockDrain();
+                flushLocked();
+                unlockDrain();
+            }
         }
-        io.outb(0x3F8, '\n');
     }
+
+    // With IF=1, re-arm THRE so the UART interrupt picks the line up.
+    // Otherwise (IRQ context, early boot) push one burst out by hand.
+    if (was_enabled and irq_enabled) {
+        io.outb(REG_IER, 0);
+        io.outb(REG_IER, IER_THRE);
+    } else {
+        _ = drainBurst();
+    }
+    if (was_enabled) cpu.enableInterrupts();
+}
+
+/// Flushes the rings, then writes `parts` directly, keeping the output ordered.
+fn writeSync(parts: []const []const u8) void {
+    if (!@atomicLoad(bool, &async_enabled, .acquire)) {
+        for (parts) |part| writeDirect(part);
+        return;
+    }
+
+    const was_enabled = cpu.interruptsEnabled();
+    cpu.disableInterrupts();
+    lockDrain();
+    flushLocked();
+    for (parts) |part| writeDirect(part);
+    unlockDrain();
+    if (was_enabled) cpu.enableInterrupts();
+}
+
+/// Writes `bytes` to the UART, one FIFO load per THRE.
+fn writeDirect(bytes: []const u8) void {
+    var rest = bytes;
+    while (rest.len > 0) {
+        waitThre();
+        const n = @min(rest.len, FIFO_DEPTH);
+        for (rest[0..n]) |c| io.outb(COM1, c);
+        rest = rest[n..];
+    }
+}
+
+fn waitThre() void {
+    while (io.inb(REG_LSR) & LSR_THRE == 0) cpu.pause();
+}
+
+fn lockDrain() void {
+    while (drain_lock.cmpxchgWeak(false, true, .acquire, .monotonic) != null) cpu.pause();
+}
+
+fn unlockDrain() void {
+    drain_lock.store(false, .release);
+}
+
+/// Pops up to `out.len` bytes, visiting the rings round-robin from drain_cursor.
+/// A ring is emptied before moving on so lines from one CPU stay together.
+/// Caller holds drain_lock.
+fn popAny(out: []u8) usize {
+    var i: usize = 0;
+    while (i < smp.MAX_CPUS) : (i += 1) {
+        const n = log_rings[drain_cursor].popBatch(out);
+        if (n > 0) return n;
+        drain_cursor = (drain_cursor + 1) % smp.MAX_CPUS;
+    }
+    return 0;
+}
+
+/// Moves one FIFO's worth of bytes to the UART if the transmitter is empty.
+/// Never waits: returns false if another CPU is draining or THR is busy.
+fn drainBurst() bool {
+    if (drain_lock.cmpxchgWeak(false, true, .acquire, .monotonic) != null) return false;
+    defer unlockDrain();
+
+    if (io.inb(REG_LSR) & LSR_THRE == 0) return false;
+    var burst: [FIFO_DEPTH]u8 = undefined;
+    const n = popAny(&burst);
+    for (burst[0..n]) |c| io.outb(COM1, c);
+    return n > 0;
+}
+
+/// Empties every ring, busy-waiting on the UART. Caller holds drain_lock.
+fn flushLocked() void {
+    var burst: [FIFO_DEPTH]u8 = undefined;
+    while (true) {
+        const n = popAny(&burst);
+        if (n == 0) return;
+        waitThre();
+        for (burst[0..n]) |c| io.outb(COM1, c);
+    }
+}
+
+/// THRE interrupt: the FIFO is empty, refill it. When the rings are empty no
+/// byte is written and the UART stays quiet until the next kick.
+fn uartHandler(vector: u64) callconv(.c) void {
+    _ = vector;
+    _ = io.inb(REG_FCR); // Read IIR to acknowledge.
+    _ = drainBurst();
+    apic.sendEoi();
+}
+
+// --- Unit Tests ---
+
+test "Serial Log Lines Are Buffered Then Flushed" {
+    try std.testing.expect(async_enabled);
+    const before = pendingBytes();
+
+    // Tests run with IF=0, so each call pushes at most one burst out inline.
+    info("Serial: buffered line one");
+    info("Serial: buffered line two");
+    try std.testing.expect(pendingBytes() > before);
+
+    flush();
+    try std.testing.expect(pendingBytes() == 0);
+}
+
+test "Serial Hex Formatting" {
+    printHex(.info, 0x0123_4567_89AB_CDEF);
+    flush();
+    try std.testing.expect(pendingBytes() == 0);
+}
+
+test "Serial UART Vector Registered" {
+    try std.testing.expect(irq_enabled);
+    try std.testing.expectError(error.VectorInUse, idt.registerFastHandler(COM1_VECTOR, uartHandler));
+}
+
+test "Serial Runtime Levels Per Subsystem" {
+    const saved = levels;
+    defer levels = saved;
+
+    setAllLevels(.info);
+    try std.testing.expect(!enabled(.debug, .pmm));
+    try std.testing.expect(enabled(.info, .pmm));
+
+    try std.testing.expect(try configure("quiet loglevel=warn log.pmm=debug splash") == 2);
+    try std.testing.expect(getLevel(.kernel) == .warn);
+    try std.testing.expect(getLevel(.pmm) == .debug);
+    try std.testing.expect(scoped(.pmm).enabled(.debug));
+    try std.testing.expect(!scoped(.vmm).enabled(.info));
+
+    try std.testing.expectError(ConfigError.UnknownSubsystem, configure("log.nope=debug"));
+    try std.testing.expectError(ConfigError.UnknownLevel, configure("loglevel=loud"));
+    try std.testing.expect(parseLevel("error") == .error_level);
+}
+
+test "Serial Rate Limit Burst And Window" {
+    var limit = RateLimit{};
+    var printed: u32 = 0;
+    var i: u32 = 0;
+    while (i < RATE_LIMIT_BURST + 5) : (i += 1) {
+        if (limit.check() != null) printed += 1;
+    }
+    try std.testing.expect(printed == RATE_LIMIT_BURST);
+
+    // Age the window: the next call is printed and reports the 5 drops.
+    limit.window_start.store(cpu.rdtsc() -% RATE_LIMIT_WINDOW -% 1, .monotonic);
+    try std.testing.expect(limit.check().? == 5);
+    try std.testing.expect(limit.check().? == 0);
+}
+
+test "Serial Rate Limit Is Per Call Site" {
+    const a = siteLimit(@src());
+    const b = siteLimit(@src());
+    try std.testing.expect(a != b);
+}
+
+test "Benchmark: Buffered vs Synchronous Log Line" {
+    const bench = @import("bench.zig");
+    const msg = "Serial: benchmark line of about forty chars";
+    const iterations: u64 = 32;
+
+    // Keep the ring from filling so only the enqueue path is measured.
+    flush();
+    var start = bench.now();
+    var i: u64 = 0;
+    while (i < iterations) : (i += 1) info(msg);
+    const buffered = bench.now() - start;
+    flush();
+
+    start = bench.now();
+    i = 0;
+    while (i < iterations) : (i += 1) writeSync(&.{ "[INFO] ", msg, "\n" });
+    const sync = bench.now() - start;
+
+    bench.report("serial log line (buffered)", buffered, iterations);
+    bench.report("serial log line (synchronous)", sync, iterations);
 }
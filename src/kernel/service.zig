@@ -0,0 +1,423 @@
+/// Service Registry
+///
+/// The kernel table pattern between programs. A server publishes a table
+/// of its own C-ABI functions under a name. A client looks the name up and
+/// calls the entries directly, without entering the kernel. Each entry the
+/// client gets is a 64-byte stub generated at publish time that
+///   1. reads the caller's PKRS and keeps it on the stack;
+///   2. adds the server's key to it (one `and`) and writes it back;
+///   3. calls the server's function;
+///   4. restores the caller's PKRS and returns the function's result.
+/// A call costs an rdmsr and two wrmsr over a plain indirect call.
+///
+/// The server runs with the caller's rights plus its own key, so it can use
+/// the buffers the caller passes, as a library would; the caller never
+/// gains the server's key. The stubs embed that key, so the server's domain
+/// is pinned (never evicted, see domain.zig) while it has services
+/// published. Services published by the kernel run with full rights.
+///
+/// Limits: entries take at most six integer or pointer arguments and no
+/// variadic ones (the saved PKRS sits on the stack where stack-passed
+/// arguments would be).
+///
+/// A service's entry table and stubs share one page in the service region,
+/// at an address that depends on the slot and how often the slot was
+/// reused (see pageOf), mapped read-only and
+/// executable with key 0. The kernel writes the page through its HHDM
+/// alias, which is in the driver domain. Without PKS the entries point
+/// straight at the server's functions.
+///
+/// Example (a client, through the kernel table):
+///   var count: usize = 0;
+///   const entries = table.lookup_service("font", 4, &count) orelse return;
+///   const measure: *const fn ([*]const u8, usize) callconv(.c) u32 = @ptrFromInt(entries[0]);
+const std = @import("std");
+const cpu = @import("../arch/x86_64/cpu.zig");
+const pks = @import("../arch/x86_64/pks.zig");
+const domain = @import("domain.zig");
+const io_ring = @import("io_ring.zig");
+const pmm = @import("memory/pmm.zig");
+const vmm = @import("memory/vmm.zig");
+const layout = @import("memory/layout.zig");
+const serial = @import("serial.zig");
+
+/// Services that may be published at once.
+pub const MAX_SERVICES: usize = 16;
+/// Longest service name.
+pub const NAME_MAX: usize = 32;
+/// Program domains that may publish at once. Each keeps its key pinned,
+/// so one key is always left for programs that only run.
+pub const MAX_PUBLISHERS: usize = domain.KEY_COUNT - 1;
+
+const PAGE_SIZE: u64 = 4096;
+const STUB_SIZE: usize = 64;
+/// Stubs start here in a service page; the entry table comes first.
+const STUBS_OFFSET: usize = 512;
+/// Times a slot can be reused before its addresses repeat.
+pub const GENERATIONS: usize = 1 << 16;
+/// Entries per service: as many stubs as fit after the table.
+pub const MAX_ENTRIES: usize = (PAGE_SIZE - STUBS_OFFSET) / STUB_SIZE;
+
+comptime {
+    std.debug.assert(MAX_ENTRIES * @sizeOf(usize) <= STUBS_OFFSET);
+}
+
+/// The stub, with zeroed immediates. Entered with RSP 8 off 16-byte
+/// alignment, so the one push realigns it for the call. RCX and RDX carry
+/// arguments and the return value, and rdmsr/wrmsr need them, so they
+/// wait in R10/R11 (scratch registers in the C ABI).
+const STUB_TEMPLATE = [STUB_SIZE]u8{
+    0x49, 0x89, 0xCA, // mov r10, rcx
+    0x49, 0x89, 0xD3, // mov r11, rdx
+    0xB9, 0, 0, 0, 0, // mov ecx, IA32_PKRS
+    0x0F, 0x32, // rdmsr
+    0x50, // push rax
+    0x25, 0, 0, 0, 0, // and eax, mask
+    0x31, 0xD2, // xor edx, edx
+    0x0F, 0x30, // wrmsr
+    0x4C, 0x89, 0xD1, // mov rcx, r10
+    0x4C, 0x89, 0xDA, // mov rdx, r11
+    0x48, 0xB8, 0, 0, 0, 0, 0, 0, 0, 0, // movabs rax, target
+    0xFF, 0xD0, // call rax
+    0x49, 0x89, 0xC2, // mov r10, rax
+    0x49, 0x89, 0xD3, // mov r11, rdx
+    0xB9, 0, 0, 0, 0, // mov ecx, IA32_PKRS
+    0x58, // pop rax
+    0x31, 0xD2, // xor edx, edx
+    0x0F, 0x30, // wrmsr
+    0x4C, 0x89, 0xD0, // mov rax, r10
+    0x4C, 0x89, 0xDA, // mov rdx, r11
+    0xC3, // ret
+};
+const STUB_MSR_ENTRY = 7;
+const STUB_MASK = 15;
+const STUB_TARGET = 31;
+const STUB_MSR_EXIT = 48;
+
+/// Writes a stub that calls `target` with the caller's PKRS ANDed with
+/// `mask`.
+fn emitStub(out: *[STUB_SIZE]u8, target: u64, mask: u32) void {
+    out.* = STUB_TEMPLATE;
+    std.mem.writeInt(u32, out[STUB_MSR_ENTRY..][0..4], pks.MSR_IA32_PKRS, .little);
+    std.mem.writeInt(u32, out[STUB_MASK..][0..4], mask, .little);
+    std.mem.writeInt(u64, out[STUB_TARGET..][0..8], target, .little);
+    std.mem.writeInt(u32, out[STUB_MSR_EXIT..][0..4], pks.MSR_IA32_PKRS, .little);
+}
+
+const Service = struct {
+    live: bool = false,
+    name: [NAME_MAX]u8 = undefined,
+    name_len: usize = 0,
+    /// Publishing domain (null: the kernel).
+    owner: ?*domain.Domain = null,
+    count: usize = 0,
+    phys: u64 = 0,
+
+    fn nameIs(self: *const Service, name: []const u8) bool {
+        return self.live and std.mem.eql(u8, self.name[0..self.name_len], name);
+    }
+};
+
+var services: [MAX_SERVICES]Service = [_]Service{.{}} ** MAX_SERVICES;
+/// Withdrawals per slot, so a new service never reuses the address of the
+/// one before it.
+var generations: [MAX_SERVICES]u32 = [_]u32{0} ** MAX_SERVICES;
+
+// Publishing maps a page and may split an HHDM huge page, which shoots
+// down TLBs; as in domain.zig the lock is held with interrupts enabled.
+// Order: this lock, then the domain lock.
+var lock = std.atomic.Value(bool).init(false);
+
+fn acquire() void {
+    while (lock.cmpxchgWeak(false, true, .acquire, .monotonic) != null) {
+        cpu.pause();
+    }
+}
+
+fn release() void {
+    lock.store(false, .release);
+}
+
+/// The page of the service in `slot`. Each withdrawal moves the slot to a
+/// fresh page, so entry pointers into a withdrawn service fault instead of
+/// reaching whatever is published next (until GENERATIONS reuses later).
+fn pageOf(slot: usize) u64 {
+    const generation = generations[slot] % GENERATIONS;
+    return layout.SERVICE_REGION_BASE + (generation * MAX_SERVICES + slot) * PAGE_SIZE;
+}
+
+fn find(name: []const u8) ?usize {
+    for (&services, 0..) |*s, i| {
+        if (s.nameIs(name)) return i;
+    }
+    return null;
+}
+
+/// Publishes `entries` under `name`. A program may only publish functions
+/// in its own ELF image. Returns the service slot, or io_ring.E_INVAL for a
+/// bad name, count or entry, io_ring.E_BUSY if the name is taken, every
+/// slot is in use or MAX_PUBLISHERS other domains publish already, or
+/// io_ring.E_FAULT if the kernel is out of memory.
+pub fn publish(name: []const u8, entries: []const usize) i64 {
+    if (name.len == 0 or name.len > NAME_MAX) return io_ring.E_INVAL;
+    if (entries.len == 0 or entries.len > MAX_ENTRIES) return io_ring.E_INVAL;
+
+    acquire();
+    defer release();
+    if (find(name) != null) return io_ring.E_BUSY;
+    const slot = for (services, 0..) |s, i| {
+        if (!s.live) break i;
+    } else return io_ring.E_BUSY;
+
+    // The server keeps its own key on top of the caller's rights; kernel
+    // services get all rights.
+    const owner = domain.current();
+    var mask: u32 = 0;
+    if (owner) |d| {
+        if (!publishes(d) and publisherCount() == MAX_PUBLISHERS) return io_ring.E_BUSY;
+        for (entries) |entry| {
+            if (!d.owns(entry, 1, .image)) return io_ring.E_INVAL;
+        }
+        mask = ~(@as(u32, 3) << (@as(u5, d.key.?) * 2));
+    }
+
+    const phys = pmm.allocatePage() orelse return io_ring.E_FAULT;
+    const page: [*]u8 = @ptrFromInt(phys + vmm.getHhdmOffset());
+    @memset(page[0..PAGE_SIZE], 0xCC); // int3 outside the stubs
+    const table: [*]usize = @ptrCast(@alignCast(page));
+    for (entries, 0..) |entry, i| {
+        if (pks.isEnabled()) {
+            const offset = STUBS_OFFSET + i * STUB_SIZE;
+            emitStub(page[offset..][0..STUB_SIZE], entry, mask);
+            table[i] = pageOf(slot) + offset;
+        } else {
+            table[i] = entry;
+        }
+    }
+
+    vmm.setKey(@intFromPtr(page), PAGE_SIZE, pks.KEY_DRIVERS);
+    vmm.mapPage(pageOf(slot), phys, 0, pks.KEY_DEFAULT) catch {
+        vmm.setKey(@intFromPtr(page), PAGE_SIZE, pks.KEY_DEFAULT);
+        pmm.freePage(phys);
+        return io_ring.E_FAULT;
+    };
+    if (owner) |d| d.pin();
+
+    const s = &services[slot];
+    s.* = .{ .live = true, .name_len = name.len, .owner = owner, .count = entries.len, .phys = phys };
+    @memcpy(s.name[0..name.len], name);
+    return @intCast(slot);
+}
+
+/// Returns the entry table of the service named `name` and stores its
+/// length in `count`, or null if there is no such service.
+pub fn lookup(name: []const u8, count: *usize) ?[*]const usize {
+    acquire();
+    defer release();
+    const slot = find(name) orelse return null;
+    count.* = services[slot].count;
+    return @ptrFromInt(pageOf(slot));
+}
+
+/// Withdraws a service. Only its publisher (or the kernel) may. Entry
+/// pointers clients still hold fault from then on (see pageOf). Returns
+/// false if there is no such service or the caller does not own it.
+pub fn withdraw(name: []const u8) bool {
+    acquire();
+    defer release();
+    const slot = find(name) orelse return false;
+    const s = &services[slot];
+    const caller = domain.current();
+    if (caller != null and caller != s.owner) return false;
+    remove(slot);
+    return true;
+}
+
+/// Withdraws every service `d` published, so its program can be unloaded.
+/// Returns how many there were.
+pub fn withdrawAll(d: *const domain.Domain) usize {
+    acquire();
+    defer release();
+    var removed: usize = 0;
+    for (&services, 0..) |*s, slot| {
+        if (!s.live or s.owner != d) continue;
+        remove(slot);
+        removed += 1;
+    }
+    return removed;
+}
+
+/// Unmaps and frees a live slot. Called with the lock.
+fn remove(slot: usize) void {
+    const s = &services[slot];
+    vmm.unmapPages(pageOf(slot), 1);
+    vmm.setKey(s.phys + vmm.getHhdmOffset(), PAGE_SIZE, pks.KEY_DEFAULT);
+    pmm.freePage(s.phys);
+    if (s.owner) |d| d.unpin();
+    s.* = .{};
+    generations[slot] +%= 1;
+}
+
+/// True if `d` has services published (and must stay loaded).
+pub fn ownedBy(d: *const domain.Domain) bool {
+    acquire();
+    defer release();
+    return publishes(d);
+}
+
+fn publishes(d: *const domain.Domain) bool {
+    for (services) |s| {
+        if (s.live and s.owner == d) return true;
+    }
+    return false;
+}
+
+/// Distinct domains with services published. Called with the lock.
+fn publisherCount() usize {
+    var count: usize = 0;
+    for (services, 0..) |s, i| {
+        const d = s.owner orelse continue;
+        if (!s.live) continue;
+        // Count each domain at its first slot only.
+        const first = for (services[0..i]) |earlier| {
+            if (earlier.live and earlier.owner == d) break false;
+        } else true;
+        if (first) count += 1;
+    }
+    return count;
+}
+
+// --- Unit Tests ---
+
+const Probe = struct {
+    var calls: usize = 0;
+
+    fn add(a: u64, b: u64) callconv(.c) u64 {
+        calls += 1;
+        return a +% b;
+    }
+
+    /// Six arguments: all argument registers, including RCX and RDX,
+    /// must survive the stub.
+    fn mix(a: u64, b: u64, c: u64, d: u64, e: u64, f: u64) callconv(.c) u64 {
+        return a + 2 * b + 3 * c + 4 * d + 5 * e + 6 * f;
+    }
+};
+
+test "Service Stub Encoding" {
+    var stub: [STUB_SIZE]u8 = undefined;
+    emitStub(&stub, 0x1122_3344_5566_7788, 0xFFFF_F3FF);
+    try std.testing.expect(std.mem.readInt(u32, stub[STUB_MSR_ENTRY..][0..4], .little) == pks.MSR_IA32_PKRS);
+    try std.testing.expect(std.mem.readInt(u32, stub[STUB_MSR_EXIT..][0..4], .little) == pks.MSR_IA32_PKRS);
+    try std.testing.expect(std.mem.readInt(u32, stub[STUB_MASK..][0..4], .little) == 0xFFFF_F3FF);
+    try std.testing.expect(std.mem.readInt(u64, stub[STUB_TARGET..][0..8], .little) == 0x1122_3344_5566_7788);
+    // The opcodes in front of each immediate.
+    try std.testing.expect(stub[STUB_MSR_ENTRY - 1] == 0xB9 and stub[STUB_MSR_EXIT - 1] == 0xB9);
+    try std.testing.expect(stub[STUB_MASK - 1] == 0x25);
+    try std.testing.expect(stub[STUB_TARGET - 2] == 0x48 and stub[STUB_TARGET - 1] == 0xB8);
+    try std.testing.expect(stub[STUB_SIZE - 1] == 0xC3);
+}
+
+test "Service Publish, Lookup, Call And Withdraw" {
+    const entries = [_]usize{ @intFromPtr(&Probe.add), @intFromPtr(&Probe.mix) };
+    const slot = publish("probe", &entries);
+    try std.testing.expect(slot >= 0);
+    try std.testing.expect(publish("probe", &entries) == io_ring.E_BUSY);
+    try std.testing.expect(publish("x" ** (NAME_MAX + 1), &entries) == io_ring.E_INVAL);
+    try std.testing.expect(publish("empty", entries[0..0]) == io_ring.E_INVAL);
+
+    var count: usize = 0;
+    const table = lookup("probe", &count) orelse return error.TestUnexpectedResult;
+    try std.testing.expect(count == 2);
+    try std.testing.expect(lookup("missing", &count) == null);
+
+    const add: *const fn (u64, u64) callconv(.c) u64 = @ptrFromInt(table[0]);
+    const mix: *const fn (u64, u64, u64, u64, u64, u64) callconv(.c) u64 = @ptrFromInt(table[1]);
+    const before = Probe.calls;
+    try std.testing.expect(add(40, 2) == 42);
+    try std.testing.expect(Probe.calls == before + 1);
+    try std.testing.expect(mix(1, 1, 1, 1, 1, 1) == 21);
+    try std.testing.expect(mix(0, 0, 1, 1, 0, 0) == 7);
+    if (pks.isEnabled()) {
+        // The kernel's rights survive the round trip.
+        try std.testing.expect(pks.Pkrs.read() == pks.KERNEL_PKRS);
+    }
+
+    const old_page = pageOf(@intCast(slot));
+    try std.testing.expect(withdraw("probe"));
+    try std.testing.expect(!withdraw("probe"));
+    try std.testing.expect(lookup("probe", &count) == null);
+    try std.testing.expect(!vmm.isMapped(old_page));
+
+    // Publishing again into the same slot uses a different page.
+    try std.testing.expect(publish("probe", &entries) == slot);
+    defer _ = withdraw("probe");
+    try std.testing.expect(@intFromPtr(lookup("probe", &count).?) != old_page);
+    try std.testing.expect(!vmm.isMapped(old_page));
+}
+
+test "Service Entries Must Be The Publisher's Code" {
+    const phys = pmm.allocatePage() orelse return error.OutOfMemory;
+    const code = phys + vmm.getHhdmOffset();
+    defer {
+        vmm.setKey(code, PAGE_SIZE, pks.KEY_DEFAULT);
+        pmm.freePage(phys);
+    }
+
+    const d = domain.create() orelse return error.OutOfMemory;
+    defer domain.destroy(d);
+    _ = try domain.enter(d);
+    defer domain.leave();
+    try d.addRegion(code, 1, .image);
+
+    const outside = [_]usize{@intFromPtr(&Probe.add)};
+    try std.testing.expect(publish("server", &outside) == io_ring.E_INVAL);
+
+    // Published (never called: the page holds no code).
+    const inside = [_]usize{ code, code + 0x80 };
+    try std.testing.expect(publish("server", &inside) >= 0);
+    try std.testing.expect(ownedBy(d));
+    try std.testing.expect(d.pins == 1);
+    try std.testing.expect(withdraw("server"));
+    try std.testing.expect(!ownedBy(d));
+    try std.testing.expect(d.pins == 0);
+
+    // Unloading the server withdraws everything it published.
+    try std.testing.expect(publish("server", &inside) >= 0);
+    try std.testing.expect(publish("server2", &inside) >= 0);
+    try std.testing.expect(d.pins == 2);
+    try std.testing.expect(withdrawAll(d) == 2);
+    try std.testing.expect(!ownedBy(d) and d.pins == 0);
+    var count: usize = 0;
+    try std.testing.expect(lookup("server2", &count) == null);
+}
+
+test "Benchmark: Service Call Through A Stub vs Direct" {
+    const bench = @import("bench.zig");
+    const iterations: u64 = 100_000;
+
+    const entries = [_]usize{@intFromPtr(&Probe.add)};
+    if (publish("bench", &entries) < 0) return;
+    defer _ = withdraw("bench");
+    var count: usize = 0;
+    const table = lookup("bench", &count) orelse return;
+
+    // Through pointers loaded from memory, as a client calls.
+    const Fn = *const fn (u64, u64) callconv(.c) u64;
+    var direct: Fn = &Probe.add;
+    var stub: Fn = @ptrFromInt(table[0]);
+    const direct_slot: *volatile Fn = &direct;
+    const stub_slot: *volatile Fn = &stub;
+
+    var sink: u64 = 0;
+    var start = bench.now();
+    var i: u64 = 0;
+    while (i < iterations) : (i += 1) sink = direct_slot.*(sink, i);
+    bench.report("service call, direct", bench.now() - start, iterations);
+
+    start = bench.now();
+    i = 0;
+    while (i < iterations) : (i += 1) sink = stub_slot.*(sink, i);
+    bench.report(if (pks.isEnabled()) "service call, PKRS stub" else "service call, no PKS (direct)", bench.now() - start, iterations);
+    std.mem.doNotOptimizeAway(sink);
+}
@@ -10,9 +10,20 @@ const std = @import("std");
 
 // Driver imports
 const framebuffer = @import("../drivers/graphics/framebuffer.zig");
+const display = @import("../drivers/graphics/display.zig");
+const console = @import("../drivers/graphics/console.zig");
+const compositor = @import("../drivers/graphics/compositor.zig");
 const keyboard = @import("../drivers/keyboard.zig");
 const serial = @import("./serial.zig");
 const pmm = @import("memory/pmm.zig");
+const io_ring = @import("io_ring.zig");
+const draw_list = @import("draw_list.zig");
+const vdso = @import("vdso.zig");
+const gate = @import("gate.zig");
+const domain = @import("domain.zig");
+const channel = @import("channel.zig");
+const service = @import("service.zig");
+const pks = @import("../arch/x86_64/pks.zig");
 const io = @import("../arch/x86_64/io.zig");
 const limine = @import("../limine_import.zig").C;
 
@@ -20,6 +31,34 @@ const limine = @import("../limine_import.zig").C;
 /// If userspace reads a different magic value, the kernel table is corrupted or invalid.
 pub const KERNEL_TABLE_MAGIC: u64 = 0xDEADC0DE;
 
+/// Table version, `major << 16 | minor`.
+///
+/// Minor versions only append entries (and feature bits), so a program built
+/// against an older minor version runs unchanged; it can test for newer
+/// entries by checking `size`. A major bump means existing entries moved or
+/// changed meaning.
+pub const VERSION_MAJOR: u16 = 1;
+pub const VERSION_MINOR: u16 = 2;
+pub const KERNEL_TABLE_VERSION: u32 = @as(u32, VERSION_MAJOR) << 16 | VERSION_MINOR;
+
+/// Feature bits: groups of entries (and the behaviour behind them) this
+/// kernel implements. A program checks the bit before relying on a group.
+pub const FEATURE_DRAW: u64 = 1 << 0; // draw_rect, present
+pub const FEATURE_INPUT: u64 = 1 << 1; // poll_key, wait_key
+pub const FEATURE_IO_RING: u64 = 1 << 2; // io_setup .. io_wait
+pub const FEATURE_CONSOLE: u64 = 1 << 3; // write_console
+pub const FEATURE_DRAW_LIST: u64 = 1 << 4; // submit_draw_list
+pub const FEATURE_SURFACES: u64 = 1 << 5; // create/destroy/damage/place_surface
+pub const FEATURE_VDSO: u64 = 1 << 6; // `vdso` is the kernel data page (set by init())
+pub const FEATURE_CHANNELS: u64 = 1 << 7; // channel_create .. channel_recv (1.1)
+pub const FEATURE_SERVICES: u64 = 1 << 8; // publish/lookup/withdraw_service (1.2)
+
+/// Features every kernel build provides. init() adds those that depend on
+/// boot-time setup succeeding.
+pub const KERNEL_FEATURES: u64 = FEATURE_DRAW | FEATURE_INPUT | FEATURE_IO_RING |
+    FEATURE_CONSOLE | FEATURE_DRAW_LIST | FEATURE_SURFACES |
+    FEATURE_CHANNELS | FEATURE_SERVICES;
+
 /// The kernel-userspace function pointer table.
 ///
 /// This struct uses `extern` layout to ensure a stable C-compatible ABI.
@@ -32,6 +71,21 @@ pub const KernelTable = extern struct {
     /// Magic number for validation. Should always be KERNEL_TABLE_MAGIC (0xDEADC0DE).
     magic: u64,
 
+    /// KERNEL_TABLE_VERSION of the kernel that built the table.
+    version: u32,
+
+    /// @sizeOf(KernelTable) as the kernel built it. Entries at or beyond this
+    /// offset do not exist.
+    size: u32,
+
+    /// FEATURE_* bits of the services this kernel provides.
+    features: u64,
+
+    /// The read-only kernel data page (clock, CPU count, framebuffer
+    /// geometry). Reading it costs a load, not a call. Without
+    /// FEATURE_VDSO it is vdso.fallback, which has no flags set.
+    vdso: *const vdso.Data,
+
     /// Logs a message to the serial console (COM1).
     ///
     /// Parameters:
@@ -52,7 +106,8 @@ pub const KernelTable = extern struct {
     ///   - color: Color in 0xAARRGGBB format (32-bit ARGB)
     ///
     /// Coordinates that fall outside the framebuffer bounds are clipped.
-    /// This function does not block.
+    /// This function does not block. Drawing lands in the back buffer and
+    /// becomes visible on the next `present` call.
     draw_rect: *const fn (x: u32, y: u32, w: u32, h: u32, color: u32) callconv(.c) void,
 
     /// Polls for keyboard input (non-blocking).
@@ -86,9 +141,196 @@ pub const KernelTable = extern struct {
     ///   - null if allocation fails (out of memory)
     ///
     /// The returned memory is guaranteed to be physically contiguous.
+    /// It carries the calling program's protection key (domain.zig).
     /// Memory is not zeroed by default.
     /// Userspace is responsible for freeing allocated pages when done.
     alloc_pages: *const fn (count: usize) callconv(.c) ?[*]u8,
+
+    /// Creates an async I/O ring (see io_ring.zig).
+    ///
+    /// Parameters:
+    ///   - entries: Submission queue size (1-256, rounded up to a power of two)
+    ///
+    /// Returns:
+    ///   - Pointer to the shared ring header on success
+    ///   - null if the size is invalid or no memory/ring slot is available
+    ///
+    /// The completion queue holds twice as many entries as the submission queue.
+    io_setup: *const fn (entries: u32) callconv(.c) ?*io_ring.RingHeader,
+
+    /// Submits every SQE published in the ring since the last call.
+    ///
+    /// Parameters:
+    ///   - ring: Ring header returned by io_setup
+    ///
+    /// Returns:
+    ///   - Number of SQEs consumed (SQEs stay queued while the CQ is full)
+    ///
+    /// One call covers any number of operations. This function does not block;
+    /// operations that need to wait (key reads) complete later.
+    io_enter: *const fn (ring: *io_ring.RingHeader) callconv(.c) u32,
+
+    /// Destroys a ring created by io_setup. Parked operations are dropped.
+    io_destroy: *const fn (ring: *io_ring.RingHeader) callconv(.c) void,
+
+    /// Blocks until the ring has at least `min_complete` unharvested completions.
+    ///
+    /// Parameters:
+    ///   - ring: Ring header returned by io_setup
+    ///   - min_complete: Number of CQEs to wait for
+    ///
+    /// Returns:
+    ///   - Number of CQEs ready (may be lower if nothing else can complete)
+    ///
+    /// Published SQEs are submitted first. The CPU halts while waiting and is
+    /// woken by the interrupt that completes the operation.
+    io_wait: *const fn (ring: *io_ring.RingHeader, min_complete: u32) callconv(.c) u32,
+
+    /// Waits for keyboard input (blocking).
+    ///
+    /// Parameters:
+    ///   - buf: Buffer receiving ASCII key codes
+    ///   - len: Capacity of the buffer
+    ///
+    /// Returns:
+    ///   - Number of keys copied (at least 1), or 0 if len is 0
+    ///
+    /// The CPU halts until the keyboard IRQ signals input, then every buffered
+    /// key that fits is returned at once. Use instead of polling poll_key.
+    wait_key: *const fn (buf: [*]u8, len: usize) callconv(.c) usize,
+
+    /// Shows everything drawn since the last present.
+    ///
+    /// Drawing calls render into a back buffer in RAM and record the
+    /// rectangles they touch; present copies only those rectangles to the
+    /// screen, with the surfaces from `create_surface` composited on top.
+    /// Call it once per frame, after drawing.
+    present: *const fn () callconv(.c) void,
+
+    /// Writes text to the kernel's text console (the one the shell uses).
+    ///
+    /// Handles '\n', '\r', '\t' and backspace; long lines wrap and the
+    /// console scrolls. The text is rendered into the back buffer before
+    /// returning and appears on the next `present`.
+    write_console: *const fn (ptr: [*]const u8, len: usize) callconv(.c) void,
+
+    /// Executes a list of draw commands (see draw_list.zig) in one call.
+    ///
+    /// Parameters:
+    ///   - cmds: Pointer to an array of draw_list.Command (rect, blit, text, line)
+    ///   - count: Number of commands (at most draw_list.MAX_COMMANDS)
+    ///
+    /// Returns:
+    ///   - Number of commands executed
+    ///   - Negative io_ring E_* code if any command is invalid; nothing is drawn
+    ///
+    /// Commands are drawn in list order into the back buffer and appear on
+    /// the next `present`.
+    submit_draw_list: *const fn (cmds: [*]const draw_list.Command, count: usize) callconv(.c) i64,
+
+    /// Creates a pixel surface the program renders into with plain stores.
+    ///
+    /// Parameters:
+    ///   - x, y: Screen position of the surface's top-left pixel
+    ///   - w, h: Size in pixels
+    ///
+    /// Returns:
+    ///   - Pointer to the surface description (pixels, size, stride)
+    ///   - null if the size is invalid or no memory/surface slot is available
+    ///
+    /// The pixels start zeroed, opaque and in front of existing surfaces.
+    /// Their pages carry the calling program's protection key (the shared
+    /// surface key outside a program domain). Until `damage_surface`
+    /// is first called, each `present` recomposes the whole surface.
+    create_surface: *const fn (x: u32, y: u32, w: u32, h: u32) callconv(.c) ?*const compositor.SurfaceInfo,
+
+    /// Destroys a surface created by create_surface. Its pixels are unmapped.
+    destroy_surface: *const fn (surface: *const compositor.SurfaceInfo) callconv(.c) void,
+
+    /// Reports that a rectangle (surface coordinates) of a surface changed.
+    /// From the first call on, `present` recomposes only reported damage.
+    damage_surface: *const fn (surface: *const compositor.SurfaceInfo, x: u32, y: u32, w: u32, h: u32) callconv(.c) void,
+
+    /// Moves a surface and sets its stacking order and flags.
+    ///
+    /// Parameters:
+    ///   - x, y: New screen position
+    ///   - z: Stacking order; higher is in front, ties go to the latest placed
+    ///   - flags: compositor.FLAG_ALPHA to blend with the per-pixel alpha
+    place_surface: *const fn (surface: *const compositor.SurfaceInfo, x: u32, y: u32, z: u32, flags: u32) callconv(.c) void,
+
+    /// Creates a zero-copy message channel (see channel.zig). Anyone may
+    /// send to it; only the caller may receive from or destroy it.
+    ///
+    /// Returns:
+    ///   - The channel id (>= 0)
+    ///   - io_ring.E_BUSY if every channel slot is taken
+    channel_create: *const fn () callconv(.c) i64,
+
+    /// Destroys a channel the caller created. Undelivered messages are
+    /// dropped.
+    channel_destroy: *const fn (id: u32) callconv(.c) void,
+
+    /// Sends a message by handing over the block that holds it.
+    ///
+    /// Parameters:
+    ///   - id: Channel id from channel_create
+    ///   - buf: Start of a block from alloc_pages (or from channel_recv)
+    ///   - len: Message length; at most the block's size
+    ///
+    /// Returns:
+    ///   - 0 on success; the caller can no longer access the block
+    ///   - io_ring.E_INVAL for an unknown channel or a block the caller does not own
+    ///   - io_ring.E_BUSY if the channel is full
+    ///
+    /// Nothing is copied: the block's pages change protection key.
+    channel_send: *const fn (id: u32, buf: [*]u8, len: usize) callconv(.c) i64,
+
+    /// Receives the oldest message on a channel (non-blocking).
+    ///
+    /// Parameters:
+    ///   - id: Channel id from channel_create
+    ///   - len: Receives the message length
+    ///
+    /// Returns:
+    ///   - The block holding the message, now owned by the caller
+    ///   - null if the channel is unknown or empty, or the caller did not
+    ///     create it
+    channel_recv: *const fn (id: u32, len: *usize) callconv(.c) ?[*]u8,
+
+    /// Publishes a table of the program's own functions under a name, for
+    /// other programs to call directly (see service.zig).
+    ///
+    /// Parameters:
+    ///   - name, name_len: Service name (1-32 bytes)
+    ///   - entries: Addresses of C-ABI functions in the program's image,
+    ///     each taking at most six integer/pointer arguments
+    ///   - count: Number of entries (at most service.MAX_ENTRIES)
+    ///
+    /// Returns:
+    ///   - The service slot (>= 0)
+    ///   - io_ring.E_INVAL for a bad name, count or entry
+    ///   - io_ring.E_BUSY if the name is taken or no slot is free
+    ///
+    /// The program stays loaded, with its key, until it withdraws every
+    /// service it published.
+    publish_service: *const fn (name: [*]const u8, name_len: usize, entries: [*]const usize, count: usize) callconv(.c) i64,
+
+    /// Looks up a published service.
+    ///
+    /// Parameters:
+    ///   - name, name_len: Service name
+    ///   - count: Receives the number of entries
+    ///
+    /// Returns:
+    ///   - The read-only entry table, in the publisher's order. Each entry
+    ///     switches to the service's rights and back around the call.
+    ///   - null if no service has that name
+    lookup_service: *const fn (name: [*]const u8, name_len: usize, count: *usize) callconv(.c) ?[*]const usize,
+
+    /// Withdraws a service the program published. Entry pointers clients
+    /// still hold fault from then on.
+    withdraw_service: *const fn (name: [*]const u8, name_len: usize) callconv(.c) void,
 };
 
 // ============================================================================
@@ -130,6 +372,12 @@ fn kernelPollKey() callconv(.c) u8 {
     return 0;
 }
 
+/// Kernel wrapper for blocking keyboard input.
+/// Returns a batch of keys once the keyboard IRQ signals input.
+fn kernelWaitKey(buf: [*]u8, len: usize) callconv(.c) usize {
+    return keyboard.waitKeys(buf[0..len]);
+}
+
 /// Kernel wrapper for sleeping (busy-wait implementation).
 /// This is temporary until APIC timer is implemented.
 /// Calibration: ~1,000,000 iterations ≈ 1ms on QEMU.
@@ -161,20 +409,164 @@ fn kernelAllocPages(count: usize) callconv(.c) ?[*]u8 {
     const hhdm_offset = hhdm_resp.*.offset;
     const virt_addr = phys_addr + hhdm_offset;
 
+    // A program's pages join its protection domain
+    if (domain.current()) |d| {
+        d.addRegion(virt_addr, count, .pages) catch {
+            serial.warn("kernelAllocPages: Domain has too many regions");
+            pmm.freePages(phys_addr, count);
+            return null;
+        };
+    }
+
     return @ptrFromInt(virt_addr);
 }
 
+/// Kernel wrapper for composing the dirty rectangles onto the screen.
+fn kernelPresent() callconv(.c) void {
+    _ = display.present();
+}
+
+/// Kernel wrapper for creating a user surface.
+fn kernelCreateSurface(x: u32, y: u32, w: u32, h: u32) callconv(.c) ?*const compositor.SurfaceInfo {
+    return compositor.create(x, y, w, h);
+}
+
+/// Kernel wrapper for destroying a user surface.
+fn kernelDestroySurface(surface: *const compositor.SurfaceInfo) callconv(.c) void {
+    if (!compositor.destroy(surface)) {
+        serial.warn("kernelDestroySurface: Unknown surface");
+    }
+}
+
+/// Kernel wrapper for reporting surface damage.
+fn kernelDamageSurface(surface: *const compositor.SurfaceInfo, x: u32, y: u32, w: u32, h: u32) callconv(.c) void {
+    if (!compositor.damage(surface, .{ .x = x, .y = y, .w = w, .h = h })) {
+        serial.warn("kernelDamageSurface: Unknown surface");
+    }
+}
+
+/// Kernel wrapper for moving and restacking a surface.
+fn kernelPlaceSurface(surface: *const compositor.SurfaceInfo, x: u32, y: u32, z: u32, flags: u32) callconv(.c) void {
+    if (!compositor.place(surface, x, y, z, flags)) {
+        serial.warn("kernelPlaceSurface: Unknown surface");
+    }
+}
+
+/// Kernel wrapper for writing to the text console.
+fn kernelWriteConsole(ptr: [*]const u8, len: usize) callconv(.c) void {
+    console.write(ptr[0..len]);
+    console.flush();
+}
+
+/// Kernel wrapper for executing a batch of draw commands.
+fn kernelSubmitDrawList(cmds: [*]const draw_list.Command, count: usize) callconv(.c) i64 {
+    return draw_list.submit(cmds, count);
+}
+
+/// Kernel wrapper for creating an async I/O ring.
+fn kernelIoSetup(entries: u32) callconv(.c) ?*io_ring.RingHeader {
+    return io_ring.setup(entries);
+}
+
+/// Kernel wrapper for submitting published SQEs.
+fn kernelIoEnter(ring: *io_ring.RingHeader) callconv(.c) u32 {
+    return io_ring.enter(ring);
+}
+
+/// Kernel wrapper for destroying an async I/O ring.
+fn kernelIoDestroy(ring: *io_ring.RingHeader) callconv(.c) void {
+    io_ring.destroy(ring);
+}
+
+/// Kernel wrapper for waiting on ring completions.
+fn kernelIoWait(ring: *io_ring.RingHeader, min_complete: u32) callconv(.c) u32 {
+    return io_ring.wait(ring, min_complete);
+}
+
+/// Kernel wrapper for creating a channel.
+fn kernelChannelCreate() callconv(.c) i64 {
+    const id = channel.create() orelse return io_ring.E_BUSY;
+    return id;
+}
+
+/// Kernel wrapper for destroying a channel.
+fn kernelChannelDestroy(id: u32) callconv(.c) void {
+    if (!channel.destroy(id)) {
+        serial.warn("kernelChannelDestroy: Unknown or foreign channel");
+    }
+}
+
+/// Kernel wrapper for sending a message block.
+fn kernelChannelSend(id: u32, buf: [*]u8, len: usize) callconv(.c) i64 {
+    return channel.send(id, buf, len);
+}
+
+/// Kernel wrapper for receiving a message block.
+fn kernelChannelRecv(id: u32, len: *usize) callconv(.c) ?[*]u8 {
+    return channel.recv(id, len);
+}
+
+/// Kernel wrapper for publishing a service.
+fn kernelPublishService(name: [*]const u8, name_len: usize, entries: [*]const usize, count: usize) callconv(.c) i64 {
+    return service.publish(name[0..name_len], entries[0..count]);
+}
+
+/// Kernel wrapper for looking up a service.
+fn kernelLookupService(name: [*]const u8, name_len: usize, count: *usize) callconv(.c) ?[*]const usize {
+    return service.lookup(name[0..name_len], count);
+}
+
+/// Kernel wrapper for withdrawing a service.
+fn kernelWithdrawService(name: [*]const u8, name_len: usize) callconv(.c) void {
+    if (!service.withdraw(name[0..name_len])) {
+        serial.warn("kernelWithdrawService: Unknown or foreign service");
+    }
+}
+
 /// The populated kernel table instance.
 /// This is the table that will be passed to userspace programs.
-pub const table = KernelTable{
+/// Every entry is a PKS call gate (gate.zig) around its kernel wrapper.
+/// `features` and `vdso` are completed at boot by init().
+pub var table = KernelTable{
     .magic = KERNEL_TABLE_MAGIC,
-    .log = kernelLog,
-    .draw_rect = kernelDrawRect,
-    .poll_key = kernelPollKey,
-    .sleep_ms = kernelSleepMs,
-    .alloc_pages = kernelAllocPages,
+    .version = KERNEL_TABLE_VERSION,
+    .size = @sizeOf(KernelTable),
+    .features = KERNEL_FEATURES,
+    .vdso = &vdso.fallback,
+    .log = gate.wrap(kernelLog),
+    .draw_rect = gate.wrap(kernelDrawRect),
+    .poll_key = gate.wrap(kernelPollKey),
+    .sleep_ms = gate.wrap(kernelSleepMs),
+    .alloc_pages = gate.wrap(kernelAllocPages),
+    .io_setup = gate.wrap(kernelIoSetup),
+    .io_enter = gate.wrap(kernelIoEnter),
+    .io_destroy = gate.wrap(kernelIoDestroy),
+    .io_wait = gate.wrap(kernelIoWait),
+    .wait_key = gate.wrap(kernelWaitKey),
+    .present = gate.wrap(kernelPresent),
+    .write_console = gate.wrap(kernelWriteConsole),
+    .submit_draw_list = gate.wrap(kernelSubmitDrawList),
+    .create_surface = gate.wrap(kernelCreateSurface),
+    .destroy_surface = gate.wrap(kernelDestroySurface),
+    .damage_surface = gate.wrap(kernelDamageSurface),
+    .place_surface = gate.wrap(kernelPlaceSurface),
+    .channel_create = gate.wrap(kernelChannelCreate),
+    .channel_destroy = gate.wrap(kernelChannelDestroy),
+    .channel_send = gate.wrap(kernelChannelSend),
+    .channel_recv = gate.wrap(kernelChannelRecv),
+    .publish_service = gate.wrap(kernelPublishService),
+    .lookup_service = gate.wrap(kernelLookupService),
+    .withdraw_service = gate.wrap(kernelWithdrawService),
 };
 
+/// Advertises what boot-time setup made available. Call after vdso.init().
+pub fn init() void {
+    if (vdso.isReady()) {
+        table.vdso = vdso.page;
+        table.features |= FEATURE_VDSO;
+    }
+}
+
 // ============================================================================
 // Unit Tests
 // ============================================================================
@@ -186,13 +578,36 @@ test "KernelTable Layout Validation" {
 
     // Expected size calculation:
     // - magic: 8 bytes (u64)
+    // - version: 4 bytes (u32)
+    // - size: 4 bytes (u32)
+    // - features: 8 bytes (u64)
+    // - vdso: 8 bytes (pointer)
     // - log: 8 bytes (function pointer)
     // - draw_rect: 8 bytes (function pointer)
     // - poll_key: 8 bytes (function pointer)
     // - sleep_ms: 8 bytes (function pointer)
     // - alloc_pages: 8 bytes (function pointer)
-    // Total: 48 bytes
-    try std.testing.expect(table_size == 48);
+    // - io_setup: 8 bytes (function pointer)
+    // - io_enter: 8 bytes (function pointer)
+    // - io_destroy: 8 bytes (function pointer)
+    // - io_wait: 8 bytes (function pointer)
+    // - wait_key: 8 bytes (function pointer)
+    // - present: 8 bytes (function pointer)
+    // - write_console: 8 bytes (function pointer)
+    // - submit_draw_list: 8 bytes (function pointer)
+    // - create_surface: 8 bytes (function pointer)
+    // - destroy_surface: 8 bytes (function pointer)
+    // - damage_surface: 8 bytes (function pointer)
+    // - place_surface: 8 bytes (function pointer)
+    // - channel_create: 8 bytes (function pointer)
+    // - channel_destroy: 8 bytes (function pointer)
+    // - channel_send: 8 bytes (function pointer)
+    // - channel_recv: 8 bytes (function pointer)
+    // - publish_service: 8 bytes (function pointer)
+    // - lookup_service: 8 bytes (function pointer)
+    // - withdraw_service: 8 bytes (function pointer)
+    // Total: 224 bytes
+    try std.testing.expect(table_size == 224);
 }
 
 test "KernelTable Magic Constant" {
@@ -203,25 +618,76 @@ test "KernelTable Magic Constant" {
 test "KernelTable Field Offsets" {
     // Verify field offsets are as expected for C ABI compatibility
     try std.testing.expect(@offsetOf(KernelTable, "magic") == 0);
-    try std.testing.expect(@offsetOf(KernelTable, "log") == 8);
-    try std.testing.expect(@offsetOf(KernelTable, "draw_rect") == 16);
-    try std.testing.expect(@offsetOf(KernelTable, "poll_key") == 24);
-    try std.testing.expect(@offsetOf(KernelTable, "sleep_ms") == 32);
-    try std.testing.expect(@offsetOf(KernelTable, "alloc_pages") == 40);
+    try std.testing.expect(@offsetOf(KernelTable, "version") == 8);
+    try std.testing.expect(@offsetOf(KernelTable, "size") == 12);
+    try std.testing.expect(@offsetOf(KernelTable, "features") == 16);
+    try std.testing.expect(@offsetOf(KernelTable, "vdso") == 24);
+    try std.testing.expect(@offsetOf(KernelTable, "log") == 32);
+    try std.testing.expect(@offsetOf(KernelTable, "draw_rect") == 40);
+    try std.testing.expect(@offsetOf(KernelTable, "poll_key") == 48);
+    try std.testing.expect(@offsetOf(KernelTable, "sleep_ms") == 56);
+    try std.testing.expect(@offsetOf(KernelTable, "alloc_pages") == 64);
+    try std.testing.expect(@offsetOf(KernelTable, "io_setup") == 72);
+    try std.testing.expect(@offsetOf(KernelTable, "io_enter") == 80);
+    try std.testing.expect(@offsetOf(KernelTable, "io_destroy") == 88);
+    try std.testing.expect(@offsetOf(KernelTable, "io_wait") == 96);
+    try std.testing.expect(@offsetOf(KernelTable, "wait_key") == 104);
+    try std.testing.expect(@offsetOf(KernelTable, "present") == 112);
+    try std.testing.expect(@offsetOf(KernelTable, "write_console") == 120);
+    try std.testing.expect(@offsetOf(KernelTable, "submit_draw_list") == 128);
+    try std.testing.expect(@offsetOf(KernelTable, "create_surface") == 136);
+    try std.testing.expect(@offsetOf(KernelTable, "destroy_surface") == 144);
+    try std.testing.expect(@offsetOf(KernelTable, "damage_surface") == 152);
+    try std.testing.expect(@offsetOf(KernelTable, "place_surface") == 160);
+    try std.testing.expect(@offsetOf(KernelTable, "channel_create") == 168);
+    try std.testing.expect(@offsetOf(KernelTable, "channel_destroy") == 176);
+    try std.testing.expect(@offsetOf(KernelTable, "channel_send") == 184);
+    try std.testing.expect(@offsetOf(KernelTable, "channel_recv") == 192);
+    try std.testing.expect(@offsetOf(KernelTable, "publish_service") == 200);
+    try std.testing.expect(@offsetOf(KernelTable, "lookup_service") == 208);
+    try std.testing.expect(@offsetOf(KernelTable, "withdraw_service") == 216);
 }
 
 test "KernelTable Populated Correctly" {
-    // Verify the exported table has correct magic value
+    // Verify the exported table has correct magic value and header
     try std.testing.expect(table.magic == KERNEL_TABLE_MAGIC);
+    try std.testing.expect(table.version == KERNEL_TABLE_VERSION);
+    try std.testing.expect(table.size == @sizeOf(KernelTable));
+    if (vdso.isReady()) {
+        try std.testing.expect((table.features & FEATURE_VDSO) != 0);
+        try std.testing.expect(table.vdso == vdso.page);
+    } else {
+        try std.testing.expect((table.features & FEATURE_VDSO) == 0);
+        try std.testing.expect(table.vdso == &vdso.fallback);
+    }
 
     // Verify all function pointers are correctly assigned
     // We can't directly compare function pointers, but we can verify they're not null
     // and point to the expected functions by comparing their addresses
-    try std.testing.expect(@intFromPtr(table.log) == @intFromPtr(&kernelLog));
-    try std.testing.expect(@intFromPtr(table.draw_rect) == @intFromPtr(&kernelDrawRect));
-    try std.testing.expect(@intFromPtr(table.poll_key) == @intFromPtr(&kernelPollKey));
-    try std.testing.expect(@intFromPtr(table.sleep_ms) == @intFromPtr(&kernelSleepMs));
-    try std.testing.expect(@intFromPtr(table.alloc_pages) == @intFromPtr(&kernelAllocPages));
+    try std.testing.expect(@intFromPtr(table.log) == @intFromPtr(gate.wrap(kernelLog)));
+    try std.testing.expect(@intFromPtr(table.draw_rect) == @intFromPtr(gate.wrap(kernelDrawRect)));
+    try std.testing.expect(@intFromPtr(table.poll_key) == @intFromPtr(gate.wrap(kernelPollKey)));
+    try std.testing.expect(@intFromPtr(table.sleep_ms) == @intFromPtr(gate.wrap(kernelSleepMs)));
+    try std.testing.expect(@intFromPtr(table.alloc_pages) == @intFromPtr(gate.wrap(kernelAllocPages)));
+    try std.testing.expect(@intFromPtr(table.io_setup) == @intFromPtr(gate.wrap(kernelIoSetup)));
+    try std.testing.expect(@intFromPtr(table.io_enter) == @intFromPtr(gate.wrap(kernelIoEnter)));
+    try std.testing.expect(@intFromPtr(table.io_destroy) == @intFromPtr(gate.wrap(kernelIoDestroy)));
+    try std.testing.expect(@intFromPtr(table.io_wait) == @intFromPtr(gate.wrap(kernelIoWait)));
+    try std.testing.expect(@intFromPtr(table.wait_key) == @intFromPtr(gate.wrap(kernelWaitKey)));
+    try std.testing.expect(@intFromPtr(table.present) == @intFromPtr(gate.wrap(kernelPresent)));
+    try std.testing.expect(@intFromPtr(table.write_console) == @intFromPtr(gate.wrap(kernelWriteConsole)));
+    try std.testing.expect(@intFromPtr(table.submit_draw_list) == @intFromPtr(gate.wrap(kernelSubmitDrawList)));
+    try std.testing.expect(@intFromPtr(table.create_surface) == @intFromPtr(gate.wrap(kernelCreateSurface)));
+    try std.testing.expect(@intFromPtr(table.destroy_surface) == @intFromPtr(gate.wrap(kernelDestroySurface)));
+    try std.testing.expect(@intFromPtr(table.damage_surface) == @intFromPtr(gate.wrap(kernelDamageSurface)));
+    try std.testing.expect(@intFromPtr(table.place_surface) == @intFromPtr(gate.wrap(kernelPlaceSurface)));
+    try std.testing.expect(@intFromPtr(table.channel_create) == @intFromPtr(gate.wrap(kernelChannelCreate)));
+    try std.testing.expect(@intFromPtr(table.channel_destroy) == @intFromPtr(gate.wrap(kernelChannelDestroy)));
+    try std.testing.expect(@intFromPtr(table.channel_send) == @intFromPtr(gate.wrap(kernelChannelSend)));
+    try std.testing.expect(@intFromPtr(table.channel_recv) == @intFromPtr(gate.wrap(kernelChannelRecv)));
+    try std.testing.expect(@intFromPtr(table.publish_service) == @intFromPtr(gate.wrap(kernelPublishService)));
+    try std.testing.expect(@intFromPtr(table.lookup_service) == @intFromPtr(gate.wrap(kernelLookupService)));
+    try std.testing.expect(@intFromPtr(table.withdraw_service) == @intFromPtr(gate.wrap(kernelWithdrawService)));
 }
 
 test "kernelLog Wrapper - Empty String" {
@@ -252,6 +718,11 @@ test "kernelPollKey Wrapper - Returns Zero or ASCII" {
     _ = result;
 }
 
+test "kernelWaitKey Wrapper - Zero Length Returns Immediately" {
+    var buf: [1]u8 = undefined;
+    try std.testing.expect(kernelWaitKey(&buf, 0) == 0);
+}
+
 test "kernelDrawRect Wrapper - Null Framebuffer Handling" {
     // Test that kernelDrawRect handles null framebuffer gracefully
     // This test verifies the function doesn't panic when FB is not available
@@ -322,3 +793,32 @@ test "kernelAllocPages Wrapper - Returns Virtual Address" {
     }
     // If null, PMM wasn't initialized - that's ok for unit test
 }
+
+test "Benchmark: Gated vs Ungated Log Call" {
+    const bench = @import("bench.zig");
+    // Empty messages: the serial path is the same on both sides.
+    const msg = "";
+    const iterations: u64 = 100_000;
+    // Through a pointer loaded from memory, as programs call table entries.
+    const slot: *const volatile KernelTable = &table;
+
+    var start = bench.now();
+    var i: u64 = 0;
+    while (i < iterations) : (i += 1) kernelLog(msg, 0);
+    bench.report("log call, ungated", bench.now() - start, iterations);
+
+    start = bench.now();
+    i = 0;
+    while (i < iterations) : (i += 1) slot.log(msg, 0);
+    bench.report("log call, gated from the kernel", bench.now() - start, iterations);
+
+    if (!pks.isEnabled()) return;
+    // What a program pays: PKRS switched both ways and the argument checked.
+    pks.switchTo(pks.PROGRAM_PKRS);
+    start = bench.now();
+    i = 0;
+    while (i < iterations) : (i += 1) slot.log(msg, 0);
+    const cycles = bench.now() - start;
+    pks.switchTo(pks.KERNEL_PKRS);
+    bench.report("log call, gated from a program", cycles, iterations);
+}
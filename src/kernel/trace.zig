@@ -0,0 +1,201 @@
+/// Binary Tracing
+///
+/// Tracepoints are named at compile time (`trace_format.Event`) and record a
+/// fixed 48-byte entry: TSC, CPU index, event id and up to four u64 arguments.
+/// Nothing is formatted on the hot path. The record is built in registers and
+/// stored into the calling CPU's ring with one struct store. Each ring is a
+/// flight recorder: when it wraps, the oldest records are overwritten.
+///
+/// `dump()` prints every buffered record as a "#T <hex>" line on the serial
+/// console; `zig build trace-decode < log` turns such a capture back into a
+/// readable, time-ordered listing.
+///
+/// Tracepoints compile to nothing when built with `-Dtrace=false`.
+///
+/// Example:
+///   trace.point(.pmm_alloc, .{ phys, count });
+const std = @import("std");
+const build_options = @import("build_options");
+const cpu = @import("../arch/x86_64/cpu.zig");
+const smp = @import("../arch/x86_64/smp.zig");
+const pmm = @import("memory/pmm.zig");
+const vmm = @import("memory/vmm.zig");
+const serial = @import("serial.zig");
+const format = @import("trace_format.zig");
+
+pub const Event = format.Event;
+pub const Record = format.Record;
+
+pub const enabled = build_options.trace;
+
+/// Records kept per CPU (a power of two). 1024 * 48 bytes = 12 pages.
+pub const RECORDS_PER_CPU: usize = 1024;
+const BUFFER_PAGES = (RECORDS_PER_CPU * @sizeOf(Record) + pmm.PAGE_SIZE - 1) / pmm.PAGE_SIZE;
+
+const CpuBuffer = struct {
+    records: ?[*]Record = null,
+    /// Total records ever written; the slot is `next % RECORDS_PER_CPU`.
+    next: std.atomic.Value(u64) = std.atomic.Value(u64).init(0),
+};
+
+var buffers: [smp.MAX_CPUS]CpuBuffer = [_]CpuBuffer{.{}} ** smp.MAX_CPUS;
+var ready: bool = false;
+
+/// Allocates a ring for every CPU. Tracepoints hit before this are dropped.
+/// Must run after smp.init() (records are tagged with smp.currentIndex()).
+pub fn init() void {
+    if (comptime !enabled) return;
+
+    var i: usize = 0;
+    while (i < smp.count()) : (i += 1) {
+        const phys = pmm.allocatePages(BUFFER_PAGES) orelse {
+            serial.warn("Trace: Out of memory, tracing disabled for remaining CPUs");
+            break;
+        };
+        buffers[i].records = @ptrFromInt(phys + vmm.getHhdmOffset());
+    }
+    @atomicStore(bool, &ready, true, .release);
+}
+
+/// Records `event` with up to four integer, enum, bool or pointer arguments.
+pub inline fn point(comptime event: Event, args: anytype) void {
+    if (comptime !enabled) return;
+
+    const fields = @typeInfo(@TypeOf(args)).@"struct".fields;
+    if (fields.len > format.MAX_ARGS) @compileError("Tracepoints take at most 4 arguments");
+    if (!@atomicLoad(bool, &ready, .acquire)) return;
+
+    var rec = Record{
+        .tsc = cpu.rdtsc(),
+        .cpu = @intCast(smp.currentIndex()),
+        .event = @intFromEnum(event),
+        .arg_count = fields.len,
+        .args = .{ 0, 0, 0, 0 },
+    };
+    inline for (fields, 0..) |field, i| {
+        rec.args[i] = toArg(@field(args, field.name));
+    }
+    write(rec);
+}
+
+fn toArg(value: anytype) u64 {
+    const T = @TypeOf(value);
+    return switch (@typeInfo(T)) {
+        .comptime_int => value,
+        .int => |info| if (info.signedness == .signed) @bitCast(@as(i64, value)) else value,
+        .bool => @intFromBool(value),
+        .@"enum" => @intFromEnum(value),
+        .pointer => @intFromPtr(value),
+        .optional => if (value) |v| toArg(v) else 0,
+        else => @compileError("Unsupported tracepoint argument type: " ++ @typeName(T)),
+    };
+}
+
+fn write(rec: Record) void {
+    const buf = &buffers[rec.cpu];
+    const records = buf.records orelse return;
+    // Claiming the slot first lets an IRQ tracepoint nest inside this one.
+    const slot = buf.next.fetchAdd(1, .monotonic) & (RECORDS_PER_CPU - 1);
+    records[slot] = rec;
+}
+
+/// Copies the buffered records of `cpu_index`, oldest first, into `out`.
+/// Returns the number copied. Records written concurrently may be torn.
+pub fn snapshot(cpu_index: usize, out: []Record) usize {
+    const buf = &buffers[cpu_index];
+    const records = buf.records orelse return 0;
+    const next = buf.next.load(.acquire);
+    const avail = @min(next, RECORDS_PER_CPU);
+    const n = @min(avail, out.len);
+    // Keep the newest `n`.
+    var seq = next - n;
+    for (out[0..n]) |*dst| {
+        dst.* = records[seq & (RECORDS_PER_CPU - 1)];
+        seq += 1;
+    }
+    return n;
+}
+
+/// Discards all buffered records.
+pub fn clear() void {
+    for (&buffers) |*buf| buf.next.store(0, .release);
+}
+
+/// Writes every buffered record to the serial console as "#T" lines.
+pub fn dump() void {
+    serial.info("Trace: dump begin");
+    for (&buffers) |*buf| {
+        const records = buf.records orelse continue;
+        const next = buf.next.load(.acquire);
+        var seq = next - @min(next, RECORDS_PER_CPU);
+        var line: [format.LINE_LEN]u8 = undefined;
+        while (seq < next) : (seq += 1) {
+            serial.logRaw(format.encodeLine(&records[seq & (RECORDS_PER_CPU - 1)], &line));
+        }
+    }
+    serial.info("Trace: dump end");
+}
+
+// --- Unit Tests ---
+
+fn findEvent(records: []const Record, event: Event, arg0: u64) ?Record {
+    for (records) |rec| {
+        if (rec.event == @intFromEnum(event) and rec.args[0] == arg0) return rec;
+    }
+    return null;
+}
+
+test "Trace PMM Tracepoints" {
+    if (comptime !enabled) return;
+
+    clear();
+    const phys = pmm.allocatePages(2) orelse return error.OutOfMemory;
+    pmm.freePages(phys, 2);
+
+    var out: [16]Record = undefined;
+    const n = snapshot(smp.currentIndex(), &out);
+    const alloc = findEvent(out[0..n], .pmm_alloc, phys) orelse return error.TestFailure;
+    const free = findEvent(out[0..n], .pmm_free, phys) orelse return error.TestFailure;
+
+    try std.testing.expect(alloc.args[1] == 2 and alloc.arg_count == 2);
+    try std.testing.expect(alloc.cpu == smp.currentIndex());
+    try std.testing.expect(free.tsc >= alloc.tsc);
+}
+
+test "Trace Ring Wraps And Keeps Newest" {
+    if (comptime !enabled) return;
+
+    clear();
+    var i: u64 = 0;
+    while (i < RECORDS_PER_CPU + 10) : (i += 1) {
+        point(.irq_exit, .{i});
+    }
+
+    var out: [4]Record = undefined;
+    try std.testing.expect(snapshot(smp.currentIndex(), &out) == 4);
+    try std.testing.expect(out[3].args[0] == RECORDS_PER_CPU + 9);
+    try std.testing.expect(out[0].args[0] == RECORDS_PER_CPU + 6);
+    clear();
+}
+
+test "Benchmark: Tracepoint vs printHex" {
+    const bench = @import("bench.zig");
+    const iterations: u64 = 1000;
+
+    var start = bench.now();
+    var i: u64 = 0;
+    while (i < iterations) : (i += 1) {
+        point(.heap_alloc, .{ i, 64, 8 });
+    }
+    bench.report("trace point (3 args)", bench.now() - start, iterations);
+
+    // printHex formats on the call site and goes through the serial rings.
+    start = bench.now();
+    i = 0;
+    while (i < 32) : (i += 1) {
+        serial.printHex(.info, i);
+    }
+    bench.report("serial.printHex", bench.now() - start, 32);
+    serial.flush();
+    clear();
+}
@@ -0,0 +1,108 @@
+/// Trace Record Format
+///
+/// The binary layout shared by the kernel tracer (src/kernel/trace.zig) and the
+/// host-side decoder (tools/trace_decode.zig). This file must not import any
+/// kernel code so that it also builds for the host.
+///
+/// A dump is a series of serial lines, one per record:
+///   #T <96 lowercase hex digits: the 48 record bytes in memory order>
+/// Anything else on the console (log lines, tags before "#T ") is ignored by
+/// the decoder.
+const std = @import("std");
+
+/// Tracepoint identifiers. Append only: the decoder uses the numeric values.
+pub const Event = enum(u16) {
+    pmm_alloc,
+    pmm_free,
+    vmm_map,
+    heap_alloc,
+    heap_free,
+    irq_entry,
+    irq_exit,
+    elf_load,
+    domain_retag,
+    _,
+
+    /// Names of the arguments each tracepoint records, for the decoder.
+    pub fn argNames(self: Event) []const []const u8 {
+        return switch (self) {
+            .pmm_alloc, .pmm_free => &.{ "phys", "pages" },
+            .vmm_map => &.{ "virt", "phys", "flags", "pkey" },
+            .heap_alloc => &.{ "ptr", "len", "align" },
+            .heap_free => &.{ "ptr", "len" },
+            .irq_entry => &.{ "vector", "rip" },
+            .irq_exit => &.{"vector"},
+            .elf_load => &.{ "entry", "size", "segments" },
+            .domain_retag => &.{ "domain", "key", "pages", "cycles" },
+            _ => &.{},
+        };
+    }
+};
+
+pub const MAX_ARGS = 4;
+
+/// One trace record, 48 bytes.
+pub const Record = extern struct {
+    tsc: u64,
+    cpu: u32,
+    event: u16,
+    arg_count: u16,
+    args: [MAX_ARGS]u64,
+};
+
+pub const LINE_PREFIX = "#T ";
+/// Prefix, hex payload and newline.
+pub const LINE_LEN = LINE_PREFIX.len + @sizeOf(Record) * 2 + 1;
+
+/// Formats `rec` as one dump line (including the trailing newline).
+pub fn encodeLine(rec: *const Record, out: *[LINE_LEN]u8) []const u8 {
+    @memcpy(out[0..LINE_PREFIX.len], LINE_PREFIX);
+    const hex = std.fmt.bytesToHex(std.mem.asBytes(rec).*, .lower);
+    @memcpy(out[LINE_PREFIX.len .. LINE_LEN - 1], &hex);
+    out[LINE_LEN - 1] = '\n';
+    return out;
+}
+
+/// Parses a dump line. Returns null if the line holds no (valid) record.
+pub fn decodeLine(line: []const u8) ?Record {
+    const start = std.mem.indexOf(u8, line, LINE_PREFIX) orelse return null;
+    const hex = line[start + LINE_PREFIX.len ..];
+    if (hex.len < @sizeOf(Record) * 2) return null;
+
+    var bytes: [@sizeOf(Record)]u8 = undefined;
+    _ = std.fmt.hexToBytes(&bytes, hex[0 .. @sizeOf(Record) * 2]) catch return null;
+    return std.mem.bytesToValue(Record, &bytes);
+}
+
+// --- Unit Tests ---
+
+test "Trace Record Layout" {
+    try std.testing.expect(@sizeOf(Record) == 48);
+    try std.testing.expect(@offsetOf(Record, "tsc") == 0);
+    try std.testing.expect(@offsetOf(Record, "cpu") == 8);
+    try std.testing.expect(@offsetOf(Record, "event") == 12);
+    try std.testing.expect(@offsetOf(Record, "args") == 16);
+}
+
+test "Trace Line Round Trip" {
+    const rec = Record{
+        .tsc = 0x1122_3344_5566_7788,
+        .cpu = 3,
+        .event = @intFromEnum(Event.vmm_map),
+        .arg_count = 4,
+        .args = .{ 0xFFFF_8000_0000_1000, 0x20_0000, 0x3, 1 },
+    };
+    var buf: [LINE_LEN]u8 = undefined;
+    const line = encodeLine(&rec, &buf);
+    try std.testing.expect(std.mem.startsWith(u8, line, LINE_PREFIX));
+
+    // Leading console noise is skipped.
+    var noisy: [LINE_LEN + 8]u8 = undefined;
+    @memcpy(noisy[0..8], "[INFO]  ");
+    @memcpy(noisy[8..], line);
+    const back = decodeLine(&noisy) orelse return error.TestFailure;
+    try std.testing.expect(std.mem.eql(u8, std.mem.asBytes(&back), std.mem.asBytes(&rec)));
+
+    try std.testing.expect(decodeLine("[INFO] no record here") == null);
+    try std.testing.expect(decodeLine("#T 1234") == null);
+}
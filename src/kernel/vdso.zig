@@ -0,0 +1,157 @@
+/// Kernel Data Page (vDSO style)
+///
+/// Values a program reads often but the kernel changes rarely or never (the
+/// clock calibration, CPU count, framebuffer geometry) are published in one
+/// page mapped read-only at layout.VDSO_BASE. Reading them is a plain load
+/// instead of an indirect call through the kernel table; the clock is a
+/// load plus rdtsc (Data.nowNs()).
+///
+/// The kernel writes the page through its HHDM alias, which is in the
+/// driver domain (pks.KEY_DRIVERS). The mapping at VDSO_BASE has no write
+/// permission, and CR0.WP (set by Limine) makes that binding in ring 0 too.
+const std = @import("std");
+const cpu = @import("../arch/x86_64/cpu.zig");
+const tsc = @import("../arch/x86_64/tsc.zig");
+const smp = @import("../arch/x86_64/smp.zig");
+const pks = @import("../arch/x86_64/pks.zig");
+const framebuffer = @import("../drivers/graphics/framebuffer.zig");
+const pmm = @import("memory/pmm.zig");
+const vmm = @import("memory/vmm.zig");
+const layout = @import("memory/layout.zig");
+const serial = @import("serial.zig");
+
+/// Layout version of Data. New fields are appended and bump it.
+pub const VERSION: u32 = 1;
+
+/// Data.flags: the tsc_* fields are valid and nowNs() works.
+pub const FLAG_CLOCK: u32 = 1 << 0;
+/// Data.flags: the TSC rate is constant across power states.
+pub const FLAG_INVARIANT_TSC: u32 = 1 << 1;
+/// Data.flags: the fb_* fields describe a framebuffer.
+pub const FLAG_FRAMEBUFFER: u32 = 1 << 2;
+
+/// The page contents. Everything is written once at boot.
+pub const Data = extern struct {
+    version: u32,
+    flags: u32,
+    /// CPUs in the system (online or not).
+    cpu_count: u32,
+    fb_bpp: u32,
+    fb_width: u32,
+    fb_height: u32,
+    /// Distance between framebuffer rows, in pixels.
+    fb_stride: u32,
+    reserved: u32 = 0,
+    tsc_hz: u64,
+    /// TSC value at which the clock reads zero.
+    tsc_base: u64,
+    /// 32.32 fixed-point nanoseconds per TSC cycle.
+    tsc_mult: u64,
+
+    /// Nanoseconds since the kernel clock started; 0 without FLAG_CLOCK.
+    pub fn nowNs(self: *const Data) u64 {
+        const cycles = cpu.rdtsc() -% self.tsc_base;
+        return @intCast((@as(u128, cycles) * self.tsc_mult) >> 32);
+    }
+};
+
+comptime {
+    std.debug.assert(@sizeOf(Data) <= pmm.PAGE_SIZE);
+}
+
+/// The program-visible, read-only mapping.
+pub const page: *const Data = @ptrFromInt(layout.VDSO_BASE);
+
+/// What the kernel table points at if the page could not be set up: no
+/// clock, no framebuffer.
+pub const fallback = Data{
+    .version = VERSION,
+    .flags = 0,
+    .cpu_count = 1,
+    .fb_bpp = 0,
+    .fb_width = 0,
+    .fb_height = 0,
+    .fb_stride = 0,
+    .tsc_hz = 0,
+    .tsc_base = 0,
+    .tsc_mult = 0,
+};
+
+var writable: ?*Data = null;
+
+/// Allocates the page, fills it in and maps it read-only at VDSO_BASE.
+/// Needs the PMM, VMM, SMP tables and a calibrated TSC.
+pub fn init() void {
+    const phys = pmm.allocatePage() orelse {
+        serial.err("vDSO: Out of memory for data page");
+        return;
+    };
+    const data: *Data = @ptrFromInt(phys + vmm.getHhdmOffset());
+    @memset(@as([*]u8, @ptrCast(data))[0..pmm.PAGE_SIZE], 0);
+
+    data.* = .{
+        .version = VERSION,
+        .flags = 0,
+        .cpu_count = @intCast(smp.count()),
+        .fb_bpp = 0,
+        .fb_width = 0,
+        .fb_height = 0,
+        .fb_stride = 0,
+        .tsc_hz = tsc.frequency(),
+        .tsc_base = tsc.baseCycles(),
+        .tsc_mult = tsc.multiplier(),
+    };
+    if (tsc.isCalibrated()) data.flags |= FLAG_CLOCK;
+    if (tsc.isInvariant()) data.flags |= FLAG_INVARIANT_TSC;
+    if (framebuffer.getFramebuffer()) |fb| {
+        data.flags |= FLAG_FRAMEBUFFER;
+        data.fb_bpp = fb.bpp;
+        data.fb_width = @intCast(fb.width);
+        data.fb_height = @intCast(fb.height);
+        data.fb_stride = @intCast(fb.pitch / 4);
+    }
+
+    vmm.mapPage(layout.VDSO_BASE, phys, vmm.PTE_NX, 0) catch {
+        serial.err("vDSO: Failed to map data page");
+        pmm.freePage(phys);
+        return;
+    };
+    vmm.setKey(@intFromPtr(data), pmm.PAGE_SIZE, pks.KEY_DRIVERS);
+    writable = data;
+    serial.info("vDSO: Data page mapped read-only");
+}
+
+/// True once the page is mapped.
+pub fn isReady() bool {
+    return writable != null;
+}
+
+// --- Unit Tests ---
+
+test "vDSO Page Is Read-Only And Matches The Kernel" {
+    const data = writable orelse return;
+    try std.testing.expect(vmm.isMapped(layout.VDSO_BASE));
+    try std.testing.expect(page.version == VERSION);
+    try std.testing.expect(page.cpu_count == smp.count());
+    try std.testing.expect(page.tsc_mult == data.tsc_mult);
+    try std.testing.expect(vmm.mappingKey(@intFromPtr(data)) == pks.KEY_DRIVERS);
+
+    if ((page.flags & FLAG_CLOCK) != 0) {
+        const a = page.nowNs();
+        const b = tsc.nowNs();
+        try std.testing.expect(b >= a);
+    }
+}
+
+test "Benchmark: vDSO Clock Read" {
+    const bench = @import("bench.zig");
+    if (!isReady()) return;
+
+    const iterations: u64 = 100_000;
+    var sink: u64 = 0;
+    const start = bench.now();
+    var i: u64 = 0;
+    while (i < iterations) : (i += 1) sink +%= page.nowNs();
+    bench.report("vdso nowNs", bench.now() - start, iterations);
+    std.mem.doNotOptimizeAway(sink);
+}
@@ -68,11 +68,14 @@ __attribute__((
                            .max_mode = 0,
                            .min_mode = 0};
 
-// MP Request
+// MP Request (ask Limine to enable x2APIC on the APs when available)
 __attribute__((
     used,
     section(".limine_reqs"))) volatile struct limine_mp_request mp_request = {
-    .id = LIMINE_MP_REQUEST_ID, .revision = 0, .response = NULL, .flags = 0};
+    .id = LIMINE_MP_REQUEST_ID,
+    .revision = 0,
+    .response = NULL,
+    .flags = LIMINE_MP_REQUEST_X86_64_X2APIC};
 
 // Memory Map Request
 __attribute__((used,
@@ -1,9 +1,14 @@
 const std = @import("std");
 const limine = @import("../limine_import.zig").C;
 const serial = @import("../kernel/serial.zig");
+const log = serial.scoped(.elf);
 const memory = @import("../kernel/memory/layout.zig");
 const pmm = @import("../kernel/memory/pmm.zig");
 const vmm = @import("../kernel/memory/vmm.zig");
+const trace = @import("../kernel/trace.zig");
+const domain = @import("../kernel/domain.zig");
+const pks = @import("../arch/x86_64/pks.zig");
+const tlb = @import("../kernel/memory/tlb.zig");
 
 // Use Zig's standard ELF definitions
 const Elf64_Ehdr = std.elf.Elf64_Ehdr;
@@ -22,7 +27,8 @@ pub const ElfError = error{
 /// Loads an ELF file from memory into the correct virtual address and returns the entry point.
 /// This function assumes the ELF is a position-dependent executable (or position-independent)
 /// and loads it exactly where the Program Headers request (unless relocatable, which we don't support yet).
-pub fn loadElf(file_ptr: [*]const u8, file_size: u64) !u64 {
+/// The loaded pages belong to `dom` and carry its key; without a domain they get key 0.
+pub fn loadElf(file_ptr: [*]const u8, file_size: u64, dom: ?*domain.Domain) !u64 {
     const header = @as(*const Elf64_Ehdr, @ptrCast(@alignCast(file_ptr)));
 
     // 1. Validation
@@ -33,7 +39,7 @@ pub fn loadElf(file_ptr: [*]const u8, file_size: u64) !u64 {
     // We only accept executables or shared objects (PIE)
     if (header.e_type != std.elf.ET.EXEC and header.e_type != std.elf.ET.DYN) return ElfError.InvalidType;
 
-    serial.info("ELFLoader: Header Validated.");
+    log.info("ELFLoader: Header Validated.");
 
     // 2. Iterate Program Headers
     const ph_offset = header.e_phoff;
@@ -43,6 +49,7 @@ pub fn loadElf(file_ptr: [*]const u8, file_size: u64) !u64 {
     // Validate bounds
     if (ph_offset + ph_num * ph_size > file_size) return ElfError.InvalidMagic; // Corrupt file
 
+    var segments: usize = 0;
     var i: usize = 0;
     while (i < ph_num) : (i += 1) {
         const ph_addr = @intFromPtr(file_ptr) + ph_offset + (i * ph_size);
@@ -50,10 +57,12 @@ pub fn loadElf(file_ptr: [*]const u8, file_size: u64) !u64 {
 
         if (ph.p_type == std.elf.PT_LOAD) {
             // Load this segment
-            try loadSegment(file_ptr, ph);
+            try loadSegment(file_ptr, ph, dom);
+            segments += 1;
         }
     }
 
+    trace.point(.elf_load, .{ header.e_entry, file_size, segments });
     return header.e_entry;
 }
 
@@ -66,21 +75,23 @@ pub fn loadElf(file_ptr: [*]const u8, file_size: u64) !u64 {
 /// ## Parameters
 /// - `file_base`: Pointer to the start of the ELF file in memory
 /// - `ph`: Pointer to the ELF Program Header describing this segment
+/// - `dom`: Protection domain that owns the pages (null: key 0)
 ///
 /// ## Process
 /// 1. Calculate page-aligned start and end addresses from the segment's virtual address
 /// 2. Allocate and map physical pages for the entire memory range
 /// 3. Copy initialized data from the file (p_filesz bytes)
 /// 4. Zero out uninitialized BSS section (p_memsz - p_filesz bytes)
-fn loadSegment(file_base: [*]const u8, ph: *const Elf64_Phdr) !void {
+/// 5. Record the pages as a region of the domain
+fn loadSegment(file_base: [*]const u8, ph: *const Elf64_Phdr, dom: ?*domain.Domain) !void {
     if (ph.p_memsz == 0) return;
 
     // Destination in memory (Virtual Address)
     const dest_addr = ph.p_vaddr;
 
-    serial.debug("ELFLoader: Loading Segment (VA, Size):");
-    serial.printHex(.debug, dest_addr);
-    serial.printHex(.debug, ph.p_memsz);
+    log.debug("ELFLoader: Loading Segment (VA, Size):");
+    log.printHex(.debug, dest_addr);
+    log.printHex(.debug, ph.p_memsz);
 
     // Calculate start and end pages
     const page_size: u64 = 0x1000;
@@ -88,14 +99,31 @@ fn loadSegment(file_base: [*]const u8, ph: *const Elf64_Phdr) !void {
     const end_addr = dest_addr + ph.p_memsz;
     const end_page = (end_addr + page_size - 1) & ~(page_size - 1);
 
+    // Never map over live pages: they belong to the kernel or to another
+    // program still loaded (a resident server). Only an earlier segment of
+    // this image may have mapped a page already, when two segments share it.
     var curr_page = start_page;
     while (curr_page < end_page) : (curr_page += page_size) {
+        if (!vmm.isMapped(curr_page)) continue;
+        const ours = if (dom) |d| d.owns(curr_page, page_size, .image) else false;
+        if (!ours) {
+            log.err("ELFLoader: Segment overlaps memory in use");
+            return ElfError.LoadFailed;
+        }
+    }
+
+    // Mapping with the domain's current key saves retagging in step 5.
+    const key = if (dom) |d| d.tag() else pks.KEY_DEFAULT;
+    curr_page = start_page;
+    while (curr_page < end_page) : (curr_page += page_size) {
+        if (vmm.isMapped(curr_page)) continue; // Shared with an earlier segment
+
         // 1. Allocate physical page
         const phys = pmm.allocatePage() orelse return ElfError.LoadFailed;
 
         // 2. Map page (RW for now, we should check ph.flags for RX/RW etc)
         // Always RWX for now since we are simple kernel
-        try vmm.mapPage(curr_page, phys, vmm.PTE_PRESENT | vmm.PTE_RW, 0);
+        try vmm.mapPage(curr_page, phys, vmm.PTE_PRESENT | vmm.PTE_RW, key);
     }
 
     // 3. Copy Data
@@ -112,6 +140,46 @@ fn loadSegment(file_base: [*]const u8, ph: *const Elf64_Phdr) !void {
         const bss_ptr = @as([*]u8, @ptrFromInt(bss_start));
         @memset(bss_ptr[0..bss_size], 0);
     }
+
+    // 5. Hand the pages to the domain
+    if (dom) |d| {
+        d.addRegion(start_page, (end_page - start_page) / page_size, .image) catch return ElfError.LoadFailed;
+    }
+}
+
+/// Unmaps the ELF image of `dom` and frees its pages, so the addresses can
+/// be loaded again. The program must not be running.
+pub fn unload(dom: *domain.Domain) void {
+    var i = dom.region_count;
+    while (i > 0) {
+        i -= 1;
+        const region = dom.regions[i];
+        if (region.kind != .image) continue;
+        _ = dom.removeRegion(region.start);
+        freePages(region.start, region.pages);
+    }
+}
+
+/// Unmaps `count` pages at `start` and frees the frames behind them, one
+/// TLB batch per chunk. Pages already unmapped (shared with a segment freed
+/// before) are skipped.
+fn freePages(start: u64, count: u64) void {
+    const page_size: u64 = 0x1000;
+    var frames: [64]u64 = undefined;
+    var done: u64 = 0;
+    while (done < count) {
+        var batch = tlb.Batch{};
+        var n: usize = 0;
+        while (done < count and n < frames.len) : (done += 1) {
+            const virt = start + done * page_size;
+            frames[n] = vmm.physicalAddress(virt) orelse continue;
+            vmm.unmapPagesBatched(virt, 1, &batch);
+            n += 1;
+        }
+        // No CPU may still reach a frame through a stale translation.
+        batch.flush();
+        for (frames[0..n]) |phys| pmm.freePage(phys);
+    }
 }
 
 // Local testing helper to avoid std.testing dependencies in freestanding
@@ -142,7 +210,7 @@ test "ELF Header Validation" {
 
     // Should fail with load error or just pass validation up to parsing loop
     // Since ph_num is 0, it should just return e_entry (0)
-    const entry = try loadElf(ptr, size);
+    const entry = try loadElf(ptr, size, null);
     try testing.expect(entry == 0);
 }
 
@@ -153,9 +221,37 @@ test "ELF Invalid Magic" {
     const ptr = @as([*]const u8, @ptrCast(&header));
     const size = @sizeOf(Elf64_Ehdr);
 
-    if (loadElf(ptr, size)) |_| {
+    if (loadElf(ptr, size, null)) |_| {
         return error.TestFailure;
     } else |err| {
         try testing.expect(err == ElfError.InvalidMagic);
     }
 }
+
+test "ELF Refuses To Map Over Live Pages" {
+    const Image = extern struct {
+        header: Elf64_Ehdr,
+        phdr: Elf64_Phdr,
+    };
+    var image = std.mem.zeroes(Image);
+    @memcpy(image.header.e_ident[0..4], "\x7FELF");
+    image.header.e_ident[std.elf.EI_CLASS] = std.elf.ELFCLASS64;
+    image.header.e_ident[std.elf.EI_DATA] = std.elf.ELFDATA2LSB;
+    image.header.e_machine = std.elf.EM.X86_64;
+    image.header.e_type = std.elf.ET.EXEC;
+    image.header.e_phoff = @offsetOf(Image, "phdr");
+    image.header.e_phnum = 1;
+    image.header.e_phentsize = @sizeOf(Elf64_Phdr);
+
+    // A segment on top of this test's own stack frame.
+    image.phdr.p_type = std.elf.PT_LOAD;
+    image.phdr.p_vaddr = @intFromPtr(&image);
+    image.phdr.p_memsz = 1;
+
+    const ptr = @as([*]const u8, @ptrCast(&image));
+    if (loadElf(ptr, @sizeOf(Image), null)) |_| {
+        return error.TestFailure;
+    } else |err| {
+        try testing.expect(err == ElfError.LoadFailed);
+    }
+}
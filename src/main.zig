@@ -3,6 +3,10 @@ const limine = @import("limine_import.zig").C;
 pub const serial = @import("kernel/serial.zig");
 const memory = @import("kernel/memory/layout.zig");
 const framebuffer = @import("drivers/graphics/framebuffer.zig");
+const surface = @import("drivers/graphics/surface.zig");
+const display = @import("drivers/graphics/display.zig");
+const console = @import("drivers/graphics/console.zig");
+const compositor = @import("drivers/graphics/compositor.zig");
 pub const pmm = @import("kernel/memory/pmm.zig");
 pub const heap = @import("kernel/memory/heap.zig");
 const demo_smiley = @import("demos/smiley.zig");
@@ -11,9 +15,26 @@ const gdt = @import("arch/x86_64/gdt.zig");
 const idt = @import("arch/x86_64/idt.zig");
 const apic = @import("arch/x86_64/apic.zig");
 const pks = @import("arch/x86_64/pks.zig");
+const pat = @import("arch/x86_64/pat.zig");
+const tsc = @import("arch/x86_64/tsc.zig");
 const vmm = @import("kernel/memory/vmm.zig");
+const tlb = @import("kernel/memory/tlb.zig");
+const smp = @import("arch/x86_64/smp.zig");
+const acpi = @import("arch/x86_64/acpi.zig");
 pub const elf = @import("loaders/elf.zig");
 const table = @import("kernel/table.zig");
+const bench = @import("kernel/bench.zig");
+const io_ring = @import("kernel/io_ring.zig");
+const draw_list = @import("kernel/draw_list.zig");
+const gate = @import("kernel/gate.zig");
+const domain = @import("kernel/domain.zig");
+const channel = @import("kernel/channel.zig");
+const service = @import("kernel/service.zig");
+const vdso = @import("kernel/vdso.zig");
+const event = @import("kernel/event.zig");
+const ring = @import("kernel/ring.zig");
+const trace = @import("kernel/trace.zig");
+const trace_format = @import("kernel/trace_format.zig");
 
 // Userspace modules
 const user_lib = @import("user/lib.zig");
@@ -32,6 +53,23 @@ extern var hhdm_request: limine.struct_limine_hhdm_request;
 // Module Request
 extern var module_request: limine.struct_limine_module_request;
 
+// Kernel Command Line Request
+extern var executable_cmdline_request: limine.struct_limine_executable_cmdline_request;
+
+/// Kernel panic handler: log lines may still sit in the per-CPU serial rings,
+/// so flush them synchronously before reporting the panic and halting.
+pub const panic = std.debug.FullPanic(kernelPanic);
+
+fn kernelPanic(msg: []const u8, first_trace_addr: ?usize) noreturn {
+    _ = first_trace_addr;
+    serial.panicFlush();
+    serial.err("KERNEL PANIC:");
+    serial.err(msg);
+    while (true) {
+        asm volatile ("hlt");
+    }
+}
+
 /// Checks if the Limine bootloader supports the requested base revision.
 /// Logs an error if not supported.
 fn checkBaseRevision() void {
@@ -76,10 +114,25 @@ fn processHhdmResponse() void {
     }
 }
 
+/// Applies `loglevel=` / `log.<subsystem>=` settings from the kernel command line.
+fn applyCmdline() void {
+    const resp = @as(*volatile ?*limine.struct_limine_executable_cmdline_response, &executable_cmdline_request.response).*;
+    const r = resp orelse return;
+    if (r.cmdline == null) return;
+    const cmdline = std.mem.span(r.cmdline);
+
+    if (serial.configure(cmdline)) |applied| {
+        if (applied > 0) serial.info("Log levels set from kernel command line");
+    } else |_| {
+        serial.warn("Invalid log setting on kernel command line");
+    }
+}
+
 /// Common kernel initialization logic.
 /// Initializes the kernel core subsystems (Serial, GDT, IDT, PMM).
 /// This is used by both the main kernel entry (kmain) and the test runner.
 pub fn initKernel() void {
+    applyCmdline();
     serial.info("Kernel Initialization Started");
 
     gdt.init();
@@ -88,17 +141,38 @@ pub fn initKernel() void {
     serial.info("IDT Initialized");
 
     pks.init();
+    // Before vmm.init(): its CR3 switch drops TLB entries with old memory types
+    pat.init();
 
     pmm.init();
     vmm.init();
 
+    acpi.init();
     apic.init();
-    serial.info("APIC Initialized (LAPIC @ 0xFEE00000, IOAPIC @ 0xFEC00000)");
+    serial.info("APIC Initialized (Topology from ACPI MADT)");
+
+    smp.init();
+    tlb.init();
+    // Needs TLB shootdowns for the retagging
+    vmm.protectPageTables();
+    event.init();
+    // Logging is buffered per CPU from here on (needs the APIC and SMP tables)
+    serial.initAsync();
+    trace.init();
 
     heap.init();
     // pmm.init() logs its own completion
 
     heap.init();
+    // Needs the PMM and HHDM for the back buffer
+    display.init();
+    console.init();
+
+    tsc.init();
+    // Publishes the clock, CPU count and framebuffer geometry to programs
+    vdso.init();
+    // Points the kernel table at the data page if it is mapped
+    table.init();
 }
 
 /// The main kernel entry point implementation.
@@ -138,6 +212,7 @@ fn kmain_impl() callconv(.c) void {
     if (framebuffer.getFramebuffer()) |fb| {
         serial.info("Framebuffer available. Running smiley demo...");
         demo_smiley.drawSmileyFace(fb);
+        _ = display.present();
         serial.info("Smiley Demo complete. Waiting 1s...");
 
         // Delay ~1s
@@ -158,7 +233,7 @@ fn kmain_impl() callconv(.c) void {
         // Check for modules
         const modules_resp = @as(*volatile ?*limine.struct_limine_module_response, &module_request.response).*;
 
-        demo_shell.runShell(fb, modules_resp);
+        demo_shell.runShell(modules_resp);
     } else {
         serial.warn("No Framebuffer found. Skipping demos.");
     }
@@ -180,8 +255,33 @@ test {
     // Force inclusions of tests in imported modules
     std.testing.refAllDecls(pmm);
     std.testing.refAllDecls(framebuffer);
+    std.testing.refAllDecls(surface);
+    std.testing.refAllDecls(display);
+    std.testing.refAllDecls(console);
+    std.testing.refAllDecls(compositor);
+    std.testing.refAllDecls(draw_list);
     std.testing.refAllDecls(elf);
     std.testing.refAllDecls(table);
+    std.testing.refAllDecls(gate);
+    std.testing.refAllDecls(domain);
+    std.testing.refAllDecls(channel);
+    std.testing.refAllDecls(service);
+    std.testing.refAllDecls(io_ring);
+    std.testing.refAllDecls(event);
+    std.testing.refAllDecls(ring);
+    std.testing.refAllDecls(serial);
+    std.testing.refAllDecls(trace);
+    std.testing.refAllDecls(trace_format);
+    std.testing.refAllDecls(idt);
+    std.testing.refAllDecls(bench);
+    std.testing.refAllDecls(smp);
+    std.testing.refAllDecls(acpi);
+    std.testing.refAllDecls(apic);
+    std.testing.refAllDecls(tlb);
+    std.testing.refAllDecls(vmm);
+    std.testing.refAllDecls(pat);
+    std.testing.refAllDecls(tsc);
+    std.testing.refAllDecls(vdso);
     std.testing.refAllDecls(user_lib);
     std.testing.refAllDecls(user_heap);
 }
@@ -189,6 +289,7 @@ test {
 /// Shuts down the kernel by entering an infinite loop.
 fn shutdown() noreturn {
     serial.info("Shutting down (hanging loop)");
+    serial.flush();
     // Hang instead of crash to allow inspection
     while (true) {}
 }
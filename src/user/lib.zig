@@ -8,6 +8,13 @@
 /// idiomatic Zig types (slices, optionals, etc.).
 const table_def = @import("../kernel/table.zig");
 const KernelTable = table_def.KernelTable;
+const io_ring = @import("../kernel/io_ring.zig");
+const draw_list = @import("../kernel/draw_list.zig");
+const compositor = @import("../drivers/graphics/compositor.zig");
+const vdso = @import("../kernel/vdso.zig");
+
+pub const Sqe = io_ring.Sqe;
+pub const Cqe = io_ring.Cqe;
 
 /// Global kernel table pointer, initialized at program startup.
 /// This is set by the _start function in start.zig before calling main().
@@ -18,10 +25,61 @@ var kernel_table: ?*const KernelTable = null;
 ///
 /// Parameters:
 ///   - table: Pointer to the kernel table passed by the ELF loader
+///
+/// Panics if the table is not a kernel table of a compatible major version.
 pub fn init(table: *const KernelTable) void {
+    if (table.magic != table_def.KERNEL_TABLE_MAGIC) @panic("Invalid kernel table");
+    if ((table.version >> 16) != table_def.VERSION_MAJOR) @panic("Incompatible kernel table version");
     kernel_table = table;
 }
 
+/// True if the kernel's table has `entry` (a KernelTable field name), i.e.
+/// the kernel is at least as new as the version that added it.
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn supports(comptime entry: []const u8) bool {
+    const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+    return @offsetOf(KernelTable, entry) + @sizeOf(@FieldType(KernelTable, entry)) <= table.size;
+}
+
+/// True if the kernel provides every service group in `features`
+/// (table.FEATURE_* bits).
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn hasFeatures(features: u64) bool {
+    const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+    return (table.features & features) == features;
+}
+
+/// The read-only kernel data page: clock calibration, CPU count and
+/// framebuffer geometry, readable without a kernel call.
+pub const KernelData = vdso.Data;
+
+/// Without table.FEATURE_VDSO it is a stand-in with no flags set.
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn kernelData() *const KernelData {
+    const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+    return table.vdso;
+}
+
+/// Nanoseconds since boot (since TSC calibration), or null if the kernel
+/// has no calibrated clock. Costs an rdtsc and a few loads.
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn nowNs() ?u64 {
+    const data = kernelData();
+    if ((data.flags & vdso.FLAG_CLOCK) == 0) return null;
+    return data.nowNs();
+}
+
+/// Number of CPUs in the system.
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn cpuCount() u32 {
+    return kernelData().cpu_count;
+}
+
 /// Draw a filled rectangle on the framebuffer.
 ///
 /// Parameters:
@@ -37,6 +95,85 @@ pub fn drawRect(x: u32, y: u32, w: u32, h: u32, color: u32) void {
     table.draw_rect(x, y, w, h, color);
 }
 
+/// Show everything drawn since the last call.
+///
+/// Drawing goes to a back buffer; only the changed rectangles are copied to
+/// the screen here. Call once per frame after drawing.
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn present() void {
+    const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+    table.present();
+}
+
+/// Write text to the kernel's text console.
+///
+/// Handles newlines, tabs and backspace; the console wraps and scrolls.
+/// The text becomes visible on the next present().
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn writeConsole(text: []const u8) void {
+    const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+    table.write_console(text.ptr, text.len);
+}
+
+/// A draw command for submitDrawList (build with DrawCommand.rect/blit/text/line).
+pub const DrawCommand = draw_list.Command;
+
+/// Draw a whole list of commands with one kernel call.
+///
+/// The list is validated up front: on error nothing is drawn.
+///
+/// Returns the number of commands drawn, or a negative io_ring E_* code.
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn submitDrawList(cmds: []const DrawCommand) i64 {
+    const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+    return table.submit_draw_list(cmds.ptr, cmds.len);
+}
+
+/// A pixel surface from createSurface: write pixels directly, then present().
+pub const SurfaceInfo = compositor.SurfaceInfo;
+
+/// Create a `w` x `h` pixel surface shown at (x, y).
+///
+/// Returns null if the size is invalid or the kernel is out of memory or slots.
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn createSurface(x: u32, y: u32, w: u32, h: u32) ?*const SurfaceInfo {
+    const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+    return table.create_surface(x, y, w, h);
+}
+
+/// Destroy a surface created by createSurface.
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn destroySurface(surface: *const SurfaceInfo) void {
+    const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+    table.destroy_surface(surface);
+}
+
+/// Blend a surface with its per-pixel alpha (see placeSurface).
+pub const SURFACE_ALPHA = compositor.FLAG_ALPHA;
+
+/// Report that a rectangle (surface coordinates) of `surface` changed, so
+/// the next present() recomposes only what was reported.
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn damageSurface(surface: *const SurfaceInfo, x: u32, y: u32, w: u32, h: u32) void {
+    const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+    table.damage_surface(surface, x, y, w, h);
+}
+
+/// Move `surface` to (x, y) with stacking order `z` (higher is in front)
+/// and `flags` (0 or SURFACE_ALPHA).
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn placeSurface(surface: *const SurfaceInfo, x: u32, y: u32, z: u32, flags: u32) void {
+    const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+    table.place_surface(surface, x, y, z, flags);
+}
+
 /// Poll for keyboard input (non-blocking).
 ///
 /// Returns:
@@ -55,6 +192,24 @@ pub fn getKey() ?u8 {
     return result;
 }
 
+/// Wait for keyboard input (blocking).
+///
+/// Parameters:
+///   - buf: Buffer receiving the keys
+///
+/// Returns:
+///   - The keys received (at least one), as a prefix of `buf`
+///
+/// Sleeps until a key is pressed instead of polling, then returns every key
+/// that arrived in the meantime. Returns an empty slice if `buf` is empty.
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn waitKeys(buf: []u8) []u8 {
+    const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+    const n = table.wait_key(buf.ptr, buf.len);
+    return buf[0..n];
+}
+
 /// Sleep for the specified number of milliseconds.
 ///
 /// Parameters:
@@ -101,16 +256,277 @@ pub fn allocPages(count: usize) ?[*]u8 {
     return table.alloc_pages(count);
 }
 
+// ============================================================================
+// Async I/O
+// ============================================================================
+
+/// An async I/O ring (see kernel/io_ring.zig).
+///
+/// Queue operations with `queue()` (no kernel call), hand them all to the
+/// kernel with one `submit()`, and collect results in bulk with `harvest()`.
+///
+/// Example:
+///   var ring = lib.IoRing.init(64) orelse return;
+///   _ = ring.queue(lib.Sqe.drawRect(0, 0, 10, 10, 0xFFFF0000, 1));
+///   _ = ring.queue(lib.Sqe.log("hello\n", 2));
+///   _ = ring.submit();
+///   var done: [8]lib.Cqe = undefined;
+///   const n = ring.harvest(&done);
+pub const IoRing = struct {
+    view: io_ring.RingView,
+    /// Local copy of sq_tail; published to the kernel by submit().
+    sq_tail: u32,
+
+    /// Creates a ring with `entries` submission slots.
+    /// Returns null if the kernel refuses (bad size, out of memory).
+    ///
+    /// Panics if the kernel table has not been initialized via init().
+    pub fn init(entries: u32) ?IoRing {
+        const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+        const header = table.io_setup(entries) orelse return null;
+        return .{ .view = .{ .header = header }, .sq_tail = header.sq_tail };
+    }
+
+    /// Destroys the ring. Operations still parked in the kernel are dropped.
+    pub fn deinit(self: *IoRing) void {
+        const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+        table.io_destroy(self.view.header);
+    }
+
+    /// Queues one operation. Returns false if the submission queue is full.
+    pub fn queue(self: *IoRing, sqe: Sqe) bool {
+        const hdr = self.view.header;
+        const head = @atomicLoad(u32, &hdr.sq_head, .acquire);
+        if (self.sq_tail -% head >= hdr.sq_entries) return false;
+        self.view.sqes()[self.sq_tail & (hdr.sq_entries - 1)] = sqe;
+        self.sq_tail +%= 1;
+        return true;
+    }
+
+    /// Publishes every queued operation and asks the kernel to process them.
+    /// Returns the number the kernel consumed.
+    pub fn submit(self: *IoRing) u32 {
+        const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+        @atomicStore(u32, &self.view.header.sq_tail, self.sq_tail, .release);
+        return table.io_enter(self.view.header);
+    }
+
+    /// Publishes every queued operation and blocks until at least
+    /// `min_complete` completions are ready. One kernel call covers both.
+    /// Returns the number of completions ready.
+    pub fn submitAndWait(self: *IoRing, min_complete: u32) u32 {
+        const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+        @atomicStore(u32, &self.view.header.sq_tail, self.sq_tail, .release);
+        return table.io_wait(self.view.header, min_complete);
+    }
+
+    /// Copies up to `out.len` completions into `out` and releases their slots.
+    /// Returns the number copied (0 if nothing has completed).
+    pub fn harvest(self: *IoRing, out: []Cqe) usize {
+        const hdr = self.view.header;
+        var head = hdr.cq_head;
+        const tail = @atomicLoad(u32, &hdr.cq_tail, .acquire);
+        const mask = hdr.cq_entries - 1;
+
+        var n: usize = 0;
+        while (head != tail and n < out.len) : (n += 1) {
+            out[n] = self.view.cqes()[head & mask];
+            head +%= 1;
+        }
+        @atomicStore(u32, &hdr.cq_head, head, .release);
+        return n;
+    }
+};
+
+// ============================================================================
+// Legacy Synchronous I/O
+// ============================================================================
+//
+// Blocking read/write for ported programs, built on a private async ring.
+// Each call submits one operation and parks until it completes; the kernel
+// halts the CPU while waiting instead of spinning.
+
+const SYNC_RING_ENTRIES: u32 = 4;
+
+/// Ring used by the blocking calls, created on first use.
+var sync_ring: ?IoRing = null;
+
+fn syncRing() *IoRing {
+    if (sync_ring == null) {
+        sync_ring = IoRing.init(SYNC_RING_ENTRIES) orelse @panic("Failed to create the synchronous I/O ring");
+    }
+    return &sync_ring.?;
+}
+
+/// Submits one async operation and blocks until it completes.
+///
+/// Returns the completion result: >= 0 on success, a negative E_* code on failure.
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn call(sqe: Sqe) i64 {
+    const ring = syncRing();
+    // Calls are serialized, so the ring never holds more than this operation.
+    if (!ring.queue(sqe)) @panic("Synchronous I/O ring full");
+
+    var done: [1]Cqe = undefined;
+    while (ring.harvest(&done) == 0) {
+        _ = ring.submitAndWait(1);
+    }
+    return done[0].result;
+}
+
+/// Writes `msg` to the console. Blocks until the write completes.
+///
+/// Returns the number of bytes written, or a negative E_* code.
+pub fn write(msg: []const u8) i64 {
+    return call(Sqe.log(msg, 0));
+}
+
+/// Reads keyboard input into `buf`. Blocks until at least one key is
+/// available, then returns every buffered key that fits.
+///
+/// Returns the number of keys read, or a negative E_* code.
+pub fn read(buf: []u8) i64 {
+    return call(Sqe.readKey(buf, 0));
+}
+
+// ============================================================================
+// Channels
+// ============================================================================
+
+/// A zero-copy message channel (see kernel/channel.zig).
+///
+/// A message travels in a block from allocPages: send() hands the block to
+/// the kernel, which moves it to the program that created the channel when
+/// that program calls recv(). Nothing is copied, and the sender must not
+/// touch the block once send() succeeds.
+///
+/// Example:
+///   const ch = lib.Channel.init() orelse return;
+///   const block = lib.allocPages(1) orelse return;
+///   @memcpy(block[0..5], "hello");
+///   _ = ch.send(block[0..5]);
+pub const Channel = struct {
+    id: u32,
+
+    /// Creates a channel only this program receives from. Returns null if
+    /// the kernel is out of channels.
+    ///
+    /// Panics if the kernel table has not been initialized via init().
+    pub fn init() ?Channel {
+        const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+        const id = table.channel_create();
+        if (id < 0) return null;
+        return .{ .id = @intCast(id) };
+    }
+
+    /// Opens an existing channel by id, e.g. to send to another program.
+    pub fn open(id: u32) Channel {
+        return .{ .id = id };
+    }
+
+    /// Destroys the channel. Undelivered messages are dropped.
+    pub fn deinit(self: Channel) void {
+        const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+        table.channel_destroy(self.id);
+    }
+
+    /// Sends `msg`, which must start at the start of a block from
+    /// allocPages or recv. Returns 0 or a negative io_ring E_* code.
+    pub fn send(self: Channel, msg: []u8) i64 {
+        const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+        return table.channel_send(self.id, msg.ptr, msg.len);
+    }
+
+    /// Receives the oldest message, or null if there is none. The block
+    /// behind it (from msg.ptr to the end of its pages) is now the caller's.
+    pub fn recv(self: Channel) ?[]u8 {
+        const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+        var len: usize = 0;
+        const block = table.channel_recv(self.id, &len) orelse return null;
+        return block[0..len];
+    }
+};
+
+// ============================================================================
+// Services
+// ============================================================================
+
+/// Publish `entries`, an extern struct of the program's own C-ABI function
+/// pointers, under `name` so other programs can call them directly.
+///
+/// Returns the service slot, or a negative io_ring E_* code.
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn publishService(comptime T: type, name: []const u8, entries: *const T) i64 {
+    comptime checkServiceTable(T);
+    const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+    const words: [*]const usize = @ptrCast(entries);
+    return table.publish_service(name.ptr, name.len, words, @sizeOf(T) / @sizeOf(usize));
+}
+
+/// Look up the service `name` and view its entries as a `T`, the same
+/// extern struct its publisher used. Returns null if there is no such
+/// service or it has fewer entries than `T`.
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn lookupService(comptime T: type, name: []const u8) ?*const T {
+    comptime checkServiceTable(T);
+    const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+    var count: usize = 0;
+    const entries = table.lookup_service(name.ptr, name.len, &count) orelse return null;
+    if (count * @sizeOf(usize) < @sizeOf(T)) return null;
+    return @ptrCast(@alignCast(entries));
+}
+
+/// Withdraw a service published with publishService.
+///
+/// Panics if the kernel table has not been initialized via init().
+pub fn withdrawService(name: []const u8) void {
+    const table = kernel_table orelse @panic("User runtime not initialized - call lib.init() first");
+    table.withdraw_service(name.ptr, name.len);
+}
+
+fn checkServiceTable(comptime T: type) void {
+    const info = @typeInfo(T);
+    if (info != .@"struct" or info.@"struct".layout != .@"extern") @compileError("A service table must be an extern struct");
+    for (info.@"struct".fields) |field| {
+        if (@typeInfo(field.type) != .pointer or @typeInfo(@typeInfo(field.type).pointer.child) != .@"fn") {
+            @compileError("Service table field '" ++ field.name ++ "' is not a function pointer");
+        }
+    }
+}
+
 // ============================================================================
 // Unit Tests
 // ============================================================================
 
 const std = @import("std");
-
-test "User Runtime - Initialization" {
-    // Create a mock kernel table for testing
-    const mock_table = KernelTable{
+const bench = @import("../kernel/bench.zig");
+
+/// Kernel data page for mock tables: 1 GHz clock, 4 CPUs, 640x480 screen.
+const mock_vdso = vdso.Data{
+    .version = vdso.VERSION,
+    .flags = vdso.FLAG_CLOCK | vdso.FLAG_FRAMEBUFFER,
+    .cpu_count = 4,
+    .fb_bpp = 32,
+    .fb_width = 640,
+    .fb_height = 480,
+    .fb_stride = 640,
+    .tsc_hz = 1_000_000_000,
+    .tsc_base = 0,
+    .tsc_mult = 1 << 32,
+};
+
+/// Returns a kernel table whose entries do nothing. Tests override the
+/// entries they care about.
+fn mockTable() KernelTable {
+    return .{
         .magic = table_def.KERNEL_TABLE_MAGIC,
+        .version = table_def.KERNEL_TABLE_VERSION,
+        .size = @sizeOf(KernelTable),
+        .features = table_def.KERNEL_FEATURES | table_def.FEATURE_VDSO,
+        .vdso = &mock_vdso,
         .log = struct {
             fn mockLog(_: [*]const u8, _: usize) callconv(.c) void {}
         }.mockLog,
@@ -130,7 +546,91 @@ test "User Runtime - Initialization" {
                 return null;
             }
         }.mockAllocPages,
+        .io_setup = struct {
+            fn mockIoSetup(_: u32) callconv(.c) ?*io_ring.RingHeader {
+                return null;
+            }
+        }.mockIoSetup,
+        .io_enter = struct {
+            fn mockIoEnter(_: *io_ring.RingHeader) callconv(.c) u32 {
+                return 0;
+            }
+        }.mockIoEnter,
+        .io_destroy = struct {
+            fn mockIoDestroy(_: *io_ring.RingHeader) callconv(.c) void {}
+        }.mockIoDestroy,
+        .io_wait = struct {
+            fn mockIoWait(_: *io_ring.RingHeader, _: u32) callconv(.c) u32 {
+                return 0;
+            }
+        }.mockIoWait,
+        .wait_key = struct {
+            fn mockWaitKey(_: [*]u8, _: usize) callconv(.c) usize {
+                return 0;
+            }
+        }.mockWaitKey,
+        .present = struct {
+            fn mockPresent() callconv(.c) void {}
+        }.mockPresent,
+        .write_console = struct {
+            fn mockWriteConsole(_: [*]const u8, _: usize) callconv(.c) void {}
+        }.mockWriteConsole,
+        .submit_draw_list = struct {
+            fn mockSubmitDrawList(_: [*]const DrawCommand, count: usize) callconv(.c) i64 {
+                return @intCast(count);
+            }
+        }.mockSubmitDrawList,
+        .create_surface = struct {
+            fn mockCreateSurface(_: u32, _: u32, _: u32, _: u32) callconv(.c) ?*const SurfaceInfo {
+                return null;
+            }
+        }.mockCreateSurface,
+        .destroy_surface = struct {
+            fn mockDestroySurface(_: *const SurfaceInfo) callconv(.c) void {}
+        }.mockDestroySurface,
+        .damage_surface = struct {
+            fn mockDamageSurface(_: *const SurfaceInfo, _: u32, _: u32, _: u32, _: u32) callconv(.c) void {}
+        }.mockDamageSurface,
+        .place_surface = struct {
+            fn mockPlaceSurface(_: *const SurfaceInfo, _: u32, _: u32, _: u32, _: u32) callconv(.c) void {}
+        }.mockPlaceSurface,
+        .channel_create = struct {
+            fn mockChannelCreate() callconv(.c) i64 {
+                return io_ring.E_BUSY;
+            }
+        }.mockChannelCreate,
+        .channel_destroy = struct {
+            fn mockChannelDestroy(_: u32) callconv(.c) void {}
+        }.mockChannelDestroy,
+        .channel_send = struct {
+            fn mockChannelSend(_: u32, _: [*]u8, _: usize) callconv(.c) i64 {
+                return io_ring.E_INVAL;
+            }
+        }.mockChannelSend,
+        .channel_recv = struct {
+            fn mockChannelRecv(_: u32, _: *usize) callconv(.c) ?[*]u8 {
+                return null;
+            }
+        }.mockChannelRecv,
+        .publish_service = struct {
+            fn mockPublishService(_: [*]const u8, _: usize, _: [*]const usize, _: usize) callconv(.c) i64 {
+                return io_ring.E_BUSY;
+            }
+        }.mockPublishService,
+        .lookup_service = struct {
+            fn mockLookupService(_: [*]const u8, _: usize, _: *usize) callconv(.c) ?[*]const usize {
+                return null;
+            }
+        }.mockLookupService,
+        .withdraw_service = struct {
+            fn mockWithdrawService(_: [*]const u8, _: usize) callconv(.c) void {}
+        }.mockWithdrawService,
     };
+}
+
+test "User Runtime - Initialization" {
+    // Create a mock kernel table for testing
+    const mock_table = mockTable();
 
     // Initialize with mock table
     init(&mock_table);
@@ -140,30 +640,26 @@ test "User Runtime - Initialization" {
     try std.testing.expect(kernel_table.?.magic == table_def.KERNEL_TABLE_MAGIC);
 }
 
+test "User Runtime - Negotiates Entries And Reads Kernel Data" {
+    var mock_table = mockTable();
+    init(&mock_table);
+    try std.testing.expect(supports("place_surface"));
+    try std.testing.expect(hasFeatures(table_def.FEATURE_SURFACES | table_def.FEATURE_VDSO));
+    try std.testing.expect(cpuCount() == 4);
+    try std.testing.expect(kernelData().fb_width == 640);
+    try std.testing.expect(nowNs() != null);
+
+    // An older kernel whose table ends before the surface entries.
+    mock_table.size = @offsetOf(KernelTable, "create_surface");
+    mock_table.features &= ~table_def.FEATURE_SURFACES;
+    try std.testing.expect(supports("submit_draw_list"));
+    try std.testing.expect(!supports("create_surface"));
+    try std.testing.expect(!hasFeatures(table_def.FEATURE_SURFACES));
+}
+
 test "User Runtime - getKey Wrapper Converts 0 to null" {
     // Setup mock that returns 0 (no key)
-    const mock_table = KernelTable{
-        .magic = table_def.KERNEL_TABLE_MAGIC,
-        .log = struct {
-            fn mockLog(_: [*]const u8, _: usize) callconv(.c) void {}
-        }.mockLog,
-        .draw_rect = struct {
-            fn mockDrawRect(_: u32, _: u32, _: u32, _: u32, _: u32) callconv(.c) void {}
-        }.mockDrawRect,
-        .poll_key = struct {
-            fn mockPollKey() callconv(.c) u8 {
-                return 0;
-            }
-        }.mockPollKey,
-        .sleep_ms = struct {
-            fn mockSleep(_: u64) callconv(.c) void {}
-        }.mockSleep,
-        .alloc_pages = struct {
-            fn mockAllocPages(_: usize) callconv(.c) ?[*]u8 {
-                return null;
-            }
-        }.mockAllocPages,
-    };
+    const mock_table = mockTable();
 
     init(&mock_table);
     const result = getKey();
@@ -172,28 +668,12 @@ test "User Runtime - getKey Wrapper Converts 0 to null" {
 
 test "User Runtime - getKey Wrapper Returns Character" {
     // Setup mock that returns ASCII 'A'
-    const mock_table = KernelTable{
-        .magic = table_def.KERNEL_TABLE_MAGIC,
-        .log = struct {
-            fn mockLog(_: [*]const u8, _: usize) callconv(.c) void {}
-        }.mockLog,
-        .draw_rect = struct {
-            fn mockDrawRect(_: u32, _: u32, _: u32, _: u32, _: u32) callconv(.c) void {}
-        }.mockDrawRect,
-        .poll_key = struct {
-            fn mockPollKey() callconv(.c) u8 {
-                return 'A';
-            }
-        }.mockPollKey,
-        .sleep_ms = struct {
-            fn mockSleep(_: u64) callconv(.c) void {}
-        }.mockSleep,
-        .alloc_pages = struct {
-            fn mockAllocPages(_: usize) callconv(.c) ?[*]u8 {
-                return null;
-            }
-        }.mockAllocPages,
-    };
+    var mock_table = mockTable();
+    mock_table.poll_key = struct {
+        fn mockPollKey() callconv(.c) u8 {
+            return 'A';
+        }
+    }.mockPollKey;
 
     init(&mock_table);
     const result = getKey();
@@ -201,6 +681,24 @@ test "User Runtime - getKey Wrapper Returns Character" {
     try std.testing.expect(result.? == 'A');
 }
 
+test "User Runtime - waitKeys Returns Batch Slice" {
+    var mock_table = mockTable();
+    mock_table.wait_key = struct {
+        fn mockWaitKey(buf: [*]u8, len: usize) callconv(.c) usize {
+            if (len < 2) return 0;
+            buf[0] = 'h';
+            buf[1] = 'i';
+            return 2;
+        }
+    }.mockWaitKey;
+
+    init(&mock_table);
+    var buf: [8]u8 = undefined;
+    const keys = waitKeys(&buf);
+    try std.testing.expect(keys.len == 2);
+    try std.testing.expect(keys[0] == 'h' and keys[1] == 'i');
+}
+
 test "User Runtime - log Wrapper Converts Slice to Pointer+Length" {
     // Track that log was called with correct parameters
     const TestState = struct {
@@ -213,26 +711,8 @@ test "User Runtime - log Wrapper Converts Slice to Pointer+Length" {
         }
     };
 
-    const mock_table = KernelTable{
-        .magic = table_def.KERNEL_TABLE_MAGIC,
-        .log = TestState.mockLog,
-        .draw_rect = struct {
-            fn mockDrawRect(_: u32, _: u32, _: u32, _: u32, _: u32) callconv(.c) void {}
-        }.mockDrawRect,
-        .poll_key = struct {
-            fn mockPollKey() callconv(.c) u8 {
-                return 0;
-            }
-        }.mockPollKey,
-        .sleep_ms = struct {
-            fn mockSleep(_: u64) callconv(.c) void {}
-        }.mockSleep,
-        .alloc_pages = struct {
-            fn mockAllocPages(_: usize) callconv(.c) ?[*]u8 {
-                return null;
-            }
-        }.mockAllocPages,
-    };
+    var mock_table = mockTable();
+    mock_table.log = TestState.mockLog;
 
     init(&mock_table);
 
@@ -265,26 +745,8 @@ test "User Runtime - drawRect Wrapper Passes Parameters" {
         }
     };
 
-    const mock_table = KernelTable{
-        .magic = table_def.KERNEL_TABLE_MAGIC,
-        .log = struct {
-            fn mockLog(_: [*]const u8, _: usize) callconv(.c) void {}
-        }.mockLog,
-        .draw_rect = TestState.mockDrawRect,
-        .poll_key = struct {
-            fn mockPollKey() callconv(.c) u8 {
-                return 0;
-            }
-        }.mockPollKey,
-        .sleep_ms = struct {
-            fn mockSleep(_: u64) callconv(.c) void {}
-        }.mockSleep,
-        .alloc_pages = struct {
-            fn mockAllocPages(_: usize) callconv(.c) ?[*]u8 {
-                return null;
-            }
-        }.mockAllocPages,
-    };
+    var mock_table = mockTable();
+    mock_table.draw_rect = TestState.mockDrawRect;
 
     init(&mock_table);
 
@@ -311,26 +773,8 @@ test "User Runtime - sleep Wrapper Passes Milliseconds" {
         }
     };
 
-    const mock_table = KernelTable{
-        .magic = table_def.KERNEL_TABLE_MAGIC,
-        .log = struct {
-            fn mockLog(_: [*]const u8, _: usize) callconv(.c) void {}
-        }.mockLog,
-        .draw_rect = struct {
-            fn mockDrawRect(_: u32, _: u32, _: u32, _: u32, _: u32) callconv(.c) void {}
-        }.mockDrawRect,
-        .poll_key = struct {
-            fn mockPollKey() callconv(.c) u8 {
-                return 0;
-            }
-        }.mockPollKey,
-        .sleep_ms = TestState.mockSleep,
-        .alloc_pages = struct {
-            fn mockAllocPages(_: usize) callconv(.c) ?[*]u8 {
-                return null;
-            }
-        }.mockAllocPages,
-    };
+    var mock_table = mockTable();
+    mock_table.sleep_ms = TestState.mockSleep;
 
     init(&mock_table);
 
@@ -343,30 +787,184 @@ test "User Runtime - sleep Wrapper Passes Milliseconds" {
 }
 
 test "User Runtime - allocPages Wrapper Returns null" {
-    const mock_table = KernelTable{
-        .magic = table_def.KERNEL_TABLE_MAGIC,
-        .log = struct {
-            fn mockLog(_: [*]const u8, _: usize) callconv(.c) void {}
-        }.mockLog,
-        .draw_rect = struct {
-            fn mockDrawRect(_: u32, _: u32, _: u32, _: u32, _: u32) callconv(.c) void {}
-        }.mockDrawRect,
-        .poll_key = struct {
-            fn mockPollKey() callconv(.c) u8 {
-                return 0;
+    const mock_table = mockTable();
+
+    init(&mock_table);
+    const result = allocPages(1);
+    try std.testing.expect(result == null);
+}
+
+test "User Runtime - IoRing Setup Failure Returns null" {
+    const mock_table = mockTable();
+
+    init(&mock_table);
+    try std.testing.expect(IoRing.init(8) == null);
+}
+
+test "User Runtime - IoRing Round Trip Through Kernel Table" {
+    init(&table_def.table);
+
+    var ring = IoRing.init(8) orelse return error.OutOfMemory;
+    defer ring.deinit();
+
+    // Queueing does not touch the kernel; submit hands over the whole batch.
+    var i: u64 = 0;
+    while (i < 8) : (i += 1) {
+        try std.testing.expect(ring.queue(Sqe.nop(i)));
+    }
+    try std.testing.expect(!ring.queue(Sqe.nop(99))); // SQ full
+    try std.testing.expect(ring.view.sqPending() == 0);
+    try std.testing.expect(ring.submit() == 8);
+
+    var done: [16]Cqe = undefined;
+    try std.testing.expect(ring.harvest(&done) == 8);
+    for (done[0..8], 0..) |cqe, idx| {
+        try std.testing.expect(cqe.user_data == idx);
+        try std.testing.expect(cqe.result == 0);
+    }
+    try std.testing.expect(ring.harvest(&done) == 0);
+}
+
+test "User Runtime - Channel Round Trip Through Kernel Table" {
+    const mock_table = mockTable();
+    init(&mock_table);
+    try std.testing.expect(Channel.init() == null);
+
+    init(&table_def.table);
+    const ch = Channel.init() orelse return error.OutOfMemory;
+    defer ch.deinit();
+
+    var block: [4096]u8 align(4096) = undefined;
+    @memcpy(block[0..5], "hello");
+    try std.testing.expect(ch.send(block[0..5]) == 0);
+    const msg = ch.recv() orelse return error.TestUnexpectedResult;
+    try std.testing.expect(@intFromPtr(msg.ptr) == @intFromPtr(&block));
+    try std.testing.expect(std.mem.eql(u8, msg, "hello"));
+    try std.testing.expect(ch.recv() == null);
+}
+
+test "User Runtime - Service Published And Called Through Kernel Table" {
+    const Counter = extern struct {
+        add: *const fn (u64, u64) callconv(.c) u64,
+        double: *const fn (u64) callconv(.c) u64,
+    };
+    const impl = Counter{
+        .add = struct {
+            fn add(a: u64, b: u64) callconv(.c) u64 {
+                return a + b;
             }
-        }.mockPollKey,
-        .sleep_ms = struct {
-            fn mockSleep(_: u64) callconv(.c) void {}
-        }.mockSleep,
-        .alloc_pages = struct {
-            fn mockAllocPages(_: usize) callconv(.c) ?[*]u8 {
-                return null;
+        }.add,
+        .double = struct {
+            fn double(a: u64) callconv(.c) u64 {
+                return a * 2;
             }
-        }.mockAllocPages,
+        }.double,
     };
 
+    const mock_table = mockTable();
     init(&mock_table);
-    const result = allocPages(1);
-    try std.testing.expect(result == null);
+    try std.testing.expect(lookupService(Counter, "counter") == null);
+
+    init(&table_def.table);
+    try std.testing.expect(publishService(Counter, "counter", &impl) >= 0);
+    defer withdrawService("counter");
+
+    const counter = lookupService(Counter, "counter") orelse return error.TestUnexpectedResult;
+    try std.testing.expect(counter.add(2, 3) == 5);
+    try std.testing.expect(counter.double(21) == 42);
+
+    const Bigger = extern struct {
+        add: *const fn (u64, u64) callconv(.c) u64,
+        double: *const fn (u64) callconv(.c) u64,
+        extra: *const fn () callconv(.c) void,
+    };
+    try std.testing.expect(lookupService(Bigger, "counter") == null);
+}
+
+test "Benchmark: IoRing Batched Ops vs Direct Table Calls" {
+    init(&table_def.table);
+
+    const op_count: u64 = 4096;
+    const batch_size: u32 = 64;
+
+    // Direct calls: one table call per 1x1 rect.
+    const direct_start = bench.now();
+    var i: u64 = 0;
+    while (i < op_count) : (i += 1) {
+        drawRect(0, 0, 1, 1, 0xFF000000);
+    }
+    const direct_cycles = bench.now() - direct_start;
+
+    // Ring: queue a batch, one submit, bulk harvest.
+    var ring = IoRing.init(batch_size) orelse return error.OutOfMemory;
+    defer ring.deinit();
+    var done: [batch_size]Cqe = undefined;
+
+    const ring_start = bench.now();
+    i = 0;
+    while (i < op_count) {
+        var queued: u32 = 0;
+        while (queued < batch_size and i < op_count) : (queued += 1) {
+            _ = ring.queue(Sqe.drawRect(0, 0, 1, 1, 0xFF000000, i));
+            i += 1;
+        }
+        _ = ring.submit();
+        _ = ring.harvest(&done);
+    }
+    const ring_cycles = bench.now() - ring_start;
+
+    bench.reportThroughput("draw_rect ops, direct table calls", op_count, direct_cycles);
+    bench.reportThroughput("draw_rect ops, io ring (batch 64)", op_count, ring_cycles);
+
+    // Same for pure dispatch overhead (no device work).
+    const nop_start = bench.now();
+    i = 0;
+    while (i < op_count) {
+        var queued: u32 = 0;
+        while (queued < batch_size and i < op_count) : (queued += 1) {
+            _ = ring.queue(Sqe.nop(i));
+            i += 1;
+        }
+        _ = ring.submit();
+        _ = ring.harvest(&done);
+    }
+    bench.reportThroughput("nop ops, io ring (batch 64)", op_count, bench.now() - nop_start);
+}
+
+test "User Runtime - Synchronous Shim" {
+    init(&table_def.table);
+
+    const msg = "[sync shim test]\n";
+    try std.testing.expect(write(msg) == msg.len);
+    try std.testing.expect(call(Sqe.nop(0)) == 0);
+
+    // Invalid requests fail immediately instead of parking.
+    var empty: [0]u8 = .{};
+    try std.testing.expect(read(&empty) == io_ring.E_INVAL);
+}
+
+test "Benchmark: Sync Shim vs Native Submit+Wait" {
+    init(&table_def.table);
+
+    const op_count: u64 = 2048;
+
+    var ring = IoRing.init(4) orelse return error.OutOfMemory;
+    defer ring.deinit();
+    var done: [1]Cqe = undefined;
+
+    const native_start = bench.now();
+    var i: u64 = 0;
+    while (i < op_count) : (i += 1) {
+        _ = ring.queue(Sqe.nop(i));
+        _ = ring.submitAndWait(1);
+        _ = ring.harvest(&done);
+    }
+    bench.report("nop latency, native submit+wait", bench.now() - native_start, op_count);
+
+    const shim_start = bench.now();
+    i = 0;
+    while (i < op_count) : (i += 1) {
+        _ = call(Sqe.nop(i));
+    }
+    bench.report("nop latency, sync shim call()", bench.now() - shim_start, op_count);
 }
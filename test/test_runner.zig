@@ -58,6 +58,8 @@ export fn kmain() callconv(.c) void {
         serial.info("SOME TESTS FAILED\n");
     }
 
+    // Log lines are buffered; get them out before QEMU exits.
+    serial.flush();
     shutdown();
 }
 
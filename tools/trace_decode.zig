@@ -0,0 +1,67 @@
+/// Host-side decoder for kernel trace dumps.
+///
+/// Reads a serial capture (stdin, or the file given as the first argument),
+/// picks out the "#T" record lines written by `trace.dump()`, sorts them by
+/// TSC across CPUs and prints one line per record:
+///
+///   +<cycles since first record> cpu<N> <event> <arg>=0x... ...
+///
+/// Usage:
+///   zig build trace-decode < serial.log
+///   zig build trace-decode -- serial.log
+const std = @import("std");
+const format = @import("trace_format");
+
+const Record = format.Record;
+const Event = format.Event;
+
+const MAX_INPUT = 256 * 1024 * 1024;
+
+pub fn main() !void {
+    var arena = std.heap.ArenaAllocator.init(std.heap.page_allocator);
+    defer arena.deinit();
+    const allocator = arena.allocator();
+
+    const args = try std.process.argsAlloc(allocator);
+    const input = if (args.len > 1) blk: {
+        const file = try std.fs.cwd().openFile(args[1], .{});
+        defer file.close();
+        break :blk try file.readToEndAlloc(allocator, MAX_INPUT);
+    } else try std.fs.File.stdin().readToEndAlloc(allocator, MAX_INPUT);
+
+    var records: std.ArrayList(Record) = .empty;
+    var lines = std.mem.splitScalar(u8, input, '\n');
+    while (lines.next()) |line| {
+        if (format.decodeLine(line)) |rec| try records.append(allocator, rec);
+    }
+    std.mem.sort(Record, records.items, {}, olderFirst);
+
+    var out_buf: [4096]u8 = undefined;
+    var stdout = std.fs.File.stdout().writer(&out_buf);
+    const out = &stdout.interface;
+
+    const base = if (records.items.len > 0) records.items[0].tsc else 0;
+    for (records.items) |rec| {
+        const event: Event = @enumFromInt(rec.event);
+        try out.print("+{d:>14} cpu{d:<3} ", .{ rec.tsc - base, rec.cpu });
+        if (std.enums.tagName(Event, event)) |name| {
+            try out.print("{s:<12}", .{name});
+        } else {
+            try out.print("event#{d:<6}", .{rec.event});
+        }
+
+        const names = event.argNames();
+        var i: usize = 0;
+        while (i < @min(rec.arg_count, format.MAX_ARGS)) : (i += 1) {
+            const name = if (i < names.len) names[i] else "arg";
+            try out.print(" {s}=0x{x}", .{ name, rec.args[i] });
+        }
+        try out.writeByte('\n');
+    }
+    try out.print("{d} records\n", .{records.items.len});
+    try out.flush();
+}
+
+fn olderFirst(_: void, a: Record, b: Record) bool {
+    return a.tsc < b.tsc;
+}